@@ -132,6 +132,8 @@ sub scan_source_files {
 	my %included_from;
 	my @sources= @{ $self->source_files };
 	for my $fname (@sources) {
+		# An included header generated by the build (like config.h) might not exist yet
+		next if $included_from{$fname} && !-e $fname;
 		open my $fh, '<', $fname or die "Can't open '$fname'\n";
 		while (<$fh>) {
 			if (/^UNIT_TEST\((\w+)\)/) {
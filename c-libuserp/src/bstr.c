@@ -9,7 +9,8 @@ bool userp_bstr_partalloc(struct userp_bstr *str, size_t part_count) {
 	// If the user is requesting to shrink the bstr, free the parts that will get trimmed
 	if (str->part_count >= part_count) {
 		for (i= str->part_count-1; i >= (int)part_count; --i) {
-			userp_drop_buffer(str->parts[i].buf);
+			if (str->parts[i].buf)
+				userp_drop_buffer(str->parts[i].buf);
 		}
 		str->part_count= part_count;
 		// Ignore requests to reallocate smaller unless it would save a lot of memory,
@@ -158,38 +159,521 @@ struct userp_bstr_part* userp_bstr_append_parts(struct userp_bstr *str, const st
 //	return true;
 //}
 
-#if 0 && HAVE_POSIX_FILES
+#if HAVE_POSIX_FILES
 
-bool userp_bstr_append_file(userp_bstr *str, int fd, size_t length) {
-	int got;
-	void *dest= userp_bstr_append_bytes(str, length, NULL);
+/*APIDOC
+#### userp_bstr_append_file
+
+    if (!userp_bstr_append_file(&str, fd, length)) ...
+
+Perform one `read()` of up to `length` bytes from `fd` onto the end of the bstr, using the free
+space of the final buffer if it is appendable or else a new buffer.  Returns false and emits
+`USERP_EFEEDME` at end of file or if a non-blocking `fd` has nothing ready, or `USERP_ESYS` if
+`read()` fails.
+*/
+
+// Read into a contiguous span appended to str, then give back whatever read() didn't fill.
+// Errors are set but not dispatched, because the readers treat EOF as routine.
+static bool bstr_read_fd(struct userp_bstr *str, int fd, size_t length) {
+	struct userp_bstr_part *part;
+	uint8_t *dest= userp_bstr_append_bytes(str, NULL, length, USERP_CONTIGUOUS);
+	ssize_t got;
+	int read_errno;
 	if (!dest)
 		return false;
-	got= read(fd, dest, length);
-	if (got > 0) {
-		((*str)->parts + (*str)->part_count - 1)->len += got;
+	do got= read(fd, dest, length);
+	while (got < 0 && errno == EINTR);
+	// Releasing the unused space calls the allocator, which may change errno
+	read_errno= got < 0? errno : 0;
+	part= &str->parts[str->part_count - 1];
+	part->len -= length - (got > 0? got : 0);
+	if (!part->len)
+		userp_bstr_partalloc(str, str->part_count - 1);
+	if (got > 0)
 		return true;
+	if (got == 0 || read_errno == EAGAIN || read_errno == EWOULDBLOCK)
+		userp_diag_set(&str->env->err, USERP_EFEEDME, "No bytes ready to read from stream");
+	else
+		userp_diag_setf(&str->env->err, USERP_ESYS, "read() failed: " USERP_DIAG_CSTR1, strerror(read_errno));
+	return false;
+}
+
+bool userp_bstr_append_file(struct userp_bstr *str, int fd, size_t length) {
+	if (!str || !str->env) return false;
+	if (bstr_read_fd(str, fd, length))
+		return true;
+	USERP_DISPATCH_ERR(str->env);
+	return false;
+}
+
+/*APIDOC
+#### userp_new_fd_reader
+
+    struct userp_fd_reader *rd= userp_new_fd_reader(env, fd, 0);
+    struct userp_fd_reader *rd= userp_new_file_reader(env, stdin, 0);
+    userp_dec_set_reader(dec, userp_fd_read, rd);
+    ...
+    userp_drop_dec(env, dec);
+    userp_free_fd_reader(rd);
+
+A stock `userp_reader_fn` which reads a file descriptor or `FILE*` into reference-counted
+buffers.  Each call appends at least `bytes_needed` to the decoder's input (unless the stream
+ends first) and then stops, so it never blocks waiting for bytes the decoder didn't ask for.
+
+Buffers start at 4KiB and double, up to `bufsize_max` (default 1MiB), each time a single
+`read()` fills one completely, or whenever the decoder asks for more than the current size.
+When the decoder knows the length of a block it asks for all of it, so the whole block is read
+into one buffer with as few syscalls as the fd allows.  Any bytes beyond the request that arrive
+in the same `read()` get appended too.
+
+Buffers come from the env's buffer pool (see `userp_env_take_buffer`), and the reader only
+keeps a reference to the one it is filling.  A buffer goes back to the pool once the decoder
+and the reader have both dropped it, and if the decoder is finished with the current one, the
+reader keeps filling it from the start, so a steady stream performs no allocations.
+`userp_free_fd_reader` releases the reader's reference; buffers still referenced by a decoder
+live until it drops them.  Neither function closes `fd` or `f`.
+
+A `FILE*` reader calls `fread` for exactly the bytes needed, because `fread` blocks until its
+whole count arrives; the `FILE` does its own read-ahead.
+*/
+
+#define USERP_FD_READER_BUFSIZE_MIN 4096
+#ifndef USERP_DEFAULT_FD_READER_BUFSIZE_MAX
+#define USERP_DEFAULT_FD_READER_BUFSIZE_MAX (1<<20)
+#endif
+
+struct userp_fd_reader {
+	userp_env env;
+	int fd;
+	FILE *file;
+	size_t bufsize, bufsize_max;
+	userp_buffer cur;          // buffer being filled
+	size_t cur_len;            // bytes of 'cur' already handed out
+};
+
+static struct userp_fd_reader* new_reader(userp_env env, int fd, FILE *f, size_t bufsize_max) {
+	struct userp_fd_reader *rd= NULL;
+	if (!USERP_ALLOC_OBJ(env, &rd))
+		return NULL;
+	bzero(rd, sizeof(*rd));
+	rd->env= env;
+	rd->fd= fd;
+	rd->file= f;
+	rd->bufsize= USERP_FD_READER_BUFSIZE_MIN;
+	rd->bufsize_max= bufsize_max? bufsize_max : USERP_DEFAULT_FD_READER_BUFSIZE_MAX;
+	if (rd->bufsize_max < rd->bufsize)
+		rd->bufsize_max= rd->bufsize;
+	userp_grab_env(env);
+	return rd;
+}
+
+struct userp_fd_reader* userp_new_fd_reader(userp_env env, int fd, size_t bufsize_max) {
+	return new_reader(env, fd, NULL, bufsize_max);
+}
+
+struct userp_fd_reader* userp_new_file_reader(userp_env env, FILE *f, size_t bufsize_max) {
+	return new_reader(env, fileno(f), f, bufsize_max);
+}
+
+void userp_free_fd_reader(struct userp_fd_reader *rd) {
+	userp_env env= rd->env;
+	if (rd->cur)
+		userp_drop_buffer(rd->cur);
+	USERP_FREE(env, &rd);
+	userp_drop_env(env);
+}
+
+// Make rd->cur an empty buffer of at least rd->bufsize.  If nobody else references 'cur' and it
+// is large enough, it is reused, and otherwise it is released to the env's buffer pool (once the
+// decoder drops it too) and replaced by one from the pool.
+static bool reader_next_buffer(struct userp_fd_reader *rd) {
+	userp_buffer buf;
+	if (!rd->cur || rd->cur->refcnt != 1 || rd->cur->alloc_len < rd->bufsize) {
+		if (!(buf= userp_env_take_buffer(rd->env, rd->bufsize, 0)))
+			return false;
+		if (rd->cur)
+			userp_drop_buffer(rd->cur);
+		rd->cur= buf;
 	}
-	else if (got == 0
-		|| errno == EAGAIN
-		|| errno == EINTR
-		|| errno == EWOULDBLOCK
-	) {
-		userp_env_set_error((*str)->env, USERP_EEOF, "No bytes ready to read from stream");
+	rd->cur_len= 0;
+	return true;
+}
+
+bool userp_fd_read(void *callback_data, struct userp_bstr *str, size_t bytes_needed, userp_env env) {
+	struct userp_fd_reader *rd= (struct userp_fd_reader*) callback_data;
+	struct userp_bstr_part part;
+	size_t got= 0, n;
+	ssize_t r;
+	// Grow toward the size of the blocks the decoder is asking for
+	if (bytes_needed > rd->bufsize)
+		rd->bufsize= roundup_pow2(bytes_needed) < rd->bufsize_max? roundup_pow2(bytes_needed) : rd->bufsize_max;
+	while (got < bytes_needed) {
+		// Keep filling the free end of 'cur' unless it is nearly full, or too small for the
+		// rest of this request while a bigger buffer is allowed.
+		n= rd->cur? rd->cur->alloc_len - rd->cur_len : 0;
+		if (n < rd->bufsize/4 || (n < bytes_needed - got && rd->cur->alloc_len < rd->bufsize)) {
+			if (!reader_next_buffer(rd))
+				return false;
+			n= rd->cur->alloc_len;
+		}
+		if (rd->file) {
+			if (n > bytes_needed - got)
+				n= bytes_needed - got;
+			r= fread(rd->cur->data + rd->cur_len, 1, n, rd->file);
+			if (!r && ferror(rd->file))
+				r= -1;
+		}
+		else {
+			do r= read(rd->fd, rd->cur->data + rd->cur_len, n);
+			while (r < 0 && errno == EINTR);
+			// One read filling the whole span means the fd can keep up with larger reads
+			if ((size_t) r == n && rd->bufsize < rd->bufsize_max)
+				rd->bufsize <<= 1;
+		}
+		if (r <= 0) {
+			if (r == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+				userp_diag_set(&env->err, USERP_EFEEDME, "No bytes ready to read from stream");
+			else
+				userp_diag_setf(&env->err, USERP_ESYS, "read() failed: " USERP_DIAG_CSTR1, strerror(errno));
+			return false;
+		}
+		// Hand out everything that arrived, as a new part referencing 'cur'
+		part.buf= rd->cur;
+		part.data= rd->cur->data + rd->cur_len;
+		part.len= r;
+		part.ofs= str->part_count? str->parts[str->part_count-1].ofs + str->parts[str->part_count-1].len : 0;
+		if (!userp_bstr_append_parts(str, &part, 1))
+			return false;
+		rd->cur_len += r;
+		got += r;
 	}
-	else {
-		(*str)->env->diag_pos= errno;
-		userp_env_set_error((*str)->env, USERP_ESYSERROR, "System error " USERP_DIAG_POS " while calling read()");
+	return true;
+}
+
+#endif
+
+#if HAVE_POSIX_FILES
+
+/*APIDOC
+#### userp_bstr_writev
+
+    size_t written= 0;
+    if (!userp_bstr_writev(fd, str, &written)) ...
+    if (!userp_bstr_sendmsg(sock, str, &written, MSG_NOSIGNAL)) ...
+
+Write the bytes of `str`, starting `*written` bytes in, directly from its parts with `writev`
+(or `sendmsg` for sockets, passing along `msg_flags`), in batches of up to `IOV_MAX` parts.
+Partial writes are continued until the whole string is written, and `*written` is updated as
+it goes, so after a failure you can tell how much got out.  Returns false with `USERP_ESYS` on
+error, or without any diagnostic if a non-blocking `fd` would block; in that case call it again
+with the same `*written` once the fd is writable.
+*/
+
+#define USERP_WRITE_IOV_BATCH (IOV_MAX < 1024? IOV_MAX : 1024)
+
+struct writer_hold {
+	uint32_t id;               // zerocopy send call whose completion releases this buffer
+	userp_buffer buf;
+};
+
+struct userp_writer {
+	userp_env env;
+	int fd;
+	bool sock, zerocopy;
+	size_t zerocopy_min;
+	uint32_t zc_next_id;       // the kernel numbers MSG_ZEROCOPY calls on a socket from 0
+	size_t hold_count, hold_alloc;
+	struct writer_hold *hold;  // buffers the kernel may still be reading
+};
+
+static bool writer_hold(struct userp_writer *w, const struct userp_bstr *str, size_t from, size_t to);
+
+static bool bstr_write(int fd, bool sock, const struct userp_bstr *str, size_t *written, int msg_flags, struct userp_writer *w) {
+	struct iovec iov[USERP_WRITE_IOV_BATCH];
+	struct msghdr msg;
+	size_t i, first, pos, skip, batch_bytes;
+	int iovcnt, flags;
+	bool zc;
+	ssize_t n;
+	for (;;) {
+		// Find the part holding position *written
+		for (i= 0, pos= 0; i < str->part_count && pos + str->parts[i].len <= *written; i++)
+			pos += str->parts[i].len;
+		if (i >= str->part_count)
+			return true;
+		first= i;
+		skip= *written - pos;
+		for (iovcnt= 0, batch_bytes= 0; i < str->part_count && iovcnt < USERP_WRITE_IOV_BATCH; i++, skip= 0) {
+			if (str->parts[i].len <= skip) continue;
+			iov[iovcnt].iov_base= str->parts[i].data + skip;
+			iov[iovcnt].iov_len= str->parts[i].len - skip;
+			batch_bytes += iov[iovcnt++].iov_len;
+		}
+		flags= msg_flags;
+#if HAVE_MSG_ZEROCOPY
+		zc= w && w->zerocopy && batch_bytes >= w->zerocopy_min;
+		if (zc) flags |= MSG_ZEROCOPY;
+#else
+		zc= false;
+#endif
+		if (sock) {
+			bzero(&msg, sizeof(msg));
+			msg.msg_iov= iov;
+			msg.msg_iovlen= iovcnt;
+			n= sendmsg(fd, &msg, flags);
+		}
+		else
+			n= writev(fd, iov, iovcnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			// The kernel can refuse zerocopy when too many notifications are outstanding
+			if (zc && errno == ENOBUFS) {
+				w->zerocopy= false;
+				n= 0;
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				userp_diag_setf(&str->env->err, USERP_ESYS, USERP_DIAG_CSTR1 "() failed: " USERP_DIAG_CSTR2,
+					sock? "sendmsg" : "writev", strerror(errno));
+				USERP_DISPATCH_ERR(str->env);
+			}
+			return false;
+		}
+		if (zc && !writer_hold(w, str, first, i))
+			return false;
+		*written += n;
 	}
-	return false;
 }
 
+bool userp_bstr_writev(int fd, const struct userp_bstr *str, size_t *written) {
+	return bstr_write(fd, false, str, written, 0, NULL);
+}
+
+bool userp_bstr_sendmsg(int sock, const struct userp_bstr *str, size_t *written, int msg_flags) {
+	return bstr_write(sock, true, str, written, msg_flags, NULL);
+}
+
+/*APIDOC
+#### userp_new_writer
+
+    struct userp_writer *w= userp_new_writer(env, fd, USERP_WRITER_SOCKET|USERP_WRITER_ZEROCOPY);
+    userp_enc_set_writer(enc, w);
+    ... // encode; completed output buffers get written as the encoder fills them
+    if (!userp_enc_finish(enc)) ...
+    userp_free_writer(w);
+
+A writer sends whole bstrs to `fd` with `userp_writer_write`, using `userp_bstr_writev`, or
+`userp_bstr_sendmsg` with `MSG_NOSIGNAL` if `USERP_WRITER_SOCKET` is given.  The fd should be
+blocking.  Attached to an encoder, the writer receives each output buffer as soon as the encoder
+moves on to the next, so an encoder's memory stays bounded no matter how large the block is,
+and the buffers go straight back to the env's pool for reuse.
+
+With `USERP_WRITER_ZEROCOPY` (on Linux TCP sockets) batches of 16KiB or more are sent with
+`MSG_ZEROCOPY`, so the kernel transmits straight from the buffers instead of copying them.  The
+writer then holds a reference to each such buffer until the kernel reports it is done with it
+on the socket's error queue.  `userp_writer_flush` waits for all of those reports, and
+`userp_free_writer` flushes first.  If the socket doesn't support zerocopy the flag is ignored.
+*/
+
+#define USERP_WRITER_ZEROCOPY_MIN 16384
+
+struct userp_writer* userp_new_writer(userp_env env, int fd, int flags) {
+	struct userp_writer *w= NULL;
+#if HAVE_MSG_ZEROCOPY
+	int one= 1;
+#endif
+	if (!USERP_ALLOC_OBJ(env, &w))
+		return NULL;
+	bzero(w, sizeof(*w));
+	w->env= env;
+	w->fd= fd;
+	w->sock= (flags & (USERP_WRITER_SOCKET|USERP_WRITER_ZEROCOPY)) != 0;
+	w->zerocopy_min= USERP_WRITER_ZEROCOPY_MIN;
+#if HAVE_MSG_ZEROCOPY
+	if (flags & USERP_WRITER_ZEROCOPY)
+		w->zerocopy= setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
 #endif
+	userp_grab_env(env);
+	return w;
+}
 
-#if 0 && HAVE_POSIX_MEMMAP
+static bool writer_hold(struct userp_writer *w, const struct userp_bstr *str, size_t from, size_t to) {
+	size_t n= w->hold_count + (to - from);
+	if (n > w->hold_alloc) {
+		n= n + 16;
+		if (!USERP_ALLOC_ARRAY(w->env, &w->hold, n))
+			return false;
+		w->hold_alloc= n;
+	}
+	for (; from < to; from++) {
+		if (!str->parts[from].buf || !userp_grab_buffer(str->parts[from].buf))
+			continue;
+		w->hold[w->hold_count].id= w->zc_next_id;
+		w->hold[w->hold_count].buf= str->parts[from].buf;
+		w->hold_count++;
+	}
+	w->zc_next_id++;
+	return true;
+}
 
-bool userp_bstr_map_file(userp_bstr *str, int fd, int64_t offset, int64_t length) {
-	// Does the string already have a part adjacent or overlapping with this request?
+// Release the buffers of zerocopy sends the kernel has finished with.  If 'wait', block until
+// every held buffer is released.
+static bool writer_reap(struct userp_writer *w, bool wait) {
+#if HAVE_MSG_ZEROCOPY
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *serr;
+	struct pollfd pfd;
+	size_t i, j;
+	while (w->hold_count) {
+		bzero(&msg, sizeof(msg));
+		msg.msg_control= control;
+		msg.msg_controllen= sizeof(control);
+		if (recvmsg(w->fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				userp_diag_setf(&w->env->err, USERP_ESYS, "recvmsg(MSG_ERRQUEUE) failed: " USERP_DIAG_CSTR1, strerror(errno));
+				USERP_DISPATCH_ERR(w->env);
+				return false;
+			}
+			if (!wait)
+				return true;
+			// The error queue becoming non-empty shows up as POLLERR
+			pfd.fd= w->fd;
+			pfd.events= 0;
+			poll(&pfd, 1, -1);
+			continue;
+		}
+		for (cm= CMSG_FIRSTHDR(&msg); cm; cm= CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR)
+				|| (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+			serr= (struct sock_extended_err*) CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			// ee_info .. ee_data is the inclusive range of completed send calls
+			for (i= 0, j= 0; i < w->hold_count; i++) {
+				if (w->hold[i].id - serr->ee_info <= serr->ee_data - serr->ee_info)
+					userp_drop_buffer(w->hold[i].buf);
+				else
+					w->hold[j++]= w->hold[i];
+			}
+			w->hold_count= j;
+		}
+	}
+#endif
+	return true;
+}
+
+bool userp_writer_write(struct userp_writer *w, const struct userp_bstr *str) {
+	size_t written= 0;
+	if (!bstr_write(w->fd, w->sock, str, &written, w->sock? MSG_NOSIGNAL : 0, w))
+		return false;
+	return writer_reap(w, false);
+}
+
+bool userp_writer_flush(struct userp_writer *w) {
+	return writer_reap(w, true);
+}
+
+void userp_free_writer(struct userp_writer *w) {
+	userp_env env= w->env;
+	size_t i;
+	writer_reap(w, true);
+	for (i= 0; i < w->hold_count; i++)
+		userp_drop_buffer(w->hold[i].buf);
+	USERP_FREE(env, &w->hold);
+	USERP_FREE(env, &w);
+	userp_drop_env(env);
+}
+
+#endif
+
+#if HAVE_POSIX_MEMMAP
+
+/*APIDOC
+#### userp_bstr_map_file
+
+    if (!userp_bstr_map_file(&str, fd, offset, length, USERP_MAP_SEQUENTIAL)) ...
+
+Append bytes `offset .. offset+length` of the file `fd` to the bstr by memory-mapping them
+read-only.  A negative `length` means "through the end of the file".  The range is mapped in
+windows no larger than the env's `USERP_MAP_WINDOW`, and each window becomes one part with its
+own `userp_buffer` flagged `USERP_BUFFER_DATA_MMAP`, which gets `munmap`ed when its last
+reference is dropped.  The file descriptor is not needed after this returns.
+
+`flags` may include `USERP_MAP_SEQUENTIAL` to tell the kernel to read ahead aggressively and
+drop pages behind the reader, and `USERP_MAP_WILLNEED` to start paging in the whole range now.
+
+Returns false if the range is beyond the end of the file or `mmap` fails, leaving the
+windows mapped so far appended to the bstr.
+*/
+
+static bool bstr_map_window(struct userp_bstr *str, int fd, int64_t offset, size_t length, int flags) {
+	size_t lead= (size_t)(offset & (sysconf(_SC_PAGESIZE) - 1));
+	struct userp_bstr_part *part;
+	userp_buffer buf;
+	void *map;
+	if (str->part_count >= str->part_alloc)
+		if (!userp_bstr_partalloc(str, str->part_count+1))
+			return false;
+	// mmap needs a page-aligned offset, so the buffer begins up to one page before the part
+	map= mmap(NULL, lead + length, PROT_READ, MAP_SHARED, fd, (off_t)(offset - lead));
+	if (map == MAP_FAILED) {
+		userp_diag_setf(&str->env->err, USERP_ESYS, "mmap(" USERP_DIAG_SIZE ") failed: " USERP_DIAG_CSTR1,
+			lead + length, strerror(errno));
+		USERP_DISPATCH_ERR(str->env);
+		return false;
+	}
+	if (flags & USERP_MAP_SEQUENTIAL)
+		madvise(map, lead + length, MADV_SEQUENTIAL);
+	if (flags & USERP_MAP_WILLNEED)
+		madvise(map, lead + length, MADV_WILLNEED);
+	if (!(buf= userp_new_buffer(str->env, map, lead + length, USERP_BUFFER_DATA_MMAP))) {
+		munmap(map, lead + length);
+		return false;
+	}
+	part= &str->parts[str->part_count++];
+	part->buf= buf;
+	part->data= buf->data + lead;
+	part->len= length;
+	part->ofs= part > str->parts? part[-1].ofs + part[-1].len : 0;
+	return true;
+}
+
+bool userp_bstr_map_file(struct userp_bstr *str, int fd, int64_t offset, int64_t length, int flags) {
+	size_t page= sysconf(_SC_PAGESIZE), window, n;
+	struct stat st;
+	int64_t lim;
+	if (!str || !str->env) return false;
+	if (fstat(fd, &st) < 0) {
+		userp_diag_setf(&str->env->err, USERP_ESYS, "fstat() failed: " USERP_DIAG_CSTR1, strerror(errno));
+		USERP_DISPATCH_ERR(str->env);
+		return false;
+	}
+	lim= length < 0? (int64_t) st.st_size : offset + length;
+	if (offset < 0 || lim < offset || lim > (int64_t) st.st_size) {
+		userp_diag_setf(&str->env->err, USERP_EOVERRUN,
+			"File range " USERP_DIAG_POS "+" USERP_DIAG_LEN " exceeds file length " USERP_DIAG_SIZE,
+			(size_t) offset, (size_t) (lim - offset), (size_t) st.st_size);
+		USERP_DISPATCH_ERR(str->env);
+		return false;
+	}
+	window= (str->env->map_window + page - 1) & ~(page - 1);
+	if (!window) window= page;
+	while (offset < lim) {
+		// Windows end on multiples of the window size, so each one maps whole pages
+		n= window - (size_t)(offset % window);
+		if ((int64_t) n > lim - offset)
+			n= (size_t)(lim - offset);
+		if (!bstr_map_window(str, fd, offset, n, flags))
+			return false;
+		offset += n;
+	}
+	return true;
 }
 
 #endif
@@ -201,3 +685,232 @@ bool userp_bstr_splice(userp_bstr *dst, size_t dst_ofs, size_t dst_len, userp_bs
 void userp_bstr_crop(userp_bstr *str, size_t trim_head, size_t trim_tail) {
 }
 */
+
+#ifdef UNIT_TEST
+
+#if HAVE_POSIX_FILES
+UNIT_TEST(bstr_append_file) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	struct userp_bstr str;
+	int fds[2];
+	if (pipe(fds) != 0) abort();
+	userp_bstr_init(&str, env);
+	if (write(fds[1], "0123456789", 10) != 10) abort();
+	if (userp_bstr_append_file(&str, fds[0], 1000))
+		printf("parts=%d len=%d '%.*s'\n", (int) str.part_count, (int) str.parts[0].len,
+			(int) str.parts[0].len, str.parts[0].data);
+	if (write(fds[1], "abc", 3) != 3) abort();
+	close(fds[1]);
+	if (userp_bstr_append_file(&str, fds[0], 1000))
+		printf("parts=%d len=%d '%.*s'\n", (int) str.part_count, (int) str.parts[0].len,
+			(int) str.parts[0].len, str.parts[0].data);
+	if (!userp_bstr_append_file(&str, fds[0], 1000))
+		printf("parts=%d len=%d\n", (int) str.part_count, (int) str.parts[0].len);
+	close(fds[0]);
+	userp_bstr_destroy(&str);
+	userp_drop_env(env);
+}
+/*OUTPUT
+parts=1 len=10 '0123456789'
+parts=1 len=13 '0123456789abc'
+error: No bytes ready to read from stream
+parts=1 len=13
+*/
+
+// Allocator which changes errno, as a tracking or logging allocator might
+static bool test_errno_alloc(void *callback_data, void **pointer, size_t new_size, userp_alloc_flags flags) {
+	bool ret= userp_default_alloc_fn(callback_data, pointer, new_size, flags);
+	errno= ENOMEM;
+	return ret;
+}
+
+UNIT_TEST(bstr_append_file_errno) {
+	userp_env env= userp_new_env(test_errno_alloc, userp_file_logger, stdout, 0);
+	struct userp_bstr str;
+	int fds[2];
+	if (pipe(fds) != 0) abort();
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	userp_bstr_init(&str, env);
+	// The errors come from read(), not from freeing the space that wasn't filled
+	userp_bstr_append_file(&str, fds[0], 1000);
+	userp_bstr_append_file(&str, -1, 1000);
+	printf("parts=%d\n", (int) str.part_count);
+	close(fds[0]);
+	close(fds[1]);
+	userp_bstr_destroy(&str);
+	userp_drop_env(env);
+}
+/*OUTPUT
+error: No bytes ready to read from stream
+error: read\(\) failed: Bad file descriptor
+parts=0
+*/
+
+UNIT_TEST(bstr_fd_reader) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	struct userp_fd_reader *rd;
+	struct userp_bstr str;
+	userp_buffer buf;
+	uint8_t bytes[8192];
+	int fds[2], i;
+	for (i= 0; i < sizeof(bytes); i++)
+		bytes[i]= (uint8_t)(i * 7);
+	if (pipe(fds) != 0) abort();
+	rd= userp_new_fd_reader(env, fds[0], 8192);
+	userp_bstr_init(&str, env);
+	// A pipe returns whatever it holds, which is more than needed but less than the buffer
+	if (write(fds[1], bytes, 3000) != 3000) abort();
+	if (userp_fd_read(rd, &str, 100, env))
+		printf("parts=%d len=%d alloc=%d\n", (int) str.part_count, (int) str.parts[0].len,
+			(int) str.parts[0].buf->alloc_len);
+	// Asking for more than the buffer size moves to a larger buffer
+	if (write(fds[1], bytes, 8192) != 8192) abort();
+	if (userp_fd_read(rd, &str, 5000, env))
+		printf("parts=%d len=%d alloc=%d refcnt=%d same=%d\n", (int) str.part_count, (int) str.parts[1].len,
+			(int) str.parts[1].buf->alloc_len, (int) str.parts[1].buf->refcnt,
+			!memcmp(str.parts[1].data, bytes, 8192));
+	// Once released, the large buffer gets reused, and the small one went back to the env's pool
+	buf= str.parts[1].buf;
+	userp_bstr_destroy(&str);
+	if (write(fds[1], bytes, 100) != 100) abort();
+	if (userp_fd_read(rd, &str, 1, env))
+		printf("parts=%d len=%d reused=%d pooled=%d\n", (int) str.part_count, (int) str.parts[0].len,
+			str.parts[0].buf == buf && str.parts[0].data == buf->data, (int) env->buffer_pool_count);
+	close(fds[1]);
+	if (!userp_fd_read(rd, &str, 1, env))
+		printf("eof=%d\n", env->err.code == USERP_EFEEDME);
+	userp_bstr_destroy(&str);
+	userp_free_fd_reader(rd);
+	close(fds[0]);
+	userp_drop_env(env);
+}
+/*OUTPUT
+parts=1 len=3000 alloc=4096
+parts=2 len=8192 alloc=8192 refcnt=2 same=1
+parts=1 len=100 reused=1 pooled=1
+eof=1
+*/
+
+// Build a string of 'n' parts of 'len' bytes each, holding a known pattern
+static void test_bstr_pattern(struct userp_bstr *str, userp_env env, int n, size_t len) {
+	struct userp_bstr_part part;
+	size_t i, pos= 0;
+	userp_bstr_init(str, env);
+	while (n--) {
+		part.buf= userp_new_buffer(env, NULL, len, 0);
+		part.data= part.buf->data;
+		part.ofs= pos;
+		part.len= len;
+		for (i= 0; i < len; i++)
+			part.data[i]= (uint8_t)((pos + i) * 13);
+		pos += len;
+		userp_bstr_append_parts(str, &part, 1);
+		userp_drop_buffer(part.buf);
+	}
+}
+
+static bool test_check_pattern(const uint8_t *data, size_t pos, size_t len) {
+	size_t i;
+	for (i= 0; i < len; i++)
+		if (data[i] != (uint8_t)((pos + i) * 13))
+			return false;
+	return true;
+}
+
+UNIT_TEST(bstr_writev) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	struct userp_bstr str;
+	uint8_t *data= malloc(300000);
+	size_t written, got;
+	ssize_t r;
+	FILE *f= tmpfile();
+	int fds[2];
+	// More parts than fit in one writev call
+	test_bstr_pattern(&str, env, 2000, 10);
+	written= 5;
+	if (userp_bstr_writev(fileno(f), &str, &written))
+		printf("written=%d\n", (int) written);
+	if (pread(fileno(f), data, 20000, 0) == 19995)
+		printf("same=%d\n", test_check_pattern(data, 5, 19995));
+	userp_bstr_destroy(&str);
+	fclose(f);
+	// A non-blocking socket fills up, then resumes where it left off
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) abort();
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	test_bstr_pattern(&str, env, 3, 100000);
+	written= 0;
+	if (!userp_bstr_sendmsg(fds[0], &str, &written, MSG_NOSIGNAL))
+		printf("blocked=%d partial=%d\n", env->err.code == 0, written > 0 && written < 300000);
+	for (got= 0; got < 300000; got += r) {
+		if ((r= read(fds[1], data + got, 300000 - got)) <= 0) abort();
+		if (written < 300000 && !userp_bstr_sendmsg(fds[0], &str, &written, MSG_NOSIGNAL) && env->err.code)
+			break;
+	}
+	printf("written=%d got=%d same=%d\n", (int) written, (int) got, test_check_pattern(data, 0, got));
+	// Writing to a closed socket is an error
+	close(fds[1]);
+	written= 0;
+	if (!userp_bstr_sendmsg(fds[0], &str, &written, MSG_NOSIGNAL))
+		printf("written=%d\n", (int) written);
+	close(fds[0]);
+	userp_bstr_destroy(&str);
+	free(data);
+	userp_drop_env(env);
+}
+/*OUTPUT
+written=20000
+same=1
+blocked=1 partial=1
+written=300000 got=300000 same=1
+error: sendmsg\(\) failed: .*
+written=0
+*/
+
+UNIT_TEST(bstr_writer_zerocopy) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	struct userp_writer *w;
+	struct userp_bstr str;
+	struct sockaddr_in addr;
+	socklen_t addrlen= sizeof(addr);
+	uint8_t *data= malloc(65536);
+	int lsock, csock, ssock;
+	size_t got;
+	ssize_t r;
+	// TCP over loopback, which supports MSG_ZEROCOPY
+	bzero(&addr, sizeof(addr));
+	addr.sin_family= AF_INET;
+	addr.sin_addr.s_addr= htonl(INADDR_LOOPBACK);
+	if ((lsock= socket(AF_INET, SOCK_STREAM, 0)) < 0
+		|| bind(lsock, (struct sockaddr*) &addr, sizeof(addr)) != 0
+		|| listen(lsock, 1) != 0
+		|| getsockname(lsock, (struct sockaddr*) &addr, &addrlen) != 0
+		|| (csock= socket(AF_INET, SOCK_STREAM, 0)) < 0
+		|| connect(csock, (struct sockaddr*) &addr, sizeof(addr)) != 0
+		|| (ssock= accept(lsock, NULL, NULL)) < 0)
+		abort();
+	w= userp_new_writer(env, csock, USERP_WRITER_SOCKET|USERP_WRITER_ZEROCOPY);
+	test_bstr_pattern(&str, env, 2, 32768);
+	if (userp_writer_write(w, &str))
+		printf("written\n");
+	for (got= 0; got < 65536; got += r)
+		if ((r= read(ssock, data + got, 65536 - got)) <= 0) abort();
+	printf("got=%d same=%d\n", (int) got, test_check_pattern(data, 0, got));
+	// Once the kernel is done with the buffers, the string holds the only reference
+	if (userp_writer_flush(w))
+		printf("held=%d refcnt=%d\n", (int) w->hold_count, (int) str.parts[0].buf->refcnt);
+	userp_bstr_destroy(&str);
+	userp_free_writer(w);
+	close(ssock);
+	close(csock);
+	close(lsock);
+	free(data);
+	userp_drop_env(env);
+}
+/*OUTPUT
+written
+got=65536 same=1
+held=0 refcnt=1
+*/
+#endif
+
+#endif
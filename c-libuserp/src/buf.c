@@ -134,6 +134,15 @@ make assumptions about this buffer.
     the buffer struct is long-lived and should not be freed, and the `refcnt` is not used.
   * USERP_BUFFER_DATA_PERSIST
     the `data` is long-lived and should not be freed
+  * USERP_BUFFER_POOLED
+    when the last reference is dropped, keep the struct and its `data` in the env's buffer pool
+    (if it has room, see `USERP_BUFFER_POOL_MAX`) so the next buffer the library needs can
+    reuse them without calling the allocator.  Encoder output and prefetch buffers use this.
+
+If you wrap your own `data`, you can set `buf->destructor` (and `buf->destructor_data`) to find
+out when libuserp is finished with it.  The destructor is called with `destructor_data` and a
+pointer to the buffer when the last reference is dropped, just before the struct is freed.
+The library does not free `data` it didn't allocate, so that is up to the destructor.
 
 #### userp_grab_buffer
 
@@ -175,9 +184,12 @@ extern userp_buffer userp_new_buffer(userp_env env, void *data, size_t alloc_len
 	buf->alloc_len= alloc_len;
 	buf->refcnt= 1;
 	buf->flags= flags;
+	buf->destructor= NULL;
+	buf->destructor_data= NULL;
 	if (!buf->data && alloc_len) {
 		// Round the buffer up to a power of 2, unless this is marked as a static allocation
 		if (!(flags & USERP_HINT_STATIC)) {
+			--alloc_len;
 			alloc_len |= alloc_len >> 1;
 			alloc_len |= alloc_len >> 2;
 			alloc_len |= alloc_len >> 4;
@@ -186,7 +198,7 @@ extern userp_buffer userp_new_buffer(userp_env env, void *data, size_t alloc_len
 			#if SIZE_MAX > 0xFFFFFFFF
 			alloc_len |= alloc_len >> 32;
 			#endif
-			alloc_len= USERP_BUFFER_DATA_ALLOC_ROUND(alloc_len);
+			alloc_len= USERP_BUFFER_DATA_ALLOC_ROUND(alloc_len + 1);
 		}
 		// Let the allocator know that this is buffer data.  (allows the allocator to walk
 		// back the pointer to get to this buffer object itself)
@@ -203,12 +215,79 @@ extern userp_buffer userp_new_buffer(userp_env env, void *data, size_t alloc_len
 	return buf;
 }
 
+/*IMPLDOC
+#### Buffer Pool
+
+Buffers flagged `USERP_BUFFER_POOLED` don't get freed when their last reference drops.  Instead,
+they get parked in `env->buffer_pool` (a small fixed array) as long as the pool holds fewer than
+`USERP_ENV_BUFFER_POOL_SLOTS` buffers and `env->buffer_pool_max` bytes, and
+`userp_env_take_buffer` hands them out again.  A parked buffer releases its reference to the env
+so that the pool doesn't keep the env alive; `userp_free_env` frees whatever is left in it.
+*/
+
+static bool buffer_pool_put(userp_buffer buf) {
+	userp_env env= buf->env;
+	if (!(buf->flags & USERP_BUFFER_DATA_ALLOC)
+		|| env->buffer_pool_count >= USERP_ENV_BUFFER_POOL_SLOTS
+		|| env->buffer_pool_bytes + buf->alloc_len > env->buffer_pool_max
+	)
+		return false;
+	env->buffer_pool[env->buffer_pool_count++]= buf;
+	env->buffer_pool_bytes += buf->alloc_len;
+	userp_drop_env(env);
+	return true;
+}
+
+// Return a pooled buffer of at least min_len bytes with a refcnt of 1, or allocate a new one
+userp_buffer userp_env_take_buffer(userp_env env, size_t min_len, userp_buffer_flags flags) {
+	userp_buffer buf;
+	int i, best= -1;
+	for (i= 0; i < env->buffer_pool_count; i++)
+		if (env->buffer_pool[i]->alloc_len >= min_len
+			&& (best < 0 || env->buffer_pool[i]->alloc_len < env->buffer_pool[best]->alloc_len))
+			best= i;
+	if (best < 0)
+		return userp_new_buffer(env, NULL, min_len, flags | USERP_BUFFER_POOLED);
+	buf= env->buffer_pool[best];
+	env->buffer_pool[best]= env->buffer_pool[--env->buffer_pool_count];
+	env->buffer_pool_bytes -= buf->alloc_len;
+	buf->refcnt= 1;
+	buf->flags= (buf->flags & USERP_BUFFER_DATA_ALLOC) | flags | USERP_BUFFER_POOLED;
+	userp_grab_env(env);
+	return buf;
+}
+
+// Free every pooled buffer.  Called while the env is being destroyed.
+void userp_env_empty_buffer_pool(userp_env env) {
+	userp_buffer buf;
+	while (env->buffer_pool_count) {
+		buf= env->buffer_pool[--env->buffer_pool_count];
+		userp_alloc(env, (void**) &buf->data, 0, USERP_POINTER_IS_BUFFER_DATA);
+		USERP_FREE(env, &buf);
+	}
+	env->buffer_pool_bytes= 0;
+}
+
 static void userp_free_buffer(userp_buffer buf) {
 	userp_env env= buf->env;
 
+	// Let the owner of the data know that the library is finished with it
+	if (buf->destructor) {
+		buf->destructor(buf->destructor_data, &buf);
+		buf->destructor= NULL;
+	}
+
+	if ((buf->flags & USERP_BUFFER_POOLED) && buffer_pool_put(buf))
+		return;
+
 	// Free the data if it came from env->alloc
 	if (buf->flags & USERP_BUFFER_DATA_ALLOC)
 		userp_alloc(env, (void**) &buf->data, 0, USERP_POINTER_IS_BUFFER_DATA);
+#if HAVE_POSIX_MEMMAP
+	// Unmap the data if it is a window of a file from userp_bstr_map_file
+	else if (buf->flags & USERP_BUFFER_DATA_MMAP)
+		munmap(buf->data, buf->alloc_len);
+#endif
 
 	// Free the buffer struct
 	USERP_FREE(env, &buf);
@@ -279,4 +358,70 @@ alloc 0x0+ to \d+ = 0x\w+
 alloc 0x\w+ to 0 = 0x0+
 */
 
+UNIT_TEST(buf_pool) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_buffer a= userp_env_take_buffer(env, 5000, 0), b, c;
+	uint8_t *a_data= a->data;
+	printf("a: alloc=%d refcnt=%d env.refcnt=%d\n", (int) a->alloc_len, (int) a->refcnt, (int) env->refcnt);
+	userp_drop_buffer(a);
+	printf("pooled=%d bytes=%d env.refcnt=%d\n", env->buffer_pool_count, (int) env->buffer_pool_bytes, (int) env->refcnt);
+	// A smaller request reuses the pooled buffer, a larger one allocates
+	b= userp_env_take_buffer(env, 100, 0);
+	c= userp_env_take_buffer(env, 100000, 0);
+	printf("b reused=%d c alloc=%d pooled=%d\n", b == a && b->data == a_data, (int) c->alloc_len, env->buffer_pool_count);
+	userp_drop_buffer(b);
+	userp_drop_buffer(c);
+	printf("pooled=%d\n", env->buffer_pool_count);
+	// Buffers over the limit get freed
+	userp_env_set_attr(env, USERP_BUFFER_POOL_MAX, 1);
+	a= userp_env_take_buffer(env, 200000, 0);
+	userp_drop_buffer(a);
+	printf("pooled=%d\n", env->buffer_pool_count);
+	userp_drop_env(env);
+}
+/*OUTPUT
+a: alloc=8192 refcnt=1 env.refcnt=2
+pooled=1 bytes=8192 env.refcnt=1
+b reused=1 c alloc=\d+ pooled=0
+pooled=2
+pooled=2
+*/
+
+#if HAVE_POSIX_MEMMAP
+UNIT_TEST(buf_map_file) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	size_t page= sysconf(_SC_PAGESIZE), i, j, pos;
+	struct userp_bstr str;
+	FILE *f= tmpfile();
+	for (i= 0; i < page*3 + 100; i++)
+		fputc((int)(i * 7), f);
+	fflush(f);
+	userp_env_set_attr(env, USERP_MAP_WINDOW, page);
+	userp_bstr_init(&str, env);
+	if (userp_bstr_map_file(&str, fileno(f), 10, -1, USERP_MAP_SEQUENTIAL)) {
+		printf("parts=%d\n", (int) str.part_count);
+		for (i= 0, pos= 10; i < str.part_count; i++) {
+			printf("ofs=%d len=%d refcnt=%d mmap=%d\n", (int) str.parts[i].ofs, (int) str.parts[i].len,
+				(int) str.parts[i].buf->refcnt, !!(str.parts[i].buf->flags & USERP_BUFFER_DATA_MMAP));
+			for (j= 0; j < str.parts[i].len; j++, pos++)
+				if (str.parts[i].data[j] != (uint8_t)(pos * 7))
+					printf("byte %d differs\n", (int) pos);
+		}
+	}
+	// range beyond the end of the file
+	userp_bstr_map_file(&str, fileno(f), page*3, 101, 0);
+	userp_bstr_destroy(&str);
+	fclose(f);
+	userp_drop_env(env);
+}
+/*OUTPUT
+parts=4
+ofs=0 len=\d+ refcnt=1 mmap=1
+ofs=\d+ len=\d+ refcnt=1 mmap=1
+ofs=\d+ len=\d+ refcnt=1 mmap=1
+ofs=\d+ len=100 refcnt=1 mmap=1
+error: File range \d+\+101 exceeds file length \d+
+*/
+#endif
+
 #endif
@@ -7,10 +7,6 @@ typedef struct userp_dec_frame *frame;
 // static void frame_init(userp_dec dec, frame f, userp_type t);
 // static void frame_destroy(userp_dec dec, frame f);
 
-static userp_error_t userp_decode_vint(userp_node_info_private *node, userp_dec_input *in, bool is_signed);
-static userp_error_t userp_decode_vsize(size_t *out, userp_dec_input *in);
-static bool userp_dec_input_next_buffer(userp_dec_input *in);
-
 /*APIDOC
 ## userp_dec
 
@@ -75,6 +71,24 @@ and then returns NULL.
 
 [*] unless you're really careful
 
+#### userp_new_dec_from_file
+
+    userp_dec dec= userp_new_dec_from_file(env, scope, root_type, fd, offset, length);
+
+Create a decoder that reads `length` bytes of the file `fd` starting at `offset` (or through the
+end of the file if `length` is negative) by memory-mapping it, so the data is decoded straight
+out of the page cache without any `read()` copies.  The file is mapped in windows (see
+`USERP_MAP_WINDOW`), one window ahead of the value being decoded, and windows the decoder has
+moved past are unmapped, so very large files only occupy a few windows of address space.  A
+value whose type has a fixed size is always mapped completely before it is decoded, but any
+other value must end within the window after the one where it begins, so raise the window size
+if the file holds larger arrays.  The kernel is asked to read ahead sequentially, and to start
+paging in each window as it gets mapped.  Zero-copy results keep their own references to the
+windows they point into.
+
+The decoder keeps a duplicate of `fd`, so the caller may close theirs.  This installs the
+decoder's reader callback; don't replace it with `userp_dec_set_reader`.
+
 #### userp_grab_dec
 
     bool success= userp_grab_dec(env, dec);
@@ -93,27 +107,38 @@ It is undefined behavior to drop a decoder that was already freed, unless you en
 USERP_MEASURE_TWICE option.  Errors (if any) are reported via the `env`. `env` may be null to
 deliberately skip any safety or error reporting.
 
-*
-
-userp_dec userp_new_dec(
-	userp_env env, userp_scope scope, userp_type root_type,
-	userp_buffer buffer_ref, uint8_t *bytes, size_t n_bytes
-) {
-	userp_dec dec;
-	USERP_CLEAR_ERROR(env);
-	dec= userp_new_dec_silent(env, scope, root_type, buffer_ref, bytes, n_bytes);
-	USERP_DISPATCH_ERR(env);
-	return dec;
-}
+*/
 
-userp_dec userp_new_dec_silent(
+static void frame_init(userp_dec dec, frame f, userp_type t);
+static void frame_destroy(userp_dec dec, frame f);
+static void userp_drop_dec_silent(userp_env env, userp_dec dec);
+static const struct type_plan* dec_node_plan(userp_dec dec);
+static void dec_next_node(userp_dec dec);
+static uint64_t dec_tell(userp_dec dec);
+static void dec_seek(userp_dec dec, uint64_t bitpos);
+static bool dec_begin_array(userp_dec dec, frame f);
+static bool dec_begin_record(userp_dec dec, frame f);
+static bool dec_array_seek(userp_dec dec, frame f, size_t elem_idx);
+static bool dec_frame_finish(userp_dec dec, frame f);
+static void dec_need_array(userp_dec dec, const struct type_plan *plan);
+static bool dec_record_seek(userp_dec dec, frame f, size_t elem_idx, userp_symbol name);
+static void dec_record_next(userp_dec dec, frame f);
+static size_t dec_record_n_pos(const struct type_plan *plan);
+static bool dec_int(userp_dec dec, struct userp_bit_io *orig, int64_t *out, bool *is_big);
+static int64_t dec_delta_prev(userp_dec dec, const struct type_plan *plan);
+static void dec_next_int(userp_dec dec, int64_t val);
+static bool dec_int_limit(userp_dec dec, struct userp_bit_io *orig, size_t bytes, bool negative);
+static bool dec_ref(userp_dec dec, uint32_t flag, size_t *out);
+bool userp_dec_init_node(userp_dec dec, struct userp_node_info_private *node, struct userp_bit_io *in);
+
+// Construct a decoder, storing any error in env->err without dispatching it
+static userp_dec userp_new_dec_silent(
 	userp_env env, userp_scope scope, userp_type root_type,
 	userp_buffer buffer_ref, uint8_t *bytes, size_t n_bytes
 ) {
 	userp_dec dec= NULL;
 	frame stack= NULL;
 	size_t n_frames= USERP_DEC_FRAME_ALLOC_ROUND(1);
-	size_t n_input_parts= 4;//enc->decoder_alloc_input_parts_typical;
 	bool got_scope= false;
 
 	if (!env->run_with_scissors) {
@@ -129,99 +154,236 @@ userp_dec userp_new_dec_silent(
 		}
 	}
 	// Perform all allocations, and if any fail, free them all
-	if (!userp_alloc(env, (void**) &dec, sizeof(*dec) + sizeof(struct userp_bstr_part)*n_input_parts, USERP_HINT_STATIC, "userp_dec")
+	if (!userp_alloc(env, (void**) &dec, sizeof(*dec), USERP_HINT_STATIC)
 		|| !USERP_ALLOC_ARRAY(env, &stack, n_frames)
 		// decoder holds a reference to the scope
-		|| !(got_scope= userp_grab_scope_silent(env, scope))
-		|| (n_bytes && bytes && buffer_ref && !userp_grab_buffer_silent(env, buffer_ref))
+		|| !(got_scope= userp_grab_scope(scope))
+		|| (n_bytes && bytes && buffer_ref && !userp_grab_buffer(buffer_ref))
 	) {
-		if (got_scope) userp_drop_scope_silent(env, scope);
+		if (got_scope) userp_drop_scope(scope);
 		USERP_FREE(env, &stack);
 		USERP_FREE(env, &dec);
 		// The userp_env->diag_code will already be set by one of the allocation functions
 		return NULL;
 	}
 	bzero(dec, sizeof(*dec));
+	dec->refcnt= 1;
 	dec->env= env;
 	dec->scope= scope;
+	dec->map_fd= -1;
 	// initialize the first decoder stack element with the root type
 	dec->stack= stack;
 	dec->stack_lim= n_frames;
 	frame_init(dec, &stack[0], root_type);
-	// initial storage for input bstr is found at end of this record
-	dec->input= &dec->input_inst;
-	dec->input_inst.part_alloc= n_input_parts;
+	userp_bstr_init(&dec->input, env);
+	userp_bstr_init(&dec->slice, env);
+	dec->in.str= &dec->input;
 	// Initialize buffer, if provided
 	if (n_bytes && bytes) {
-		dec->input_inst.part_count= 1;
-		dec->input_inst.parts[0].data= bytes;
-		dec->input_inst.parts[0].len= n_bytes;
-		dec->input_inst.parts[0].buf= buffer_ref; // ref count was handled above
+		if (!userp_bstr_partalloc(&dec->input, 1)) {
+			if (buffer_ref) userp_drop_buffer(buffer_ref);
+			userp_drop_dec_silent(env, dec);
+			return NULL;
+		}
+		dec->input.part_count= 1;
+		dec->input.parts[0].data= bytes;
+		dec->input.parts[0].len= n_bytes;
+		dec->input.parts[0].ofs= 0;
+		dec->input.parts[0].buf= buffer_ref; // ref count was handled above
+		dec->in.part= dec->input.parts;
+		dec->in.pos= bytes;
+		dec->in.lim= bytes + n_bytes;
 	}
 	return dec;
 }
 
-void dec_free(userp_dec dec) {
-	size_t i;
-	do {
-		frame_destroy(dec, &dec->stack[dec->stack_i]);
-	} while (dec->stack_i-- > 0); 
-	USERP_FREE(dec->env, &dec->stack);
-	if (dec->input == &dec->input_inst) {
-		for (i= 0; i < dec->input_inst.part_count; i++) {
-			if (dec->input_inst.parts[i].buf)
-				userp_drop_buffer(dec->env, dec->input_inst.parts[i].buf);
+userp_dec userp_new_dec(
+	userp_env env, userp_scope scope, userp_type root_type,
+	userp_buffer buffer_ref, uint8_t *bytes, size_t n_bytes
+) {
+	userp_dec dec= userp_new_dec_silent(env, scope, root_type, buffer_ref, bytes, n_bytes);
+	if (!dec)
+		USERP_DISPATCH_ERR(env);
+	return dec;
+}
+
+// Call the reader if fewer than 'n' bytes remain after the read position.  The parts before the
+// current one have been decoded, so they are released first, which lets a reader that appends
+// mapped windows or pooled buffers recycle them, except for any part that an array or record
+// being iterated can seek back into.  Returns false if the bytes are not available.
+static bool dec_need(userp_dec dec, size_t n) {
+	struct userp_bstr *str= &dec->input;
+	size_t avail= dec->in.lim - dec->in.pos, done, cur= 0, i;
+	uint64_t keep;
+	bool ok;
+	for (i= dec->in.part? dec->in.part - str->parts + 1 : 0; i < str->part_count && avail < n; i++)
+		avail += str->parts[i].len;
+	if (avail >= n)
+		return true;
+	if (!dec->reader)
+		return false;
+	if (dec->in.part && (cur= done= dec->in.part - str->parts)) {
+		if (dec->stack_i) {
+			keep= (dec->stack[1].extra_count? dec->stack[1].refs_start : dec->stack[1].start) >> 3;
+			while (done && str->parts[done-1].ofs + str->parts[done-1].len > keep)
+				--done;
 		}
-	} else if (dec->input)
-		userp_bstr_free(dec->input);
-	userp_drop_scope_silent(dec->env, dec->scope);
-	USERP_FREE(dec->env, &dec);
+		for (i= 0; i < done; i++)
+			if (str->parts[i].buf)
+				userp_drop_buffer(str->parts[i].buf);
+		memmove(str->parts, str->parts + done, sizeof(*str->parts) * (str->part_count - done));
+		str->part_count -= done;
+		cur -= done;
+	}
+	ok= dec->reader(dec->reader_cb_data, str, n - avail, dec->env);
+	// The reader may have reallocated the parts, or supplied the first input
+	if (!dec->in.part) {
+		if (str->part_count) {
+			dec->in.part= str->parts;
+			dec->in.pos= str->parts[0].data;
+			dec->in.lim= str->parts[0].data + str->parts[0].len;
+		}
+	}
+	else
+		dec->in.part= str->parts + cur;
+	return ok;
 }
 
-bool userp_grab_dec(userp_env env, userp_dec dec) {
-	if (env) USERP_CLEAR_ERROR(env);
-	if (userp_grab_dec_silent(env, dec))
+#if HAVE_POSIX_MEMMAP
+
+// Reader callback of userp_new_dec_from_file.  It maps whole windows up to one window beyond
+// bytes_needed, so that a value no longer than a window is mapped before it gets decoded.
+static bool dec_map_reader(void *callback_data, struct userp_bstr *str, size_t bytes_needed, userp_env env) {
+	userp_dec dec= (userp_dec) callback_data;
+	size_t window= env->map_window? env->map_window : 1, i= str->part_count;
+	int64_t end= dec->map_pos + bytes_needed + window;
+	bool ok;
+	if (dec->map_pos >= dec->map_lim)
+		return false;
+	end -= end % window;
+	if (end > dec->map_lim)
+		end= dec->map_lim;
+	ok= userp_bstr_map_file(str, dec->map_fd, dec->map_pos, end - dec->map_pos,
+		USERP_MAP_SEQUENTIAL|USERP_MAP_WILLNEED);
+	// On failure, the windows mapped so far are still usable
+	for (; i < str->part_count; i++)
+		dec->map_pos += str->parts[i].len;
+	return ok;
+}
+
+userp_dec userp_new_dec_from_file(
+	userp_env env, userp_scope scope, userp_type root_type,
+	int fd, int64_t offset, int64_t length
+) {
+	userp_dec dec;
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		userp_diag_setf(&env->err, USERP_ESYS, "fstat() failed: " USERP_DIAG_CSTR1, strerror(errno));
+		USERP_DISPATCH_ERR(env);
+		return NULL;
+	}
+	if (offset < 0 || offset > (int64_t) st.st_size
+		|| (length >= 0 && length > (int64_t) st.st_size - offset)
+	) {
+		userp_diag_setf(&env->err, USERP_EOVERRUN,
+			"File range " USERP_DIAG_POS "+" USERP_DIAG_LEN " exceeds file length " USERP_DIAG_SIZE,
+			(size_t) offset, (size_t) length, (size_t) st.st_size);
+		USERP_DISPATCH_ERR(env);
+		return NULL;
+	}
+	if (!(dec= userp_new_dec_silent(env, scope, root_type, NULL, NULL, 0))) {
+		USERP_DISPATCH_ERR(env);
+		return NULL;
+	}
+	dec->map_pos= offset;
+	dec->map_lim= length < 0? (int64_t) st.st_size : offset + length;
+	if ((dec->map_fd= dup(fd)) < 0) {
+		userp_diag_setf(&env->err, USERP_ESYS, "dup() failed: " USERP_DIAG_CSTR1, strerror(errno));
+		USERP_DISPATCH_ERR(env);
+		goto fail_map;
+	}
+	dec->reader= dec_map_reader;
+	dec->reader_cb_data= dec;
+	// Map the first window now, so that errors are reported by the constructor
+	if (dec->map_pos < dec->map_lim && !dec_need(dec, 1))
+		goto fail_map;
+	return dec;
+
+	CATCH(fail_map) {
+		userp_drop_dec_silent(env, dec);
+	}
+	return NULL;
+}
+
+#endif
+
+// Flags of userp_dec_bytes are reserved
+static bool dec_bytes_check_flags(userp_dec dec, int flags) {
+	if (!flags)
 		return true;
-	if (env) USERP_DISPATCH_ERR(env);
+	userp_diag_setf(&dec->env->err, USERP_EUNKNOWN, "Unknown " USERP_DIAG_CSTR1 ": " USERP_DIAG_INDEX,
+		"userp_dec_bytes flags", flags);
+	USERP_DISPATCH_ERR(dec->env);
 	return false;
 }
 
-bool userp_grab_dec_silent(userp_env env, userp_dec dec) {
-	if (env && env->measure_twice) {
-		unimplemented("verify decoder belongs to env");
-		// remove decoder from env's set if decoder is getting freed
-	}
+// Drop the buffer references of the previous userp_dec_bytes_zerocopy result
+static void dec_release_slice(userp_dec dec) {
+	size_t i;
+	for (i= 0; i < dec->slice.part_count; i++)
+		if (dec->slice.parts[i].buf)
+			userp_drop_buffer(dec->slice.parts[i].buf);
+	dec->slice.part_count= 0;
+}
+
+static void dec_free(userp_dec dec) {
+	userp_env env= dec->env;
+	do {
+		frame_destroy(dec, &dec->stack[dec->stack_i]);
+	} while (dec->stack_i-- > 0);
+	USERP_FREE(env, &dec->stack);
+	userp_bstr_destroy(&dec->input);
+	dec_release_slice(dec);
+	userp_bstr_destroy(&dec->slice);
+	if (dec->map_fd >= 0)
+		close(dec->map_fd);
+	userp_drop_scope(dec->scope);
+	USERP_FREE(env, &dec);
+}
+
+static bool userp_grab_dec_silent(userp_env env, userp_dec dec) {
 	if (++dec->refcnt)
 		return true;
 	// else, overflow
 	--dec->refcnt;
 	if (env)
-		unimplemented("report grab_dec failed");
+		userp_diag_set(&env->err, USERP_EALLOC, "Decoder reference count overflow");
 	return false;
 }
 
-void userp_drop_dec(userp_env env, userp_dec dec) {
-	if (env) USERP_CLEAR_ERROR(env);
-	userp_drop_dec_silent(env, dec);
+bool userp_grab_dec(userp_env env, userp_dec dec) {
+	if (userp_grab_dec_silent(env, dec))
+		return true;
 	if (env) USERP_DISPATCH_ERR(env);
+	return false;
 }
 
-void userp_drop_dec_silent(userp_env env, userp_dec dec) {
-	if (env && env->measure_twice) {
-		unimplemented("verify dec belongs to env");
-	}
+static void userp_drop_dec_silent(userp_env env, userp_dec dec) {
 	if (dec->refcnt && !--dec->refcnt) {
 		dec_free(dec);
 	}
 }
 
-void frame_init(userp_dec dec, frame f, userp_type t) {
+void userp_drop_dec(userp_env env, userp_dec dec) {
+	userp_drop_dec_silent(env, dec);
+}
+
+static void frame_init(userp_dec dec, frame f, userp_type t) {
 	bzero(f, sizeof(*f));
 	f->node_type= t;
-	unimplemented("initialize frame");
 }
-void frame_destroy(userp_dec dec, frame f) {
-	unimplemented("destroy frame");
+static void frame_destroy(userp_dec dec, frame f) {
+	// frames hold no allocations yet
 }
 
 
@@ -259,7 +421,7 @@ decoder, avoiding the error condition.
 
 You may pass NULL to un-set the reader.
 
-*
+*/
 
 userp_env userp_dec_env(userp_dec dec) {
 	return dec->env;
@@ -308,10 +470,24 @@ recycled.  Attempting to alter this struct (which is deliberately marked const)
 undefined behavior.  Do not make shallow copies of this struct either, as the referenced arrays
 like `subtypes` and `array_dims` are similarly transient.
 
-*
+*/
 
-const userp_node_info userp_dec_node_info(userp_dec dec) {
-	unimplemented("userp_dec_node_info");
+userp_node_info userp_dec_node_info(userp_dec dec) {
+	struct userp_node_info_private *node= &dec->node;
+	frame f= &dec->stack[dec->stack_i];
+	struct userp_bit_io in;
+	bzero(node, sizeof(*node));
+	node->pub.node_depth= dec->stack_i;
+	if (!f->node_type)
+		return &node->pub;
+	if (!dec_node_plan(dec))
+		return NULL;
+	// Decode a copy of the input, so the node is still the current one
+	in= dec->in;
+	node->pub.node_type= f->node_type;
+	if (!userp_dec_init_node(dec, node, &in))
+		return NULL;
+	return &node->pub;
 }
 
 /*APIDOC
@@ -336,18 +512,68 @@ If the current node is not an array or record, this returns false and sets an er
     bool success= userp_dec_end(dec);
 
 Stop iterating an array or record, return to that parent node, and then set the current node to
-whatever follows it.
+whatever follows it.  Any elements or fields not yet decoded are skipped; the elements of a
+fixed-size type are skipped all at once.
+
+The descent is driven by the type plans (see `userp_scope_get_type_plan`), so `begin` reads only
+the record header, finds the static fields and the fields of a fixed-size record by their offset,
+and checks once that the static area is available.  Within a record, the current node is the
+field; with `userp_dec_seek_field` you can go straight to the field you need.
 
 */
 
 bool userp_dec_begin(userp_dec dec) {
-	unimplemented("userp_dec_begin");
-	return false;
+	const struct type_plan *plan= dec_node_plan(dec);
+	uint64_t orig;
+	size_t n;
+	frame f;
+	if (!plan)
+		return false;
+	if (plan->op != PLAN_ARRAY && plan->op != PLAN_RECORD && plan->op != PLAN_RECORD_FIXED) {
+		userp_diag_setf(&dec->env->err, USERP_ETYPE,
+			"Type " USERP_DIAG_INDEX " is not an array or record", (int) plan->type);
+		USERP_DISPATCH_ERR(dec->env);
+		return false;
+	}
+	if (dec->stack_i + 1 >= dec->stack_lim) {
+		n= USERP_DEC_FRAME_ALLOC_ROUND(dec->stack_i + 2);
+		if (!USERP_ALLOC_ARRAY(dec->env, &dec->stack, n))
+			return false;
+		dec->stack_lim= n;
+	}
+	// Make the header and static area available up front (a generous guess at the header size)
+	if (dec->reader)
+		dec_need(dec, 64 + ((plan->static_bits + ((size_t)1 << plan->align)) >> 3));
+	orig= dec_tell(dec);
+	f= &dec->stack[dec->stack_i + 1];
+	frame_init(dec, f, 0);
+	f->plan= plan;
+	if (!(plan->op == PLAN_ARRAY? dec_begin_array(dec, f) : dec_begin_record(dec, f))) {
+		dec_seek(dec, orig);
+		return false;
+	}
+	dec->stack_i++;
+	return true;
 }
 
 bool userp_dec_end(userp_dec dec) {
-	unimplemented("userp_dec_end");
-	return false;
+	frame f= &dec->stack[dec->stack_i];
+	struct userp_dec_frame saved= *f;
+	uint64_t orig= dec_tell(dec);
+	if (!dec->stack_i) {
+		userp_diag_set(&dec->env->err, USERP_EDOINGITWRONG, "No array or record is being iterated");
+		USERP_DISPATCH_ERR(dec->env);
+		return false;
+	}
+	if (!dec_frame_finish(dec, f)) {
+		*f= saved;
+		dec_seek(dec, orig);
+		return false;
+	}
+	frame_destroy(dec, f);
+	dec->stack_i--;
+	dec_next_node(dec);
+	return true;
 }
 
 /*APIDOC
@@ -355,7 +581,10 @@ bool userp_dec_end(userp_dec dec) {
 
     bool success= userp_dec_seek_elem(dec, elem_idx);
 
-Seek to the specified field name or array index, changing the current node to that element.
+Seek to the specified array index, or to the Nth field present in the record, changing the
+current node to that element.  Elements of a fixed-size type, static fields, and the fields of a
+fixed-size record are found by their offset.  Any other element is found by skipping the ones
+before it, starting over from the first if it is behind the current node.
 
 If the element does not exist, the current node is unchanged and the function
 returns false.  If there is no current array or record being iterated, this returns false and
@@ -363,7 +592,21 @@ sets a error flag on the `userp_env`.
 
 */
 bool userp_dec_seek_elem(userp_dec dec, size_t elem_idx) {
-	unimplemented("userp_dec_seek");
+	frame f= &dec->stack[dec->stack_i];
+	struct userp_dec_frame saved= *f;
+	uint64_t orig= dec_tell(dec);
+	if (!dec->stack_i) {
+		userp_diag_set(&dec->env->err, USERP_EDOINGITWRONG, "No array or record is being iterated");
+		USERP_DISPATCH_ERR(dec->env);
+		return false;
+	}
+	if (elem_idx >= f->elem_lim)
+		return false;
+	if (f->frame_type == FRAME_TYPE_ARRAY? dec_array_seek(dec, f, elem_idx)
+		: dec_record_seek(dec, f, elem_idx, 0))
+		return true;
+	*f= saved;
+	dec_seek(dec, orig);
 	return false;
 }
 
@@ -373,34 +616,80 @@ bool userp_dec_seek_elem(userp_dec dec, size_t elem_idx) {
   userp_symbol sym= userp_scope_get_symbol(scope, "my_field");
   bool success= userp_dec_seek_field(dec, sym);
 
-Seek to the named field of the most recent parent record node.  If the record does not contain
-this field, this returns false.  If there is no record being iterated, or the symbol is NULL, or
-the symbol is not part of the current scope (regardless of its string value) this returns false
-and sets an error flag in `userp_env`.
+Seek to the named field of the record being iterated.  If the record does not contain this
+field, this returns false and the current node is unchanged.  If there is no record being
+iterated, or the symbol is NULL, or the symbol is not part of the current scope (regardless of
+its string value) this returns false and sets an error flag in `userp_env`.
+
+A static field, or any field of a fixed-size record, is found by its offset without reading
+anything.  An often field which the record header marks as absent is rejected without reading
+anything.  Otherwise the fields between the current node and the named one are skipped, starting
+over from the first field after the static area if the named field is behind the current node.
 
 */
 bool userp_dec_seek_field(userp_dec dec, userp_symbol fieldname) {
-	unimplemented("userp_dec_seek_field");
+	frame f= &dec->stack[dec->stack_i];
+	struct userp_dec_frame saved= *f;
+	uint64_t orig= dec_tell(dec);
+	if (f->frame_type != FRAME_TYPE_RECORD) {
+		userp_diag_set(&dec->env->err, USERP_EDOINGITWRONG, "No record is being iterated");
+		USERP_DISPATCH_ERR(dec->env);
+		return false;
+	}
+	if (!fieldname || !userp_scope_get_symbol_str(dec->scope, fieldname)) {
+		userp_diag_setf(&dec->env->err, USERP_ESYMBOL,
+			"Symbol " USERP_DIAG_INDEX " is not part of the scope", (int) fieldname);
+		USERP_DISPATCH_ERR(dec->env);
+		return false;
+	}
+	if (dec_record_seek(dec, f, 0, fieldname) && f->node_type && f->field_name == fieldname)
+		return true;
+	*f= saved;
+	dec_seek(dec, orig);
 	return false;
 }
 
 /*APIDOC
 #### userp_dec_skip
 
-Skip the current node and move to the next element in the parent array or record.
+Skip the current node and move to the next element in the parent array or record.  The node is
+skipped according to its type's plan, so a node of fixed size is skipped without reading it, and
+an array of fixed-size elements is skipped all at once.
 
 To skip more than one element, use `userp_seek_elem`.
 
 */
 bool userp_dec_skip(userp_dec dec) {
-	unimplemented("userp_dec_skip");
-	return false;
+	const struct type_plan *plan= dec_node_plan(dec);
+	struct userp_bit_io orig;
+	if (!plan)
+		return false;
+	orig= dec->in;
+	// A delta element still has to be read, for the elements after it
+	if ((plan->flags & PLAN_DELTA) && dec->stack[dec->stack_i].frame_type == FRAME_TYPE_ARRAY) {
+		if (!userp_plan_read_int_next(plan, &dec->in, &dec->stack[dec->stack_i].delta_prev)) {
+			dec->in= orig;
+			return false;
+		}
+	}
+	else if (!userp_plan_skip(dec->scope, plan, &dec->in)) {
+		dec->in= orig;
+		return false;
+	}
+	dec_next_node(dec);
+	return true;
 }
 
 /*APIDOC
 
 ### Decoding Functions
 
+Each decoding function consumes the current node and moves to the next one: the next element of
+the array or the next field of the record being iterated.  Once the root node, or the last
+element, has been decoded there is no current node, and further calls fail with
+`USERP_EDOINGITWRONG` (until `userp_dec_end`).  A call that fails leaves the decoder at the same
+node.
+
 #### userp_dec_int
 
   int int_out;
@@ -413,6 +702,20 @@ the value into `*int_out` and moves the internal iterator to the next node, and
 If one of those pre-conditions is not true, this returns false and emits an error via
 the `userp_env`.
 
+The elements of an array whose integer type is a delta type store the difference from the
+previous element.  While iterating such an array, the decoder keeps the running value in the
+array's frame, so each element decodes to its actual value whether it was reached with
+`userp_dec_int`, `userp_dec_skip` or `userp_dec_seek_elem`.  (Seeking to an earlier element
+re-reads the array from its start.)  A delta-typed node that is not an array element, such as a
+record field, is a lone value and decodes to the value stored.
+
+#### userp_dec_int64
+
+  int64_t i64;
+  bool success= userp_dec_int64(dec, &i64);
+
+Same as `userp_dec_int`, for any value that fits in an `int64_t`.
+
 #### userp_dec_int_n
 
     long long int_out;
@@ -422,7 +725,8 @@ the `userp_env`.
 
 Decode the current node as an arbitrary-sized integer.  Same as userp_dec_int but you can
 specify any byte length.  The entire number of bytes will be filled in host-endian order,
-and optionally signed.  Decoding a negative number into an unsigned integer is an error.
+and optionally signed.  Decoding a negative number into an unsigned integer is an error, as is a
+value that does not fit in `word_size` bytes.
 
 #### userp_dec_bigint
 
@@ -438,20 +742,155 @@ encoding.  If `sign` is not supplied, the value will always be two's-complement
 of bytes written.  (the remainder of the buffer is not filled)
 
 If the current node is not an integer, or it does not fit into the buffer, this returns false and
-sets an error on the `userp_env`.  (to find the size of buffer required, inspect the node_info)
+sets an error on the `userp_env`.  If the buffer is too small, `len` is set to the number of bytes
+required.  The limbs are `unsigned long` in host order, least significant first, and `sign` is
+set to 1 for a negative value.  (Integers wider than 64 bits are not decoded yet.)
 
 */
 bool userp_dec_int(userp_dec dec, int *out) {
-	unimplemented("userp_dec_int");
-	return false;
+	struct userp_bit_io orig;
+	int64_t val;
+	bool is_big;
+	if (!dec_int(dec, &orig, &val, &is_big))
+		return false;
+	if (is_big || val < INT_MIN || val > INT_MAX)
+		return dec_int_limit(dec, &orig, sizeof(int), false);
+	*out= (int) val;
+	dec_next_int(dec, val);
+	return true;
+}
+bool userp_dec_int64(userp_dec dec, int64_t *out) {
+	struct userp_bit_io orig;
+	int64_t val;
+	bool is_big;
+	if (!dec_int(dec, &orig, &val, &is_big))
+		return false;
+	if (is_big)
+		return dec_int_limit(dec, &orig, sizeof(int64_t), false);
+	*out= val;
+	dec_next_int(dec, val);
+	return true;
 }
 bool userp_dec_int_n(userp_dec dec, void *intbuf, size_t word_size, bool is_signed) {
-	unimplemented("userp_dec_int_n");
-	return false;
+	struct userp_bit_io orig;
+	uint8_t *dst= (uint8_t*) intbuf;
+	int64_t val;
+	int shift;
+	bool is_big;
+	size_t i;
+	if (!word_size) {
+		userp_diag_set(&dec->env->err, USERP_EDOINGITWRONG, "Integer word size must be nonzero");
+		USERP_DISPATCH_ERR(dec->env);
+		return false;
+	}
+	if (!dec_int(dec, &orig, &val, &is_big))
+		return false;
+	if (!is_signed && val < 0 && !is_big)
+		return dec_int_limit(dec, &orig, word_size, true);
+	// The value must survive truncation to word_size bytes
+	if (word_size < 8) {
+		shift= 64 - word_size * 8;
+		if (is_big || (is_signed? ((int64_t)((uint64_t) val << shift) >> shift) != val
+			: ((uint64_t) val >> (word_size * 8)) != 0))
+			return dec_int_limit(dec, &orig, word_size, false);
+	}
+	else if (word_size == 8 && is_signed && is_big)
+		return dec_int_limit(dec, &orig, word_size, false);
+	for (i= 0; i < word_size; i++)
+		dst[ENDIAN == LSB_FIRST? i : word_size - 1 - i]= i < 8? (uint8_t)((uint64_t) val >> (i * 8))
+			: (val < 0 && !is_big)? 0xFF : 0;
+	dec_next_int(dec, val);
+	return true;
 }
 bool userp_dec_bigint(userp_dec dec, void *intbuf, size_t *len, int *sign) {
-	unimplemented("userp_dec_bigint");
-	return false;
+	struct userp_bit_io orig;
+	unsigned long limbs[8 / sizeof(long) + 1];
+	int64_t val;
+	uint64_t mag;
+	bool is_big;
+	size_t n, i;
+	if (!dec_int(dec, &orig, &val, &is_big))
+		return false;
+	// A two's complement value above INT64_MAX needs another limb for its sign
+	n= (8 / sizeof(long) + (is_big && !sign)) * sizeof(long);
+	if (*len < n) {
+		dec->in= orig;
+		userp_diag_setf(&dec->env->err, USERP_ELIMIT,
+			"Integer needs " USERP_DIAG_SIZE " bytes, but buffer holds " USERP_DIAG_SIZE2, n, *len);
+		*len= n;
+		USERP_DISPATCH_ERR(dec->env);
+		return false;
+	}
+	mag= (sign && val < 0 && !is_big)? -(uint64_t) val : (uint64_t) val;
+	for (i= 0; i < 8 / sizeof(long); i++)
+		limbs[i]= (unsigned long)(mag >> (i * 8 * sizeof(long)));
+	limbs[i]= 0;
+	if (sign)
+		*sign= val < 0 && !is_big;
+	memcpy(intbuf, limbs, n);
+	*len= n;
+	dec_next_int(dec, val);
+	return true;
+}
+
+// Get the plan of the current node.  If there is a reader, first make sure that the whole node
+// is available when its size is fixed, and otherwise that at least one byte is.
+static const struct type_plan* dec_node_plan(userp_dec dec) {
+	frame f= &dec->stack[dec->stack_i];
+	const struct type_plan *plan= f->node_plan;
+	if (!f->node_type) {
+		userp_diag_set(&dec->env->err, USERP_EDOINGITWRONG, dec->stack_i
+			? "No current node (the last element was already decoded)"
+			: "No current node (the root node was already decoded)");
+		USERP_DISPATCH_ERR(dec->env);
+		return NULL;
+	}
+	if (!plan && !(plan= f->node_plan= userp_scope_get_type_plan(dec->scope, f->node_type)))
+		return NULL;
+	if (dec->reader)
+		dec_need(dec, (plan->flags & PLAN_FIXED)? (plan->fixed_bits + ((size_t)1 << plan->align) + 14) >> 3 : 1);
+	return plan;
+}
+
+// Move past the node that was just decoded, to the next element of the array or field of the
+// record being iterated.  The root node is not followed by any other node.
+static void dec_next_node(userp_dec dec) {
+	frame f= &dec->stack[dec->stack_i];
+	if (f->frame_type == FRAME_TYPE_ARRAY) {
+		if (++f->elem_i >= f->elem_lim)
+			f->node_type= 0;
+	}
+	else if (f->frame_type == FRAME_TYPE_RECORD)
+		dec_record_next(dec, f);
+	else
+		f->node_type= 0;
+}
+
+/*APIDOC
+#### userp_dec_int_array
+
+  int16_t samples[4096];
+  size_t count= sizeof(samples)/sizeof(*samples);
+  bool success= userp_dec_int_array(dec, samples, sizeof(*samples), &count, 0);
+
+Decode the current node, which must be an array of integers, into a native array of 1, 2, 4,
+or 8 byte integers, and move to the next node.  `count` is the capacity of the buffer on input,
+and the number of elements decoded on output.  If the array is larger than the buffer, this
+fails and sets `count` to the number of elements required.  Pass flag `USERP_DEC_UNSIGNED` if
+the native integers are unsigned, so that the range is checked accordingly.  Any element that
+doesn't fit in the native integer is an error.  If the element type has the `delta` attribute,
+the stored differences are summed, so `samples` receives the actual values.
+
+Arrays of fixed-width integers (the common encoding for sampled data) are unpacked in bulk,
+with SIMD where available, and are much faster than calling `userp_dec_int` per element.
+
+*/
+bool userp_dec_int_array(userp_dec dec, void *out, size_t elem_size, size_t *count, int flags) {
+	const struct type_plan *plan= dec_node_plan(dec);
+	if (!plan || !userp_plan_read_int_array(dec->scope, plan, &dec->in, out, elem_size, count, flags))
+		return false;
+	dec_next_node(dec);
+	return true;
 }
 
 /*
@@ -467,8 +906,11 @@ integer value) return the Symbol.  Else returns NULL and sets an error flag in t
 
 */
 bool userp_dec_symbol(userp_dec dec, userp_symbol *out) {
-	unimplemented("userp_dec_symbol");
-	return false;
+	size_t ref;
+	if (!dec_ref(dec, USERP_NODEFLAG_SYM, &ref))
+		return false;
+	*out= (userp_symbol) ref;
+	return true;
 }
 
 /*
@@ -485,8 +927,11 @@ error flag in the `userp_env`.
 
 */
 bool userp_dec_typeref(userp_dec dec, userp_type *out) {
-	unimplemented("userp_dec_typeref");
-	return false;
+	size_t ref;
+	if (!dec_ref(dec, USERP_NODEFLAG_TYPE, &ref))
+		return false;
+	*out= (userp_type) ref;
+	return true;
 }
 
 /*
@@ -501,6 +946,10 @@ If the current node is a floating-point record that fits in `float`, or is an in
 losslessly loadded into a `float` (unless truncate options are enabled in the environent), this
 stores the value into `*out` and returns true.  Else it returns false and sets an error flag.
 
+A record with the layout of an IEEE-754 float (such as the types from
+`userp_scope_add_float_types`) is loaded directly from its encoding, without decoding each
+field.
+
 #### userp_dec_double
 
     double d;
@@ -508,93 +957,270 @@ stores the value into `*out` and returns true.  Else it returns false and sets a
 
 Same as `userp_dec_float` but with storage into a double.
 
+An integer type with `scale` or `bias` attributes is a fixed-point number, and decodes to
+`integer * scale + bias`, rounded to the nearest `float` or `double`.
+
+#### userp_dec_double_array
+
+    double readings[1024];
+    size_t count= sizeof(readings)/sizeof(*readings);
+    bool success= userp_dec_double_array(dec, readings, &count);
+
+Decode the current node, which must be an array of integers, into a native array of `double`,
+and move to the next node.  `count` behaves the same as for `userp_dec_int_array`.  Each element
+is converted like `userp_dec_double`, applying the `scale` and `bias` of its type, but unscaled
+elements beyond 2**53 are rounded rather than rejected.  The integers are unpacked in bulk, and
+the conversion uses SIMD where available.  The elements may also be IEEE floats, in which case
+an array of byte-aligned Float64 is a single `memcpy` of the encoded data.
+
+#### userp_dec_float_array
+
+    float matrix[256*256];
+    size_t count= sizeof(matrix)/sizeof(*matrix);
+    bool success= userp_dec_float_array(dec, matrix, &count);
+
+Decode the current node, which must be an array of 32-bit IEEE floats, into a native array of
+`float`, and move to the next node.  As with `userp_dec_double_array`, aligned elements are
+copied as a block.
+
+
 */
-bool userp_dec_float(userp_dec dec, float *out) {
-	unimplemented("userp_dec_float");
+
+// Decode an IEEE float, integer, or fixed-point integer to double, requiring an unscaled integer
+// or 64-bit float to fit in 'mantissa_bits' so that the conversion is lossless.
+static bool dec_real(userp_dec dec, double *out, int mantissa_bits) {
+	const struct type_plan *plan= dec_node_plan(dec);
+	int64_t val;
+	uint64_t mag;
+	struct userp_bit_io orig= dec->in;
+	if (!plan)
+		return false;
+	if (plan->flags & PLAN_SCALED) {
+		if (!userp_plan_read_double(plan, &dec->in, out))
+			return false;
+	}
+	else if (plan->flags & PLAN_IEEE_FLOAT) {
+		if (!userp_plan_read_double(plan, &dec->in, out))
+			return false;
+		// A double only fits in a float if it has no more precision or range (NaN always fits)
+		if (mantissa_bits < 53 && plan->fixed_bits == 64 && (double)(float) *out != *out && *out == *out) {
+			userp_diag_set(&dec->env->err, USERP_ELIMIT, "64-bit float cannot be represented exactly as float");
+			goto fail_limit;
+		}
+	}
+	else {
+		if (!userp_plan_read_int(plan, &dec->in, &val))
+			return false;
+		val= (int64_t)((uint64_t) dec_delta_prev(dec, plan) + (uint64_t) val);
+		mag= val < 0? -(uint64_t)val : (uint64_t)val;
+		if (mag && (mag >> __builtin_ctzll(mag)) >> mantissa_bits) {
+			userp_diag_set(&dec->env->err, USERP_ELIMIT, "Integer cannot be represented exactly as floating point");
+			goto fail_limit;
+		}
+		*out= (double) val;
+		dec->stack[dec->stack_i].delta_prev= val;
+	}
+	dec_next_node(dec);
+	return true;
+
+	CATCH(fail_limit) {
+		// The value can still be decoded as something else
+		dec->in= orig;
+		USERP_DISPATCH_ERR(dec->env);
+	}
 	return false;
 }
+
+bool userp_dec_float(userp_dec dec, float *out) {
+	double d;
+	if (!dec_real(dec, &d, 24))
+		return false;
+	*out= (float) d;
+	return true;
+}
 bool userp_dec_double(userp_dec dec, double *out) {
-	unimplemented("userp_dec_double");
-	return false;
+	return dec_real(dec, out, 53);
 }
 
-/*
+bool userp_dec_double_array(userp_dec dec, double *out, size_t *count) {
+	const struct type_plan *plan= dec_node_plan(dec);
+	if (!plan || !userp_plan_read_double_array(dec->scope, plan, &dec->in, out, count))
+		return false;
+	dec_next_node(dec);
+	return true;
+}
+
+bool userp_dec_float_array(userp_dec dec, float *out, size_t *count) {
+	const struct type_plan *plan= dec_node_plan(dec);
+	if (!plan || !userp_plan_read_float_array(dec->scope, plan, &dec->in, out, sizeof(*out), count))
+		return false;
+	dec_next_node(dec);
+	return true;
+}
+
+/*APIDOC
 #### userp_dec_bytes
 
-  int buffer[500];
+  int32_t buffer[500];
   size_t len= sizeof(buffer);
-  int elem_size= sizeof(*buffer);
-  bool success= userp_dec_bytes(dec, buffer, &len, elem_size, flags);
+  bool success= userp_dec_bytes(dec, buffer, &len, sizeof(*buffer), 0);
+
+Copy out the bytes of the current node, as-is, and move to the next node.  This is intended
+primarily to dump out arrays of fixed-length integers (like reading char[], int[], float[] and
+so on).  This can be an error-prone operation, so you should first verify that the type of the
+current node matches your expectations.  A good way to do this is to declare a type that
+matches your array (which can be generated at compile time) and then call
+`userp_type_has_equiv_encoding` to find out if it is binary-compatible with the current node's
+type.
+
+The current node must be an array whose elements have a fixed size of whole bytes, with no
+alignment gaps between them, so that the array is a single run of bytes (see
+`userp_plan_array_slice`).  If `elem_size` is nonzero, this verifies that it matches the size of
+an element.  This is the coalescing version of `userp_dec_bytes_zerocopy`: if the array is
+split across input buffers, the pieces are joined in `out`.  `flags` is reserved, and must be 0
+(anything else fails with `USERP_EUNKNOWN`).
 
-Copy out the bytes of the current node, as-is.  This is intended primarily to dump out arrays of
-fixed-length integers (like reading char[], int[], float[] and so on).  This can be an error-prone
-operation, so you should first verify that the type of the current node matches your expectations.
-A good way to do this is to declare a type that matches your struct or array (which can be
-generated at compile time) and then call `userp_type_has_equiv_encoding` to find out if it is
-binary-compatible with the current node's type.
+On success, it returns true and the number of bytes copied into the buffer is stored into `len`.
+If the buffer is too small, or the `elem_size` was given and does not match, or the type is not
+a suitable array, this returns false and sets an error code in `userp_env`.  **On failure, if
+the error code is `USERP_ELIMIT`, this function will still update the len argument to let you
+know how many bytes were required,** and the decoder remains at the same node so that you can
+try again with a larger buffer.
 
-The flags determine which kind of copying is performed and which circumstances it is permitted for.
+#### userp_dec_bytes_zerocopy
 
-Flags:
-  - USERP_COPY_STRNUL - ensure that the array is made of bytes and does not contain NUL, and then
-    append a NUL at the end in the destination buffer.  (the copy is only performed if the buffer
-	is large enough for string + NUL byte)
-  - USERP_COPY_ARRAY - permit copying arrays
-  - USERP_COPY_STRUCT - permit copying structs
-  - USERP_COPY_STRUCT_DYN_TAIL - permit copying one struct with a variable length final field
-  - USERP_FORCE_COPY - copy the protocol bytes even if it contains dynamic protocol things that
-    don't make sense in a C struct or array.
+  const struct userp_bstr *str= userp_dec_bytes_zerocopy(dec, sizeof(int32_t), 0);
+  for (i= 0; i < str->part_count; i++)
+    consume(str->parts[i].data, str->parts[i].len);
 
-As a further safeguard, if `elem_size` is nonzero, this function will verify that the array
-element or struct size matches that.  As a special case for uses like
+This is the same as `userp_dec_bytes` but instead of copying bytes into a user-supplied buffer,
+the library provides a view of the source buffers themselves, so that the application can
+perform its own copying, or use the data directly.  Nothing is copied, no matter how large the
+array.
 
-  struct { int a, b, c, d;  int len; int array[]; }
+The returned `userp_bstr` is owned by the decoder and lives until the next call to
+`userp_dec_bytes_zerocopy` or until the decoder is freed.  Each part holds a reference to its
+`userp_buffer` (if the input buffer was reference-counted) for that long.  To keep the data
+longer, call `userp_grab_buffer` on the parts' buffers, and drop them when you are done.
 
-if the fixed-length portion of the record is immediately followed by an array field which has a
-fixed-length element count, then it will fall back to checking if the `elem_size` matches the size
-of the static record plus the size of the array length.
+If you gave the decoder a single buffer, there will be exactly one part.  If the array spans
+several input buffers, there is one part per buffer, rather than a copy.  If you need a single
+contiguous copy in that case, call `userp_dec_bytes` instead, which joins them into your buffer.
 
-On success, it returns true and the number of bytes copied into the buffer is stored into `len`.
-If the buffer is too small, or the `elem_size` was given and does not match, or the type does not
-meet the restrictions of the `flags` in effect, this returns false and sets an error code in
-`userp_env`.  **On failure, if the error code is `USERP_EBUFSIZE`, this function will stil update
-the len argument to let you know how many bytes were required.**
+On failure, this function returns NULL and sets a code in `userp_env` as usual.
 
 */
 bool userp_dec_bytes(userp_dec dec, void *out, size_t *length_inout, size_t elem_size, int flags) {
-	unimplemented("userp_dec_bytes");
-	return false;
+	const struct type_plan *plan;
+	struct userp_bit_io orig;
+	uint8_t *dst= (uint8_t*) out;
+	size_t i, len= 0;
+	if (!dec_bytes_check_flags(dec, flags) || !(plan= dec_node_plan(dec)))
+		return false;
+	orig= dec->in;
+	dec_release_slice(dec);
+	if ( !userp_plan_array_slice(dec->scope, plan, &dec->in, elem_size, &dec->slice))
+		return false;
+	for (i= 0; i < dec->slice.part_count; i++)
+		len += dec->slice.parts[i].len;
+	if (len > *length_inout) {
+		userp_diag_setf(&dec->env->err, USERP_ELIMIT,
+			"Array has " USERP_DIAG_SIZE " bytes, but buffer holds " USERP_DIAG_SIZE2, len, *length_inout);
+		*length_inout= len;
+		dec_release_slice(dec);
+		dec->in= orig;
+		USERP_DISPATCH_ERR(dec->env);
+		return false;
+	}
+	for (i= 0; i < dec->slice.part_count; i++) {
+		memcpy(dst, dec->slice.parts[i].data, dec->slice.parts[i].len);
+		dst += dec->slice.parts[i].len;
+	}
+	*length_inout= len;
+	dec_release_slice(dec);
+	dec_next_node(dec);
+	return true;
 }
 
-/*
-### userp_dec_bytes_zerocopy
+struct userp_bstr* userp_dec_bytes_zerocopy(userp_dec dec, size_t elem_size, int flags) {
+	const struct type_plan *plan;
+	if (!dec_bytes_check_flags(dec, flags))
+		return NULL;
+	plan= dec_node_plan(dec);
+	dec_release_slice(dec);
+	if (!plan || !userp_plan_array_slice(dec->scope, plan, &dec->in, elem_size, &dec->slice))
+		return NULL;
+	dec_next_node(dec);
+	return &dec->slice;
+}
 
-  size_t len= sizeof(buffer);
-  int elem_size= sizeof(*buffer);
-  userp_bstrings str= userp_dec_bytes_zerocopy(dec, size_t elem_size, int flags);
+/*APIDOC
+#### userp_dec_struct
 
-This is the same as `userp_dec_bytes` but instead of copying bytes into a user-supplied buffer,
-the library provides a temporary view of the source buffer itself so that the application can
-perform its own copying, or use the data directly.
+  struct telemetry rec;
+  bool success= userp_dec_struct(dec, &rec, sizeof(rec));
 
-If successful (under the same conditions described for `userp_dec_bytes`) this returns a reference
-to a `userp_bstrings` struct.  The struct is owned by the decoder and only guaranteed to live
-until the next call to a userp_dec function that performs decoding.  However, you may inspect the
-buffers it points to, which may have a reference count available, allowing you to hold onto them
-without needing to make a copy of the buffer data.
+Copy the current node, which must be a record of only static and always fields with fixed sizes
+(see `PLAN_RECORD_FIXED`) totalling a whole number of bytes, directly into a C struct, and move to
+the next node.  There is one bounds check for the whole record, and no field is decoded
+individually.  `sizeof_struct` must equal the size of the record (optionally including its `pad`
+bytes) as a guard against mismatched types, but you should still verify that the type of the
+current node matches the struct, such as with `userp_type_has_equiv_encoding`.
 
-In ideal circumstances, if you gave the decoder a single buffer to parse, there will only be one
-byte range of that same buffer referenced in the return value.  However it is not guaranteed
-because sometimes the library might need to make small changes to the data, and it does this by
-allocating temporary buffers to hold the edits, paired with references to the original buffers
-for any data that didn't need changed.
+#### userp_dec_struct_zerocopy
 
-On failure, this function returns NULL and sets a code in `userp_env` as usual.
+  const struct telemetry *rec= userp_dec_struct_zerocopy(dec, sizeof(*rec));
+
+Same as `userp_dec_struct`, but returns a pointer to the record within the input buffer.  The
+pointer is valid as long as the buffer.  This fails if the record is split across two buffers
+(error `USERP_EBUFPOINTER`), in which case you can fall back to `userp_dec_struct`.
+
+To walk a stream of records, `userp_dec_begin` the array (or the record containing them) and
+call `userp_dec_struct` or `userp_dec_struct_zerocopy` for each element.
+
+#### userp_dec_struct_array
+
+  struct telemetry recs[1024];
+  size_t count= sizeof(recs)/sizeof(*recs);
+  bool success= userp_dec_struct_array(dec, recs, sizeof(*recs), &count);
+
+Decode the current node, which must be an array of records suitable for `userp_dec_struct`, into
+an array of C structs, and move to the next node.  `count` behaves the same as for
+`userp_dec_int_array`.  When the elements have no alignment gaps beyond the struct size, the
+whole array is a single `memcpy` of the encoded data (unless it spans input buffers).
 
 */
-struct userp_bstr* userp_dec_bytes_zerocopy(userp_dec dec, size_t elem_size, int flags) {
-	unimplemented("userp_dec_bytes_zerocopy");
-	return NULL;
+
+bool userp_dec_struct(userp_dec dec, void *out, size_t sizeof_struct) {
+	const struct type_plan *plan= dec_node_plan(dec);
+	if (!plan || !userp_plan_copy_struct(plan, &dec->in, out, sizeof_struct))
+		return false;
+	dec_next_node(dec);
+	return true;
+}
+
+bool userp_dec_struct_array(userp_dec dec, void *out, size_t sizeof_struct, size_t *count) {
+	const struct type_plan *plan= dec_node_plan(dec);
+	struct userp_bit_io orig;
+	if (!plan)
+		return false;
+	dec_need_array(dec, plan);
+	orig= dec->in;
+	if (!userp_plan_read_struct_array(dec->scope, plan, &dec->in, out, sizeof_struct, count)) {
+		dec->in= orig;
+		return false;
+	}
+	dec_next_node(dec);
+	return true;
+}
+
+const void* userp_dec_struct_zerocopy(userp_dec dec, size_t sizeof_struct) {
+	const struct type_plan *plan= dec_node_plan(dec);
+	const uint8_t *ret;
+	if (!plan || !(ret= userp_plan_struct_zerocopy(plan, &dec->in, sizeof_struct)))
+		return NULL;
+	dec_next_node(dec);
+	return ret;
 }
 
 /* Zerocopy API
@@ -631,620 +1257,538 @@ safe to write code like
 
 */
 
-/*
-### userp_dec_input_next_buffer
+/*IMPLDOC
 
-Make the next bstr_part (having at least one byte) the current part, returning true if
-such a buffer part exists, and false otherwise.
+#### userp_decode_vqty_quick
 
-*/
+    size_t value;
+    if (!userp_decode_vqty_quick(&value, in)) ...
 
-bool userp_dec_input_next_buffer(userp_dec_input *in) {
-	assert(in != NULL);
-	assert(in->str != NULL);
-	if (in->str_part >= in->str->part_count)
-		return false;
-	for (size_t i= in->str_part + 1; i < in->str->part_count; i++) {
-		if (in->str->parts[i].len) {
-			assert(in->str->parts[i].len <= (SIZE_MAX >> 3));
-			in->str_part= i;
-			in->buf_lim= in->str->parts[i].data + in->str->parts[i].len;
-			in->bits_left= in->str->parts[i].len << 3;
-			return true;
-		}
-	}
-	return false;
-}
+Decode a variable-length unsigned quantity which must fit in a size_t, from a byte-aligned
+`userp_bit_io`.  The low bits of the first byte select the length:
 
-/*
-### userp_dec_input_skip_bits
+    .......0                      7-bit value
+    ......01 ........             14-bit value
+    .....011 ........ x3          29-bit value
+    00000111 ........ x4          32-bit value follows
+    00001111 ........ x8          64-bit value follows
 
-  if (userp_dec_input_skip_bits(input, count)) ...
-
-Skip forward by N bits, possibly iterating into new buffer parts.
-
-### userp_dec_input_skip_bytes
-
-  if (userp_dec_input_skip_bytes(input, count)) ...
-
-Like skip_bits, but aligned to whole bytes, and a count of bytes.
-Any partial "current" byte is not included in the count.
-This can skip a full size_t worth of bytes, not limited to 1/8 as a bit count.
+Any other prefix is a bigint, which fails with USERP_ELIMIT, as does a 64-bit value on a host
+with a smaller size_t.  A quantity may be split across parts of `in->str`, in which case it is
+reassembled in a temporary buffer.  Running out of input fails with USERP_EOVERRUN.  On failure
+the error is stored in the env but not dispatched, so the caller can add context.
 
 */
-
-inline static bool userp_dec_input_skip_bits(userp_dec_input *in, size_t bit_count) {
-	while (in->bits_left < bit_count) {
-		bit_count -= in->bits_left;
-		if (!userp_dec_input_next_buffer(in))
-			return false;
+bool userp_decode_vqty_quick(size_t *out, struct userp_bit_io *in) {
+	uint8_t tmp[9], *p;
+	uint64_t val;
+	size_t n, i, avail;
+
+	while (in->pos >= in->lim) {
+		if (!in->part || in->part + 1 >= in->str->parts + in->str->part_count)
+			goto fail_overrun;
+		++in->part;
+		in->pos= in->part->data;
+		in->lim= in->part->data + in->part->len;
 	}
-	in->bits_left -= bit_count;
-	return true;
-}
-
-inline static bool userp_dec_input_skip_bytes(userp_dec_input *in, size_t byte_count) {
-	while ((in->bits_left >> 3) < byte_count) {
-		byte_count -= (in->bits_left >> 3);
-		if (!userp_dec_input_next_buffer(in))
-			return false;
+	p= in->pos;
+	n= !(*p & 1)? 1 : !(*p & 2)? 2 : !(*p & 4)? 4 : *p == 0x07? 5 : *p == 0x0F? 9 : 0;
+	if (!n)
+		goto fail_limit;
+	if ((size_t)(in->lim - in->pos) >= n)
+		in->pos += n;
+	else {
+		// Quantity spans more than one part
+		for (i= 0; i < n; i += avail) {
+			while (in->pos >= in->lim) {
+				if (in->part + 1 >= in->str->parts + in->str->part_count)
+					goto fail_overrun;
+				++in->part;
+				in->pos= in->part->data;
+				in->lim= in->part->data + in->part->len;
+			}
+			avail= MIN(n - i, (size_t)(in->lim - in->pos));
+			memcpy(tmp + i, in->pos, avail);
+			in->pos += avail;
+		}
+		p= tmp;
+	}
+	switch (n) {
+	case 1: val= p[0] >> 1; break;
+	case 2: val= userp_load_le16(p) >> 2; break;
+	case 4: val= userp_load_le32(p) >> 3; break;
+	case 5: val= userp_load_le32(p+1); break;
+	default:
+		val= userp_load_le64(p+1);
+		if (val > SIZE_MAX)
+			goto fail_limit;
 	}
-	in->bits_left= ((in->bits_left >> 3) - bit_count) << 3;
+	*out= (size_t) val;
 	return true;
-}
-
-/*
-### userp_dec_input_align
-
-  if (userp_dec_input_align(input, pow2_bits)) ...
 
-Skip some number of bits or bytes to reach the next multiple of pow2_bits.
-
-*/
-
-inline static bool userp_dec_input_align(userp_dec_input *in, unsigned pow2) {
-	assert(pow2 < sizeof(size_t)*8);
-	if (pow2 <= 3) {
-		// Aligning to a byte or less, no need to seek
-		in->bits_left= (in->bits_left >> pow2) << pow2;
-		return in->bits_left? true : userp_dec_input_next_buffer(in);
+	CATCH(fail_overrun) {
+		userp_diag_set(&in->str->env->err, USERP_EOVERRUN, "Variable-length quantity exceeds end of input");
 	}
-	else {
-		size_t mask= (1<<pow2)-1;
-		size_t remainder;
-		// Alignment requests up to the alignment of the buffer itself
-		// can rely on manipulating the buffer pointers as integers.
-		// However, the time to check this probably isn't worth the savings.
-		//if (pow2 <= in->str->env->buffer_align) {
-			// can use the pointer address for the alignment
-			remainder= mask & ((((intptr_t)in->buf_lim) << 3) - in->bits_left);
-		//} else {
-			// else the alignment is greater than known by the pointer, and
-			// need to inspect the overall offset from the start of the block.
-			userp_bstr_part *part= in->str->parts + in->str_part;
-			remainder= ((part->ofs << 3) + (part->len << 3) - in->bits_left) & mask;
-		//}
-		return !remainder? true : userp_dec_input_skip_bits(mask + 1 - remainder);
+	CATCH(fail_limit) {
+		userp_diag_set(&in->str->env->err, USERP_ELIMIT, "Variable-length quantity is larger than size_t");
 	}
+	return false;
 }
 
-/*
-### userp_decode_bits
-
-  err= userp_decode_bits(decoder, input, bit_count);
-
-*/
+#include "decplan.c"
 
-userp_error_t
-userp_decode_bits(userp_node_info_private *node, userp_dec_input *in, size_t bits) {
-	assert(bits > 0);
-	//if (bits < 64) { // signed storage, so can't be a full 64
-	//	
-	//}
-	unimplemented("decode_bits");
+// Absolute bit position of the read position in the stream
+static uint64_t dec_tell_io(struct userp_bit_io *in) {
+	if (!in->part)
+		return 0;
+	return ((uint64_t)(in->part->ofs + (in->pos - in->part->data)) << 3) + in->accum_bits;
+}
+static uint64_t dec_tell(userp_dec dec) {
+	return dec_tell_io(&dec->in);
 }
 
-/*
-### userp_decode_vint
-
-  err= userp_decode_vint(&dest_node, src_input, is_signed);
-
-Decode a variable-length integer from the decoder input, and store it in the dest_node either as
-a plain integer, or as a BigInt (sign, number of "limbs", and userp_bstr of those limbs)
-
-Variable length integers are 1 byte followed either by 1-7 additional bytes, or an array of 8-byte
-"limbs" of a BigInt.  For signed integers, the BigInt notation has a dedicated sign bit, but the
-1-8 byte encodings use the low bit as the sign bit.
-
-#### Unsigned:
+// Move the read position to an absolute bit position within the parts held by the decoder
+static void dec_seek(userp_dec dec, uint64_t bitpos) {
+	struct userp_bit_io *in= &dec->in;
+	struct userp_bstr_part *part= in->part, *last= dec->input.parts + dec->input.part_count - 1;
+	size_t ofs= (size_t)(bitpos >> 3);
+	if (!part)
+		return;
+	while (part > dec->input.parts && ofs < part->ofs)
+		--part;
+	while (part < last && ofs >= part->ofs + part->len)
+		++part;
+	in->part= part;
+	in->pos= part->data + (ofs - part->ofs);
+	in->lim= part->data + part->len;
+	in->accum_bits= bitpos & 7;
+}
 
-    0b.......1              7-bit number
-    0b....XXX0 0x.... (...) 4 + X*8 bit number (little-endian)
-    0bSXXX0000              Sign + 3-bit limb count (8 bytes each). if X=0, read larger word
-    0bS0000000 0x....       Sign, 16-bit limb count. if X=0, read larger word
-    0bS0000000 0x0000 0x........  Sign, 32-bit limb count. If X=0, read larger word, etc
-    (Sign must equal zero, or error)
+// Make sure the stream is available up to an absolute bit position
+static bool dec_have(userp_dec dec, uint64_t bitpos) {
+	uint64_t pos= dec_tell(dec);
+	return bitpos <= pos || dec_need(dec, (size_t)(((bitpos + 7) >> 3) - (pos >> 3)));
+}
 
-#### Signed:
+// With a reader, make sure that a whole array of fixed-size elements is available before it gets
+// decoded in bulk.  The header is read from a copy of the input, and any error in it is left for
+// the decoding function to report.
+static void dec_need_array(userp_dec dec, const struct type_plan *plan) {
+	const struct userp_type_array *ta= (const struct userp_type_array*) plan->typeobj;
+	struct userp_bit_io peek;
+	size_t count= 1, dim, dim_count, i;
+	if (!dec->reader || plan->op != PLAN_ARRAY || !plan->elem || !(plan->elem->flags & PLAN_FIXED) || plan->dim)
+		return;
+	dec_need(dec, 64);
+	peek= dec->in;
+	if (plan->align && !plan_align(&peek, plan->align))
+		return;
+	dim_count= ta->dimension_count;
+	if (!dim_count && !plan_read_vqty(&dim_count, &peek))
+		return;
+	for (i= 0; i < dim_count; i++) {
+		dim= i < ta->dimension_count? ta->dimensions[i] : 0;
+		if ((!dim && !plan_read_vqty(&dim, &peek)) || SIZET_MUL_CAN_OVERFLOW(count, dim))
+			return;
+		count *= dim;
+	}
+	if (SIZET_MUL_CAN_OVERFLOW(plan->elem_stride, count))
+		return;
+	dec_need(dec, (size_t)(dec_tell_io(&peek) - dec_tell(dec) + plan->elem_stride * count
+		+ ((size_t)1 << plan->elem->align) + 7) / 8 + plan->pad);
+}
 
-    0b......S1              6-bit number, Sign
-    0b...SXXX0 0x.... (...) 3 + X*8 bit number, Sign
-	(bigint encodings remain the same)
+static bool dec_begin_array(userp_dec dec, frame f) {
+	const struct type_plan *elem;
+	size_t count;
+	if (!plan_array_begin(dec->scope, f->plan, &dec->in, &elem, &count))
+		return false;
+	f->frame_type= FRAME_TYPE_ARRAY;
+	f->start= dec_tell(dec);
+	f->elem_lim= count;
+	// The element plan stays in node_plan, even past the last element, for dec_array_seek
+	f->node_plan= elem;
+	f->node_type= count? elem->type : 0;
+	return true;
+}
 
-*/
+// Number of leading fields[] which are found by their offset: the static fields, or every field
+// of a fixed-size record
+static size_t dec_record_n_pos(const struct type_plan *plan) {
+	return plan->op == PLAN_RECORD_FIXED? plan->member_count
+		: plan->member_count - plan->seldom_count - plan->often_count - plan->always_count;
+}
 
-userp_error_t
-userp_decode_vint(userp_node_info_private *node, userp_dec_input *in, bool is_signed) {
-	// switch to bytes for the moment
-	size_t bytes_left= in->bits_left >> 3;
-	uint64_t val;
-	if (!bytes_left) {
-		if (!dec_input_next_buffer(in))
-			return USERP_EOVERRUN;
-		bytes_left= in->bits_left >> 3;
-	}
-	val= buf_lim[-bytes_left--];
-	if (val & 0xF) {
-		if (val & 1) {
-			node->pub.intval= val >> 1;
-		} else {
-			int n= (val & 0x0E) >> 1;
-			int shift= 0;
-			val >>= 4;
-			while (n--) {
-				if (!bytes_left) {
-					if (!dec_input_next_buffer(in))
-						return USERP_EOVERRUN;
-					bytes_left= in->bits_left >> 3;
-				}
-				val |= ((uint64_t) buf_lim[-bytes_left--]) << shift;
-				shift += 8;
-			}
-			node->pub.intval= val;
-		}
-		if (is_signed)
-			node->pub.intval= (node->pub.intval & 1)? -(node->pub.intval >> 1) : (node->pub.intval >> 1);
-		node->pub.flags= USERP_NODEFLAG_INT;
+// Make the first field present at or after field_i (or after extra_i, for the fields listed in
+// the header) the current node, or mark the end of the record.  The input is already at that
+// field, except for the fields found by their offset.
+static void dec_record_field(userp_dec dec, frame f) {
+	const struct type_plan *plan= f->plan;
+	size_t first_often= plan->member_count - plan->seldom_count - plan->often_count,
+		first_seldom= first_often + plan->often_count, ref;
+	const struct plan_field *pf;
+	struct userp_bit_io in;
+	if (f->field_i < dec_record_n_pos(plan)) {
+		pf= &plan->fields[f->field_i];
+		dec_seek(dec, f->start + pf->ofs);
 	}
 	else {
-		int sign= val >> 7;
-		size_t limbs= (val >> 4) & 0x7;
-		for (int n= 16; !limbs && n <= sizeof(size_t)*8; n <<= 1) {
-			for (int shift= 0; shift < n: shift+= 8) {
-				if (!bytes_left) {
-					if (!dec_input_next_buffer(in))
-						return USERP_EOVERRUN;
-					bytes_left= in->bits_left >> 3;
-				}
-				limbs |= ((uint16_t) buf_lim[-bytes_left--]) << shift;
+		while (f->field_i >= first_often && f->field_i < first_seldom
+			&& !((f->presence >> (f->field_i - first_often)) & 1))
+			f->field_i++;
+		if (f->field_i < first_seldom)
+			pf= &plan->fields[f->field_i];
+		else if (f->extra_i < f->extra_count) {
+			// userp_dec_begin already validated the references
+			in= dec->in;
+			dec_seek(dec, f->refs);
+			plan_read_vqty(&ref, &dec->in);
+			f->refs= dec_tell(dec);
+			dec->in= in;
+			if (ref < plan->seldom_count)
+				pf= &plan->fields[first_seldom + ref];
+			else {
+				f->node_plan= plan->other;
+				f->node_type= plan->other->type;
+				f->field_name= (userp_symbol)(ref - plan->seldom_count);
+				return;
 			}
 		}
-		if (!limbs || limbs > (SIZE_MAX >> 3))
-			return USERP_EOVERFLOW;
-		size_t cur_part= in->str_part;
-		size_t byte_ofs= in->str.parts[in->str_part].len - bytes_left;
-		if (!dec_input_skip(in, limbs << 3))
-			return USERP_EOVERRUN;
-		userp_bstr_set_substr(&node->pub.data, in->str, cur_part, byte_ofs, limbs << 3);
-		node->pub.flags= USERP_NODEFLAG_BIGINT;
+		else {
+			f->node_plan= NULL;
+			f->node_type= 0;
+			f->field_name= 0;
+			return;
+		}
 	}
-	in->bits_left= bytes_left << 3;
-	return 0;
+	f->node_plan= pf->plan;
+	f->node_type= pf->plan->type;
+	f->field_name= pf->name;
 }
 
-/*
-### userp_decode_vsize
-
-  err= userp_decode_vsize(&size, src_input);
-
-Decode a variable-length unsigned integer no larger than a size_t.  If the integer is larger, this
-returns USERP_EOVERFLOW.  This is just like decode_vint but is always unsigned and only succeeds
-if the value fits in a size_t.
+static bool dec_begin_record(userp_dec dec, frame f) {
+	const struct type_plan *plan= f->plan;
+	struct userp_bit_io *in= &dec->in;
+	size_t ref, i;
+	// The header lists which often fields are present, and the seldom or ad-hoc fields
+	if (plan->op == PLAN_RECORD && (plan->often_count || plan->seldom_count || plan->other)) {
+		if (!plan_read_vqty(&f->presence, in))
+			goto fail_header;
+		if (plan->often_count < sizeof(size_t)*8) {
+			f->extra_count= f->presence >> plan->often_count;
+			f->presence &= ((size_t)1 << plan->often_count) - 1;
+		}
+		f->refs= f->refs_start= dec_tell(dec);
+		for (i= 0; i < f->extra_count; i++) {
+			if (!plan_read_vqty(&ref, in))
+				goto fail_header;
+			if (ref >= plan->seldom_count && !plan->other) {
+				userp_diag_setf(&dec->env->err, USERP_ERECORD,
+					"Record has no field " USERP_DIAG_INDEX, (int) ref);
+				goto fail_header;
+			}
+		}
+	}
+	if (plan->align && !plan_align(in, plan->align))
+		return plan_overrun(in);
+	// One check that the static area (or the whole fixed-size record) is available
+	f->start= dec_tell(dec);
+	if (!plan_skip_bits(in, plan->op == PLAN_RECORD_FIXED? plan->fixed_bits : plan->static_bits))
+		return plan_overrun(in);
+	f->resume= dec_tell(dec);
+	f->frame_type= FRAME_TYPE_RECORD;
+	f->elem_lim= plan->member_count - plan->seldom_count - plan->often_count
+		+ __builtin_popcountll(f->presence) + f->extra_count;
+	dec_record_field(dec, f);
+	return true;
+	CATCH(fail_header) {
+		USERP_DISPATCH_ERR(dec->env);
+	}
+	return false;
+}
 
-*/
+static void dec_record_next(userp_dec dec, frame f) {
+	size_t n_pos= dec_record_n_pos(f->plan);
+	f->elem_i++;
+	if (f->field_i < n_pos) {
+		// After the static area, the fields follow one another
+		if (++f->field_i == n_pos)
+			dec_seek(dec, f->resume);
+	}
+	else if (f->field_i < f->plan->member_count - f->plan->seldom_count)
+		f->field_i++;
+	else
+		f->extra_i++;
+	dec_record_field(dec, f);
+}
 
-userp_error_t
-userp_decode_vsize(size_t *out, userp_dec_input *in) {
-	// Optimize the common case of sizes 12 bits or less.
-	if (in->bits_left >= 23) {
-		size_t bytes_left= in->bits_left >> 3;
-		uin8_t *p= in->buf_lim - bytes_left;
-		if (*p & 1) {
-			*out= *p >> 1;
-			in->bits_left= (bytes_left-1) << 3;
+// Move a record frame to the node 'elem_idx', or if 'name' is nonzero, to the field of that name.
+// If there is no such node, the frame is left at the end of the record.  Returns false on a
+// decoding error.
+static bool dec_record_seek(userp_dec dec, frame f, size_t elem_idx, userp_symbol name) {
+	const struct type_plan *plan= f->plan;
+	size_t n_pos= dec_record_n_pos(plan), first_often= plan->member_count - plan->seldom_count - plan->often_count,
+		i= elem_idx;
+	if (name) {
+		for (i= 0; i < plan->member_count && plan->fields[i].name != name; i++);
+		if (f->node_type && f->field_name == name)
 			return true;
-		} else if ((sel & 0xF) == 1) {
-			*out= userp_load_le16(p) >> 4;
-			in->bits_left= (bytes_left-2) << 3;
+		// An often field which is absent doesn't need to be searched for
+		if (i >= first_often && i < first_often + plan->often_count
+			&& !((f->presence >> (i - first_often)) & 1)) {
+			f->node_type= 0;
 			return true;
 		}
 	}
-	node_info node;
-	userp_error_t err= userp_decode_vint(&node, in);
-	if (!err && node->pub.flags == USERP_NODEFLAG_INT && node->pub.intval <= SIZE_MAX) {
-		*out= node->pub.intval;
+	if (i < n_pos) {
+		f->field_i= f->elem_i= i;
+		dec_record_field(dec, f);
 		return true;
 	}
-	return false;
-}
-
-// Decode an unsigned variable-length size_t
-// This macro uses 'goto' for errors, which the caller must handle.
-// Caller must also have an 'err' variable.
-#define DECODE_SIZE(dest) \
-    do { \
-		if (in->bits_left >= 8 && (in->buf_lim[-(in->bits_left >> 3)] & 1)) { \
-			(dest)= in->buf_lim[-(in->bits_left >> 3)] >> 1; \
-		else { \
-			size_t tmp; \
-			if ((err= userp_decode_vsize(&tmp, in))) \
-				goto fail_decode_size; \
-			(dest)= tmp; \
-		} \
-	} while (0)
-
-// Decode an unsigned variable-length integer (must fit in size_t)
-// Then resolve relative type reference, if relative
-// This macro uses 'goto' for errors, which the caller must handle.
-// Caller must also have an 'err' variable.
-#define DECODE_TYPEREF(dest) \
-    do { \
-		size_t tmp; \
-		DECODE_SIZE(tmp); \
-		if (!(tmp & 1) && (tmp >> 1) <= scope->type_count) \
-			(dest)= tmp >> 1; \
-		else if (!((dest)= userp_scope_resolve_relative_typeref(scope, tmp))) \
-			goto fail_typeref; \
-	} while (0)
-
-// Decode an unsigned variable-length integer (must fit in size_t)
-// Then resolve relative symbol reference, if relative
-// This macro uses 'goto' for errors, which the caller must handle.
-// Caller must also have an 'err' variable.
-#define DECODE_SYMREF(dest) \
-    do { \
-		size_t tmp; \
-		DECODE_SIZE(tmp); \
-		if (!(tmp & 1) && (tmp >> 1) <= scope->symbol_count) \
-			(dest)= tmp >> 1; \
-		else if (!((dest)= userp_scope_resolve_relative_symref(scope, tmp))) \
-			goto fail_symref; \
-	} while (0)
-
-// Decode the next N bits into an unsigned int64, where 0 < N <= 64
-// Returns false if and only if it would overrun the buffer.
-bool userp_decode_bits(uint64_t *out, size_t bits, struct userp_bit_io *in) {
-	uint64_t val;
-	assert(bits > 0 && bits <= 64);
-	// There might be 0-7 leftover bits from the previous byte, so reading more
-	// than 57 bits has the potential to need to touch 9 bytes.  Below that requires
-	// at most 8 bytes, and if the buffer is large enough, can be done in a single read.
-	int remainder= in->bits_left & 7;
-	if (bits <= 57 && in->bits_left >= 57) {
-		val= !remainder? userp_load_le64(in->buf_lim - (in->bits_left >> 3))
-			: userp_load_le64(in->buf_lim - (in->bits_left >> 3) - 1) >> (8 - remainder);
-		in->bits_left -= bits;
+	// The other fields can only be reached by skipping the ones before them
+	if (f->field_i < n_pos || (name? !(i < first_often + plan->often_count && f->field_i <= i)
+		: elem_idx < f->elem_i)) {
+		dec_seek(dec, f->resume);
+		f->field_i= f->elem_i= n_pos;
+		f->extra_i= 0;
+		f->refs= f->refs_start;
+		dec_record_field(dec, f);
 	}
-	else {
-		// else just iteratively read bytes into the accumulator
-		int shift= 0;
-		if (remainder) {
-			val= in->buf_end[-(in->bits_left>>3) - 1] >> (8 - remainder);
-			shift= remainder;
-			in->bits_left -= remainder;
-		} else {
-			val= 0;
-		}
-		// loop starts on whole-byte boundary, and bits_left will be a multiple of 8
-		while (shift < bits) {
-			if (!in->bits_left)
-				if (!userp_dec_input_next_buffer(in))
-					return false;
-			val |= (uint64_t)in->buf_end[-in->bits_left>>3] << shift;
-			in->bits_left -= 8;
-			shift += 8;
-		}
+	while (f->node_type && (name? f->field_name != name : f->elem_i < elem_idx)) {
+		if (!userp_plan_skip(dec->scope, f->node_plan, &dec->in))
+			return false;
+		dec_record_next(dec, f);
 	}
-	if (bits < 64)
-		val= val << (64 - bits) >> (64 - bits); // clear out upper bits
-	*out= val;
 	return true;
 }
 
-// Decode the next N bits as twos-complement, where 0 < N <= 64
-// Returns false if and only if it would overrun the buffer.
-bool userp_decode_bits_twos(int64_t *out, size_t bits, struct userp_bit_io *in) {
-	int64_t val;
-	assert(bits > 0 && bits <= 64);
-	// There might be 0-7 leftover bits from the previous byte, so reading more
-	// than 57 bits has the potential to need to touch 9 bytes.  Below that requires
-	// at most 8 bytes, and if the buffer is large enough, can be done in a single read.
-	int remainder= in->bits_left & 7;
-	if (bits <= 57 && in->bits_left >= 57) {
-		val= !remainder? userp_load_le64(in->buf_lim - (in->bits_left >> 3))
-			: userp_load_le64(in->buf_lim - (in->bits_left >> 3) - 1) >> (8 - remainder);
-		in->bits_left -= bits;
+// Move an array frame to element 'elem_idx', or to the end of the array if it equals elem_lim
+static bool dec_array_seek(userp_dec dec, frame f, size_t elem_idx) {
+	const struct type_plan *elem= f->node_plan;
+	size_t size, stride, mask;
+	uint64_t pos;
+	if (elem_idx == f->elem_i)
+		return true;
+	// Delta elements must all be read to know the value of the next, unless leaving the array
+	if ((elem->flags & PLAN_FIXED) && (!(elem->flags & PLAN_DELTA) || elem_idx == f->elem_lim)) {
+		// Every element has the same size, so go straight to it
+		pos= f->start;
+		if (elem->align) {
+			mask= ((size_t)1 << (elem->align < 3? 3 : elem->align)) - 1;
+			pos= (pos + mask) & ~(uint64_t) mask;
+		}
+		size= elem->fixed_bits + elem->pad * 8;
+		stride= elem == f->plan->elem? f->plan->elem_stride : !elem->align? size
+			: (size + ((size_t)1 << elem->align) - 1) & ~(((size_t)1 << elem->align) - 1);
+		pos += elem_idx < f->elem_lim? (uint64_t) stride * elem_idx : (uint64_t) stride * (elem_idx - 1) + size;
+		if (!dec_have(dec, pos + (elem_idx < f->elem_lim? size : 0)))
+			return plan_overrun(&dec->in);
+		dec_seek(dec, pos);
+		f->elem_i= elem_idx;
 	}
 	else {
-		// else just iteratively read bytes into the accumulator
-		int shift= 0;
-		if (remainder) {
-			val= in->buf_end[-(in->bits_left>>3) - 1] >> (8 - remainder);
-			shift= remainder;
-			in->bits_left -= remainder;
-		} else {
-			val= 0;
-		}
-		// loop starts on whole-byte boundary, and bits_left will be a multiple of 8
-		while (shift < bits) {
-			if (!in->bits_left)
-				if (!userp_dec_input_next_buffer(in))
-					return false;
-			val |= (uint64_t)in->buf_end[-in->bits_left>>3] << shift;
-			in->bits_left -= 8;
-			shift += 8;
+		if (elem_idx < f->elem_i) {
+			dec_seek(dec, f->start);
+			f->elem_i= 0;
+			f->delta_prev= 0;
 		}
+		for (; f->elem_i < elem_idx; f->elem_i++)
+			if (!((elem->flags & PLAN_DELTA) && elem_idx < f->elem_lim
+				? userp_plan_read_int_next(elem, &dec->in, &f->delta_prev)
+				: userp_plan_skip(dec->scope, elem, &dec->in)))
+				return false;
 	}
-	if (bits < 64)
-		val= val << (64 - bits) >> (64 - bits); // clear out upper bits and sign extend
-	*out= val;
+	f->node_type= elem_idx < f->elem_lim? elem->type : 0;
 	return true;
 }
 
-bool userp_dec_init_node(userp_dec dec, userp_node_info_private *node, userp_dec_input *in) {
-	userp_error_t err;
-	size_t sz;
-	struct type_entry *type_entry;
-	node->pub.value_type= node->pub.node_type;
-	top:
-	type_entry= userp_scope_get_type_entry(dec->scope, node->pub.value_type);
-	assert(type_entry != NULL);
-	switch (type_entry->typeclass) {
-	case TYPE_CLASS_ANY:
-	case TYPE_CLASS_TYPEREF:
-		{
-			userp_type t;
-			DECODE_TYPEREF(t); // failures goto error cases below
-			// If type=ANY, use the typeref to continue reading the value
-			if (type_entry->typeclass == TYPE_CLASS_ANY) {
-				node->pub.value_type= t;
-				if (t) goto top;
-				else goto fail_null_type;
-			}
-			// else if type=TYPEREF, give the type ref back to the user
-			else {
-				node->as_typeref= t;
-				node->pub.flags= USERP_NODE_IS_TYPEREF;
-				return true;
-			}
-		}
-	case TYPE_CLASS_SYMREF:
-		{
-			userp_symbol s;
-			DECODE_SYMREF(s); // failures goto error cases below
-			node->as_symref= s;
-			node->pub.flags= USERP_NODE_IS_SYMBOL;
-			return true;
-		}
-	case TYPE_CLASS_INT_POW2ALIGN_U8:
-		{
-			size_t bytes_left= in->bits_left >> 3;
-			if (bytes_left) {
-				node->pub.intval= in->buf_lim[-bytes_left];
-				in->bits_left= (bytes_left - 1) << 3;
-				node->pub.flags= USERP_NODE_IS_ALIGNED_INT;
-				return true;
-			}
-		}
-		// fall through to the generic fixed-width integer implementation
-		if (0) {
-	case TYPE_CLASS_INT_POW2ALIGN:
-			// The type class is not set to "INT_POW2_ALIGNED" unless the buffer alignment
-			// requirement is at least as large as this integer type.  So, can use the
-			// buffer pointer directly to determine alignment.
-			intptr_t size= type_entry->as_int->size;
-			intptr_t pos= (intptr_t)in->buf_lim - (in->bits_left >> 3);
-			pos= (pos + size - 1) & ~(size-1);
-			// Are there enough bytes left in the buffer?
-			if (pos + size <= (intptr_t) in->buf_lim) {
-				node->pub.data_start= (uint8_t*) pos;
-				in->bits_left= ((intptr_t)in->buf_lim - pos - size) << 3;
-				node->pub.flags= USERP_NODE_IS_ALIGNED_INT;
-				return true;
-			}
-			// else not enough bytes, but could be collected from the next buffer(s) if any.
-		}
-		// fall through to the generic fixed-width integer implementation
-	case TYPE_CLASS_INT:
-		{
-			// Unsigned can read 63 bits, and signed can read 64 bits.
-			// Beyond that needs BigInts.
-			if (type_entry->as_int->twos && type_entry->as_int->bits <= 64) {
-				if (type_entry->as_int->align)
-	case TYPE_CLASS_INT_ALIGNED_TWOS_AS_INT64:
-					userp_dec_input_align(in, type_entry->as_int->align);
-	case TYPE_CLASS_INT_TWOS_AS_INT64:
-				if (!userp_decode_bits_twos(&node->pub.intval, type_entry->as_int->bits, in))
-					goto fail_overrun;
-			} else if (!type_entry->as_int->twos && type_entry->as_int->bits < 64) {
-				if (type_entry->as_int->align)
-	case TYPE_CLASS_INT_ALIGNED_BITS_AS_INT64:
-					userp_dec_input_align(in, type_entry->as_int->align);
-	case TYPE_CLASS_INT_BITS_AS_INT64:
-				uint64_t dest;
-				if (!userp_decode_bits(&dest, type_entry->as_int->bits, in))
-					goto fail_overrun;
-				node->pub.intval= dest;
-			} else {
-				// needs returned as a BigInt
-				unimplemented("Decode BigInt bits");
-			}
-			return true;
-		}
-		// variable-width integers
-	case TYPE_CLASS_VINT:
-		{
-			err= userp_decode_vint(node, in, false);
-			if (0)
-	case TYPE_CLASS_VINT_SIGNED:
-				err= userp_decode_vint(node, in, true);
-			if (err) goto fail_decode_vint;
-			// TODO: apply transform, like scale and bias
-			...
-			return true;
-		}
-	}
-	
-	CATCH(fail_decode_size) {
-		...
-	}
-	CATCH(fail_decode_typeref) {
-		...
-	}
-	CATCH(fail_decode_symref) {
-		...
-	}
+// Move past the remaining elements or fields of a frame, and the pad of its array or record
+static bool dec_frame_finish(userp_dec dec, frame f) {
+	if (!(f->frame_type == FRAME_TYPE_ARRAY? dec_array_seek(dec, f, f->elem_lim)
+		: dec_record_seek(dec, f, f->elem_lim, 0)))
+		return false;
+	if (f->plan->pad && !plan_skip_bits(&dec->in, f->plan->pad << 3))
+		return plan_overrun(&dec->in);
+	return true;
 }
 
-struct record_context {
-	userp_type type;
-	struct userp_type_record *rec;
-	struct field_detail *field_detail;
-	size_t field_detail_alloc;
-};
-
-/* userp_dec_rec_begin
- *
- * Read the intro bytes of the record, and allocate the list of 'extra' fields.
- */
-static bool userp_dec_rec_begin(
-	userp_dec dec,
-	struct record_context *ctx,
-	userp_type rectype
-) {
-	// Can't continue until all extra_bytes are available
-	// If extra_bytes == -1, need to read the count of bytes first
-	...
-	// Assume each byte could become a field ID.  Decode all the vints in the buffer.
-	alloca(...);
-	// Numbers less than the extra field count reference a field, and numbers greater
-	// represent an ad-hoc field, which is a pair of a symbol ID and a type ID.
-	...
-	// Allocate and store the field list, while verifying the fields.  (maybe checking for dups)
-	...
-	// finish initializing the record_context
-}
-
-/* userp_dec_rec_seek_field
- *
- * Locate the beginning of the field, and (only if those bytes are available to be read) set the
- * decoder state to begin decoding that field.
- */
-static bool userp_dec_rec_seek_field(
-	userp_dec dec,
-	size_t field_idx
-) {
-	// Fail unless field_idx is in bounds
-	...
-	// Does this field have a presence conditional?
-		// read the conditional, if not already loaded
-		// fail unless present
-	// Does the first byte of the field exist in the buffer yet?
-		// If the field is not static placement, seek across the previous fields to locate
-		// the first byte
-		...
-	// finish initializing the decoder to read the field 
+// Decode the current node as an integer, without moving to the next node.  Values of an unsigned
+// type above INT64_MAX are stored as uint64_t, and flagged with is_big.  The caller either checks
+// the range and calls dec_next_int, or restores 'orig' with dec_int_limit.
+static bool dec_int(userp_dec dec, struct userp_bit_io *orig, int64_t *out, bool *is_big) {
+	const struct type_plan *plan= dec_node_plan(dec);
+	if (!plan)
+		return false;
+	*orig= dec->in;
+	if (!userp_plan_read_int(plan, &dec->in, out)) {
+		dec->in= *orig;
+		return false;
+	}
+	*is_big= *out < 0 && (plan->op == PLAN_INT_BITS || plan->op == PLAN_INT_VQTY)
+		&& plan->base >= 0 && !(plan->flags & (PLAN_DESCENDING|PLAN_DELTA|PLAN_DELTA_ZIGZAG));
+	*out= (int64_t)((uint64_t) dec_delta_prev(dec, plan) + (uint64_t) *out);
+	return true;
 }
 
+// The running value that the current node is a difference from, if it is an element of a delta
+// integer type in the array being iterated, else 0
+static int64_t dec_delta_prev(userp_dec dec, const struct type_plan *plan) {
+	frame f= &dec->stack[dec->stack_i];
+	return (plan->flags & PLAN_DELTA) && f->frame_type == FRAME_TYPE_ARRAY && plan == f->node_plan
+		? f->delta_prev : 0;
+}
 
+// Move to the next node after decoding an integer, which the next delta element is relative to
+static void dec_next_int(userp_dec dec, int64_t val) {
+	dec->stack[dec->stack_i].delta_prev= val;
+	dec_next_node(dec);
+}
 
-/*
-On a constrained memory system, the decoder doesn't want to have to track too many details.
-For a record, ideally this could be as small as a pointer to the type and idx of the current field
-and the total count of possible fields.  It would iterate through the "always" fields like normal,
-
-*/
+static bool dec_int_limit(userp_dec dec, struct userp_bit_io *orig, size_t bytes, bool negative) {
+	dec->in= *orig;
+	if (negative)
+		userp_diag_set(&dec->env->err, USERP_ELIMIT, "Negative integer can't be stored as unsigned");
+	else
+		userp_diag_setf(&dec->env->err, USERP_ELIMIT,
+			"Integer does not fit in " USERP_DIAG_SIZE " bytes", bytes);
+	USERP_DISPATCH_ERR(dec->env);
+	return false;
+}
 
-static bool userp_dec_rec_begin(userp_dec dec, struct record_context *ctx, userp_type rectype) {
-	struct type_entry *type_entry= userp_scope_get_type_entry(dec->scope, rectype);
-	assert(type_entry && type_entry->typeclass == TYPE_CLASS_RECORD);
-	ctx->type= rectype;
-	ctx->rec= (struct userp_type_record*) type_entry->typeobj;
-
-	// If there are any dynamic fields (Often or Seldom placement or `other_field_type`) the
-    // record begins with a selector to indicate which Often fields and how many Seldom fields.
-	if (ctx->rec->often_field_count || ctx->rec->seldom_field_count || ctx->rev->other_field_type) {
-		// If a selector is supplied, it is both the often-presence flags (lower bits)
-		// and the other_field_count (upper bits)
-		if (dec->in->has_selector) {
-			ctx->often_field_presence= dec->in->selector;
-			ctx->extra_field_count= (ctx->rec->often_field_count < sizeof(dec->in->selector)*8)
-				? dec->in->selector >> ctx->rec->often_field_count
-				: 0;
-			dec->in->has_selector= false;
-		}
-		// Else the often-presence bits are the next N bits from here,
-		// and the other_field_count (if any) is encoded after that.
-		else {
-			if (ctx->rec->often_field_count) {
-				if (ctx->rec->often_field_count <= sizeof(ctx->often_field_presence)*8) {
-					if (!(ctx->often_field_presence= userp_decode_bits(dec->in, ctx->rec->often_field_count))
-						&& dec->in->failed)
-						goto fail_presence_bits;
-				}
-				else {
-					ctx->often_field_presence_vec= userp_dec_get_contiguous_bits(dec->in,
-						&ctx->often_field_presence_shift);
-				}
-			}
-			if (ctx->rec->other_field_type) {
-				if (!(ctx->extra_field_count= userp_decode_vqty(dec->in))
-					&& dec->in->failed)
-					goto fail_field_count;
-			}
-			else if (ctx->rec->seldom_field_count) {
-				if (!(ctx->extra_field_count= userp_decode_bits(dec->in, log2_sizet(ctx->rec->seldom_field_count)))
-					&& dec->in->failed)
-					goto fail_field_count;
-			}
+// Decode the current node as a symbol or type reference (flag USERP_NODEFLAG_SYM or _TYPE),
+// which must be valid in the scope, and move to the next node
+static bool dec_ref(userp_dec dec, uint32_t flag, size_t *out) {
+	struct userp_node_info_private node;
+	struct userp_bit_io orig;
+	if (!dec_node_plan(dec))
+		return false;
+	orig= dec->in;
+	node.pub.node_type= dec->stack[dec->stack_i].node_type;
+	if (!userp_dec_init_node(dec, &node, &dec->in))
+		goto fail;
+	if (!(node.pub.flags & flag)) {
+		userp_diag_setf(&dec->env->err, USERP_ETYPE, flag == USERP_NODEFLAG_SYM
+			? "Type " USERP_DIAG_INDEX " is not a symbol" : "Type " USERP_DIAG_INDEX " is not a type reference",
+			(int) node.pub.value_type);
+		goto fail_dispatch;
+	}
+	if (flag == USERP_NODEFLAG_SYM) {
+		if (!node.as_symref || !userp_scope_get_symbol_str(dec->scope, node.as_symref)) {
+			userp_diag_setf(&dec->env->err, USERP_ESYMBOL,
+				"Symbol " USERP_DIAG_INDEX " is not part of the scope", (int) node.as_symref);
+			goto fail_dispatch;
 		}
-		// If the extra_field_count is nonzero, read that many field indicators.
-		// Field indicators are vqty if there are arbitrary "other" fields.
-		if (ctx->extra_field_count) {
-			size_n n= ctx->extra_field_count;
-			if (!USERP_ALLOC_ARRAY(dec->env, &ctx->extra_fields, n))
-				goto fail_alloc;
-			if (ctx->rec->other_field_type) {
-				if (userp_decode_vqty_sizevec(dec->in, ctx->extra_fields, n) < n)
-					goto fail_field_list;
-			}
-			else {
-				if (userp_decode_bits_sizevec(dec->in, ctx->extra_fields, n, log2_sizet(n), 0) < n)
-					goto fail_field_list;
-			}
-			for (i= 0; i < n; i++)
-				if (!userp_scope_verify_extra_field_ref(dec->scope, ctx->extra_fields[i]))
-					goto fail_field_list;
+		*out= node.as_symref;
+	}
+	else {
+		if (!userp_scope_contains_type(dec->scope, node.as_typeref)) {
+			userp_diag_setf(&dec->env->err, USERP_ETYPESCOPE,
+				"Type " USERP_DIAG_INDEX " is not part of the scope", (int) node.as_typeref);
+			goto fail_dispatch;
 		}
+		*out= node.as_typeref;
 	}
-	// Apply record alignment
-	if (ctx->rec->align)
-		if (!userp_decode_align(ctx->rec->align))
-			goto fail_align;
-	// Record the location of the start of the record's data
-	ctx->data_start.bitpos= dec->in->bitpos;
-	ctx->data_start.part= dec->in->part;
-	// For each "Conditional" field with placement outside of the official static area,
-	// check its condition and enlarge the static area if needed.
-	...
-	// Record is fully initialized here.
-	// The total number of present fields has not been determined, but that can be lazily
-	// calculated if needed.
+	dec_next_node(dec);
 	return true;
+	CATCH(fail_dispatch) {
+		USERP_DISPATCH_ERR(dec->env);
+		dec->in= orig;
+	}
+	CATCH(fail) {
+		dec->in= orig;
+	}
+	return false;
 }
 
-bool userp_dec_rec_seek_field(userp_dec dec, size_t field_id) {
-	unimplemented("seek field");
+bool userp_dec_init_node(userp_dec dec, struct userp_node_info_private *node, struct userp_bit_io *in) {
+	const struct type_plan *plan, *elem;
+	size_t ref, presence= 0, extra_count= 0;
+	node->pub.value_type= node->pub.node_type;
+	top:
+	// The plan holds everything about the encoding, so this never looks at the type object
+	plan= userp_scope_get_type_plan(dec->scope, node->pub.value_type);
+	if (!plan)
+		return false;
+	switch (plan->op) {
+	case PLAN_ANY:
+		if (plan->align && !plan_align(in, plan->align))
+			goto fail_overrun;
+		if (!plan_read_vqty(&ref, in))
+			goto fail_vqty;
+		// Use the typeref to continue reading the value
+		if (!ref)
+			goto fail_null_type;
+		node->pub.value_type= ref;
+		goto top;
+	case PLAN_TYPEREF:
+	case PLAN_SYMREF:
+		if (plan->align && !plan_align(in, plan->align))
+			goto fail_overrun;
+		if (!plan_read_vqty(&ref, in))
+			goto fail_vqty;
+		if (plan->pad && !plan_skip_bits(in, plan->pad << 3))
+			goto fail_overrun;
+		if (plan->op == PLAN_TYPEREF) {
+			node->as_typeref= ref;
+			node->pub.flags= USERP_NODEFLAG_TYPE;
+		} else {
+			node->as_symref= ref;
+			node->pub.flags= USERP_NODEFLAG_SYM;
+		}
+		return true;
+	case PLAN_INT_TWOS:
+	case PLAN_INT_BITS:
+	case PLAN_INT_VQTY:
+	case PLAN_INT_VQTY_SIGNED:
+		// Integers wider than 64 bits fail with USERP_ELIMIT until BigInt nodes exist
+		if (!userp_plan_read_int(plan, in, &node->pub.intval))
+			return false;
+		node->pub.intval= (int64_t)((uint64_t) dec_delta_prev(dec, plan) + (uint64_t) node->pub.intval);
+		node->pub.flags= USERP_NODEFLAG_INT;
+		return true;
+	case PLAN_ARRAY:
+		if (!plan_array_begin(dec->scope, plan, in, &elem, &node->pub.elem_count))
+			return false;
+		node->pub.flags= USERP_NODEFLAG_ARRAY;
+		return true;
+	case PLAN_RECORD_FIXED:
+	case PLAN_RECORD:
+		// The number of fields present is given by the header
+		if (plan->op == PLAN_RECORD && (plan->often_count || plan->seldom_count || plan->other)) {
+			if (!plan_read_vqty(&presence, in))
+				goto fail_vqty;
+			if (plan->often_count < sizeof(size_t)*8)
+				extra_count= presence >> plan->often_count;
+			presence &= plan->often_count < sizeof(size_t)*8? ((size_t)1 << plan->often_count) - 1 : ~(size_t)0;
+		}
+		node->pub.elem_count= plan->member_count - plan->seldom_count - plan->often_count
+			+ __builtin_popcountll(presence) + extra_count;
+		node->pub.flags= USERP_NODEFLAG_RECORD;
+		return true;
+	case PLAN_CHOICE:
+		userp_diag_setf(&dec->env->err, USERP_ETYPE,
+			"Type " USERP_DIAG_INDEX " is a choice, which can't be decoded as a node yet",
+			(int) plan->type);
+		USERP_DISPATCH_ERR(dec->env);
+		return false;
+	default:
+		userp_diag_setf(&dec->env->err, USERP_ETYPE,
+			"Type " USERP_DIAG_INDEX " has no definition", (int) plan->type);
+		USERP_DISPATCH_ERR(dec->env);
+		return false;
+	}
+	
+	CATCH(fail_overrun) {
+		userp_diag_set(&dec->env->err, USERP_EOVERRUN, "Data ends before the end of the value");
+		USERP_DISPATCH_ERR(dec->env);
+	}
+	CATCH(fail_vqty) {
+		USERP_DISPATCH_ERR(dec->env);
+	}
+	CATCH(fail_null_type) {
+		userp_diag_set(&dec->env->err, USERP_ETYPE, "Value of type Any refers to type 0");
+		USERP_DISPATCH_ERR(dec->env);
+	}
 	return false;
 }
 
@@ -1300,7 +1844,7 @@ UNIT_TEST(decode_ints_varqty) {
 			printf("\\x%02X", (int)(test->data[i]&0xFF));
 		printf("\"\n");
 
-		size_t got= userp_decode_vqty_u64vec(&value, 1, &in);
+		size_t got= userp_decode_vqty_array(&value, 1, &in);
 		if (got) {
 			printf("actual=%08llX expected=%08llX\n", (long long)value, (long long)test->expected);
 			if (in.pos < in.lim) printf("  leftover bytes: %d\n", (int)(in.lim - in.pos));
@@ -1344,7 +1888,7 @@ UNIT_TEST(decode_ints_varqty) {
 			in.pos= in.part->data;
 			in.lim= in.part->data + in.part->len;
 			in.accum_bits= 0;
-			got= userp_decode_vqty_u64vec(&value, 1, &in);
+			got= userp_decode_vqty_array(&value, 1, &in);
 			if (got && value == test->expected) {
 				printf("  works with split at %d\n", i);
 				if (in.pos < in.lim) printf("  leftover bytes: %d\n", (int)(in.lim - in.pos));
@@ -1418,4 +1962,650 @@ actual=FFFFFFFFFFFFFFFF expected=FFFFFFFFFFFFFFFF
 (  works with split at \d\n)+
 */
 
+UNIT_TEST(dec_struct) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_struct_scope(env);
+	uint8_t data[]= { 1,0,0,0, 2,0, 3, 4 };
+	struct test_telemetry rec;
+	const struct test_telemetry *p;
+	userp_dec dec= userp_new_dec(env, scope, 4, NULL, data, sizeof(data));
+	// A wrong size fails without consuming the node
+	userp_dec_struct(dec, &rec, 6);
+	if (userp_dec_struct(dec, &rec, sizeof(rec)))
+		printf("ts=%d seq=%d a=%d b=%d\n", rec.ts, rec.seq, rec.a, rec.b);
+	// The root was the only node
+	userp_dec_struct(dec, &rec, sizeof(rec));
+	userp_drop_dec(env, dec);
+	dec= userp_new_dec(env, scope, 4, NULL, data, sizeof(data));
+	if ((p= (const struct test_telemetry*) userp_dec_struct_zerocopy(dec, sizeof(*p))))
+		printf("zerocopy at offset %d ts=%d\n", (int)((const uint8_t*) p - data), p->ts);
+	userp_dec_struct_zerocopy(dec, sizeof(*p));
+	userp_drop_dec(env, dec);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+error: Record is 8 bytes but struct is 6 bytes
+ts=1 seq=2 a=3 b=4
+error: No current node \(the root node was already decoded\)
+zerocopy at offset 0 ts=1
+error: No current node \(the root node was already decoded\)
+*/
+
+// Reader which appends one pending buffer after the last part
+struct test_dec_feed { userp_buffer buf; size_t len; };
+static bool test_dec_feed_reader(void *callback_data, struct userp_bstr *str, size_t bytes_needed, userp_env env) {
+	struct test_dec_feed *feed= (struct test_dec_feed*) callback_data;
+	struct userp_bstr_part part, *last= str->part_count? str->parts + str->part_count - 1 : NULL;
+	if (!feed->buf)
+		return false;
+	part.buf= feed->buf;
+	part.data= feed->buf->data;
+	part.len= feed->len;
+	part.ofs= last? last->ofs + last->len : 0;
+	feed->buf= NULL;
+	return userp_bstr_append_parts(str, &part, 1) != NULL;
+}
+
+// Scope with 1: Byte, and 2: an array of 'dim' Bytes
+static userp_scope test_byte_array_scope(userp_env env, size_t dim) {
+	userp_scope scope= userp_new_scope(env, NULL);
+	struct test_typetable *tt= malloc(sizeof(*tt) + 256);
+	struct userp_bstr_part part;
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	#define T(id) ((size_t)(id) << 1)
+	tt->len= 0;
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<5), S("Byte"), 8, TEST_SIGNED(0));
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S("Bytes"), T(1), 1, dim);
+	#undef S
+	#undef T
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 2, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+	free(tt);
+	return scope;
+}
+
+UNIT_TEST(dec_bytes_release) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_byte_array_scope(env, 300);
+	userp_buffer b0= userp_new_buffer(env, NULL, 100, 0), b1= userp_new_buffer(env, NULL, 200, 0);
+	struct test_dec_feed feed;
+	struct userp_bstr *str;
+	uint8_t out[300];
+	size_t len, i;
+	userp_dec dec;
+	for (i= 0; i < 300; i++)
+		*(i < 100? b0->data + i : b1->data + i - 100)= (uint8_t) i;
+
+	// The fixed-length array needs 300 bytes, so the reader supplies the second buffer
+	feed.buf= b1;
+	feed.len= 200;
+	dec= userp_new_dec(env, scope, 2, b0, b0->data, 100);
+	userp_dec_set_reader(dec, test_dec_feed_reader, &feed);
+	userp_dec_bytes_zerocopy(dec, 1, 1);
+	if ((str= userp_dec_bytes_zerocopy(dec, 1, 0))) {
+		for (i= 0; i < str->part_count; i++)
+			printf("part %d: len=%d [0]=%d\n", (int) i, (int) str->parts[i].len, str->parts[i].data[0]);
+		printf("refcnt while sliced: %d %d\n", (int) b0->refcnt, (int) b1->refcnt);
+	}
+	userp_drop_dec(env, dec);
+	printf("refcnt after drop: %d %d\n", (int) b0->refcnt, (int) b1->refcnt);
+
+	// Copying out releases the slice immediately, including when the buffer is too small
+	feed.buf= b1;
+	dec= userp_new_dec(env, scope, 2, b0, b0->data, 100);
+	userp_dec_set_reader(dec, test_dec_feed_reader, &feed);
+	len= 10;
+	if (!userp_dec_bytes(dec, out, &len, 1, 0))
+		printf("need %d, refcnt %d %d\n", (int) len, (int) b0->refcnt, (int) b1->refcnt);
+	if (userp_dec_bytes(dec, out, &len, 1, 0))
+		printf("copied %d, out[299]=%d, refcnt %d %d\n", (int) len, out[299], (int) b0->refcnt, (int) b1->refcnt);
+	userp_drop_dec(env, dec);
+	printf("refcnt after drop: %d %d\n", (int) b0->refcnt, (int) b1->refcnt);
+
+	userp_drop_buffer(b0);
+	userp_drop_buffer(b1);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+error: Unknown userp_dec_bytes flags: 1
+part 0: len=100 \[0\]=0
+part 1: len=200 \[0\]=100
+refcnt while sliced: 3 3
+refcnt after drop: 1 1
+error: Array has 300 bytes, but buffer holds 10
+need 300, refcnt 2 2
+copied 300, out\[299\]=43, refcnt 2 2
+refcnt after drop: 1 1
+*/
+
+#if HAVE_POSIX_MEMMAP
+UNIT_TEST(dec_from_file) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	size_t page= sysconf(_SC_PAGESIZE), n= page * 2 + 500, i, pos;
+	userp_scope scope= test_byte_array_scope(env, n);
+	uint8_t *data= malloc(n);
+	struct userp_bstr *str;
+	FILE *f= tmpfile(), *empty= tmpfile();
+	userp_dec dec;
+	int same= 1;
+	// The array starts 100 bytes into the file and ends in its third window
+	for (i= 0; i < n; i++)
+		data[i]= (uint8_t)(i * 7);
+	if (pwrite(fileno(f), data, n, 100) != (ssize_t) n) abort();
+	userp_env_set_attr(env, USERP_MAP_WINDOW, page);
+	dec= userp_new_dec_from_file(env, scope, 2, fileno(f), 100, -1);
+	fclose(f);
+	// Only the first window is mapped up front
+	printf("mapped to window end=%d\n", dec->map_pos == (int64_t) page);
+	if ((str= userp_dec_bytes_zerocopy(dec, 1, 0))) {
+		for (i= 0, pos= 0; i < str->part_count; pos += str->parts[i++].len)
+			same= same && memcmp(str->parts[i].data, data + pos, str->parts[i].len) == 0;
+		printf("parts=%d len=%d same=%d\n", (int) str->part_count, (int) pos, same);
+	}
+	// The file range is checked
+	userp_new_dec_from_file(env, scope, 2, fileno(empty), 1, -1);
+	fclose(empty);
+	userp_drop_dec(env, dec);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+	free(data);
+}
+/*OUTPUT
+mapped to window end=1
+parts=3 len=\d+ same=1
+error: File range .* exceeds file length 0
+*/
+#endif
+
+// Scope with 4: Sample, a record of two static bytes, two always fields and an often field,
+// 5: Samples, 8: Event, a record of an always field, seldom fields and ad-hoc I32 fields,
+// 9: Events, 11: Telemetry, matching struct test_telemetry, and 12: Telemetries
+static userp_scope test_dec_tree_scope(userp_env env) {
+	userp_scope scope= userp_new_scope(env, NULL);
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part;
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	#define T(id) ((size_t)(id) << 1)
+	tt->len= 0;
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<5), S("U8"), 8, TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<5), S("Count"), TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<2) + (1<<3), S("I32"), 3, 32);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), S("Sample"), 16, 5,
+		S("id"), T(2), FIELD_PLACEMENT_ALWAYS,
+		S("flags"), T(1), (0<<2)|FIELD_PLACEMENT_STATIC,
+		S("kind"), T(1), (8<<2)|FIELD_PLACEMENT_STATIC,
+		S("value"), T(3), FIELD_PLACEMENT_ALWAYS,
+		S("note"), T(2), FIELD_PLACEMENT_OFTEN);
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S("Samples"), T(4), 1, 0);
+	TT(TYPEDEF_SYMREF_SELBASE, S("Sym"));
+	TT(TYPEDEF_TYPEREF_SELBASE, S("Type"));
+	TT(TYPEDEF_RECORD_SELBASE + 1 + (1<<3), 1, TYPEDEF_RECORD_SELDOM_OTHERTYPE, S("Event"), 3,
+		S("id"), T(2), FIELD_PLACEMENT_ALWAYS,
+		S("name"), T(6), FIELD_PLACEMENT_SELDOM,
+		S("kind"), T(7), FIELD_PLACEMENT_SELDOM,
+		T(3));
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S("Events"), T(8), 1, 0);
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3), S("I16"), 16);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), S("Telemetry"), 64, 4,
+		S("ts"), T(3), (0<<2)|FIELD_PLACEMENT_STATIC,
+		S("seq"), T(10), (32<<2)|FIELD_PLACEMENT_STATIC,
+		S("a"), T(1), (48<<2)|FIELD_PLACEMENT_STATIC,
+		S("b"), T(1), (56<<2)|FIELD_PLACEMENT_STATIC);
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S("Telemetries"), T(11), 1, 0);
+	TT(TYPEDEF_INTEGER_SELBASE + 1, 1, TYPEDEF_INT_SELDOM_DELTA, S("TS"), 1);
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S("Stamps"), T(13), 1, 0);
+	TT(TYPEDEF_INTEGER_SELBASE + 1 + (1<<3) + (1<<5), 1, TYPEDEF_INT_SELDOM_DELTA, S("D16"), 16, TEST_SIGNED(0), 2);
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S("Levels"), T(15), 1, 0);
+	// the name of an ad-hoc field in the test data
+	userp_scope_get_symbol(scope, "x", USERP_CREATE);
+	#undef S
+	#undef T
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 16, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+	free(tt);
+	return scope;
+}
+
+// Encode 'n' Telemetries, where record i has ts=i, seq=i, a=i, b=i>>8
+static void test_dec_telemetries(struct test_typetable *data, size_t n) {
+	struct test_telemetry rec;
+	size_t i;
+	data->len= 0;
+	TEST_DATA(n);
+	for (i= 0; i < n; i++) {
+		rec.ts= i; rec.seq= i; rec.a= i; rec.b= i >> 8;
+		memcpy(data->buf + data->len, &rec, 8);
+		data->len += 8;
+	}
+}
+
+// Encode 'n' Samples, where sample i has flags=i, kind=i>>8, id=i, value=i, and note=i&0x7F on
+// every third sample
+static void test_dec_samples(struct test_typetable *data, size_t n) {
+	size_t i;
+	data->len= 0;
+	TEST_DATA(n);
+	for (i= 0; i < n; i++) {
+		TEST_DATA(i % 3 == 0);
+		data->buf[data->len++]= i;
+		data->buf[data->len++]= i >> 8;
+		TEST_DATA(i & 0x3FFF);
+		memcpy(data->buf + data->len, &i, 4);
+		data->len += 4;
+		if (i % 3 == 0)
+			TEST_DATA(i & 0x7F);
+	}
+}
+
+UNIT_TEST(dec_navigate) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_dec_tree_scope(env);
+	struct test_typetable *data= malloc(sizeof(*data) + 256);
+	userp_symbol s_x= userp_scope_get_symbol(scope, "x", 0);
+	#define SYM(name) userp_scope_get_symbol(scope, name, 0)
+	userp_node_info info;
+	userp_dec dec;
+	userp_type t;
+	int v, sign;
+	int64_t v64;
+	uint8_t u8;
+	unsigned long big[4];
+	size_t len, sum;
+	struct test_dec_feed feed;
+	userp_buffer b0, b1;
+
+	// Samples: descend into an array of records, reaching fields by name and by index
+	test_dec_samples(data, 4);
+	dec= userp_new_dec(env, scope, 5, NULL, data->buf, data->len);
+	if ((info= userp_dec_node_info(dec)))
+		printf("root: type=%d array=%d count=%d depth=%d\n", (int) info->node_type,
+			(info->flags & USERP_NODEFLAG_ARRAY) != 0, (int) info->elem_count, (int) info->node_depth);
+	userp_dec_int(dec, &v);
+	userp_dec_begin(dec);
+	if ((info= userp_dec_node_info(dec)))
+		printf("elem: type=%d record=%d count=%d depth=%d\n", (int) info->node_type,
+			(info->flags & USERP_NODEFLAG_RECORD) != 0, (int) info->elem_count, (int) info->node_depth);
+	// Fields are iterated static, always, then often
+	userp_dec_begin(dec);
+	while ((info= userp_dec_node_info(dec)) && info->node_type) {
+		if (userp_dec_int(dec, &v))
+			printf(" %d", v);
+	}
+	printf("\n");
+	userp_dec_int(dec, &v);
+	userp_dec_end(dec);
+	// Sample 1 has no note, and the decoder stays on 'value' after failing to find it
+	userp_dec_begin(dec);
+	if (!userp_dec_seek_field(dec, SYM("value")) || !userp_dec_int(dec, &v))
+		printf("seek value failed\n");
+	printf("value=%d note=%d\n", v, userp_dec_seek_field(dec, SYM("note")));
+	if (userp_dec_seek_field(dec, SYM("kind")) && userp_dec_int_n(dec, &u8, 1, false)
+		&& userp_dec_seek_field(dec, SYM("id")) && userp_dec_int(dec, &v))
+		printf("kind=%d id=%d\n", u8, v);
+	userp_dec_seek_field(dec, 0);
+	userp_dec_seek_field(dec, 1000);
+	userp_dec_end(dec);
+	// Skip a record, then seek ahead to the last one and back to the first
+	userp_dec_skip(dec);
+	if (userp_dec_seek_elem(dec, 3) && userp_dec_begin(dec) && userp_dec_seek_elem(dec, 4)
+		&& userp_dec_int(dec, &v))
+		printf("sample 3 note=%d\n", v);
+	userp_dec_end(dec);
+	printf("seek 4: %d\n", userp_dec_seek_elem(dec, 4));
+	if (userp_dec_seek_elem(dec, 0) && userp_dec_begin(dec) && userp_dec_seek_elem(dec, 3)
+		&& userp_dec_int(dec, &v))
+		printf("sample 0 value=%d\n", v);
+	userp_dec_end(dec);
+	userp_dec_end(dec);
+	if ((info= userp_dec_node_info(dec)))
+		printf("after: type=%d depth=%d\n", (int) info->node_type, (int) info->node_depth);
+	userp_dec_end(dec);
+	userp_drop_dec(env, dec);
+
+	// With a reader appending the second half of the input, the array can still seek back
+	test_dec_samples(data, 20);
+	b0= userp_new_buffer(env, NULL, data->len / 2, 0);
+	b1= userp_new_buffer(env, NULL, data->len - data->len / 2, 0);
+	memcpy(b0->data, data->buf, data->len / 2);
+	memcpy(b1->data, data->buf + data->len / 2, data->len - data->len / 2);
+	feed.buf= b1;
+	feed.len= data->len - data->len / 2;
+	dec= userp_new_dec(env, scope, 5, b0, b0->data, data->len / 2);
+	userp_dec_set_reader(dec, test_dec_feed_reader, &feed);
+	userp_dec_begin(dec);
+	for (sum= 0; userp_dec_begin(dec); sum += v) {
+		if (!userp_dec_seek_field(dec, SYM("value")) || !userp_dec_int(dec, &v) || !userp_dec_end(dec))
+			break;
+	}
+	if (userp_dec_seek_elem(dec, 1) && userp_dec_begin(dec) && userp_dec_seek_field(dec, SYM("id"))
+		&& userp_dec_int(dec, &v))
+		printf("sum=%d, then sample %d, parts=%d\n", (int) sum, v, (int) dec->input.part_count);
+	userp_drop_dec(env, dec);
+	userp_drop_buffer(b0);
+	userp_drop_buffer(b1);
+
+	// Events: seldom and ad-hoc fields listed in the record header
+	data->len= 0;
+	TEST_DATA(2, 2, 1, s_x + 2, 7, 8);
+	memcpy(data->buf + data->len, "\xFB\xFF\xFF\xFF", 4);
+	data->len += 4;
+	TEST_DATA(0, 9);
+	dec= userp_new_dec(env, scope, 9, NULL, data->buf, data->len);
+	userp_dec_begin(dec);
+	userp_dec_begin(dec);
+	if (userp_dec_seek_field(dec, s_x) && userp_dec_int(dec, &v))
+		printf("x=%d\n", v);
+	if (userp_dec_seek_field(dec, SYM("id")) && userp_dec_bigint(dec, big, (len= sizeof(big), &len), &sign))
+		printf("id=%d len=%d sign=%d\n", (int) big[0], (int) len, sign);
+	userp_dec_symbol(dec, (userp_symbol*) &v);
+	if (userp_dec_typeref(dec, &t))
+		printf("kind=%d\n", (int) t);
+	printf("name: %d\n", userp_dec_seek_field(dec, SYM("name")));
+	userp_dec_skip(dec);
+	userp_dec_int(dec, &v);
+	userp_dec_end(dec);
+	userp_dec_begin(dec);
+	if (userp_dec_int_n(dec, &v64, sizeof(v64), true))
+		printf("id=%d\n", (int) v64);
+	userp_dec_end(dec);
+	userp_dec_end(dec);
+	userp_drop_dec(env, dec);
+	#undef SYM
+	free(data);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+root: type=5 array=1 count=4 depth=0
+error: Type 5 is not an integer
+elem: type=4 record=1 count=5 depth=1
+ 0 0 0 0 0
+error: No current node \(the last element was already decoded\)
+value=1 note=0
+kind=0 id=1
+error: Symbol 0 is not part of the scope
+error: Symbol 1000 is not part of the scope
+sample 3 note=3
+seek 4: 0
+sample 0 value=0
+after: type=0 depth=0
+error: No array or record is being iterated
+error: No current node \(the last element was already decoded\)
+sum=190, then sample 1, parts=2
+x=-5
+id=7 len=8 sign=0
+error: Type 7 is not a symbol
+kind=8
+name: 0
+error: No current node \(the last element was already decoded\)
+id=9
+*/
+
+UNIT_TEST(bench_dec_navigate) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_dec_tree_scope(env);
+	size_t n_rec= argc > 0? atoi(argv[0]) : 100000, iters= argc > 1? atoi(argv[1]) : 10;
+	struct test_typetable *data= malloc(sizeof(*data) + n_rec * 16 + 64);
+	userp_symbol s_value= userp_scope_get_symbol(scope, "value", 0);
+	const char *names[]= { "skip each record", "begin, seek_field, int, end", "begin, int per field, end",
+		"skip the array" };
+	userp_node_info info;
+	userp_dec dec;
+	double t;
+	clock_t start;
+	size_t i, j, k, fail= 0;
+	int64_t sum[4];
+	int v= 0;
+
+	test_dec_samples(data, n_rec);
+	for (k= 0; k < 4; k++) {
+		sum[k]= 0;
+		start= clock();
+		for (j= 0; j < iters; j++) {
+			dec= userp_new_dec(env, scope, 5, NULL, data->buf, data->len);
+			if (k == 3) {
+				if (!userp_dec_skip(dec))
+					fail++;
+				userp_drop_dec(env, dec);
+				continue;
+			}
+			if (!userp_dec_begin(dec))
+				fail++;
+			for (i= 0; i < n_rec; i++) {
+				if (k == 0) {
+					if (!userp_dec_skip(dec))
+						fail++;
+				}
+				else if (k == 1) {
+					if (!userp_dec_begin(dec) || !userp_dec_seek_field(dec, s_value)
+						|| !userp_dec_int(dec, &v) || !userp_dec_end(dec))
+						fail++;
+					sum[k] += v;
+				}
+				else {
+					if (!userp_dec_begin(dec))
+						fail++;
+					while ((info= userp_dec_node_info(dec)) && info->node_type) {
+						if (!userp_dec_int(dec, &v))
+							fail++;
+						sum[k] += v;
+					}
+					if (!userp_dec_end(dec))
+						fail++;
+				}
+			}
+			if (!userp_dec_end(dec))
+				fail++;
+			userp_drop_dec(env, dec);
+		}
+		t= (double)(clock() - start) / CLOCKS_PER_SEC;
+		printf("%s: %.1f M records/sec\n", names[k], n_rec * iters / (t > 0? t : 1e-9) / 1e6);
+	}
+	printf("failures: %d, value checksum %s\n", (int) fail,
+		sum[1] == (int64_t)(n_rec * (n_rec - 1) / 2 * iters)? "ok" : "wrong");
+	free(data);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+skip each record: [0-9.]+ M records/sec
+begin, seek_field, int, end: [0-9.]+ M records/sec
+begin, int per field, end: [0-9.]+ M records/sec
+skip the array: [0-9.]+ M records/sec
+failures: 0, value checksum ok
+*/
+
+UNIT_TEST(dec_struct_array) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_dec_tree_scope(env);
+	struct test_typetable *data= malloc(sizeof(*data) + 256);
+	struct test_telemetry recs[4], rec;
+	userp_buffer b0, b1;
+	struct test_dec_feed feed;
+	userp_dec dec;
+	size_t count;
+
+	test_dec_telemetries(data, 3);
+	dec= userp_new_dec(env, scope, 12, NULL, data->buf, data->len);
+	// Too small a buffer reports the count, and the decoder stays at the array
+	count= 2;
+	userp_dec_struct_array(dec, recs, sizeof(*recs), &count);
+	printf("need %d\n", (int) count);
+	userp_dec_struct_array(dec, recs, 6, (count= 4, &count));
+	if (userp_dec_struct_array(dec, recs, sizeof(*recs), (count= 4, &count)))
+		printf("count=%d ts=%d seq=%d a=%d b=%d\n", (int) count, recs[2].ts, recs[2].seq, recs[2].a, recs[2].b);
+	userp_drop_dec(env, dec);
+	// Records of a stream are also reached one at a time
+	dec= userp_new_dec(env, scope, 12, NULL, data->buf, data->len);
+	userp_dec_begin(dec);
+	userp_dec_seek_elem(dec, 1);
+	if (userp_dec_struct(dec, &rec, sizeof(rec)) && userp_dec_struct_zerocopy(dec, sizeof(rec)))
+		printf("rec 1 ts=%d\n", rec.ts);
+	userp_dec_struct(dec, &rec, sizeof(rec));
+	userp_dec_end(dec);
+	userp_drop_dec(env, dec);
+	// Split across buffers, the elements are copied one by one
+	b0= userp_new_buffer(env, NULL, 13, 0);
+	b1= userp_new_buffer(env, NULL, data->len - 13, 0);
+	memcpy(b0->data, data->buf, 13);
+	memcpy(b1->data, data->buf + 13, data->len - 13);
+	feed.buf= b1;
+	feed.len= data->len - 13;
+	dec= userp_new_dec(env, scope, 12, b0, b0->data, 13);
+	userp_dec_set_reader(dec, test_dec_feed_reader, &feed);
+	memset(recs, 0, sizeof(recs));
+	if (userp_dec_struct_array(dec, recs, sizeof(*recs), (count= 4, &count)))
+		printf("split: count=%d ts=%d,%d,%d\n", (int) count, recs[0].ts, recs[1].ts, recs[2].ts);
+	userp_drop_dec(env, dec);
+	userp_drop_buffer(b0);
+	userp_drop_buffer(b1);
+	free(data);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+error: Array has 3 elements, but buffer holds 2
+need 3
+error: Record is 8 bytes but struct is 6 bytes
+count=3 ts=2 seq=2 a=2 b=0
+rec 1 ts=1
+error: No current node \(the last element was already decoded\)
+split: count=3 ts=0,1,2
+*/
+
+UNIT_TEST(dec_int_delta) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_dec_tree_scope(env);
+	struct test_typetable *data= malloc(sizeof(*data) + 256);
+	userp_node_info info;
+	userp_dec dec;
+	int64_t v[4], bulk[4];
+	double d;
+	size_t count;
+
+	// Stamps 1000, 1003, 998, 998, stored as differences
+	data->len= 0;
+	TEST_DATA(4, TEST_SIGNED(1000), TEST_SIGNED(3), TEST_SIGNED(-5), TEST_SIGNED(0));
+	dec= userp_new_dec(env, scope, 14, NULL, data->buf, data->len);
+	if (userp_dec_begin(dec) && userp_dec_int64(dec, &v[0]) && userp_dec_int64(dec, &v[1])
+		&& userp_dec_int64(dec, &v[2]) && userp_dec_int64(dec, &v[3]) && userp_dec_end(dec))
+		printf("stamps %d %d %d %d\n", (int) v[0], (int) v[1], (int) v[2], (int) v[3]);
+	userp_drop_dec(env, dec);
+	dec= userp_new_dec(env, scope, 14, NULL, data->buf, data->len);
+	userp_dec_int_array(dec, bulk, sizeof(*bulk), (count= 4, &count), 0);
+	printf("bulk %s\n", memcmp(v, bulk, sizeof(v))? "differs" : "matches");
+	userp_drop_dec(env, dec);
+	// Skipping and seeking keep the running value
+	dec= userp_new_dec(env, scope, 14, NULL, data->buf, data->len);
+	userp_dec_begin(dec);
+	userp_dec_skip(dec);
+	if ((info= userp_dec_node_info(dec)))
+		printf("after skip %d\n", (int) info->intval);
+	if (userp_dec_seek_elem(dec, 3) && userp_dec_int64(dec, &v[0])
+		&& userp_dec_seek_elem(dec, 0) && userp_dec_int64(dec, &v[1]) && userp_dec_double(dec, &d))
+		printf("elem 3=%d, elem 0=%d, elem 1=%g\n", (int) v[0], (int) v[1], d);
+	userp_dec_end(dec);
+	userp_drop_dec(env, dec);
+	// Fixed-size zigzag levels 100, 90, 95 can't be jumped to directly
+	data->len= 0;
+	TEST_DATA(3);
+	memcpy(data->buf + data->len, (uint8_t[]){ 200, 0, 19, 0, 10, 0 }, 6);
+	data->len += 6;
+	dec= userp_new_dec(env, scope, 16, NULL, data->buf, data->len);
+	if (userp_dec_begin(dec) && userp_dec_seek_elem(dec, 2) && userp_dec_int64(dec, &v[0])
+		&& userp_dec_seek_elem(dec, 1) && userp_dec_int64(dec, &v[1]) && userp_dec_end(dec))
+		printf("level 2=%d, level 1=%d\n", (int) v[0], (int) v[1]);
+	userp_drop_dec(env, dec);
+	free(data);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+stamps 1000 1003 998 998
+bulk matches
+after skip 1003
+elem 3=998, elem 0=1000, elem 1=1003
+level 2=95, level 1=90
+*/
+
+UNIT_TEST(bench_dec_struct) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_dec_tree_scope(env);
+	size_t n_rec= argc > 0? atoi(argv[0]) : 1000000, iters= argc > 1? atoi(argv[1]) : 10;
+	struct test_typetable *data= malloc(sizeof(*data) + n_rec * 8 + 16);
+	struct test_telemetry *out= malloc(n_rec * sizeof(*out));
+	const struct test_telemetry *p;
+	const char *names[]= { "per field", "struct copy", "struct zerocopy", "struct array" };
+	userp_dec dec;
+	double t;
+	clock_t start;
+	size_t i, j, k, count, fail= 0;
+	int64_t sum[4];
+	int v[4];
+
+	test_dec_telemetries(data, n_rec);
+	for (k= 0; k < 4; k++) {
+		start= clock();
+		for (j= 0; j < iters; j++) {
+			dec= userp_new_dec(env, scope, 12, NULL, data->buf, data->len);
+			if (k == 3) {
+				count= n_rec;
+				if (!userp_dec_struct_array(dec, out, sizeof(*out), &count))
+					fail++;
+				userp_drop_dec(env, dec);
+				continue;
+			}
+			if (!userp_dec_begin(dec))
+				fail++;
+			for (i= 0; i < n_rec; i++) {
+				if (k == 0) {
+					// Each static field is found by its offset
+					if (!userp_dec_begin(dec) || !userp_dec_int(dec, &v[0]) || !userp_dec_int(dec, &v[1])
+						|| !userp_dec_int(dec, &v[2]) || !userp_dec_int(dec, &v[3]) || !userp_dec_end(dec))
+						fail++;
+					out[i].ts= v[0]; out[i].seq= v[1]; out[i].a= v[2]; out[i].b= v[3];
+				}
+				else if (k == 1) {
+					if (!userp_dec_struct(dec, &out[i], sizeof(*out)))
+						fail++;
+				}
+				else {
+					if (!(p= (const struct test_telemetry*) userp_dec_struct_zerocopy(dec, sizeof(*p))))
+						fail++;
+					else
+						out[i]= *p;
+				}
+			}
+			if (!userp_dec_end(dec))
+				fail++;
+			userp_drop_dec(env, dec);
+		}
+		t= (double)(clock() - start) / CLOCKS_PER_SEC;
+		printf("%s: %.1f M records/sec\n", names[k], n_rec * iters / (t > 0? t : 1e-9) / 1e6);
+		for (sum[k]= 0, i= 0; i < n_rec; i++)
+			sum[k] += out[i].ts + out[i].seq + out[i].a + out[i].b;
+	}
+	printf("failures: %d, checksums %s\n", (int) fail,
+		sum[0] == sum[1] && sum[1] == sum[2] && sum[2] == sum[3]? "match" : "differ");
+	free(data);
+	free(out);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+per field: [0-9.]+ M records/sec
+struct copy: [0-9.]+ M records/sec
+struct zerocopy: [0-9.]+ M records/sec
+struct array: [0-9.]+ M records/sec
+failures: 0, checksums match
+*/
+
 #endif /* UNT_TEST */
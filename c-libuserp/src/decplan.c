@@ -0,0 +1,2747 @@
+// This file is included into dec.c
+
+/*IMPLDOC
+
+### Plan Execution
+
+    if (!userp_plan_skip(scope, plan, &in))
+      ... // error was dispatched to scope->env
+
+    int64_t value;
+    if (!userp_plan_read_int(plan, &in, &value))
+      ... // error was dispatched to in.str->env
+
+These walk the input according to a compiled `struct type_plan` (see "Decode Plans" in
+scopetype.c) and never consult the type objects.  Every decision was made when the plan was
+compiled, so each node costs one switch on `plan->op`, and any value with a fixed size
+(`PLAN_FIXED`) is skipped with one addition no matter how many fields or elements it contains.
+
+Bits are consumed least-significant first.  `in->accum_bits` is the number of bits of `*in->pos`
+already consumed.  Variable-length quantities always begin on a byte boundary.  Each value
+begins by aligning to `plan->align` (a power of 2 number of bits, relative to the start of the
+`userp_bstr`) and ends with `plan->pad` NUL bytes.
+
+A record with Often or Seldom fields or with `other_field_type` has a header, which comes
+before the record's alignment:
+
+  * A quantity whose lowest `often_count` bits are the presence flags of the Often fields,
+    and whose upper bits are the number of extra fields.
+  * One quantity per extra field: below `seldom_count` it is the index of a Seldom field, and
+    otherwise it is a symbol (offset by `seldom_count`) naming an ad-hoc field of the type
+    `other_field_type`.
+
+Then follows the static area of `static_bits`, the Always fields, the Often fields which are
+present, and the extra fields in the order of the header.  A record without Often or Seldom
+fields or `other_field_type`, whose Always fields all have a fixed size, is PLAN_RECORD_FIXED
+and is just the static area followed by the Always fields.
+
+An array with no element type in its definition begins with the element type.  If the
+definition has no dimensions, the data gives the number of dimensions, and each dimension that
+is 0 in the definition is given in the data.  Elements with a fixed size are skipped in bulk.
+
+A choice is a quantity selecting an option.  If the option is a type merged into the
+selector, the selector already holds the value.  Otherwise the value of the option's type
+follows, unless the option is a constant value.
+
+An integer type with `PLAN_DELTA` stores each element of an array as the difference from the
+previous one.  `userp_plan_read_int` returns the stored difference (after zigzag decoding, with
+`PLAN_DELTA_ZIGZAG`), which is the value of a lone element.  `userp_plan_read_int_next` reads
+elements one at a time and adds each difference to the previous value, and
+`userp_plan_read_int_array` does the same in bulk.
+
+*/
+
+#define PLAN_NESTING_MAX 1024
+
+// Advance by 'bits' bits, which may cross into following parts.
+// Returns false if that would pass the end of the input.
+static bool plan_skip_bits(struct userp_bit_io *in, size_t bits) {
+	size_t avail;
+	bits += in->accum_bits;
+	for (;;) {
+		avail= in->lim - in->pos;
+		if ((bits >> 3) < avail) {
+			in->pos += bits >> 3;
+			in->accum_bits= bits & 7;
+			return true;
+		}
+		bits -= avail << 3;
+		in->pos= in->lim;
+		in->accum_bits= 0;
+		if (!in->part || in->part + 1 >= in->str->parts + in->str->part_count)
+			return !bits;
+		++in->part;
+		in->pos= in->part->data;
+		in->lim= in->part->data + in->part->len;
+	}
+}
+
+// Advance to a byte boundary, then to the next multiple of 2**align bits of the whole stream
+static bool plan_align(struct userp_bit_io *in, int align) {
+	size_t ofs, mask;
+	if (in->accum_bits && !plan_skip_bits(in, 8 - in->accum_bits))
+		return false;
+	if (align > 3) {
+		if (userp_bit_io_at_end(in))
+			return true;
+		mask= ((size_t)1 << (align - 3)) - 1;
+		ofs= in->part->ofs + (in->pos - in->part->data);
+		if ((ofs & mask) && !plan_skip_bits(in, ((mask + 1 - (ofs & mask)) & mask) << 3))
+			return false;
+	}
+	return true;
+}
+
+// Read 'bits' bits, where 0 <= bits <= 64, as an unsigned integer
+static bool plan_read_bits(uint64_t *out, struct userp_bit_io *in, int bits) {
+	uint64_t val= 0;
+	int shift= 0, take;
+	if (!bits) {
+		*out= 0;
+		return true;
+	}
+	// Fast path: all bits are within the next 8 bytes of this part
+	if (in->accum_bits + bits <= 64 && in->lim - in->pos >= 8) {
+		val= userp_load_le64((char*) in->pos) >> in->accum_bits;
+		if (bits < 64)
+			val &= ((uint64_t)1 << bits) - 1;
+		bits += in->accum_bits;
+		in->pos += bits >> 3;
+		in->accum_bits= bits & 7;
+		*out= val;
+		return true;
+	}
+	while (shift < bits) {
+		if (userp_bit_io_at_end(in))
+			return false;
+		take= 8 - in->accum_bits;
+		if (take > bits - shift)
+			take= bits - shift;
+		val |= (uint64_t)((*in->pos >> in->accum_bits) & ((1 << take) - 1)) << shift;
+		shift += take;
+		if ((in->accum_bits += take) == 8) {
+			in->pos++;
+			in->accum_bits= 0;
+		}
+	}
+	*out= val;
+	return true;
+}
+
+// Read a variable-length quantity, which begins on a byte boundary
+static inline bool plan_read_vqty(size_t *out, struct userp_bit_io *in) {
+	if (in->accum_bits && !plan_skip_bits(in, 8 - in->accum_bits))
+		return false;
+	return userp_decode_vqty_quick(out, in);
+}
+
+static bool plan_overrun(struct userp_bit_io *in) {
+	userp_diag_set(&in->str->env->err, USERP_EOVERRUN, "Data ends before the end of the value");
+	USERP_DISPATCH_ERR(in->str->env);
+	return false;
+}
+
+bool userp_plan_read_int(const struct type_plan *plan, struct userp_bit_io *in, int64_t *out) {
+	uint64_t bits;
+	size_t qty;
+	if (plan->align && !plan_align(in, plan->align))
+		return plan_overrun(in);
+	switch (plan->op) {
+	case PLAN_INT_TWOS:
+	case PLAN_INT_BITS:
+		if (plan->bits > 64) {
+			userp_diag_setf(&in->str->env->err, USERP_ELIMIT,
+				"Integer of " USERP_DIAG_SIZE " bits does not fit in int64_t", (size_t) plan->bits);
+			USERP_DISPATCH_ERR(in->str->env);
+			return false;
+		}
+		if (!plan_read_bits(&bits, in, plan->bits))
+			return plan_overrun(in);
+		if ((plan->flags & PLAN_BSWAP) && !(plan->bits & 7))
+			bits= __builtin_bswap64(bits) >> (64 - plan->bits);
+		if (plan->op == PLAN_INT_TWOS)
+			*out= plan->bits && plan->bits < 64 && (bits >> (plan->bits - 1))
+				? (int64_t)(bits | (~(uint64_t)0 << plan->bits)) : (int64_t) bits;
+		else
+			*out= (plan->flags & PLAN_DESCENDING)? (int64_t)((uint64_t) plan->base - bits)
+				: (int64_t)((uint64_t) plan->base + bits);
+		break;
+	case PLAN_INT_VQTY:
+	case PLAN_INT_VQTY_SIGNED:
+		if (!plan_read_vqty(&qty, in)) {
+			USERP_DISPATCH_ERR(in->str->env);
+			return false;
+		}
+		if (plan->op == PLAN_INT_VQTY_SIGNED)
+			*out= (qty & 1)? -(int64_t)(qty >> 1) - 1 : (int64_t)(qty >> 1);
+		else
+			*out= (plan->flags & PLAN_DESCENDING)? (int64_t)((uint64_t) plan->base - qty)
+				: (int64_t)((uint64_t) plan->base + qty);
+		break;
+	default:
+		userp_diag_setf(&in->str->env->err, USERP_ETYPE,
+			"Type " USERP_DIAG_INDEX " is not an integer", (int) plan->type);
+		USERP_DISPATCH_ERR(in->str->env);
+		return false;
+	}
+	if (plan->flags & PLAN_DELTA_ZIGZAG)
+		*out= (int64_t)(((uint64_t) *out >> 1) ^ (0 - ((uint64_t) *out & 1)));
+	if (plan->pad && !plan_skip_bits(in, plan->pad << 3))
+		return plan_overrun(in);
+	return true;
+}
+
+// Read the next element of an integer array, whose previous value is *prev_inout (0 before the
+// first element).  The value is stored in *prev_inout.
+bool userp_plan_read_int_next(const struct type_plan *plan, struct userp_bit_io *in, int64_t *prev_inout) {
+	int64_t val;
+	if (!userp_plan_read_int(plan, in, &val))
+		return false;
+	*prev_inout= (plan->flags & PLAN_DELTA)? (int64_t)((uint64_t) *prev_inout + (uint64_t) val) : val;
+	return true;
+}
+
+/*IMPLDOC
+
+#### userp_plan_copy_struct
+
+    if (!userp_plan_copy_struct(plan, &in, &my_struct, sizeof(my_struct)))
+      ... // error was dispatched to in.str->env
+
+    const struct my_struct *p= (const struct my_struct*)
+      userp_plan_struct_zerocopy(plan, &in, sizeof(*p));
+
+A record with PLAN_RECORD_FIXED whose size is a whole number of bytes is laid out exactly like
+a C struct (if the type was written to match one).  These check that the record and the struct
+have the same size, align the input, check once that the whole record is available, and then
+either copy it or return a pointer to it, and advance past it.  No field is decoded
+individually.  `sizeof_struct` may include the record's `pad` bytes, to match the trailing
+padding of a C struct.
+
+The zerocopy version fails if the record is split across two parts of the input, in which case
+the caller can fall back to the copying version.
+
+    size_t count= sizeof(recs)/sizeof(*recs);
+    if (!userp_plan_read_struct_array(scope, plan, &in, recs, sizeof(*recs), &count))
+      ... // error was dispatched to scope->env
+
+Read an array of such records into an array of C structs.  If the stride of the elements equals
+the struct size and the elements are within the current part, the whole array is one `memcpy`.
+Otherwise each element is copied like `userp_plan_copy_struct`.
+
+*/
+
+// Verify that plan is a struct-compatible record of sizeof_struct, align to it, and
+// return the number of bytes to consume, or 0 on failure (which has been dispatched).
+static size_t plan_struct_prepare(const struct type_plan *plan, struct userp_bit_io *in, size_t sizeof_struct) {
+	size_t size= plan->fixed_bits >> 3;
+	if (plan->op != PLAN_RECORD_FIXED || (plan->fixed_bits & 7)) {
+		userp_diag_setf(&in->str->env->err, USERP_ETYPE,
+			"Type " USERP_DIAG_INDEX " is not a fixed-size record of whole bytes", (int) plan->type);
+		goto fail;
+	}
+	if (sizeof_struct != size && sizeof_struct != size + plan->pad) {
+		userp_diag_setf(&in->str->env->err, USERP_ETYPE,
+			"Record is " USERP_DIAG_SIZE " bytes but struct is " USERP_DIAG_SIZE2 " bytes",
+			size, sizeof_struct);
+		goto fail;
+	}
+	if (!plan_align(in, plan->align < 3? 3 : plan->align)) {
+		userp_diag_set(&in->str->env->err, USERP_EOVERRUN, "Data ends before the end of the value");
+		goto fail;
+	}
+	return size + plan->pad;
+	CATCH(fail) {
+		USERP_DISPATCH_ERR(in->str->env);
+	}
+	return 0;
+}
+
+bool userp_plan_copy_struct(const struct type_plan *plan, struct userp_bit_io *in, void *out, size_t sizeof_struct) {
+	size_t size, n;
+	uint8_t *dst= (uint8_t*) out;
+	if (!(size= plan_struct_prepare(plan, in, sizeof_struct)))
+		return false;
+	// One bounds check for the common case of the whole record in the current part
+	if ((size_t)(in->lim - in->pos) >= size) {
+		memcpy(dst, in->pos, sizeof_struct);
+		in->pos += size;
+		return true;
+	}
+	if (userp_bit_io_remaining(in) < size)
+		return plan_overrun(in);
+	while (size) {
+		userp_bit_io_at_end(in);
+		n= in->lim - in->pos;
+		if (n > size)
+			n= size;
+		if (sizeof_struct) {
+			memcpy(dst, in->pos, n < sizeof_struct? n : sizeof_struct);
+			dst += n < sizeof_struct? n : sizeof_struct;
+			sizeof_struct -= n < sizeof_struct? n : sizeof_struct;
+		}
+		in->pos += n;
+		size -= n;
+	}
+	return true;
+}
+
+const uint8_t* userp_plan_struct_zerocopy(const struct type_plan *plan, struct userp_bit_io *in, size_t sizeof_struct) {
+	size_t size;
+	const uint8_t *ret;
+	if (!(size= plan_struct_prepare(plan, in, sizeof_struct)))
+		return NULL;
+	userp_bit_io_at_end(in);
+	if ((size_t)(in->lim - in->pos) < size) {
+		if (userp_bit_io_remaining(in) < size)
+			plan_overrun(in);
+		else {
+			userp_diag_set(&in->str->env->err, USERP_EBUFPOINTER, "Record is split across buffers and must be copied");
+			USERP_DISPATCH_ERR(in->str->env);
+		}
+		return NULL;
+	}
+	ret= in->pos;
+	in->pos += size;
+	return ret;
+}
+
+static bool plan_skip(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in, int depth);
+
+// Skip the value of a field whose index or ad-hoc name was given in a record header
+static bool plan_skip_extra_field(userp_scope scope, const struct type_plan *plan, size_t ref,
+	struct userp_bit_io *in, int depth
+) {
+	size_t first_seldom= plan->member_count - plan->seldom_count;
+	if (ref < plan->seldom_count)
+		return plan_skip(scope, plan->fields[first_seldom + ref].plan, in, depth);
+	if (!plan->other) {
+		userp_diag_setf(&scope->env->err, USERP_ERECORD,
+			"Record has no field " USERP_DIAG_INDEX, (int) ref);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	return plan_skip(scope, plan->other, in, depth);
+}
+
+static bool plan_skip_record(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in, int depth) {
+	struct userp_bit_io extra_refs;
+	size_t presence= 0, extra_count= 0, ref, i, n;
+	// The header comes before alignment
+	if (plan->often_count || plan->seldom_count || plan->other) {
+		if (!plan_read_vqty(&presence, in))
+			goto fail_header;
+		if (plan->often_count < sizeof(size_t)*8)
+			extra_count= presence >> plan->often_count;
+		// Remember where the field references are, then skip past them
+		extra_refs= *in;
+		for (i= 0; i < extra_count; i++)
+			if (!plan_read_vqty(&ref, in))
+				goto fail_header;
+	}
+	if (plan->align && !plan_align(in, plan->align))
+		return plan_overrun(in);
+	if (plan->static_bits && !plan_skip_bits(in, plan->static_bits))
+		return plan_overrun(in);
+	i= plan->member_count - plan->seldom_count - plan->often_count - plan->always_count;
+	for (n= i + plan->always_count; i < n; i++)
+		if (!plan_skip(scope, plan->fields[i].plan, in, depth))
+			return false;
+	for (n= i + plan->often_count; i < n; i++)
+		if (((presence >> (i - (n - plan->often_count))) & 1)
+			&& !plan_skip(scope, plan->fields[i].plan, in, depth))
+			return false;
+	for (i= 0; i < extra_count; i++) {
+		if (!plan_read_vqty(&ref, &extra_refs))
+			goto fail_header;
+		if (!plan_skip_extra_field(scope, plan, ref, in, depth))
+			return false;
+	}
+	return true;
+	CATCH(fail_header) {
+		USERP_DISPATCH_ERR(scope->env);
+	}
+	return false;
+}
+
+// Read the start of an array up to its first element: the element type if not part of the
+// definition, and any dimensions not part of the definition.
+static bool plan_array_begin(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	const struct type_plan **elem_out, size_t *count_out
+) {
+	const struct userp_type_array *ta= (const struct userp_type_array*) plan->typeobj;
+	const struct type_plan *elem= plan->elem;
+	size_t elem_type, dim_count, dim, count= 1, i;
+	int64_t dim_val;
+	if (plan->align && !plan_align(in, plan->align))
+		return plan_overrun(in);
+	if (!elem) {
+		if (!plan_read_vqty(&elem_type, in))
+			goto fail_vqty;
+		if (!(elem= userp_scope_get_type_plan(scope, elem_type)))
+			return false;
+	}
+	dim_count= ta->dimension_count;
+	if (!dim_count && !plan_read_vqty(&dim_count, in))
+		goto fail_vqty;
+	for (i= 0; i < dim_count; i++) {
+		dim= i < ta->dimension_count? ta->dimensions[i] : 0;
+		if (!dim) {
+			if (plan->dim && plan->dim->op >= PLAN_INT_TWOS && plan->dim->op <= PLAN_INT_VQTY_SIGNED) {
+				if (!userp_plan_read_int(plan->dim, in, &dim_val))
+					return false;
+				if (dim_val < 0)
+					goto fail_dim;
+				dim= (size_t) dim_val;
+			}
+			else if (!plan_read_vqty(&dim, in))
+				goto fail_vqty;
+		}
+		if (SIZET_MUL_CAN_OVERFLOW(count, dim))
+			goto fail_dim;
+		count *= dim;
+	}
+	*elem_out= elem;
+	*count_out= count;
+	return true;
+	CATCH(fail_vqty) {
+		USERP_DISPATCH_ERR(scope->env);
+	}
+	CATCH(fail_dim) {
+		userp_diag_set(&scope->env->err, USERP_ELIMIT, "Array dimensions are too large");
+		USERP_DISPATCH_ERR(scope->env);
+	}
+	return false;
+}
+
+static bool plan_skip_array(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in, int depth) {
+	const struct type_plan *elem;
+	size_t count, size, stride, i;
+	if (!plan_array_begin(scope, plan, in, &elem, &count))
+		return false;
+	if (!count)
+		return true;
+	if (elem->flags & PLAN_FIXED) {
+		// Every element has the same size, so skip them all at once
+		if (elem->align && !plan_align(in, elem->align))
+			return plan_overrun(in);
+		size= elem->fixed_bits + elem->pad * 8;
+		stride= elem == plan->elem? plan->elem_stride : !elem->align? size
+			: (size + ((size_t)1 << elem->align) - 1) & ~(((size_t)1 << elem->align) - 1);
+		if (SIZET_MUL_CAN_OVERFLOW(stride, count - 1)) {
+			userp_diag_set(&scope->env->err, USERP_ELIMIT, "Array dimensions are too large");
+			USERP_DISPATCH_ERR(scope->env);
+			return false;
+		}
+		if (!plan_skip_bits(in, stride * (count - 1) + size))
+			return plan_overrun(in);
+		return true;
+	}
+	for (i= 0; i < count; i++)
+		if (!plan_skip(scope, elem, in, depth))
+			return false;
+	return true;
+}
+
+static bool plan_skip_choice(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in, int depth) {
+	const struct plan_option *opt;
+	size_t sel, lo= 0, hi= plan->member_count, mid;
+	if (plan->align && !plan_align(in, plan->align))
+		return plan_overrun(in);
+	if (!plan_read_vqty(&sel, in)) {
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	// Binary search for the option whose selector range includes sel
+	while (lo < hi) {
+		mid= (lo + hi) >> 1;
+		if (sel < plan->options[mid].sel_start)
+			hi= mid;
+		else if (sel - plan->options[mid].sel_start >= plan->options[mid].sel_count)
+			lo= mid + 1;
+		else
+			break;
+	}
+	if (lo >= hi) {
+		userp_diag_setf(&scope->env->err, USERP_ELIMIT,
+			"Selector " USERP_DIAG_INDEX " exceeds the options of the choice", (int) sel);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	opt= &plan->options[mid];
+	// Merged options and constant values are entirely described by the selector
+	if (opt->merged || !opt->plan)
+		return true;
+	return plan_skip(scope, opt->plan, in, depth);
+}
+
+static bool plan_skip(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in, int depth) {
+	size_t ref;
+	if (++depth > PLAN_NESTING_MAX) {
+		userp_diag_setf(&scope->env->err, USERP_ELIMIT,
+			"Data is nested more than " USERP_DIAG_COUNT " levels deep", (size_t) PLAN_NESTING_MAX);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	if (plan->flags & PLAN_FIXED) {
+		if (plan->align && !plan_align(in, plan->align))
+			return plan_overrun(in);
+		if (!plan_skip_bits(in, plan->fixed_bits + plan->pad * 8))
+			return plan_overrun(in);
+		return true;
+	}
+	switch (plan->op) {
+	case PLAN_ANY:
+		if (plan->align && !plan_align(in, plan->align))
+			return plan_overrun(in);
+		if (!plan_read_vqty(&ref, in))
+			goto fail_vqty;
+		if (!ref) {
+			userp_diag_set(&scope->env->err, USERP_ETYPE, "Value of type Any refers to type 0");
+			USERP_DISPATCH_ERR(scope->env);
+			return false;
+		}
+		if (!(plan= userp_scope_get_type_plan(scope, ref)))
+			return false;
+		return plan_skip(scope, plan, in, depth);
+	case PLAN_TYPEREF:
+	case PLAN_SYMREF:
+	case PLAN_INT_VQTY:
+	case PLAN_INT_VQTY_SIGNED:
+		if (plan->align && !plan_align(in, plan->align))
+			return plan_overrun(in);
+		if (!plan_read_vqty(&ref, in))
+			goto fail_vqty;
+		break;
+	case PLAN_CHOICE:
+		if (!plan_skip_choice(scope, plan, in, depth))
+			return false;
+		break;
+	case PLAN_ARRAY:
+		if (!plan_skip_array(scope, plan, in, depth))
+			return false;
+		break;
+	case PLAN_RECORD:
+		if (!plan_skip_record(scope, plan, in, depth))
+			return false;
+		break;
+	default:
+		userp_diag_setf(&scope->env->err, USERP_ETYPE,
+			"Type " USERP_DIAG_INDEX " has no definition", (int) plan->type);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	if (plan->pad && !plan_skip_bits(in, plan->pad << 3))
+		return plan_overrun(in);
+	return true;
+	CATCH(fail_vqty) {
+		USERP_DISPATCH_ERR(scope->env);
+	}
+	return false;
+}
+
+bool userp_plan_skip(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in) {
+	return plan_skip(scope, plan, in, 0);
+}
+
+/*IMPLDOC
+
+#### userp_plan_read_int_array
+
+    size_t count= sizeof(samples)/sizeof(*samples);
+    if (!userp_plan_read_int_array(scope, plan, &in, samples, sizeof(*samples), &count, 0))
+      ... // error was dispatched to scope->env
+
+Read an entire array of integers into a native array of `elem_size` bytes (1, 2, 4 or 8) per
+element.  `*count` is the capacity of `out` on input, and the number of elements on output.
+If the array holds more elements than that, this fails with `USERP_ELIMIT` and stores the
+number of elements required into `*count`.  With flag `USERP_DEC_UNSIGNED` the output is
+checked against the range of an unsigned type instead of a signed one.
+
+If the elements have a fixed number of bits (up to 57) packed end to end, they are unpacked in
+blocks by a kernel that never touches the bit-level input state.  Each element is loaded with
+one unaligned read at a precomputed byte offset and shift, so the kernel has no dependency from
+one element to the next.  On x86 with AVX2, widths of up to 25 bits unpack 8 elements at a time
+using a gather.  Every group of 8 elements spans exactly `bits` bytes, so the per-lane offsets
+and shifts never change.  Then a second pass applies the byte swap (if any), sign extension or
+min/max offset, accumulates the differences of a delta-encoded type, stores into the output
+width, and checks the range only if the type's range doesn't fit the output (or is a delta).  Any other element encoding is read one at a time.  Define
+`USERP_NO_SIMD` to build only the scalar kernel.
+
+*/
+
+#define INT_UNPACK_BLOCK 256
+
+typedef void (*int_unpack_fn)(uint64_t *dst, const uint8_t *src, size_t bitpos, int bits, size_t n);
+
+// Unpack n elements of 'bits' bits (at most 57) beginning 'bitpos' bits after src.
+// The caller guarantees that 8 bytes can be read from the byte holding the last element.
+static void int_unpack_scalar(uint64_t *dst, const uint8_t *src, size_t bitpos, int bits, size_t n) {
+	uint64_t mask= ((uint64_t)1 << bits) - 1;
+	size_t i;
+	for (i= 0; i < n; i++, bitpos += bits)
+		dst[i]= (userp_load_le64((char*)(src + (bitpos >> 3))) >> (bitpos & 7)) & mask;
+}
+
+#if !defined(USERP_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+__attribute__((target("avx2")))
+static void int_unpack_avx2(uint64_t *dst, const uint8_t *src, size_t bitpos, int bits, size_t n) {
+	__m256i ofs, shift, mask, v;
+	size_t i= 0;
+	if (bits <= 25) {
+		src += bitpos >> 3;
+		bitpos &= 7;
+		// Each lane reads 32 bits from byte (bitpos + lane*bits)/8, shifted by the remainder
+		ofs= _mm256_setr_epi32(0, bits, 2*bits, 3*bits, 4*bits, 5*bits, 6*bits, 7*bits);
+		ofs= _mm256_add_epi32(ofs, _mm256_set1_epi32((int) bitpos));
+		shift= _mm256_and_si256(ofs, _mm256_set1_epi32(7));
+		ofs= _mm256_srli_epi32(ofs, 3);
+		mask= _mm256_set1_epi32((int)(((uint32_t)1 << bits) - 1));
+		for (; i + 8 <= n; i += 8, src += bits) {
+			v= _mm256_i32gather_epi32((const int*) src, ofs, 1);
+			v= _mm256_and_si256(_mm256_srlv_epi32(v, shift), mask);
+			_mm256_storeu_si256((__m256i*)(dst + i), _mm256_cvtepu32_epi64(_mm256_castsi256_si128(v)));
+			_mm256_storeu_si256((__m256i*)(dst + i + 4), _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1)));
+		}
+	}
+	int_unpack_scalar(dst + i, src, bitpos, bits, n - i);
+}
+#define INT_UNPACK_HAVE_AVX2
+#endif
+
+// Chosen when the library loads, so that decoding threads only ever read it
+static int_unpack_fn int_unpack= int_unpack_scalar;
+
+#ifdef INT_UNPACK_HAVE_AVX2
+__attribute__((constructor))
+static void int_unpack_init(void) {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		int_unpack= int_unpack_avx2;
+}
+#endif
+
+/*IMPLDOC
+
+#### userp_decode_vqty_array
+
+    uint64_t values[256];
+    size_t n= userp_decode_vqty_array(values, 256, &in);
+
+Decode up to `n` consecutive variable-length quantities from a byte-aligned `userp_bit_io`,
+returning the number decoded.  If that is less than `n`, an error is stored in the env (but not
+dispatched) as for `userp_decode_vqty_quick`.
+
+Within a part, while at least 16 bytes remain, values are decoded by a run kernel that never
+checks bounds per byte.  The length of each value comes from a 16-entry table indexed by the low
+4 bits of its first byte, and the value is one unaligned load masked and shifted by tables.  The
+SIMD kernels also check a whole window for a run of same-length values.  If the low bit of every
+byte in 16 (SSE2) or 32 (AVX2) bytes is 0, those are all 1-byte values, decoded with one shift.
+If every 16-bit word in 16 bytes ends with binary 01, those are 8 2-byte values.  Small IDs,
+counts, and deltas are mostly such runs.  Near the end of a part, and for 64-bit or BigInt
+prefixes, each value is decoded by `userp_decode_vqty_quick`.
+
+*/
+
+// Length of a quantity by the low 4 bits of its first byte.  0 means check for 0x07 or 0x0F.
+static const uint8_t vqty_len[16]= { 1,2,1,4, 1,2,1,0, 1,2,1,4, 1,2,1,0 };
+static const uint32_t vqty_mask[5]= { 0, 0xFF, 0xFFFF, 0, 0xFFFFFFFF };
+static const uint8_t vqty_shift[5]= { 0, 1, 2, 0, 3 };
+
+typedef size_t (*vqty_run_fn)(uint64_t *dst, size_t n, const uint8_t **pos, const uint8_t *lim);
+
+// Decode up to n quantities of 1, 2, 4, or 5 bytes while 16 bytes remain before lim.
+// Returns the number decoded, and stops early at any other prefix.
+static size_t vqty_run_scalar(uint64_t *dst, size_t n, const uint8_t **pos, const uint8_t *lim) {
+	const uint8_t *p= *pos;
+	size_t i;
+	for (i= 0; i < n && p + 16 <= lim; i++) {
+		// Branches are cheaper than a table here, because lengths tend to repeat
+		if (!(*p & 1))
+			dst[i]= *p++ >> 1;
+		else if (!(*p & 2)) {
+			dst[i]= userp_load_le16((char*) p) >> 2;
+			p += 2;
+		}
+		else if (!(*p & 4)) {
+			dst[i]= userp_load_le32((char*) p) >> 3;
+			p += 4;
+		}
+		else if (*p == 0x07) {
+			dst[i]= userp_load_le32((char*) p + 1);
+			p += 5;
+		}
+		else
+			break;
+	}
+	*pos= p;
+	return i;
+}
+
+#if !defined(USERP_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+static size_t vqty_run_sse2(uint64_t *dst, size_t n, const uint8_t **pos, const uint8_t *lim) {
+	const __m128i zero= _mm_setzero_si128(), low2= _mm_set1_epi16(3), one= _mm_set1_epi16(1);
+	const uint8_t *p= *pos;
+	__m128i v, w;
+	size_t i= 0, done;
+	while (i < n && p + 16 <= lim) {
+		v= _mm_loadu_si128((const __m128i*) p);
+		if (i + 16 <= n && !(_mm_movemask_epi8(_mm_slli_epi16(v, 7)) & 0xFFFF)) {
+			// 16 values of 1 byte
+			v= _mm_and_si128(_mm_srli_epi16(v, 1), _mm_set1_epi8(0x7F));
+			w= _mm_unpacklo_epi8(v, zero);
+			_mm_storeu_si128((__m128i*)(dst + i),     _mm_unpacklo_epi32(_mm_unpacklo_epi16(w, zero), zero));
+			_mm_storeu_si128((__m128i*)(dst + i + 2), _mm_unpackhi_epi32(_mm_unpacklo_epi16(w, zero), zero));
+			_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpacklo_epi32(_mm_unpackhi_epi16(w, zero), zero));
+			_mm_storeu_si128((__m128i*)(dst + i + 6), _mm_unpackhi_epi32(_mm_unpackhi_epi16(w, zero), zero));
+			w= _mm_unpackhi_epi8(v, zero);
+			_mm_storeu_si128((__m128i*)(dst + i + 8),  _mm_unpacklo_epi32(_mm_unpacklo_epi16(w, zero), zero));
+			_mm_storeu_si128((__m128i*)(dst + i + 10), _mm_unpackhi_epi32(_mm_unpacklo_epi16(w, zero), zero));
+			_mm_storeu_si128((__m128i*)(dst + i + 12), _mm_unpacklo_epi32(_mm_unpackhi_epi16(w, zero), zero));
+			_mm_storeu_si128((__m128i*)(dst + i + 14), _mm_unpackhi_epi32(_mm_unpackhi_epi16(w, zero), zero));
+			p += 16;
+			i += 16;
+		}
+		else if (i + 8 <= n && _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, low2), one)) == 0xFFFF) {
+			// 8 values of 2 bytes
+			v= _mm_srli_epi16(v, 2);
+			_mm_storeu_si128((__m128i*)(dst + i),     _mm_unpacklo_epi32(_mm_unpacklo_epi16(v, zero), zero));
+			_mm_storeu_si128((__m128i*)(dst + i + 2), _mm_unpackhi_epi32(_mm_unpacklo_epi16(v, zero), zero));
+			_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpacklo_epi32(_mm_unpackhi_epi16(v, zero), zero));
+			_mm_storeu_si128((__m128i*)(dst + i + 6), _mm_unpackhi_epi32(_mm_unpackhi_epi16(v, zero), zero));
+			p += 16;
+			i += 8;
+		}
+		else {
+			// Mixed lengths; decode a block the scalar way before checking again
+			done= vqty_run_scalar(dst + i, n - i < 64? n - i : 64, &p, lim);
+			i += done;
+			if (done < 64 && i < n)
+				break;
+		}
+	}
+	*pos= p;
+	return i;
+}
+#define VQTY_RUN_DEFAULT vqty_run_sse2
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+__attribute__((target("avx2")))
+static size_t vqty_run_avx2(uint64_t *dst, size_t n, const uint8_t **pos, const uint8_t *lim) {
+	const uint8_t *p= *pos;
+	__m256i v;
+	size_t i= 0;
+	while (i + 32 <= n && p + 32 <= lim) {
+		v= _mm256_loadu_si256((const __m256i*) p);
+		if (_mm256_movemask_epi8(_mm256_slli_epi16(v, 7)))
+			break;
+		// 32 values of 1 byte
+		v= _mm256_and_si256(_mm256_srli_epi16(v, 1), _mm256_set1_epi8(0x7F));
+		_mm256_storeu_si256((__m256i*)(dst + i),      _mm256_cvtepu8_epi64(_mm256_castsi256_si128(v)));
+		_mm256_storeu_si256((__m256i*)(dst + i + 4),  _mm256_cvtepu8_epi64(_mm_srli_si128(_mm256_castsi256_si128(v), 4)));
+		_mm256_storeu_si256((__m256i*)(dst + i + 8),  _mm256_cvtepu8_epi64(_mm_srli_si128(_mm256_castsi256_si128(v), 8)));
+		_mm256_storeu_si256((__m256i*)(dst + i + 12), _mm256_cvtepu8_epi64(_mm_srli_si128(_mm256_castsi256_si128(v), 12)));
+		_mm256_storeu_si256((__m256i*)(dst + i + 16), _mm256_cvtepu8_epi64(_mm256_extracti128_si256(v, 1)));
+		_mm256_storeu_si256((__m256i*)(dst + i + 20), _mm256_cvtepu8_epi64(_mm_srli_si128(_mm256_extracti128_si256(v, 1), 4)));
+		_mm256_storeu_si256((__m256i*)(dst + i + 24), _mm256_cvtepu8_epi64(_mm_srli_si128(_mm256_extracti128_si256(v, 1), 8)));
+		_mm256_storeu_si256((__m256i*)(dst + i + 28), _mm256_cvtepu8_epi64(_mm_srli_si128(_mm256_extracti128_si256(v, 1), 12)));
+		p += 32;
+		i += 32;
+	}
+	*pos= p;
+	// Not a run of 32 1-byte values; let the SSE2 kernel continue
+	return i + vqty_run_sse2(dst + i, n - i, pos, lim);
+}
+#define VQTY_RUN_HAVE_AVX2
+#endif
+#else
+#define VQTY_RUN_DEFAULT vqty_run_scalar
+#endif
+
+// Chosen when the library loads, like int_unpack
+static vqty_run_fn vqty_run= VQTY_RUN_DEFAULT;
+
+#ifdef VQTY_RUN_HAVE_AVX2
+__attribute__((constructor))
+static void vqty_run_init(void) {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		vqty_run= vqty_run_avx2;
+}
+#endif
+
+size_t userp_decode_vqty_array(uint64_t *out, size_t n, struct userp_bit_io *in) {
+	size_t i= 0, val;
+	while (i < n) {
+		if (in->lim - in->pos >= 16)
+			i += vqty_run(out + i, n - i, (const uint8_t**) &in->pos, in->lim);
+		// Then one value the slow way, near the end of the part or for a large prefix
+		if (i < n) {
+			if (!userp_decode_vqty_quick(&val, in))
+				break;
+			out[i++]= val;
+		}
+	}
+	return i;
+}
+
+// Parameters for converting an unpacked element to its value and storing it
+struct int_array_store {
+	uint64_t base, flip, negate; // value= base + ((((raw ^ flip) - flip) ^ negate) - negate)
+	int64_t min, max;            // range of the output, if range_check
+	bool range_check, unsigned_out, bswap, zigzag;
+	bool delta, delta_zigzag;    // value= prev + (zigzag-decoded) value
+	int bits;
+	uint64_t prev;               // previous value, for delta
+};
+
+// Convert and store n unpacked elements at out[i...]
+static bool int_array_store(struct int_array_store *st, const uint64_t *raw, void *out,
+	size_t elem_size, size_t i, size_t n
+) {
+	uint64_t v;
+	size_t j;
+	bool in_range= true;
+	// The loop is repeated per output width, so that each copy can be vectorized
+	#define INT_ARRAY_STORE_LOOP(type) \
+		for (j= 0; j < n; j++) { \
+			v= raw[j]; \
+			if (st->bswap) \
+				v= __builtin_bswap64(v) >> (64 - st->bits); \
+			if (st->zigzag) \
+				v= (v >> 1) ^ (0 - (v & 1)); \
+			v= st->base + ((((v ^ st->flip) - st->flip) ^ st->negate) - st->negate); \
+			if (st->delta) { \
+				if (st->delta_zigzag) \
+					v= (v >> 1) ^ (0 - (v & 1)); \
+				v= st->prev += v; \
+			} \
+			if (st->range_check) \
+				in_range &= (int64_t) v >= st->min \
+					&& (st->unsigned_out? v <= (uint64_t) st->max : (int64_t) v <= st->max); \
+			((type*) out)[i + j]= (type) v; \
+		}
+	switch (elem_size) {
+	case 1: INT_ARRAY_STORE_LOOP(uint8_t); break;
+	case 2: INT_ARRAY_STORE_LOOP(uint16_t); break;
+	case 4: INT_ARRAY_STORE_LOOP(uint32_t); break;
+	default: INT_ARRAY_STORE_LOOP(uint64_t);
+	}
+	#undef INT_ARRAY_STORE_LOOP
+	return in_range;
+}
+
+// Begin reading an array into a caller's buffer of *count elements, and set *count to the
+// number of elements in the array.
+static bool plan_read_array_begin(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	const struct type_plan **elem_out, size_t *count
+) {
+	size_t n;
+	if (plan->op != PLAN_ARRAY) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE, "Type " USERP_DIAG_INDEX " is not an array", (int) plan->type);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	if (!plan_array_begin(scope, plan, in, elem_out, &n))
+		return false;
+	if (n > *count) {
+		userp_diag_setf(&scope->env->err, USERP_ELIMIT,
+			"Array has " USERP_DIAG_COUNT " elements, but buffer holds " USERP_DIAG_COUNT2, n, *count);
+		USERP_DISPATCH_ERR(scope->env);
+		*count= n;
+		return false;
+	}
+	*count= n;
+	return true;
+}
+
+// Read n integer elements of plan 'elem' into out[], after plan_read_array_begin
+static bool plan_read_int_elems(userp_scope scope, const struct type_plan *elem, size_t n, struct userp_bit_io *in,
+	void *out, size_t elem_size, int flags
+) {
+	struct int_array_store st;
+	uint64_t raw[INT_UNPACK_BLOCK], range;
+	int64_t val, lo, hi;
+	size_t i, avail, bitpos, block;
+	int bits;
+
+	if (elem->op < PLAN_INT_TWOS || elem->op > PLAN_INT_VQTY_SIGNED) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE,
+			"Array elements of type " USERP_DIAG_INDEX " are not integers", (int) elem->type);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	// The range of the output
+	bzero(&st, sizeof(st));
+	st.unsigned_out= (flags & USERP_DEC_UNSIGNED) != 0;
+	st.min= st.unsigned_out? 0 : elem_size == 8? INT64_MIN : -((int64_t)1 << (elem_size*8 - 1));
+	st.max= st.unsigned_out? (elem_size == 8? -1 : (int64_t)(((uint64_t)1 << (elem_size*8)) - 1))
+		: elem_size == 8? INT64_MAX : ((int64_t)1 << (elem_size*8 - 1)) - 1;
+	bits= elem->bits;
+	// Delta elements accumulate, so any element could be out of range
+	st.delta= (elem->flags & PLAN_DELTA) != 0;
+	st.delta_zigzag= (elem->flags & PLAN_DELTA_ZIGZAG) != 0;
+	// Variable-length elements are decoded in batches
+	if ((elem->op == PLAN_INT_VQTY || elem->op == PLAN_INT_VQTY_SIGNED) && elem->align <= 3 && !elem->pad) {
+		st.range_check= true;
+		st.zigzag= elem->op == PLAN_INT_VQTY_SIGNED;
+		st.base= elem->op == PLAN_INT_VQTY? (uint64_t) elem->base : 0;
+		st.negate= (elem->flags & PLAN_DESCENDING)? ~(uint64_t)0 : 0;
+		if (in->accum_bits && !plan_skip_bits(in, 8 - in->accum_bits))
+			return plan_overrun(in);
+		for (i= 0; i < n; i += block) {
+			block= n - i < INT_UNPACK_BLOCK? n - i : INT_UNPACK_BLOCK;
+			if (userp_decode_vqty_array(raw, block, in) < block) {
+				USERP_DISPATCH_ERR(scope->env);
+				return false;
+			}
+			if (!int_array_store(&st, raw, out, elem_size, i, block))
+				goto fail_range;
+		}
+		return true;
+	}
+	// Only packed fixed-width elements can use the bulk path
+	if ((elem->op != PLAN_INT_TWOS && elem->op != PLAN_INT_BITS)
+		|| bits > 57 || !bits || elem->pad || (elem->align && (bits & ((1 << elem->align) - 1)))
+		|| ((elem->flags & PLAN_BSWAP) && (bits & 7))
+	) {
+		// userp_plan_read_int_next already accumulated a delta
+		st.bits= 64;
+		st.range_check= true;
+		st.delta= false;
+		val= 0;
+		for (i= 0; i < n; i++) {
+			if (!userp_plan_read_int_next(elem, in, &val))
+				return false;
+			raw[0]= (uint64_t) val;
+			if (!int_array_store(&st, raw, out, elem_size, i, 1))
+				goto fail_range;
+		}
+		return true;
+	}
+	// Determine how to get from the raw bits to the value, and whether any value could be
+	// out of range for the output.
+	st.bits= bits;
+	st.bswap= (elem->flags & PLAN_BSWAP) != 0;
+	range= (uint64_t)1 << bits; // bits <= 57
+	if (elem->op == PLAN_INT_TWOS) {
+		st.flip= (uint64_t)1 << (bits - 1);
+		lo= -(int64_t)(range >> 1);
+		hi= (int64_t)(range >> 1) - 1;
+	}
+	else {
+		st.base= (uint64_t) elem->base;
+		st.negate= (elem->flags & PLAN_DESCENDING)? ~(uint64_t)0 : 0;
+		lo= st.negate? (int64_t)((uint64_t) elem->base - (range - 1)) : elem->base;
+		hi= st.negate? elem->base : (int64_t)((uint64_t) elem->base + (range - 1));
+		// If the range wraps around int64, check every value
+		if (hi < lo)
+			lo= INT64_MIN, hi= INT64_MAX;
+	}
+	st.range_check= st.delta
+		|| (st.unsigned_out? (lo < 0 || (elem_size < 8 && hi > st.max)) : (lo < st.min || hi > st.max));
+	if (elem->align && !plan_align(in, elem->align))
+		return plan_overrun(in);
+	for (i= 0; i < n; ) {
+		userp_bit_io_at_end(in);
+		// Unpack as many elements as can be loaded with 8-byte reads within this part
+		avail= in->lim - in->pos;
+		bitpos= in->accum_bits;
+		if (avail >= 8 && (avail - 8) * 8 >= bitpos) {
+			size_t fit= ((avail - 8) * 8 - bitpos) / bits + 1;
+			if (fit > n - i)
+				fit= n - i;
+			while (fit) {
+				block= fit < INT_UNPACK_BLOCK? fit : INT_UNPACK_BLOCK;
+				int_unpack(raw, in->pos, bitpos, bits, block);
+				if (!int_array_store(&st, raw, out, elem_size, i, block))
+					goto fail_range;
+				bitpos += block * bits;
+				in->pos += bitpos >> 3;
+				bitpos &= 7;
+				i += block;
+				fit -= block;
+			}
+			in->accum_bits= bitpos;
+		}
+		// Then one element across the end of the part
+		if (i < n) {
+			if (!plan_read_bits(&raw[0], in, bits))
+				return plan_overrun(in);
+			if (!int_array_store(&st, raw, out, elem_size, i, 1))
+				goto fail_range;
+			i++;
+		}
+	}
+	return true;
+	CATCH(fail_range) {
+		userp_diag_setf(&scope->env->err, USERP_ELIMIT,
+			"Array element does not fit in " USERP_DIAG_SIZE "-byte integer", elem_size);
+		USERP_DISPATCH_ERR(scope->env);
+	}
+	return false;
+}
+
+bool userp_plan_read_int_array(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	void *out, size_t elem_size, size_t *count, int flags
+) {
+	const struct type_plan *elem;
+	if (elem_size != 1 && elem_size != 2 && elem_size != 4 && elem_size != 8) {
+		userp_diag_setf(&scope->env->err, USERP_EDOINGITWRONG,
+			"Integer element size must be 1, 2, 4, or 8 (not " USERP_DIAG_SIZE ")", elem_size);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	return plan_read_array_begin(scope, plan, in, &elem, count)
+		&& plan_read_int_elems(scope, elem, *count, in, out, elem_size, flags);
+}
+
+bool userp_plan_read_struct_array(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	void *out, size_t sizeof_struct, size_t *count
+) {
+	const struct type_plan *elem;
+	uint8_t *dst= (uint8_t*) out;
+	size_t size, stride, i;
+	if (!plan_read_array_begin(scope, plan, in, &elem, count))
+		return false;
+	// Checks the element type, and aligns to the first element
+	if (!(size= plan_struct_prepare(elem, in, sizeof_struct)))
+		return false;
+	stride= (elem == plan->elem? plan->elem_stride : !elem->align? size * 8
+		: (size * 8 + ((size_t)1 << elem->align) - 1) & ~(((size_t)1 << elem->align) - 1)) >> 3;
+	if (stride == sizeof_struct && size == sizeof_struct && (size_t)(in->lim - in->pos) / size >= *count) {
+		memcpy(dst, in->pos, size * *count);
+		in->pos += size * *count;
+	}
+	else {
+		for (i= 0; i < *count; i++)
+			if (!userp_plan_copy_struct(elem, in, dst + i * sizeof_struct, sizeof_struct))
+				return false;
+	}
+	if (plan->pad && !plan_skip_bits(in, plan->pad << 3))
+		return plan_overrun(in);
+	return true;
+}
+
+/*IMPLDOC
+
+#### userp_plan_read_double_array
+
+    size_t count= sizeof(readings)/sizeof(*readings);
+    if (!userp_plan_read_double_array(scope, plan, &in, readings, &count))
+      ... // error was dispatched to scope->env
+
+Read an array of integers into a native array of `double`, applying the `scale` and `bias` of a
+fixed-point element type (`PLAN_SCALED`).  The integers are first decoded as `int64_t` directly
+into `out` by the code of `userp_plan_read_int_array` (so they get its bulk unpacking), and then converted in
+place, since both are 8 bytes.  With AVX2 and FMA, the conversion handles 4 elements at a time:
+an integer in [-2**51, 2**51) converts exactly by adding it to the bits of the double 2**52+2**51
+and subtracting that double, and then one fused multiply-add applies the scale and bias.  Any
+group of 4 with a larger element is converted the scalar way.
+
+`userp_plan_read_double` does the same for a single value.  Both also accept IEEE floats, below,
+and `userp_plan_read_float_array` is the same with a choice of `float` or `double` output.
+
+*/
+
+static bool plan_read_ieee(const struct type_plan *plan, struct userp_bit_io *in, double *out);
+
+bool userp_plan_read_double(const struct type_plan *plan, struct userp_bit_io *in, double *out) {
+	int64_t val;
+	if (plan->flags & PLAN_IEEE_FLOAT)
+		return plan_read_ieee(plan, in, out);
+	if (!userp_plan_read_int(plan, in, &val))
+		return false;
+	*out= (plan->flags & PLAN_SCALED)? (double) val * plan->scale + plan->bias : (double) val;
+	return true;
+}
+
+typedef void (*int_to_double_fn)(double *buf, size_t n, double scale, double bias);
+
+// Convert n int64_t stored in buf into double, in place
+static void int_to_double_scalar(double *buf, size_t n, double scale, double bias) {
+	int64_t v;
+	size_t i;
+	for (i= 0; i < n; i++) {
+		memcpy(&v, buf + i, sizeof(v));
+		buf[i]= (double) v * scale + bias;
+	}
+}
+
+#if !defined(USERP_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+__attribute__((target("avx2,fma")))
+static void int_to_double_avx2(double *buf, size_t n, double scale, double bias) {
+	const __m256i magic= _mm256_set1_epi64x(0x4338000000000000LL), half_range= _mm256_set1_epi64x((int64_t)1 << 51);
+	const __m256d magic_d= _mm256_set1_pd(6755399441055744.0), s= _mm256_set1_pd(scale), b= _mm256_set1_pd(bias);
+	__m256i v;
+	size_t i;
+	for (i= 0; i + 4 <= n; i += 4) {
+		v= _mm256_loadu_si256((const __m256i*)(buf + i));
+		if (!_mm256_testz_si256(_mm256_srli_epi64(_mm256_add_epi64(v, half_range), 52), _mm256_set1_epi64x(-1))) {
+			int_to_double_scalar(buf + i, 4, scale, bias);
+			continue;
+		}
+		_mm256_storeu_pd(buf + i, _mm256_fmadd_pd(
+			_mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(v, magic)), magic_d), s, b));
+	}
+	int_to_double_scalar(buf + i, n - i, scale, bias);
+}
+#define INT_TO_DOUBLE_HAVE_AVX2
+#endif
+
+// Chosen when the library loads, like int_unpack
+static int_to_double_fn int_to_double= int_to_double_scalar;
+
+#ifdef INT_TO_DOUBLE_HAVE_AVX2
+__attribute__((constructor))
+static void int_to_double_init(void) {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		int_to_double= int_to_double_avx2;
+}
+#endif
+
+/*IMPLDOC
+
+#### IEEE-754 Floats
+
+A record whose static fields are exactly the mantissa, exponent, and sign of an IEEE-754
+binary32 or binary64 number (see `userp_scope_add_float_types`) compiles with the flag
+`PLAN_IEEE_FLOAT`.  Since bits are read least-significant first, its encoding is identical to
+the little-endian native float, so `userp_plan_read_double` loads it with a single read of
+`fixed_bits`, rather than assembling it from fields.
+
+For an array of these whose elements are byte-aligned and follow one another with no padding,
+the encoded elements *are* the native array, and `userp_plan_read_float_array` copies them with
+`memcpy` (plus a byte swap per element on big-endian hosts).  Elements that are bit-packed to an
+odd position, or which need widening from float to double, are read one at a time.
+
+*/
+
+// Copy len bytes from a byte boundary of the input, crossing into following parts
+static bool plan_copy_bytes(struct userp_bit_io *in, uint8_t *dst, size_t len) {
+	size_t n;
+	while (len) {
+		if (userp_bit_io_at_end(in))
+			return false;
+		n= MIN(len, (size_t)(in->lim - in->pos));
+		memcpy(dst, in->pos, n);
+		in->pos += n;
+		dst += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool plan_read_ieee(const struct type_plan *plan, struct userp_bit_io *in, double *out) {
+	uint64_t bits;
+	uint32_t bits32;
+	float f;
+	if (plan->align && !plan_align(in, plan->align))
+		return plan_overrun(in);
+	if (!plan_read_bits(&bits, in, plan->fixed_bits))
+		return plan_overrun(in);
+	if (plan->fixed_bits == 32) {
+		bits32= (uint32_t) bits;
+		memcpy(&f, &bits32, sizeof(f));
+		*out= f;
+	}
+	else
+		memcpy(out, &bits, sizeof(*out));
+	if (plan->pad && !plan_skip_bits(in, plan->pad << 3))
+		return plan_overrun(in);
+	return true;
+}
+
+// Read n elements of the IEEE float plan 'elem' into an array of float (elem_size 4) or double
+static bool plan_read_ieee_elems(userp_scope scope, const struct type_plan *elem, size_t n, struct userp_bit_io *in,
+	void *out, size_t elem_size
+) {
+	size_t i;
+	double d;
+	if (elem_size == 4 && elem->fixed_bits == 64) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE,
+			"Array elements of type " USERP_DIAG_INDEX " are 64-bit floats and do not fit in float", (int) elem->type);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	// Unpadded elements whose size is a multiple of their alignment are contiguous
+	if (n && elem_size * 8 == elem->fixed_bits && !elem->pad
+		&& !(elem->fixed_bits & (((size_t)1 << elem->align) - 1))
+	) {
+		if (elem->align && !plan_align(in, elem->align))
+			return plan_overrun(in);
+		if (!in->accum_bits) {
+			if (!plan_copy_bytes(in, (uint8_t*) out, n * elem_size))
+				return plan_overrun(in);
+			#if ENDIAN == MSB_FIRST
+			for (i= 0; i < n; i++)
+				if (elem_size == 4)
+					((uint32_t*) out)[i]= __builtin_bswap32(((uint32_t*) out)[i]);
+				else
+					((uint64_t*) out)[i]= __builtin_bswap64(((uint64_t*) out)[i]);
+			#endif
+			return true;
+		}
+	}
+	for (i= 0; i < n; i++) {
+		if (!plan_read_ieee(elem, in, &d))
+			return false;
+		if (elem_size == 4)
+			((float*) out)[i]= (float) d;
+		else
+			((double*) out)[i]= d;
+	}
+	return true;
+}
+
+bool userp_plan_read_float_array(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	void *out, size_t elem_size, size_t *count
+) {
+	const struct type_plan *elem;
+	if (elem_size != sizeof(float) && elem_size != sizeof(double)) {
+		userp_diag_setf(&scope->env->err, USERP_EDOINGITWRONG,
+			"Float element size must be 4 or 8 (not " USERP_DIAG_SIZE ")", elem_size);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	if (!plan_read_array_begin(scope, plan, in, &elem, count))
+		return false;
+	if (elem->flags & PLAN_IEEE_FLOAT)
+		return plan_read_ieee_elems(scope, elem, *count, in, out, elem_size);
+	if (elem_size != sizeof(double)) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE,
+			"Array elements of type " USERP_DIAG_INDEX " are not 32-bit floats", (int) elem->type);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	// Integers are unpacked as int64_t into the same buffer, then converted in place
+	if (!plan_read_int_elems(scope, elem, *count, in, out, sizeof(int64_t), 0))
+		return false;
+	if (elem->flags & PLAN_SCALED)
+		int_to_double((double*) out, *count, elem->scale, elem->bias);
+	else
+		int_to_double((double*) out, *count, 1, 0);
+	return true;
+}
+
+bool userp_plan_read_double_array(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	double *out, size_t *count
+) {
+	return userp_plan_read_float_array(scope, plan, in, out, sizeof(double), count);
+}
+
+/*IMPLDOC
+
+#### userp_plan_array_slice
+
+    if (!userp_plan_array_slice(scope, plan, &in, sizeof(int32_t), &slice))
+      ... // error was dispatched to scope->env
+
+Append to `slice` the parts of the input holding the elements of an array, without copying
+them.  The elements must have a fixed size of whole bytes and follow each other with no gap,
+which is true of byte strings and of arrays of fixed-width integers or floats, so the array is
+one run of bytes in the input.  If `elem_size` is nonzero, it must equal the size of an element.
+Each appended part refers to the same `userp_buffer` as the input part it came from, and holds
+a reference to it (if it is reference-counted).  An array split across input parts becomes
+several parts of `slice`; nothing is coalesced.
+
+*/
+
+bool userp_plan_array_slice(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	size_t elem_size, struct userp_bstr *slice
+) {
+	const struct type_plan *elem;
+	struct userp_bstr_part *part;
+	size_t n, size, stride, len, avail, orig_count= slice->part_count;
+	if (plan->op != PLAN_ARRAY) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE, "Type " USERP_DIAG_INDEX " is not an array", (int) plan->type);
+		goto fail;
+	}
+	if (!plan_array_begin(scope, plan, in, &elem, &n))
+		return false;
+	size= elem->fixed_bits + elem->pad * 8;
+	stride= !elem->align? size : (size + ((size_t)1 << elem->align) - 1) & ~(((size_t)1 << elem->align) - 1);
+	if (!(elem->flags & PLAN_FIXED) || (size & 7) || stride != size) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE,
+			"Array elements of type " USERP_DIAG_INDEX " are not contiguous whole bytes", (int) elem->type);
+		goto fail;
+	}
+	if (elem_size && elem_size * 8 != size) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE,
+			"Array element is " USERP_DIAG_SIZE " bytes, not " USERP_DIAG_SIZE2, size >> 3, elem_size);
+		goto fail;
+	}
+	if (SIZET_MUL_CAN_OVERFLOW(n, size >> 3)) {
+		userp_diag_set(&scope->env->err, USERP_ELIMIT, "Array dimensions are too large");
+		goto fail;
+	}
+	len= n * (size >> 3);
+	if (!plan_align(in, elem->align < 3? 3 : elem->align) || userp_bit_io_remaining(in) < len)
+		return plan_overrun(in);
+	while (len) {
+		userp_bit_io_at_end(in);
+		avail= in->lim - in->pos;
+		if (slice->part_count >= slice->part_alloc && !userp_bstr_partalloc(slice, slice->part_count + 1))
+			goto fail_alloc;
+		part= &slice->parts[slice->part_count];
+		part->buf= in->part->buf;
+		part->data= in->pos;
+		part->len= avail < len? avail : len;
+		part->ofs= in->part->ofs + (in->pos - in->part->data);
+		if (part->buf && !userp_grab_buffer(part->buf))
+			goto fail_alloc;
+		slice->part_count++;
+		in->pos += part->len;
+		len -= part->len;
+	}
+	return true;
+	CATCH(fail) {
+		USERP_DISPATCH_ERR(scope->env);
+	}
+	CATCH(fail_alloc) {
+		// Release the parts appended so far
+		while (slice->part_count > orig_count)
+			if (slice->parts[--slice->part_count].buf)
+				userp_drop_buffer(slice->parts[slice->part_count].buf);
+		USERP_DISPATCH_ERR(scope->env);
+	}
+	return false;
+}
+
+#ifdef UNIT_TEST
+
+static const char *test_plan_op_names[]= {
+	"NONE", "ANY", "TYPEREF", "SYMREF", "INT_TWOS", "INT_BITS", "INT_VQTY", "INT_VQTY_SIGNED",
+	"CHOICE", "ARRAY", "RECORD_FIXED", "RECORD"
+};
+
+UNIT_TEST(plan_compile) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope syms= userp_new_scope(env, NULL), scope;
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part;
+	const struct type_plan *plan;
+	userp_type i;
+	size_t j;
+
+	test_build_typetable(tt, syms);
+	userp_scope_finalize(syms, 0);
+	scope= userp_new_scope(env, syms);
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 12, 0))
+		printf("parse failed\n");
+	// Compile one type out of order, then the rest via finalize
+	plan= userp_scope_get_type_plan(scope, 9);
+	printf("planned=%d\n", (int) scope->typetable.planned);
+	if (!userp_scope_finalize(scope, 0))
+		printf("finalize failed\n");
+	for (i= 1; i <= 12; i++) {
+		plan= userp_scope_get_type_plan(scope, i);
+		printf("%d %s", (int) i, test_plan_op_names[plan->op]);
+		if (plan->flags & PLAN_FIXED) printf(" fixed=%d", (int) plan->fixed_bits);
+		if (plan->align) printf(" align=%d", plan->align);
+		if (plan->pad) printf(" pad=%d", (int) plan->pad);
+		if (plan->op == PLAN_INT_BITS) printf(" base=%d", (int) plan->base);
+		if (plan->op == PLAN_ARRAY) printf(" elem=%d stride=%d count=%d",
+			(int) plan->elem->type, (int) plan->elem_stride, (int) plan->elem_count);
+		if (plan->op == PLAN_CHOICE)
+			for (j= 0; j < plan->member_count; j++)
+				printf(" [%d+%d]", (int) plan->options[j].sel_start, (int) plan->options[j].sel_count);
+		if (plan->op == PLAN_RECORD || plan->op == PLAN_RECORD_FIXED)
+			for (j= 0; j < plan->member_count; j++)
+				printf(" %s@%d", userp_scope_get_symbol_str(scope, plan->fields[j].name), (int) plan->fields[j].ofs);
+		printf("\n");
+	}
+	plan= userp_scope_get_type_plan(scope, 9);
+	printf("self-reference: %s\n", plan->fields[1].plan == plan? "ok" : "wrong");
+	free(tt);
+	userp_drop_scope(scope);
+	userp_drop_scope(syms);
+	userp_drop_env(env);
+}
+/*OUTPUT
+planned=8
+1 INT_BITS fixed=8 base=-128
+2 INT_VQTY_SIGNED
+3 INT_TWOS fixed=2
+4 CHOICE \[0\+10\] \[10\+1\]
+5 ARRAY elem=1 stride=8 count=0
+6 ARRAY fixed=72 elem=1 stride=8 count=9
+7 RECORD_FIXED fixed=16 x@0 y@8
+8 RECORD_FIXED fixed=16 align=4 x@0 y@8
+9 RECORD value@0 next@0
+10 ANY
+11 SYMREF pad=2
+12 TYPEREF
+self-reference: ok
+*/
+
+// Encode a quantity in the same format as test_tt_vqty
+#define TEST_DATA(...) test_tt_put(data, sizeof((size_t[]){__VA_ARGS__})/sizeof(size_t), __VA_ARGS__)
+
+static userp_scope test_plan_scope(userp_env env, userp_scope *syms) {
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part;
+	userp_scope scope;
+	*syms= userp_new_scope(env, NULL);
+	test_build_typetable(tt, *syms);
+	userp_scope_finalize(*syms, 0);
+	scope= userp_new_scope(env, *syms);
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 12, 0))
+		printf("parse failed\n");
+	free(tt);
+	return scope;
+}
+
+// Point a bit_io at 'data' divided into two parts at 'split'
+static void test_plan_input(struct userp_bit_io *in, struct userp_bstr *str, struct userp_bstr_part *parts,
+	uint8_t *data, size_t len, size_t split
+) {
+	parts[0].data= data;
+	parts[0].len= split;
+	parts[0].ofs= 0;
+	parts[1].data= data + split;
+	parts[1].len= len - split;
+	parts[1].ofs= split;
+	str->parts= parts;
+	str->part_count= 2;
+	in->str= str;
+	in->part= parts;
+	in->pos= parts[0].data;
+	in->lim= parts[0].data + parts[0].len;
+	in->accum_bits= 0;
+}
+
+UNIT_TEST(plan_skip) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope syms, scope= test_plan_scope(env, &syms);
+	struct test_typetable *data= malloc(sizeof(*data) + 256);
+	struct userp_bstr_part parts[2];
+	struct userp_bstr str= { .env= env };
+	struct userp_bit_io in;
+	static const struct { userp_type type; const char *desc; } values[]= {
+		{ 4, "MaybeInt merged" }, { 4, "MaybeInt value" }, { 5, "Bytes" }, { 6, "Matrix" },
+		{ 8, "AlignedPoint" }, { 9, "Node list" }, { 10, "Any Int8" }, { 11, "Sym" },
+		{ 12, "Type" }, { 2, "Color" }, { 0, NULL }
+	};
+	size_t i, split, ends[16], failures= 0;
+	int64_t val;
+
+	data->len= 0;
+	TEST_DATA(3);                    // MaybeInt: Int8 merged as selector 3
+	ends[0]= data->len;
+	TEST_DATA(10);                   // MaybeInt: the constant value
+	ends[1]= data->len;
+	TEST_DATA(5, 1, 2, 3, 4, 5);     // Bytes: dimension 5, then 5 bytes (which happen to be vqty)
+	ends[2]= data->len;
+	memcpy(data->buf + data->len, "123456789", 9); // Matrix: 3x3 bytes
+	data->len += 9;
+	ends[3]= data->len;
+	data->len= (data->len + 1) & ~(size_t)1; // AlignedPoint: aligned to 16 bits
+	data->buf[data->len++]= 'x';
+	data->buf[data->len++]= 'y';
+	ends[4]= data->len;
+	TEST_DATA(1, 10, 1, 11, 0, 12);  // Node list: presence, value, presence, value, no more
+	ends[5]= data->len;
+	TEST_DATA(1, 42);                // Any: type 1, then Int8
+	ends[6]= data->len;
+	TEST_DATA(7, 0, 0);              // Sym: symbol 7, then 2 bytes of padding
+	ends[7]= data->len;
+	TEST_DATA(9);                    // Type: type 9
+	ends[8]= data->len;
+	TEST_DATA(TEST_SIGNED(-2));      // Color: signed -2
+	ends[9]= data->len;
+
+	// Skip every value, with the input divided at every possible position
+	for (split= 0; split <= data->len; split++) {
+		test_plan_input(&in, &str, parts, data->buf, data->len, split);
+		for (i= 0; values[i].desc; i++) {
+			if (!userp_plan_skip(scope, userp_scope_get_type_plan(scope, values[i].type), &in)) {
+				printf("split %d: failed to skip %s\n", (int) split, values[i].desc);
+				failures++;
+				break;
+			}
+			if (in.part->ofs + (in.pos - in.part->data) != ends[i] || in.accum_bits) {
+				printf("split %d: %s ended at %d, expected %d\n", (int) split, values[i].desc,
+					(int)(in.part->ofs + (in.pos - in.part->data)), (int) ends[i]);
+				failures++;
+				break;
+			}
+		}
+	}
+	printf("skip failures: %d\n", (int) failures);
+
+	// Read integers
+	test_plan_input(&in, &str, parts, data->buf + ends[8], data->len - ends[8], data->len - ends[8]);
+	if (userp_plan_read_int(userp_scope_get_type_plan(scope, 2), &in, &val))
+		printf("Color=%d\n", (int) val);
+	data->len= 0;
+	data->buf[data->len++]= 0x05;
+	data->buf[data->len++]= 0xFF;
+	data->buf[data->len++]= 0x36;
+	test_plan_input(&in, &str, parts, data->buf, data->len, 2);
+	if (userp_plan_read_int(userp_scope_get_type_plan(scope, 1), &in, &val))
+		printf("Int8=%d\n", (int) val);
+	if (userp_plan_read_int(userp_scope_get_type_plan(scope, 1), &in, &val))
+		printf("Int8=%d\n", (int) val);
+	// SmallColor is 2 bits, packed LSB first
+	for (i= 0; i < 4; i++)
+		if (userp_plan_read_int(userp_scope_get_type_plan(scope, 3), &in, &val))
+			printf("SmallColor=%d\n", (int) val);
+	if (userp_plan_read_int(userp_scope_get_type_plan(scope, 3), &in, &val))
+		printf("SmallColor=%d\n", (int) val);
+	free(data);
+	userp_drop_scope(scope);
+	userp_drop_scope(syms);
+	userp_drop_env(env);
+}
+/*OUTPUT
+skip failures: 0
+Color=-2
+Int8=-123
+Int8=127
+SmallColor=-2
+SmallColor=1
+SmallColor=-1
+SmallColor=0
+error: Data ends before the end of the value
+*/
+
+UNIT_TEST(plan_skip_errors) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope syms, scope= test_plan_scope(env, &syms);
+	struct test_typetable *data= malloc(sizeof(*data) + 256);
+	struct userp_bstr_part parts[2];
+	struct userp_bstr str= { .env= env };
+	struct userp_bit_io in;
+	#define TEST_SKIP(type) ( \
+		test_plan_input(&in, &str, parts, data->buf, data->len, data->len), \
+		userp_plan_skip(scope, userp_scope_get_type_plan(scope, type), &in)? printf("ok\n") : 0 )
+
+	data->len= 0;
+	TEST_DATA(5, 1, 2);              // Bytes: dimension 5, but only 2 bytes
+	TEST_SKIP(5);
+	data->len= 0;
+	TEST_DATA(11);                   // MaybeInt: selector beyond the options
+	TEST_SKIP(4);
+	data->len= 0;
+	TEST_DATA(0);                    // Any: type 0
+	TEST_SKIP(10);
+	data->len= 0;
+	TEST_DATA(1, 1, 1, 1);           // Node list: ends before the final node
+	TEST_SKIP(9);
+	#undef TEST_SKIP
+	free(data);
+	userp_drop_scope(scope);
+	userp_drop_scope(syms);
+	userp_drop_env(env);
+}
+/*OUTPUT
+error: Data ends before the end of the value
+error: Selector 11 exceeds the options of the choice
+error: Value of type Any refers to type 0
+error: Variable-length quantity exceeds end of input
+*/
+// Skip a value by inspecting the type objects at every node, as the decoder did before plans.
+// This supports just the types used by bench_plan_skip.
+static bool test_interp_skip(userp_scope scope, userp_type type, struct userp_bit_io *in) {
+	struct type_entry *entry= userp_scope_get_type_entry(scope, type);
+	size_t i, n, count, presence= 0, often_idx, bits;
+	uintmax_t range;
+	int placement;
+	switch (entry->typeclass) {
+	case TYPE_CLASS_INT: {
+		struct userp_type_int *ti= (struct userp_type_int*) entry->typeobj;
+		if (ti->align && !plan_align(in, ti->align))
+			return false;
+		if (ti->has_bits || (ti->has_min && ti->has_max)) {
+			bits= ti->bits;
+			if (!ti->has_bits)
+				for (bits= 0, range= (uintmax_t) ti->max - (uintmax_t) ti->min; range; range >>= 1)
+					bits++;
+			if (!plan_skip_bits(in, bits))
+				return false;
+		}
+		else if (!plan_read_vqty(&n, in))
+			return false;
+		return !ti->pad || plan_skip_bits(in, ti->pad * 8);
+	}
+	case TYPE_CLASS_ARRAY: {
+		struct userp_type_array *ta= (struct userp_type_array*) entry->typeobj;
+		if (ta->align && !plan_align(in, ta->align))
+			return false;
+		for (i= 0, count= 1; i < ta->dimension_count; i++) {
+			if (!(n= ta->dimensions[i]) && !plan_read_vqty(&n, in))
+				return false;
+			count *= n;
+		}
+		for (i= 0; i < count; i++)
+			if (!test_interp_skip(scope, ta->elem_type, in))
+				return false;
+		return !ta->pad || plan_skip_bits(in, ta->pad * 8);
+	}
+	case TYPE_CLASS_RECORD: {
+		struct userp_type_record *tr= (struct userp_type_record*) entry->typeobj;
+		if (tr->often_field_count && !plan_read_vqty(&presence, in))
+			return false;
+		if (tr->align && !plan_align(in, tr->align))
+			return false;
+		if (!plan_skip_bits(in, tr->static_bits))
+			return false;
+		for (placement= FIELD_PLACEMENT_ALWAYS; placement <= FIELD_PLACEMENT_OFTEN; placement++)
+			for (i= 0, often_idx= 0; i < tr->field_count; i++)
+				if (FIELD_PLACEMENT(tr->fields[i].placement) == placement
+					&& (placement == FIELD_PLACEMENT_ALWAYS || ((presence >> often_idx++) & 1))
+					&& !test_interp_skip(scope, tr->fields[i].type, in))
+					return false;
+		return !tr->pad || plan_skip_bits(in, tr->pad * 8);
+	}
+	}
+	return false;
+}
+
+UNIT_TEST(bench_plan_skip) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	size_t n_rec= argc > 0? atoi(argv[0]) : 100000, iters= argc > 1? atoi(argv[1]) : 10;
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096),
+		*data= malloc(sizeof(*data) + n_rec * 16 + 64);
+	struct userp_bstr_part part;
+	struct userp_bstr str= { .env= env };
+	struct userp_bit_io in;
+	userp_type type;
+	const char *names[]= { "Samples", "Pixels" };
+	double t_interp, t_plan;
+	clock_t start;
+	size_t i, k, fail= 0;
+
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	#define T(id) ((size_t)(id) << 1)
+	tt->len= 0;
+	// 1: U8, 2: Count (vqty from 0), 3: I32 (byte aligned twos complement)
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<5), S("U8"), 8, TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<5), S("Count"), TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<2) + (1<<3), S("I32"), 3, 32);
+	// 4: Sample, with two static bytes, two always fields and one often field
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), S("Sample"), 16, 5,
+		S("id"), T(2), FIELD_PLACEMENT_ALWAYS,
+		S("flags"), T(1), (0<<2)|FIELD_PLACEMENT_STATIC,
+		S("kind"), T(1), (8<<2)|FIELD_PLACEMENT_STATIC,
+		S("value"), T(3), FIELD_PLACEMENT_ALWAYS,
+		S("note"), T(2), FIELD_PLACEMENT_OFTEN);
+	// 5: Samples, array of Sample with the length in the data
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S("Samples"), T(4), 1, 0);
+	// 6: Pixel, four always U8 fields
+	TT(TYPEDEF_RECORD_SELBASE + (1<<3), S("Pixel"), 4,
+		S("r"), T(1), FIELD_PLACEMENT_ALWAYS, S("g"), T(1), FIELD_PLACEMENT_ALWAYS,
+		S("b"), T(1), FIELD_PLACEMENT_ALWAYS, S("a"), T(1), FIELD_PLACEMENT_ALWAYS);
+	// 7: Pixels, array of Pixel with the length in the data
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S("Pixels"), T(6), 1, 0);
+	#undef S
+	#undef T
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 7, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+
+	for (k= 0; k < 2; k++) {
+		type= k? 7 : 5;
+		data->len= 0;
+		TEST_DATA(n_rec);
+		for (i= 0; i < n_rec; i++) {
+			if (type == 5) {
+				TEST_DATA(i % 3 == 0);   // presence of 'note'
+				data->buf[data->len++]= i;
+				data->buf[data->len++]= i >> 8;
+				TEST_DATA(i & 0x3FFF);   // id
+				memcpy(data->buf + data->len, &i, 4);
+				data->len += 4;
+				if (i % 3 == 0)
+					TEST_DATA(i & 0x7F); // note
+			}
+			else {
+				memcpy(data->buf + data->len, &i, 4);
+				data->len += 4;
+			}
+		}
+		part.data= data->buf;
+		part.len= data->len;
+		str.parts= &part;
+		str.part_count= 1;
+		#define TEST_RESET_INPUT() (in.str= &str, in.part= &part, in.pos= part.data, in.lim= part.data + part.len, in.accum_bits= 0)
+		start= clock();
+		for (i= 0; i < iters; i++) {
+			TEST_RESET_INPUT();
+			if (!test_interp_skip(scope, type, &in) || in.pos != in.lim)
+				fail++;
+		}
+		t_interp= (double)(clock() - start) / CLOCKS_PER_SEC;
+		start= clock();
+		for (i= 0; i < iters; i++) {
+			TEST_RESET_INPUT();
+			if (!userp_plan_skip(scope, userp_scope_get_type_plan(scope, type), &in) || in.pos != in.lim)
+				fail++;
+		}
+		t_plan= (double)(clock() - start) / CLOCKS_PER_SEC;
+		#undef TEST_RESET_INPUT
+		printf("%s: type objects %.1f M records/sec, plan %.1f M records/sec, speedup %.1fx\n", names[k],
+			n_rec * iters / (t_interp > 0? t_interp : 1e-9) / 1e6,
+			n_rec * iters / (t_plan > 0? t_plan : 1e-9) / 1e6,
+			t_interp / (t_plan > 0? t_plan : 1e-9));
+	}
+	printf("failures: %d\n", (int) fail);
+	free(tt);
+	free(data);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+Samples: type objects [0-9.]+ M records/sec, plan [0-9.]+ M records/sec, speedup [0-9.]+x
+Pixels: type objects [0-9.]+ M records/sec, plan [0-9.]+ M records/sec, speedup [0-9.]+x
+failures: 0
+*/
+
+// Scope with a record "Telemetry" (type 4) matching struct test_telemetry, a record "Sample"
+// (type 5) with a variable-length field, and "Tiny" (type 6) with pad matching trailing padding
+struct test_telemetry {
+	int32_t ts;
+	int16_t seq;
+	uint8_t a, b;
+};
+struct test_tiny {
+	int32_t x;
+	uint8_t y;
+};
+static userp_scope test_struct_scope(userp_env env) {
+	userp_scope scope= userp_new_scope(env, NULL);
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part;
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	#define T(id) ((size_t)(id) << 1)
+	tt->len= 0;
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<5), S("U8"), 8, TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3), S("I16"), 16);
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3), S("I32"), 32);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), S("Telemetry"), 64, 4,
+		S("ts"), T(3), (0<<2)|FIELD_PLACEMENT_STATIC,
+		S("seq"), T(2), (32<<2)|FIELD_PLACEMENT_STATIC,
+		S("a"), T(1), (48<<2)|FIELD_PLACEMENT_STATIC,
+		S("b"), T(1), (56<<2)|FIELD_PLACEMENT_STATIC);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<3), S("Sample"), 2,
+		S("ts"), T(3), FIELD_PLACEMENT_ALWAYS,
+		S("note"), T(3), FIELD_PLACEMENT_OFTEN);
+	TT(TYPEDEF_RECORD_SELBASE + 1 + (1<<3), 1, TYPEDEF_RECORD_SELDOM_PAD, S("Tiny"), 2,
+		S("x"), T(3), FIELD_PLACEMENT_ALWAYS,
+		S("y"), T(1), FIELD_PLACEMENT_ALWAYS,
+		3);
+	#undef S
+	#undef T
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 6, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+	free(tt);
+	return scope;
+}
+
+UNIT_TEST(plan_struct) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_struct_scope(env);
+	const struct type_plan *telemetry= userp_scope_get_type_plan(scope, 4),
+		*sample= userp_scope_get_type_plan(scope, 5), *tiny= userp_scope_get_type_plan(scope, 6);
+	struct test_telemetry rec;
+	struct test_tiny tr;
+	const struct test_telemetry *p;
+	struct userp_bstr_part parts[2];
+	struct userp_bstr str= { .env= env };
+	struct userp_bit_io in;
+	uint8_t data[]= { 1,0,0,0, 2,0, 3, 4,  0xFF,0xFF,0xFF,0xFF, 0xFE,0xFF, 0x80, 0x81,  5,0,0,0, 6, 0,0,0 };
+	size_t split;
+
+	printf("Telemetry op=%d fixed=%d\n", telemetry->op, (int) telemetry->fixed_bits);
+	printf("Tiny op=%d fixed=%d pad=%d\n", tiny->op, (int) tiny->fixed_bits, (int) tiny->pad);
+	// Copy, with the input divided at every position
+	for (split= 0; split <= 16; split++) {
+		test_plan_input(&in, &str, parts, data, 16, split);
+		if (!userp_plan_copy_struct(telemetry, &in, &rec, sizeof(rec))
+			|| rec.ts != 1 || rec.seq != 2 || rec.a != 3 || rec.b != 4
+			|| !userp_plan_copy_struct(telemetry, &in, &rec, sizeof(rec))
+			|| rec.ts != -1 || rec.seq != -2 || rec.a != 0x80 || rec.b != 0x81)
+			printf("split %d: copy failed\n", (int) split);
+	}
+	// Zerocopy only works if the record is within one part
+	test_plan_input(&in, &str, parts, data, 16, 12);
+	if ((p= (const struct test_telemetry*) userp_plan_struct_zerocopy(telemetry, &in, sizeof(*p))))
+		printf("zerocopy ts=%d seq=%d a=%d b=%d\n", p->ts, p->seq, p->a, p->b);
+	p= (const struct test_telemetry*) userp_plan_struct_zerocopy(telemetry, &in, sizeof(*p));
+	printf("zerocopy %s\n", p? "succeeded" : "failed");
+	// Tiny's pad covers the trailing padding of the C struct
+	test_plan_input(&in, &str, parts, data + 16, 8, 8);
+	if (userp_plan_copy_struct(tiny, &in, &tr, sizeof(tr)))
+		printf("tiny x=%d y=%d remaining=%d\n", tr.x, tr.y, (int) userp_bit_io_remaining(&in));
+	// Errors
+	test_plan_input(&in, &str, parts, data, 16, 16);
+	userp_plan_copy_struct(telemetry, &in, &rec, 6);
+	userp_plan_copy_struct(sample, &in, &rec, sizeof(rec));
+	test_plan_input(&in, &str, parts, data, 7, 7);
+	userp_plan_copy_struct(telemetry, &in, &rec, sizeof(rec));
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+Telemetry op=10 fixed=64
+Tiny op=10 fixed=40 pad=3
+zerocopy ts=1 seq=2 a=3 b=4
+error: Record is split across buffers and must be copied
+zerocopy failed
+tiny x=5 y=6 remaining=0
+error: Record is 8 bytes but struct is 6 bytes
+error: Type 5 is not a fixed-size record of whole bytes
+error: Data ends before the end of the value
+*/
+
+static void test_pack_bits(uint8_t *buf, size_t *bitpos, uint64_t v, int bits) {
+	int i;
+	for (i= 0; i < bits; i++, (*bitpos)++)
+		if ((v >> i) & 1)
+			buf[*bitpos >> 3] |= 1 << (*bitpos & 7);
+		else
+			buf[*bitpos >> 3] &= ~(1 << (*bitpos & 7));
+}
+
+// Scope with integer types 1-7 and arrays 8-14 of each, with the length given in the data,
+// and signed variable-length Z (15) and its array (16)
+static userp_scope test_int_array_scope(userp_env env) {
+	userp_scope scope= userp_new_scope(env, NULL);
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part;
+	static const char *array_names[]= { "U12[]", "S5[]", "D3[]", "BE16[]", "V[]", "A12[]", "S33[]" };
+	int i;
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	#define T(id) ((size_t)(id) << 1)
+	tt->len= 0;
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<5), S("U12"), 12, TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3), S("S5"), 5);
+	TT(TYPEDEF_INTEGER_SELBASE + 1 + (1<<3), 1, TYPEDEF_INT_SELDOM_MAX, S("D3"), 3, TEST_SIGNED(100));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<4), S("BE16"), 16, 1);
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<5), S("V"), TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<2) + (1<<3) + (1<<5), S("A12"), 4, 12, TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3), S("S33"), 33);
+	for (i= 1; i <= 7; i++)
+		TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S(array_names[i-1]), T(i), 1, 0);
+	// 15: Z, signed variable-length, and 16: array of Z
+	TT(TYPEDEF_INTEGER_SELBASE, S("Z"));
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S("Z[]"), T(15), 1, 0);
+	#undef S
+	#undef T
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 16, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+	free(tt);
+	return scope;
+}
+
+// Encode an array of n pseudo-random elements of element type 'type'
+static void test_int_array_data(userp_scope scope, userp_type type, struct test_typetable *data, size_t n) {
+	const struct type_plan *plan= userp_scope_get_type_plan(scope, type);
+	size_t i, bitpos;
+	uint64_t v;
+	data->len= 0;
+	test_tt_vqty(data, n);
+	bitpos= data->len * 8;
+	for (i= 0; i < n; i++) {
+		v= (i * 0x9E3779B97F4A7C15ull) >> 20;
+		if (plan->op == PLAN_INT_VQTY) {
+			data->len= (bitpos + 7) >> 3;
+			test_tt_vqty(data, v & 0xFFFFF);
+			bitpos= data->len * 8;
+		}
+		else {
+			if (plan->align)
+				bitpos= (bitpos + (1 << plan->align) - 1) & ~(size_t)((1 << plan->align) - 1);
+			test_pack_bits(data->buf, &bitpos, v, plan->bits);
+		}
+	}
+	data->len= (bitpos + 7) >> 3;
+}
+
+UNIT_TEST(plan_int_array) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_int_array_scope(env);
+	struct test_typetable *data= malloc(sizeof(*data) + 4096);
+	struct userp_bstr_part parts[2];
+	struct userp_bstr str= { .env= env };
+	struct userp_bit_io in;
+	int64_t expected[300], out64[300];
+	int16_t out16[300];
+	size_t n= 300, count, i, split, fail;
+	userp_type t;
+	const char *names[]= { "U12", "S5", "D3", "BE16", "V", "A12", "S33" };
+	int_unpack_fn selected= int_unpack;
+	int pass;
+
+	for (pass= 0; pass < 2; pass++) {
+		// Once with the SIMD kernel (if available) and once with the scalar kernel
+		int_unpack= pass? int_unpack_scalar : selected;
+		for (t= 1; t <= 7; t++) {
+			test_int_array_data(scope, t, data, n);
+			// Decode the expected values one at a time
+			test_plan_input(&in, &str, parts, data->buf, data->len, data->len);
+			plan_read_vqty(&count, &in);
+			for (i= 0; i < n; i++)
+				userp_plan_read_int(userp_scope_get_type_plan(scope, t), &in, &expected[i]);
+			for (split= 0, fail= 0; split <= data->len; split++) {
+				test_plan_input(&in, &str, parts, data->buf, data->len, split);
+				count= n;
+				if (!userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, t + 7), &in,
+					out64, sizeof(*out64), &count, 0)
+					|| count != n || memcmp(out64, expected, n * sizeof(*out64)) != 0
+					|| userp_bit_io_remaining(&in) != (in.accum_bits? 1 : 0))
+					fail++;
+			}
+			if (!pass)
+				printf("%s: first=%d last=%d split failures: %d\n", names[t-1],
+					(int) expected[0], (int) expected[n-1], (int) fail);
+			else if (fail)
+				printf("%s scalar: split failures: %d\n", names[t-1], (int) fail);
+		}
+	}
+	// Narrower output, in range
+	test_int_array_data(scope, 2, data, n);
+	test_plan_input(&in, &str, parts, data->buf, data->len, data->len);
+	count= n;
+	if (userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, 9), &in, out16, sizeof(*out16), &count, 0))
+		printf("S5 as int16: %d %d %d\n", out16[0], out16[1], out16[2]);
+	// Errors: out of range, buffer too small, not integers
+	test_int_array_data(scope, 1, data, n);
+	test_plan_input(&in, &str, parts, data->buf, data->len, data->len);
+	count= n;
+	userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, 8), &in, out16, 1, &count, 0);
+	test_plan_input(&in, &str, parts, data->buf, data->len, data->len);
+	count= 10;
+	userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, 8), &in, out16, 2, &count, 0);
+	printf("count=%d\n", (int) count);
+	test_int_array_data(scope, 2, data, n);
+	test_plan_input(&in, &str, parts, data->buf, data->len, data->len);
+	count= n;
+	userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, 9), &in, out16, 2, &count, USERP_DEC_UNSIGNED);
+	test_plan_input(&in, &str, parts, data->buf, data->len, data->len);
+	userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, 1), &in, out16, 2, &count, 0);
+	int_unpack= selected;
+	free(data);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+U12: first=0 last=-?\d+ split failures: 0
+S5: first=0 last=-?\d+ split failures: 0
+D3: first=100 last=-?\d+ split failures: 0
+BE16: first=0 last=-?\d+ split failures: 0
+V: first=0 last=-?\d+ split failures: 0
+A12: first=0 last=-?\d+ split failures: 0
+S33: first=0 last=-?\d+ split failures: 0
+S5 as int16: 0 -?\d+ -?\d+
+error: Array element does not fit in 1-byte integer
+error: Array has 300 elements, but buffer holds 10
+count=300
+error: Array element does not fit in 2-byte integer
+error: Type 1 is not an array
+*/
+
+UNIT_TEST(bench_plan_int_array) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_int_array_scope(env);
+	size_t n= argc > 0? atoi(argv[0]) : 1000000, iters= argc > 1? atoi(argv[1]) : 10;
+	struct test_typetable *data= malloc(sizeof(*data) + n * 2 + 64);
+	const struct type_plan *elem= userp_scope_get_type_plan(scope, 1), *array= userp_scope_get_type_plan(scope, 8);
+	int16_t *out= malloc(n * sizeof(*out));
+	struct userp_bstr_part part;
+	struct userp_bstr str= { .env= env, .parts= &part, .part_count= 1 };
+	struct userp_bit_io in;
+	int64_t val, sum[3]= { 0, 0, 0 };
+	double t[3];
+	clock_t start;
+	size_t i, j, k, count, fail= 0;
+	int_unpack_fn selected= int_unpack;
+
+	test_int_array_data(scope, 1, data, n);
+	part.data= data->buf;
+	part.len= data->len;
+	part.ofs= 0;
+	for (k= 0; k < 3; k++) {
+		int_unpack= k == 1? int_unpack_scalar : selected;
+		start= clock();
+		for (j= 0; j < iters; j++) {
+			in.str= &str; in.part= &part; in.pos= part.data; in.lim= part.data + part.len; in.accum_bits= 0;
+			if (k == 0) {
+				// One element at a time
+				plan_read_vqty(&count, &in);
+				for (i= 0; i < count; i++) {
+					if (!userp_plan_read_int(elem, &in, &val))
+						fail++;
+					out[i]= val;
+				}
+			}
+			else {
+				count= n;
+				if (!userp_plan_read_int_array(scope, array, &in, out, sizeof(*out), &count, 0))
+					fail++;
+			}
+		}
+		t[k]= (double)(clock() - start) / CLOCKS_PER_SEC;
+		for (i= 0; i < n; i++)
+			sum[k] += out[i];
+	}
+	printf("12-bit, one at a time: %.1f M values/sec\n", n * iters / (t[0] > 0? t[0] : 1e-9) / 1e6);
+	printf("12-bit, bulk scalar: %.1f M values/sec\n", n * iters / (t[1] > 0? t[1] : 1e-9) / 1e6);
+	printf("12-bit, bulk %s: %.1f M values/sec\n", int_unpack == int_unpack_scalar? "scalar" : "simd",
+		n * iters / (t[2] > 0? t[2] : 1e-9) / 1e6);
+	printf("failures: %d, checksums %s\n", (int) fail, sum[0] == sum[1] && sum[1] == sum[2]? "match" : "differ");
+	free(data);
+	free(out);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+12-bit, one at a time: [0-9.]+ M values/sec
+12-bit, bulk scalar: [0-9.]+ M values/sec
+12-bit, bulk \w+: [0-9.]+ M values/sec
+failures: 0, checksums match
+*/
+
+// Encode n quantities whose lengths follow 'pattern': a run of 1-byte, a run of 2-byte, then mixed
+static void test_vqty_data(struct test_typetable *data, uint64_t *expected, size_t n) {
+	size_t i;
+	uint64_t v;
+	data->len= 0;
+	for (i= 0; i < n; i++) {
+		v= (i * 0x9E3779B97F4A7C15ull);
+		switch ((i / 40) % 4) {
+		case 0: v &= 0x7F; break;
+		case 1: v= 0x80 + (v & 0x3F7F); break;
+		case 2: v >>= (v & 63); break;
+		default: v &= 0xFFFF;
+		}
+		expected[i]= v;
+		if (v >= 0x20000000 && v <= 0xFFFFFFFF) {
+			data->buf[data->len++]= 0x07;
+			memcpy(data->buf + data->len, &v, 4);
+			data->len += 4;
+		}
+		else if (v > 0xFFFFFFFF) {
+			data->buf[data->len++]= 0x0F;
+			memcpy(data->buf + data->len, &v, 8);
+			data->len += 8;
+		}
+		else
+			test_tt_vqty(data, v);
+	}
+}
+
+UNIT_TEST(decode_vqty_array) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	struct test_typetable *data= malloc(sizeof(*data) + 8192);
+	struct userp_bstr_part parts[2];
+	struct userp_bstr str= { .env= env };
+	struct userp_bit_io in;
+	uint64_t expected[600], out[600];
+	size_t n= 600, split, got, fail;
+	int k;
+	vqty_run_fn kernels[3]= { vqty_run_scalar, VQTY_RUN_DEFAULT, NULL };
+	const char *names[3]= { "scalar", "default", "selected" };
+
+	kernels[2]= vqty_run;
+	test_vqty_data(data, expected, n);
+	for (k= 0; k < 3; k++) {
+		vqty_run= kernels[k];
+		for (split= 0, fail= 0; split <= data->len; split++) {
+			test_plan_input(&in, &str, parts, data->buf, data->len, split);
+			memset(out, 0, sizeof(out));
+			got= userp_decode_vqty_array(out, n, &in);
+			if (got != n || memcmp(out, expected, sizeof(out)) || userp_bit_io_remaining(&in))
+				fail++;
+		}
+		printf("%s: split failures: %d\n", names[k], (int) fail);
+	}
+	// Stops at a bigint prefix
+	test_plan_input(&in, &str, parts, data->buf, data->len, data->len);
+	data->buf[1000]= 0x1F;
+	got= userp_decode_vqty_array(out, n, &in);
+	printf("stopped after %d: %s\n", (int) got, userp_diag_get_code(&env->err) == USERP_ELIMIT? "ELIMIT" : "?");
+	free(data);
+	userp_drop_env(env);
+}
+/*OUTPUT
+scalar: split failures: 0
+default: split failures: 0
+selected: split failures: 0
+stopped after \d+: ELIMIT
+*/
+
+UNIT_TEST(plan_int_array_signed_vqty) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_int_array_scope(env);
+	struct test_typetable *data= malloc(sizeof(*data) + 256);
+	struct userp_bstr_part parts[2];
+	struct userp_bstr str= { .env= env };
+	struct userp_bit_io in;
+	int8_t out[8];
+	size_t count= 8, i;
+
+	data->len= 0;
+	TEST_DATA(6, TEST_SIGNED(0), TEST_SIGNED(-1), TEST_SIGNED(1), TEST_SIGNED(-128), TEST_SIGNED(127), TEST_SIGNED(-5));
+	test_plan_input(&in, &str, parts, data->buf, data->len, data->len);
+	if (userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, 16), &in, out, 1, &count, 0)) {
+		for (i= 0; i < count; i++)
+			printf("%d ", out[i]);
+		printf("\n");
+	}
+	data->len= 0;
+	TEST_DATA(2, TEST_SIGNED(-1), TEST_SIGNED(128));
+	test_plan_input(&in, &str, parts, data->buf, data->len, data->len);
+	count= 8;
+	userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, 16), &in, out, 1, &count, 0);
+	free(data);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+0 -1 1 -128 127 -5 
+error: Array element does not fit in 1-byte integer
+*/
+
+UNIT_TEST(plan_int_array_delta) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL), bad;
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part, parts[2];
+	struct userp_bstr str= { .env= env }, *encoded;
+	struct userp_bit_io in;
+	userp_enc enc;
+	int64_t stamps[1000], out64[1000];
+	int32_t samples[6]= { 1000, 1003, 998, 998, -20000, 12000 }, out32[6];
+	uint64_t zz;
+	int64_t val;
+	size_t i, n, count, abs_len, delta_len;
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	#define T(id) ((size_t)(id) << 1)
+	tt->len= 0;
+	// 1: TS, signed variable-length delta
+	TT(TYPEDEF_INTEGER_SELBASE + 1, 1, TYPEDEF_INT_SELDOM_DELTA, S("TS"), 1);
+	// 2: D16, 16-bit unsigned zigzag delta, and 3: D16 followed by a NUL byte
+	TT(TYPEDEF_INTEGER_SELBASE + 1 + (1<<3) + (1<<5), 1, TYPEDEF_INT_SELDOM_DELTA, S("D16"), 16, TEST_SIGNED(0), 2);
+	TT(TYPEDEF_INTEGER_SELBASE + 1 + (1<<1), 1, TYPEDEF_INT_SELDOM_PAD, S("D16P"), T(2), 1);
+	for (i= 1; i <= 3; i++)
+		TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), 0, T(i), 1, 0);
+	// 7: Int, 8: Int[], and 9: Log, a record of TS[] and Int[]
+	TT(TYPEDEF_INTEGER_SELBASE, S("Int"));
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), 0, T(7), 1, 0);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<3), S("Log"), 2,
+		S("ts"), T(4), FIELD_PLACEMENT_ALWAYS,
+		S("v"), T(8), FIELD_PLACEMENT_ALWAYS);
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 9, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+	printf("D16P delta flags: %d %d\n", (userp_scope_get_type_plan(scope, 3)->flags & PLAN_DELTA) != 0,
+		(userp_scope_get_type_plan(scope, 3)->flags & PLAN_DELTA_ZIGZAG) != 0);
+
+	// Millisecond timestamps, encoded absolute and as deltas
+	for (i= 0; i < 1000; i++)
+		stamps[i]= 1700000000000LL + i * 1000 + (int64_t)((i * 0x9E3779B97F4A7C15ull) >> 58);
+	n= 1000;
+	for (i= 0; i < 2; i++) {
+		enc= userp_new_enc(env, scope, 1);
+		userp_enc_int_array(enc, &n, sizeof(n), 1, USERP_ENC_UNSIGNED);
+		userp_enc_int_array(enc, stamps, sizeof(*stamps), n, i? USERP_ENC_DELTA : 0);
+		encoded= userp_enc_finish(enc);
+		if (!i) {
+			abs_len= encoded->parts[0].len;
+			userp_free_enc(enc);
+		}
+	}
+	printf("absolute: %d bytes, delta: %d bytes\n", (int) abs_len, (int) encoded->parts[0].len);
+	test_plan_input(&in, &str, parts, encoded->parts[0].data, encoded->parts[0].len, 7);
+	count= 1000;
+	if (userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, 4), &in, out64, 8, &count, 0))
+		printf("TS[]: %d elements, match=%d\n", (int) count, !memcmp(out64, stamps, sizeof(stamps)));
+	// One element at a time
+	test_plan_input(&in, &str, parts, encoded->parts[0].data, encoded->parts[0].len, 7);
+	val= 0;
+	if (userp_decode_vqty_quick(&count, &in)) {
+		for (i= 0; i < count && userp_plan_read_int_next(userp_scope_get_type_plan(scope, 1), &in, &val); i++)
+			if (val != stamps[i])
+				break;
+		printf("TS one at a time: %d elements match\n", (int) i);
+	}
+	// As a record field, the type makes the elements deltas, and the flag must agree with it
+	delta_len= encoded->parts[0].len;
+	userp_free_enc(enc);
+	enc= userp_new_enc(env, scope, 9);
+	count= 6;
+	if (!userp_enc_rec_begin(enc, 9)
+		|| !userp_enc_rec_seek_field(enc, 0) || !userp_enc_int_array(enc, &n, sizeof(n), 1, USERP_ENC_UNSIGNED)
+		|| !userp_enc_int_array(enc, stamps, sizeof(*stamps), n, 0)
+		|| !userp_enc_rec_seek_field(enc, 1) || !userp_enc_int_array(enc, &count, sizeof(count), 1, USERP_ENC_UNSIGNED)
+		|| userp_enc_int_array(enc, samples, sizeof(*samples), 6, USERP_ENC_DELTA)
+		|| !userp_enc_int_array(enc, samples, sizeof(*samples), 6, 0)
+		|| !userp_enc_rec_end(enc))
+		printf("encode failed\n");
+	encoded= userp_enc_finish(enc);
+	test_plan_input(&in, &str, parts, encoded->parts[0].data, encoded->parts[0].len, 7);
+	count= 1000;
+	if (userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, 4), &in, out64, 8, &count, 0))
+		printf("Log.ts: %d elements, match=%d, same size=%d\n", (int) count,
+			!memcmp(out64, stamps, sizeof(stamps)), (size_t)(in.pos - encoded->parts[0].data) == delta_len);
+	userp_free_enc(enc);
+
+	// 16-bit zigzag deltas, on the bulk path and (with padding) the per-element path
+	for (n= 5; n <= 6; n++) {
+		tt->len= 0;
+		test_tt_vqty(tt, 6);
+		for (i= 0; i < 6; i++) {
+			zz= (uint64_t)(samples[i] - (i? samples[i-1] : 0));
+			zz= (zz << 1) ^ (uint64_t)((int64_t) zz >> 63);
+			tt->buf[tt->len++]= (uint8_t) zz;
+			tt->buf[tt->len++]= (uint8_t) (zz >> 8);
+			if (n == 6)
+				tt->buf[tt->len++]= 0;
+		}
+		test_plan_input(&in, &str, parts, tt->buf, tt->len, 4);
+		count= 6;
+		if (userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, n), &in, out32, 4, &count, 0)) {
+			for (i= 0; i < count; i++)
+				printf("%d ", out32[i]);
+			printf("\n");
+		}
+	}
+	// The sum is range-checked, even though each difference fits
+	tt->len= 0;
+	TT(3, TEST_SIGNED(100), TEST_SIGNED(27), TEST_SIGNED(1));
+	test_plan_input(&in, &str, parts, tt->buf, tt->len, tt->len);
+	count= 8;
+	userp_plan_read_int_array(scope, userp_scope_get_type_plan(scope, 4), &in, out32, 1, &count, 0);
+
+	// Encoding an unsigned delta requires non-decreasing values
+	enc= userp_new_enc(env, scope, 1);
+	userp_enc_int_array(enc, samples, sizeof(*samples), 6, USERP_ENC_UNSIGNED | USERP_ENC_DELTA);
+	userp_free_enc(enc);
+
+	// Invalid delta mode
+	bad= userp_new_scope(env, NULL);
+	tt->len= 0;
+	#undef S
+	#define S(name) ((size_t) userp_scope_get_symbol(bad, name, USERP_CREATE) << 1)
+	TT(TYPEDEF_INTEGER_SELBASE + 1, 1, TYPEDEF_INT_SELDOM_DELTA, S("Bad"), 3);
+	part.len= tt->len;
+	userp_scope_parse_types(bad, &part, 1, 1, 0);
+	#undef S
+	#undef T
+	userp_drop_scope(bad);
+	free(tt);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+D16P delta flags: 1 1
+absolute: \d+ bytes, delta: \d+ bytes
+TS\[\]: 1000 elements, match=1
+TS one at a time: 1000 elements match
+error: USERP_ENC_DELTA given, but type 7 is not a delta
+Log.ts: 1000 elements, match=1, same size=1
+1000 1003 998 998 -20000 12000 
+1000 1003 998 998 -20000 12000 
+error: Array element does not fit in 1-byte integer
+error: Element of unsigned delta array is less than the element before it
+error: Integer delta mode 3 is not valid
+*/
+
+UNIT_TEST(plan_double_array) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL), bad;
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part, parts[2];
+	struct userp_bstr str= { .env= env }, *encoded;
+	struct userp_bit_io in;
+	userp_enc enc;
+	int16_t temps[5]= { 0, 4000, 6150, 12000, -32768 };
+	int64_t big[9]= { 1, -2, (int64_t)1 << 52, 5, 6, 7, 8, 9, -((int64_t)1 << 60) };
+	double out[9];
+	size_t i, n, count;
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	#define T(id) ((size_t)(id) << 1)
+	tt->len= 0;
+	// 1: Temp, 16-bit hundredths of a degree offset by -40
+	TT(TYPEDEF_INTEGER_SELBASE + 1 + (1<<3) + (1<<5), 2, TYPEDEF_INT_SELDOM_SCALE, TYPEDEF_INT_SELDOM_BIAS,
+		S("Temp"), 16, TEST_SIGNED(-32768), TEST_SIGNED(1), TEST_SIGNED(-2), TEST_SIGNED(-40), TEST_SIGNED(0));
+	// 2: Triple, signed variable-length integer times 3
+	TT(TYPEDEF_INTEGER_SELBASE + 1, 1, TYPEDEF_INT_SELDOM_SCALE, S("Triple"), TEST_SIGNED(3), TEST_SIGNED(0));
+	for (i= 1; i <= 2; i++)
+		TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), 0, T(i), 1, 0);
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 4, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+	printf("Temp scale=%g bias=%g\n", userp_scope_get_type_plan(scope, 1)->scale, userp_scope_get_type_plan(scope, 1)->bias);
+
+	// One at a time, and as an array
+	tt->len= 0;
+	test_tt_vqty(tt, 5);
+	for (i= 0; i < 5; i++) {
+		tt->buf[tt->len++]= (uint8_t) (temps[i] + 32768);
+		tt->buf[tt->len++]= (uint8_t) ((temps[i] + 32768) >> 8);
+	}
+	test_plan_input(&in, &str, parts, tt->buf + 1, 2, 2);
+	if (userp_plan_read_double(userp_scope_get_type_plan(scope, 1), &in, out))
+		printf("%.2f\n", out[0]);
+	test_plan_input(&in, &str, parts, tt->buf, tt->len, 4);
+	count= 5;
+	if (userp_plan_read_double_array(scope, userp_scope_get_type_plan(scope, 3), &in, out, &count)) {
+		for (i= 0; i < count; i++)
+			printf("%.2f ", out[i]);
+		printf("\n");
+	}
+	// Elements beyond 2**51 take the scalar path
+	n= 9;
+	enc= userp_new_enc(env, scope, 1);
+	userp_enc_int_array(enc, &n, sizeof(n), 1, USERP_ENC_UNSIGNED);
+	userp_enc_int_array(enc, big, sizeof(*big), n, 0);
+	encoded= userp_enc_finish(enc);
+	test_plan_input(&in, &str, parts, encoded->parts[0].data, encoded->parts[0].len, 5);
+	count= 9;
+	if (userp_plan_read_double_array(scope, userp_scope_get_type_plan(scope, 4), &in, out, &count)) {
+		for (i= 0; i < count; i++)
+			printf("%.0f ", out[i]);
+		printf("\n");
+	}
+	userp_free_enc(enc);
+	// Not an array of integers
+	count= 9;
+	userp_plan_read_double_array(scope, userp_scope_get_type_plan(scope, 1), &in, out, &count);
+
+	// Exponent out of range
+	bad= userp_new_scope(env, NULL);
+	tt->len= 0;
+	#undef S
+	#define S(name) ((size_t) userp_scope_get_symbol(bad, name, USERP_CREATE) << 1)
+	TT(TYPEDEF_INTEGER_SELBASE + 1, 1, TYPEDEF_INT_SELDOM_BIAS, S("Bad"), TEST_SIGNED(1), TEST_SIGNED(400));
+	part.len= tt->len;
+	userp_scope_parse_types(bad, &part, 1, 1, 0);
+	#undef S
+	#undef T
+	userp_drop_scope(bad);
+	free(tt);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+Temp scale=0.01 bias=-40
+-40.00
+-40.00 0.00 21.50 80.00 -367.68 
+3 -6 13510798882111488 15 18 21 24 27 -3458764513820540928 
+error: Type 1 is not an array
+error: Integer scale or bias exponent exceeds limit
+*/
+
+UNIT_TEST(bench_plan_double_array) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	size_t n= argc > 0? atoi(argv[0]) : 1000000, iters= argc > 1? atoi(argv[1]) : 10;
+	struct test_typetable *tt= malloc(sizeof(*tt) + n * 2 + 64);
+	const struct type_plan *elem, *array;
+	double *out= malloc(n * sizeof(*out)), sum[3]= { 0, 0, 0 }, t[3];
+	struct userp_bstr_part part;
+	struct userp_bstr str= { .env= env, .parts= &part, .part_count= 1 };
+	struct userp_bit_io in;
+	clock_t start;
+	size_t i, j, k, count, fail= 0;
+	int_to_double_fn selected= int_to_double;
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	tt->len= 0;
+	TT(TYPEDEF_INTEGER_SELBASE + 1 + (1<<3) + (1<<5), 2, TYPEDEF_INT_SELDOM_SCALE, TYPEDEF_INT_SELDOM_BIAS,
+		S("Temp"), 16, TEST_SIGNED(-32768), TEST_SIGNED(1), TEST_SIGNED(-2), TEST_SIGNED(-40), TEST_SIGNED(0));
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), 0, 1 << 1, 1, 0);
+	#undef S
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 2, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+	elem= userp_scope_get_type_plan(scope, 1);
+	array= userp_scope_get_type_plan(scope, 2);
+	tt->len= 0;
+	test_tt_vqty(tt, n);
+	for (i= 0; i < n; i++) {
+		j= (i * 0x9E3779B97F4A7C15ull) >> 48;
+		tt->buf[tt->len++]= (uint8_t) j;
+		tt->buf[tt->len++]= (uint8_t) (j >> 8);
+	}
+	part.len= tt->len;
+	for (k= 0; k < 3; k++) {
+		int_to_double= k == 1? int_to_double_scalar : selected;
+		start= clock();
+		for (j= 0; j < iters; j++) {
+			in.str= &str; in.part= &part; in.pos= part.data; in.lim= part.data + part.len; in.accum_bits= 0;
+			if (k == 0) {
+				// One element at a time
+				plan_read_vqty(&count, &in);
+				for (i= 0; i < count; i++)
+					if (!userp_plan_read_double(elem, &in, out + i))
+						fail++;
+			}
+			else {
+				count= n;
+				if (!userp_plan_read_double_array(scope, array, &in, out, &count))
+					fail++;
+			}
+		}
+		t[k]= (double)(clock() - start) / CLOCKS_PER_SEC;
+		for (i= 0; i < n; i++)
+			sum[k] += out[i];
+	}
+	printf("scaled 16-bit, one at a time: %.1f M values/sec\n", n * iters / (t[0] > 0? t[0] : 1e-9) / 1e6);
+	printf("scaled 16-bit, bulk scalar: %.1f M values/sec\n", n * iters / (t[1] > 0? t[1] : 1e-9) / 1e6);
+	printf("scaled 16-bit, bulk %s: %.1f M values/sec\n", int_to_double == int_to_double_scalar? "scalar" : "simd",
+		n * iters / (t[2] > 0? t[2] : 1e-9) / 1e6);
+	printf("failures: %d, checksums %s\n", (int) fail, sum[0] == sum[1] && sum[1] == sum[2]? "match" : "differ");
+	free(tt);
+	free(out);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+scaled 16-bit, one at a time: [0-9.]+ M values/sec
+scaled 16-bit, bulk scalar: [0-9.]+ M values/sec
+scaled 16-bit, bulk \w+: [0-9.]+ M values/sec
+failures: 0, checksums match
+*/
+
+UNIT_TEST(plan_ieee_float) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part, parts[2];
+	struct userp_bstr str= { .env= env }, *encoded;
+	struct userp_bit_io in;
+	userp_enc enc;
+	userp_type f32, f64, t;
+	float fvals[5]= { 1.5f, -0.0f, 3.25e-20f, 1e30f, 7 }, fout[5];
+	double dvals[5]= { 2.5e17, -1.0/3, 1e-300, 0, 42 }, dout[5];
+	uint64_t bit;
+	size_t i, n, count;
+	#define T(id) ((size_t)(id) << 1)
+
+	if (!userp_scope_add_float_types(scope))
+		printf("add_float_types failed\n");
+	f32= userp_scope_type_by_name(scope, "Float32", 0);
+	f64= userp_scope_type_by_name(scope, "Float64", 0);
+	// f32+2: Float32[], f32+3: Float64[], f32+4: a record of the same size that isn't a float
+	tt->len= 0;
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), 0, T(f32), 1, 0);
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), 0, T(f64), 1, 0);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), 0, 32, 3,
+		userp_scope_get_symbol(scope, "sign", 0) << 1, T(f32 - 5), (31<<2)|FIELD_PLACEMENT_STATIC,
+		userp_scope_get_symbol(scope, "exp", 0) << 1, T(f32 - 4), (24<<2)|FIELD_PLACEMENT_STATIC,
+		userp_scope_get_symbol(scope, "sig", 0) << 1, T(f32 - 3), (0<<2)|FIELD_PLACEMENT_STATIC);
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 3, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+	for (t= f32; t <= f32 + 4; t++)
+		printf("type %d ieee=%d bits=%d\n", (int)(t - f32), (userp_scope_get_type_plan(scope, t)->flags & PLAN_IEEE_FLOAT) != 0,
+			(int) userp_scope_get_type_plan(scope, t)->fixed_bits);
+
+	// The encoding is the little-endian float
+	enc= userp_new_enc(env, scope, 1);
+	userp_enc_float(enc, 2.5e17f);
+	n= 5;
+	userp_enc_int_array(enc, &n, sizeof(n), 1, USERP_ENC_UNSIGNED);
+	userp_enc_float_array(enc, fvals, sizeof(*fvals), n);
+	userp_enc_int_array(enc, &n, sizeof(n), 1, USERP_ENC_UNSIGNED);
+	userp_enc_float_array(enc, dvals, sizeof(*dvals), n);
+	encoded= userp_enc_finish(enc);
+	printf("encoded %d bytes, first %02X %02X %02X %02X\n", (int) encoded->parts[0].len,
+		encoded->parts[0].data[0], encoded->parts[0].data[1], encoded->parts[0].data[2], encoded->parts[0].data[3]);
+	// Split the input in the middle of the float array, to copy from both parts
+	test_plan_input(&in, &str, parts, encoded->parts[0].data, encoded->parts[0].len, 15);
+	if (userp_plan_read_double(userp_scope_get_type_plan(scope, f32), &in, dout))
+		printf("%g\n", dout[0]);
+	count= 5;
+	if (userp_plan_read_float_array(scope, userp_scope_get_type_plan(scope, f32 + 2), &in, fout, sizeof(*fout), &count))
+		printf("Float32[]: %d elements, match=%d\n", (int) count, !memcmp(fout, fvals, sizeof(fvals)));
+	count= 5;
+	if (userp_plan_read_double_array(scope, userp_scope_get_type_plan(scope, f32 + 3), &in, dout, &count))
+		printf("Float64[]: %d elements, match=%d\n", (int) count, !memcmp(dout, dvals, sizeof(dvals)));
+	// Float32 widened to double
+	test_plan_input(&in, &str, parts, encoded->parts[0].data, encoded->parts[0].len, 15);
+	in.pos += 4;
+	count= 5;
+	if (userp_plan_read_double_array(scope, userp_scope_get_type_plan(scope, f32 + 2), &in, dout, &count)) {
+		for (i= 0; i < count; i++)
+			printf("%g ", dout[i]);
+		printf("\n");
+	}
+	// Float64 can't narrow to a float array
+	count= 5;
+	userp_plan_read_float_array(scope, userp_scope_get_type_plan(scope, f32 + 3), &in, fout, sizeof(*fout), &count);
+	userp_free_enc(enc);
+
+	// A float at an odd bit position is read with shifts
+	memcpy(&bit, &dvals[1], 8);
+	for (i= 0; i < 8; i++)
+		tt->buf[i]= (uint8_t)(((bit << 1) | 1) >> (i * 8));
+	tt->buf[8]= (uint8_t)(bit >> 63);
+	tt->len= 9;
+	test_plan_input(&in, &str, parts, tt->buf, tt->len, 9);
+	plan_read_bits(&bit, &in, 1);
+	if (userp_plan_read_double(userp_scope_get_type_plan(scope, f64), &in, dout))
+		printf("bit=%d %.17g\n", (int) bit, dout[0]);
+	#undef T
+	free(tt);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+type 0 ieee=1 bits=32
+type 1 ieee=1 bits=64
+type 2 ieee=0 bits=0
+type 3 ieee=0 bits=0
+type 4 ieee=0 bits=32
+encoded 66 bytes, first 6B 0B 5E 5C
+2.5e\+17
+Float32\[\]: 5 elements, match=1
+Float64\[\]: 5 elements, match=1
+1.5 -0 3.25e-20 1e\+30 7 
+error: Array elements of type \d+ are 64-bit floats and do not fit in float
+bit=1 -0.33333333333333331
+*/
+
+UNIT_TEST(bench_plan_float_array) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	size_t n= argc > 0? atoi(argv[0]) : 1000000, iters= argc > 1? atoi(argv[1]) : 10;
+	struct test_typetable *tt= malloc(sizeof(*tt) + n * 8 + 64);
+	const struct type_plan *elem, *array;
+	double *out= malloc(n * sizeof(*out)), sum[2]= { 0, 0 }, t[2];
+	struct userp_bstr_part part;
+	struct userp_bstr str= { .env= env, .parts= &part, .part_count= 1 };
+	struct userp_bit_io in;
+	userp_type f64;
+	clock_t start;
+	size_t i, j, k, count, fail= 0;
+
+	userp_scope_add_float_types(scope);
+	f64= userp_scope_type_by_name(scope, "Float64", 0);
+	tt->len= 0;
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), 0, (size_t) f64 << 1, 1, 0);
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 1, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+	elem= userp_scope_get_type_plan(scope, f64);
+	array= userp_scope_get_type_plan(scope, f64 + 1);
+	tt->len= 0;
+	test_tt_vqty(tt, n);
+	for (i= 0; i < n; i++) {
+		out[i]= (double)(i * 0x9E3779B97F4A7C15ull) / 7;
+		memcpy(tt->buf + tt->len, out + i, 8);
+		tt->len += 8;
+	}
+	part.len= tt->len;
+	for (k= 0; k < 2; k++) {
+		start= clock();
+		for (j= 0; j < iters; j++) {
+			in.str= &str; in.part= &part; in.pos= part.data; in.lim= part.data + part.len; in.accum_bits= 0;
+			if (k == 0) {
+				// One element at a time
+				plan_read_vqty(&count, &in);
+				for (i= 0; i < count; i++)
+					if (!userp_plan_read_double(elem, &in, out + i))
+						fail++;
+			}
+			else {
+				count= n;
+				if (!userp_plan_read_double_array(scope, array, &in, out, &count))
+					fail++;
+			}
+		}
+		t[k]= (double)(clock() - start) / CLOCKS_PER_SEC;
+		for (i= 0; i < n; i++)
+			sum[k] += out[i];
+	}
+	printf("Float64, one at a time: %.2f GB/sec\n", n * iters * 8 / (t[0] > 0? t[0] : 1e-9) / 1e9);
+	printf("Float64, bulk: %.2f GB/sec\n", n * iters * 8 / (t[1] > 0? t[1] : 1e-9) / 1e9);
+	printf("failures: %d, checksums %s\n", (int) fail, sum[0] == sum[1]? "match" : "differ");
+	free(tt);
+	free(out);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+Float64, one at a time: [0-9.]+ GB/sec
+Float64, bulk: [0-9.]+ GB/sec
+failures: 0, checksums match
+*/
+
+UNIT_TEST(plan_array_slice) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part, parts[2];
+	struct userp_bstr str= { .env= env, .parts= parts, .part_count= 2 }, slice= { .env= env };
+	struct userp_bit_io in;
+	userp_buffer buf[2];
+	size_t i;
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	#define T(id) ((size_t)(id) << 1)
+	tt->len= 0;
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<5), S("Byte"), 8, TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<2) + (1<<3) + (1<<5), S("A12"), 4, 12, TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE, S("V"));
+	for (i= 1; i <= 3; i++)
+		TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), 0, T(i), 1, 0);
+	#undef S
+	#undef T
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 6, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+
+	// 300 bytes, split between two reference-counted buffers
+	buf[0]= userp_new_buffer(env, NULL, 100, 0);
+	buf[1]= userp_new_buffer(env, NULL, 400, 0);
+	tt->len= 0;
+	test_tt_vqty(tt, 300);
+	for (i= 0; i < 300; i++)
+		tt->buf[tt->len++]= (uint8_t) i;
+	memcpy(buf[0]->data, tt->buf, 100);
+	memcpy(buf[1]->data, tt->buf + 100, tt->len - 100);
+	parts[0].buf= buf[0]; parts[0].data= buf[0]->data; parts[0].len= 100; parts[0].ofs= 0;
+	parts[1].buf= buf[1]; parts[1].data= buf[1]->data; parts[1].len= tt->len - 100; parts[1].ofs= 100;
+	in.str= &str; in.part= parts; in.pos= parts[0].data; in.lim= parts[0].data + 100; in.accum_bits= 0;
+	if (userp_plan_array_slice(scope, userp_scope_get_type_plan(scope, 4), &in, 1, &slice)) {
+		for (i= 0; i < slice.part_count; i++)
+			printf("part %d: ofs=%d len=%d first=%d refcnt=%d same_buffer=%d\n", (int) i,
+				(int) slice.parts[i].ofs, (int) slice.parts[i].len, slice.parts[i].data[0],
+				(int) slice.parts[i].buf->refcnt, slice.parts[i].buf == buf[i]);
+		printf("input at end: %d\n", userp_bit_io_at_end(&in));
+	}
+	for (i= 0; i < slice.part_count; i++)
+		userp_drop_buffer(slice.parts[i].buf);
+	slice.part_count= 0;
+	printf("refcnt after release: %d %d\n", (int) buf[0]->refcnt, (int) buf[1]->refcnt);
+
+	// Wrong element size, elements with gaps, and elements of variable size
+	in.part= parts; in.pos= parts[0].data; in.lim= parts[0].data + 100;
+	userp_plan_array_slice(scope, userp_scope_get_type_plan(scope, 4), &in, 2, &slice);
+	in.part= parts; in.pos= parts[0].data; in.lim= parts[0].data + 100;
+	userp_plan_array_slice(scope, userp_scope_get_type_plan(scope, 5), &in, 0, &slice);
+	in.part= parts; in.pos= parts[0].data; in.lim= parts[0].data + 100;
+	userp_plan_array_slice(scope, userp_scope_get_type_plan(scope, 6), &in, 0, &slice);
+	printf("parts after errors: %d\n", (int) slice.part_count);
+
+	USERP_FREE(env, &slice.parts);
+	userp_drop_buffer(buf[0]);
+	userp_drop_buffer(buf[1]);
+	free(tt);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+part 0: ofs=2 len=98 first=0 refcnt=2 same_buffer=1
+part 1: ofs=100 len=202 first=98 refcnt=2 same_buffer=1
+input at end: 1
+refcnt after release: 1 1
+error: Array element is 1 bytes, not 2
+error: Array elements of type 2 are not contiguous whole bytes
+error: Array elements of type 3 are not contiguous whole bytes
+parts after errors: 0
+*/
+
+UNIT_TEST(bench_decode_vqty_array) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	size_t n= argc > 0? atoi(argv[0]) : 1000000, iters= argc > 1? atoi(argv[1]) : 10;
+	struct test_typetable *data= malloc(sizeof(*data) + n * 5 + 64);
+	uint64_t *out= malloc(n * sizeof(*out)), sum[3];
+	struct userp_bstr_part part;
+	struct userp_bstr str= { .env= env, .parts= &part, .part_count= 1 };
+	struct userp_bit_io in;
+	const char *dist_name[3]= { "7-bit", "14-bit", "mixed" };
+	const char *method_name[3]= { "one at a time", "batch scalar", "batch simd" };
+	double t;
+	clock_t start;
+	size_t i, j, k, d, val, fail= 0;
+	uint64_t v;
+	vqty_run_fn selected= vqty_run;
+
+	for (d= 0; d < 3; d++) {
+		data->len= 0;
+		for (i= 0; i < n; i++) {
+			v= (i * 0x9E3779B97F4A7C15ull) >> 32;
+			test_tt_vqty(data, d == 0? v & 0x7F : d == 1? v & 0x3FFF : v >> (v & 31));
+		}
+		part.data= data->buf;
+		part.len= data->len;
+		part.ofs= 0;
+		for (k= 0; k < 3; k++) {
+			vqty_run= k == 1? vqty_run_scalar : selected;
+			// The first pass is a warm-up, and not timed
+			for (j= 0, start= 0; j <= iters; j++) {
+				if (j == 1)
+					start= clock();
+				in.str= &str; in.part= &part; in.pos= part.data; in.lim= part.data + part.len; in.accum_bits= 0;
+				if (k == 0) {
+					for (i= 0; i < n; i++) {
+						if (!userp_decode_vqty_quick(&val, &in))
+							fail++;
+						out[i]= val;
+					}
+				}
+				else if (userp_decode_vqty_array(out, n, &in) != n)
+					fail++;
+			}
+			t= (double)(clock() - start) / CLOCKS_PER_SEC;
+			for (i= 0, sum[k]= 0; i < n; i++)
+				sum[k] += out[i];
+			printf("%s, %s: %.1f M values/sec\n", dist_name[d], method_name[k], n * iters / (t > 0? t : 1e-9) / 1e6);
+		}
+		if (sum[0] != sum[1] || sum[1] != sum[2])
+			fail++;
+	}
+	printf("failures: %d\n", (int) fail);
+	free(data);
+	free(out);
+	userp_drop_env(env);
+}
+/*OUTPUT
+7-bit, one at a time: [0-9.]+ M values/sec
+7-bit, batch scalar: [0-9.]+ M values/sec
+7-bit, batch simd: [0-9.]+ M values/sec
+14-bit, one at a time: [0-9.]+ M values/sec
+14-bit, batch scalar: [0-9.]+ M values/sec
+14-bit, batch simd: [0-9.]+ M values/sec
+mixed, one at a time: [0-9.]+ M values/sec
+mixed, batch scalar: [0-9.]+ M values/sec
+mixed, batch simd: [0-9.]+ M values/sec
+failures: 0
+*/
+
+#endif
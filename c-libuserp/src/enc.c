@@ -24,22 +24,94 @@ userp_enc userp_new_enc(userp_env env, userp_scope scope, userp_type root_type)
 	bzero(enc, sizeof(struct userp_enc));
 	enc->env= env;
 	enc->scope= scope;
+	enc->output.env= env;
 	enc->output.parts= enc->output_initial_parts;
 	enc->output.part_alloc= env->enc_output_parts;
+	enc->out_bufsize= env->enc_output_bufsize;
 	return enc;
 }
 
+static void rec_swap_output(userp_enc enc, struct enc_rec_frame *f);
+
 void userp_free_enc(userp_enc enc) {
 	struct userp_bstr_part *p, *p2;
-	// TODO: free each of the encoder frames
+	struct enc_rec_frame *f;
+	size_t i;
+	// Put back the main output, if a record was abandoned while a field was in its temporary
+	for (i= enc->rec_depth; i > 0; i--)
+		if (enc->rec[i-1].cur_in_temp)
+			rec_swap_output(enc, &enc->rec[i-1]);
+	// Free the record frames, which are kept for reuse
+	for (i= 0; i < enc->rec_alloc; i++) {
+		f= &enc->rec[i];
+		for (p= f->alt.parts, p2= p + f->alt.part_count; p < p2; p++)
+			userp_drop_buffer(p->buf);
+		USERP_FREE(enc->env, &f->alt.parts);
+		USERP_FREE(enc->env, &f->order);
+		USERP_FREE(enc->env, &f->extra);
+		USERP_FREE(enc->env, &f->written);
+		USERP_FREE(enc->env, &f->seg);
+	}
+	USERP_FREE(enc->env, &enc->rec);
 	// Release each buffer of the output
 	for (p= enc->output.parts, p2= p + enc->output.part_count; p < p2; p++)
 		userp_drop_buffer(p->buf);
 	// Free the bstr unless it was allocated as part of this object
 	if (enc->output.parts != enc->output_initial_parts)
-		USERP_FREE(enc->env, enc->output.parts);
+		USERP_FREE(enc->env, &enc->output.parts);
 	userp_drop_scope(enc->scope);
-	USERP_FREE(enc->env, enc);
+	USERP_FREE(enc->env, &enc);
+}
+
+/*APIDOC
+#### userp_enc_set_writer
+
+    userp_enc_set_writer(enc, w);
+
+Send the encoder's output to a writer (see `userp_new_writer`) as it is produced.  Each time the
+encoder starts a new output buffer, the completed ones are written and released, and
+`userp_enc_finish` writes whatever remains, returning an empty bstr.  The `ofs` of the output
+parts keeps counting from the start of the encoding.  Pass NULL to go back to accumulating the
+output in memory.  The writer must outlive its use by the encoder.
+*/
+
+void userp_enc_set_writer(userp_enc enc, struct userp_writer *w) {
+	enc->writer= w;
+}
+
+// Write the completed output parts to enc->writer, and release them.
+static bool enc_flush_output(userp_enc enc) {
+	struct userp_bstr_part *p, *p2;
+	if (!userp_writer_write(enc->writer, &enc->output))
+		return false;
+	for (p= enc->output.parts, p2= p + enc->output.part_count; p < p2; p++)
+		userp_drop_buffer(p->buf);
+	enc->output.part_count= 0;
+	enc->out_pos= enc->out_lim= NULL;
+	return true;
+}
+
+// Make sure the output bstr has room for n more parts
+static bool enc_grow_parts(userp_enc enc, size_t n) {
+	struct userp_bstr_part *parts= NULL;
+	size_t alloc_n;
+	if (enc->output.part_count + n <= enc->output.part_alloc)
+		return true;
+	alloc_n= enc->output.part_alloc * 2;
+	if (alloc_n < enc->output.part_count + n)
+		alloc_n= enc->output.part_count + n;
+	// If output is the one built into the record, can't resize it.
+	if (enc->output.parts == enc->output_initial_parts) {
+		if (!USERP_ALLOC_ARRAY(enc->env, &parts, alloc_n))
+			return false;
+		memcpy(parts, enc->output.parts, sizeof(struct userp_bstr_part) * enc->output.part_count);
+		enc->output.parts= parts;
+		enc->output.env= enc->env;
+	}
+	else if (!USERP_ALLOC_ARRAY(enc->env, &enc->output.parts, alloc_n))
+		return false;
+	enc->output.part_alloc= alloc_n;
+	return true;
 }
 
 static struct userp_bstr_part * userp_enc_make_room(userp_enc enc, size_t n, int align) {
@@ -48,37 +120,39 @@ static struct userp_bstr_part * userp_enc_make_room(userp_enc enc, size_t n, int
 	userp_buffer buf= NULL;
 	size_t alloc_n;
 
+	// A value written into the static area of a record can't spill into a new buffer
+	if (enc->out_redirect) {
+		userp_diag_set(&enc->env->err, USERP_EDOINGITWRONG, "Value is larger than its static record field");
+		USERP_DISPATCH_ERR(enc->env);
+		return NULL;
+	}
 	// "commit" the progress from out_pos back to the bstr
 	if (enc->out_pos) {
 		part= &enc->output.parts[enc->output.part_count-1];
 		part->len= enc->out_pos - part->data;
+	}
+	if (enc->output.part_count) {
+		part= &enc->output.parts[enc->output.part_count-1];
 		ofs= part->ofs + part->len;
+		// Records can still be written into earlier buffers until they end
+		if (enc->writer && !enc->rec_depth && !enc_flush_output(enc))
+			return NULL;
 	}
 
 	// Is there room in the bstr?
-	if (enc->output.part_count >= enc->output.part_alloc) {
-		alloc_n= enc->output.part_alloc * 2;
-		// If output is the one built into the record, can't resize it.
-		if (enc->output.parts == enc->output_initial_parts) {
-			part= NULL;
-			if (!USERP_ALLOC_ARRAY(enc->env, &part, alloc_n))
-				return NULL;
-			memcpy(part, enc->output.parts, sizeof(struct userp_bstr_part) * enc->output.part_count);
-			enc->output.parts= part;
-			enc->output.part_alloc= alloc_n;
-			enc->output.env= enc->env;
-		}
-		else {
-			if (!USERP_ALLOC_ARRAY(enc->env, &enc->output.parts, alloc_n))
-				return NULL;
-		}
-	}
+	if (!enc_grow_parts(enc, 1))
+		return NULL;
 
-	// Allocate a new buffer for the bstr
-	// TODO: grow the allocation size each time
-	alloc_n= enc->env->enc_output_bufsize;
-	if (!(buf= userp_new_buffer(enc->env, NULL, alloc_n, 0)))
+	// Take a new buffer for the bstr from the env's pool, each one twice the size of the last
+	// up to enc_output_bufsize_max, so large blocks don't turn into thousands of parts.
+	alloc_n= enc->out_bufsize;
+	if (alloc_n < n)
+		alloc_n= n;
+	if (!(buf= userp_env_take_buffer(enc->env, alloc_n, 0)))
 		return NULL;
+	if (enc->out_bufsize < enc->env->enc_output_bufsize_max)
+		enc->out_bufsize= enc->out_bufsize * 2 < enc->env->enc_output_bufsize_max?
+			enc->out_bufsize * 2 : enc->env->enc_output_bufsize_max;
 
 	// Initialize the new part with the new buffer
 	part= &enc->output.parts[enc->output.part_count++];
@@ -94,17 +168,467 @@ static struct userp_bstr_part * userp_enc_make_room(userp_enc enc, size_t n, int
 	return part;
 }
 
+/*IMPLDOC
+
+#### userp_encode_vqty
+
+    uint8_t *p= userp_encode_vqty(p, value);
+
+Write a variable-length quantity in the format read by `userp_decode_vqty_quick`, and return
+the position after it.  The caller must ensure `USERP_VQTY_MAX` bytes are available at `p`,
+because the value is written with a single unaligned 8-byte store even when it is shorter.
+
+The length comes from the count of significant bits, and the store is branch-free except for
+values of more than 32 bits, which are rare.  It is defined in userp_private.h, so that the
+builtin type tables of scopetype.c are written by the same code.
+
+*/
+/*APIDOC
+
+#### userp_enc_int
+
+    bool success= userp_enc_int(enc, value);
+    bool success= userp_enc_int64(enc, value);
+
+Encode an integer as a signed variable-length quantity.  The sign is stored in the low bit,
+so small negative numbers are as compact as small positive ones.
+
+As the value of a record field (see `userp_enc_rec_seek_field`) the integer is encoded as the
+field's type says: fixed-width two's complement, an offset from the type's min or max, or a
+variable-length quantity, byte-swapped if the type says so.  A value outside the type's range
+is an error.
+
+*/
+static bool enc_zeros(userp_enc enc, size_t n);
+static bool enc_align(userp_enc enc, int align);
+
+// Store the low 'bits' of 'raw' at bit offset 'bitofs' of 'area', leaving the other bits.
+// 'lim' is the end of the buffer, below which 8-byte loads and stores are safe.
+static void enc_store_bits(uint8_t *area, size_t bitofs, int bits, uint64_t raw, const uint8_t *lim) {
+	uint8_t *p= area + (bitofs >> 3), m;
+	int shift= bitofs & 7, take;
+	uint64_t mask, w;
+	if (shift + bits <= 64 && p + 8 <= lim) {
+		mask= (bits < 64? ((uint64_t)1 << bits) - 1 : ~(uint64_t)0) << shift;
+		w= userp_load_le64((char*) p);
+		userp_store_le64(p, (w & ~mask) | ((raw << shift) & mask));
+		return;
+	}
+	for (; bits > 0; bits -= take, shift= 0, p++) {
+		take= 8 - shift < bits? 8 - shift : bits;
+		m= (uint8_t)(((1 << take) - 1) << shift);
+		*p= (*p & ~m) | ((uint8_t)(raw << shift) & m);
+		raw >>= take;
+	}
+}
+
+// Encode an integer as the type of the record field being written (enc->val_plan)
+static bool enc_int_plan(userp_enc enc, int64_t value) {
+	const struct type_plan *plan= enc->val_plan;
+	int bits= plan->bits;
+	uint64_t raw;
+	if (plan->flags & PLAN_DELTA_ZIGZAG)
+		value= (int64_t)(((uint64_t) value << 1) ^ (uint64_t)(value >> 63));
+	switch (plan->op) {
+	case PLAN_INT_TWOS:
+		if (bits < 64 && (bits? (value >> (bits - 1)) != 0 && (value >> (bits - 1)) != -1 : value != 0))
+			goto fail_range;
+		raw= bits < 64? (uint64_t) value & (((uint64_t)1 << bits) - 1) : (uint64_t) value;
+		break;
+	case PLAN_INT_BITS:
+	case PLAN_INT_VQTY:
+		if ((plan->flags & PLAN_DESCENDING)? value > plan->base : value < plan->base)
+			goto fail_range;
+		raw= (plan->flags & PLAN_DESCENDING)? (uint64_t) plan->base - (uint64_t) value
+			: (uint64_t) value - (uint64_t) plan->base;
+		if (plan->op == PLAN_INT_VQTY)
+			goto vqty;
+		if (bits < 64 && (raw >> bits))
+			goto fail_range;
+		break;
+	case PLAN_INT_VQTY_SIGNED:
+		raw= ((uint64_t) value << 1) ^ (uint64_t)(value >> 63);
+		goto vqty;
+	default:
+		userp_diag_setf(&enc->env->err, USERP_ETYPE,
+			"Type " USERP_DIAG_INDEX " is not an integer", (int) plan->type);
+		USERP_DISPATCH_ERR(enc->env);
+		return false;
+	}
+	if (bits > 64) {
+		userp_diag_setf(&enc->env->err, USERP_ELIMIT,
+			"Type " USERP_DIAG_INDEX " is wider than 64 bits, which is not supported yet", (int) plan->type);
+		USERP_DISPATCH_ERR(enc->env);
+		return false;
+	}
+	if ((plan->flags & PLAN_BSWAP) && bits && !(bits & 7))
+		raw= __builtin_bswap64(raw) >> (64 - bits);
+	// Static fields are stored in place, at any bit offset
+	if (enc->val_static) {
+		enc_store_bits(enc->val_static, enc->val_bitofs, bits, raw, enc->val_static_lim);
+		return true;
+	}
+	if (bits & 7) {
+		userp_diag_set(&enc->env->err, USERP_EDOINGITWRONG,
+			"Integers of partial bytes can only be encoded in the static area of a record");
+		USERP_DISPATCH_ERR(enc->env);
+		return false;
+	}
+	if (!enc_align(enc, enc->val_align))
+		return false;
+	if (enc->out_lim - enc->out_pos < 8 && !userp_enc_make_room(enc, 8, 0))
+		return false;
+	userp_store_le64(enc->out_pos, raw);
+	enc->out_pos += bits >> 3;
+	return enc_zeros(enc, enc->val_pad);
+
+	vqty:
+	if (!enc_align(enc, enc->val_align))
+		return false;
+	if (enc->out_lim - enc->out_pos < USERP_VQTY_MAX && !userp_enc_make_room(enc, USERP_VQTY_MAX, 0))
+		return false;
+	enc->out_pos= userp_encode_vqty(enc->out_pos, raw);
+	return enc_zeros(enc, enc->val_pad);
+
+	CATCH(fail_range) {
+		userp_diag_setf(&enc->env->err, USERP_ELIMIT,
+			"Value is out of range for type " USERP_DIAG_INDEX, (int) plan->type);
+		USERP_DISPATCH_ERR(enc->env);
+	}
+	return false;
+}
+
+bool userp_enc_int64(userp_enc enc, int64_t value) {
+	if (enc->val_plan)
+		return enc_int_plan(enc, value);
+	if (enc->out_lim - enc->out_pos < USERP_VQTY_MAX) {
+		if (!userp_enc_make_room(enc, USERP_VQTY_MAX, 0))
+			return false;
+	}
+	enc->out_pos= userp_encode_vqty(enc->out_pos, ((uint64_t) value << 1) ^ (uint64_t)(value >> 63));
+	return true;
+}
+
 bool userp_enc_int(userp_enc enc, int value) {
-	// TODO: switch based on current frame's type and alignment requirements
-	if (enc->out_lim - enc->out_pos < 4) {
-		if (!userp_enc_make_room(enc, 4, 0))
+	return userp_enc_int64(enc, value);
+}
+
+/*APIDOC
+
+#### userp_enc_int_array
+
+    int32_t samples[4096];
+    bool success= userp_enc_int_array(enc, samples, sizeof(*samples), 4096, 0);
+
+Encode a native array of 1, 2, 4, or 8 byte integers as a sequence of variable-length
+quantities.  Values are signed (with the sign in the low bit, as for `userp_enc_int`) unless
+flag `USERP_ENC_UNSIGNED` is given.  This writes only the elements; the array's length and
+type are up to the caller.
+
+With flag `USERP_ENC_DELTA`, each element is written as its difference from the previous
+element (the first from 0), for an Integer type with the `delta` attribute.  Sorted data such
+as timestamps then encodes as small numbers.  Signed differences match a signed type with
+`delta` 1, or an unsigned type with `delta` 2 (zigzag).  With `USERP_ENC_UNSIGNED` the
+differences are unsigned, so the elements must not decrease.  As the value of a record field,
+the field's element type decides whether elements are deltas, and `USERP_ENC_DELTA` for a type
+without `delta` is an error.
+
+This is much faster than calling `userp_enc_int` per element.
+
+*/
+/*IMPLDOC
+
+The array is encoded in blocks of `INT_PACK_BLOCK` elements.  The first pass over a block
+widens each element to 64 bits and looks up its encoded length by its count of leading zeros.
+Then the output space for the whole block is reserved once, and the second pass writes each
+value with an unaligned 8-byte store and no bounds check.  The last few values of the
+reserved space would overrun it with such a store, so they are copied from a temporary.
+
+Reserving per block rather than for the whole array keeps a huge array from demanding a
+single huge buffer, and lets the block fill the remainder of the current one.
+
+*/
+#define INT_PACK_BLOCK 256
+
+bool userp_enc_int_array(userp_enc enc, const void *values, size_t elem_size, size_t count, int flags) {
+	uint64_t raw[INT_PACK_BLOCK], v, prev= 0;
+	uint8_t len[INT_PACK_BLOCK], tmp[USERP_VQTY_MAX + 8], *p, *end;
+	size_t i, j, block, total;
+	int is_unsigned= (flags & USERP_ENC_UNSIGNED)? 1 : 0;
+	bool delta= (flags & USERP_ENC_DELTA) != 0, decreasing= false;
+	const struct type_plan *elem= enc->val_plan;
+
+	// As a record field, the element type decides whether elements are deltas
+	if (elem && elem->op == PLAN_ARRAY && elem->elem)
+		elem= elem->elem;
+	if (elem && elem->op >= PLAN_INT_TWOS && elem->op <= PLAN_INT_VQTY_SIGNED) {
+		if (delta && !(elem->flags & PLAN_DELTA)) {
+			userp_diag_setf(&enc->env->err, USERP_ETYPE,
+				"USERP_ENC_DELTA given, but type " USERP_DIAG_INDEX " is not a delta", (int) elem->type);
+			USERP_DISPATCH_ERR(enc->env);
+			return false;
+		}
+		delta= (elem->flags & PLAN_DELTA) != 0;
+	}
+	if (elem_size != 1 && elem_size != 2 && elem_size != 4 && elem_size != 8) {
+		userp_diag_setf(&enc->env->err, USERP_EDOINGITWRONG,
+			"Integer element size must be 1, 2, 4, or 8 (not " USERP_DIAG_SIZE ")", elem_size);
+		USERP_DISPATCH_ERR(enc->env);
+		return false;
+	}
+	for (i= 0; i < count; i += block) {
+		block= count - i < INT_PACK_BLOCK? count - i : INT_PACK_BLOCK;
+		// The loop is repeated per input type and signedness, to keep the loop body simple
+		#define INT_PACK_LEN_LOOP(type, zigzag) \
+			for (j= 0; j < block; j++) { \
+				v= (uint64_t)(int64_t) ((const type*) values)[i + j]; \
+				if (delta) { \
+					decreasing |= v < prev; \
+					v -= prev; \
+					prev += v; \
+				} \
+				if (zigzag) \
+					v= (v << 1) ^ (uint64_t)((int64_t) v >> 63); \
+				raw[j]= v; \
+				total += (len[j]= vqty_encoded_len(v)); \
+			}
+		total= 0;
+		switch (elem_size * 2 + is_unsigned) {
+		case 2: INT_PACK_LEN_LOOP(int8_t, true); break;
+		case 3: INT_PACK_LEN_LOOP(uint8_t, false); break;
+		case 4: INT_PACK_LEN_LOOP(int16_t, true); break;
+		case 5: INT_PACK_LEN_LOOP(uint16_t, false); break;
+		case 8: INT_PACK_LEN_LOOP(int32_t, true); break;
+		case 9: INT_PACK_LEN_LOOP(uint32_t, false); break;
+		case 16: INT_PACK_LEN_LOOP(int64_t, true); break;
+		default: INT_PACK_LEN_LOOP(uint64_t, false);
+		}
+		#undef INT_PACK_LEN_LOOP
+		if (decreasing && is_unsigned) {
+			userp_diag_set(&enc->env->err, USERP_ELIMIT,
+				"Element of unsigned delta array is less than the element before it");
+			USERP_DISPATCH_ERR(enc->env);
 			return false;
+		}
+
+		if ((size_t)(enc->out_lim - enc->out_pos) < total) {
+			if (!userp_enc_make_room(enc, total, 0))
+				return false;
+		}
+		p= enc->out_pos;
+		end= p + total;
+		for (j= 0; j < block && end - p >= 8 + 1; j++) {
+			if (len[j] == 9) {
+				p[0]= 0x0F;
+				userp_store_le64(p + 1, raw[j]);
+			}
+			else
+				userp_store_le64(p, (raw[j] << vqty_enc_shift[len[j]]) | vqty_enc_prefix[len[j]]);
+			p += len[j];
+		}
+		for (; j < block; j++) {
+			userp_encode_vqty(tmp, raw[j]);
+			memcpy(p, tmp, len[j]);
+			p += len[j];
+		}
+		enc->out_pos= p;
+	}
+	return true;
+}
+
+/*APIDOC
+
+#### userp_enc_float
+
+    bool success= userp_enc_float(enc, value);
+
+Encode a `float` as a Float32 (see `userp_scope_add_float_types`), which is just the 4 bytes of
+the value in little-endian order.
+
+#### userp_enc_double
+
+    bool success= userp_enc_double(enc, value);
+
+Encode a `double` as a Float64, the 8 bytes of the value in little-endian order.
+
+#### userp_enc_float_array
+
+    double matrix[512*512];
+    bool success= userp_enc_float_array(enc, matrix, sizeof(*matrix), 512*512);
+
+Encode a native array of `float` (`elem_size` 4) or `double` (`elem_size` 8) as the elements
+of an array of Float32 or Float64.  On little-endian hosts the encoding is identical to the
+native array, so this is a `memcpy` into the output buffers, a buffer at a time.  This writes
+only the elements; the array's length and type are up to the caller.
+
+*/
+
+// Append count elements of elem_size bytes, as little-endian
+static bool enc_le_elems(userp_enc enc, const void *values, size_t elem_size, size_t count) {
+	const uint8_t *src= (const uint8_t*) values;
+	size_t n, chunk;
+	while (count) {
+		n= (size_t)(enc->out_lim - enc->out_pos) / elem_size;
+		if (!n) {
+			// Ask for at most a buffer's worth at a time, so a huge array isn't one huge buffer
+			chunk= enc->env->enc_output_bufsize / elem_size;
+			n= count < chunk? count : chunk? chunk : 1;
+			if (!userp_enc_make_room(enc, n * elem_size, 0))
+				return false;
+			n= (size_t)(enc->out_lim - enc->out_pos) / elem_size;
+		}
+		if (n > count)
+			n= count;
+		#if ENDIAN != LSB_FIRST
+		if (elem_size > 1) {
+			size_t i;
+			for (i= 0; i < n; i++)
+				if (elem_size == 4)
+					userp_store_le32(enc->out_pos + i * 4, ((const uint32_t*) src)[i]);
+				else
+					userp_store_le64(enc->out_pos + i * 8, ((const uint64_t*) src)[i]);
+		}
+		else
+		#endif
+		memcpy(enc->out_pos, src, n * elem_size);
+		enc->out_pos += n * elem_size;
+		src += n * elem_size;
+		count -= n;
+	}
+	return true;
+}
+
+bool userp_enc_float(userp_enc enc, float value) {
+	return enc_le_elems(enc, &value, sizeof(value), 1);
+}
+
+bool userp_enc_double(userp_enc enc, double value) {
+	return enc_le_elems(enc, &value, sizeof(value), 1);
+}
+
+bool userp_enc_float_array(userp_enc enc, const void *values, size_t elem_size, size_t count) {
+	if (elem_size != sizeof(float) && elem_size != sizeof(double)) {
+		userp_diag_setf(&enc->env->err, USERP_EDOINGITWRONG,
+			"Float element size must be 4 or 8 (not " USERP_DIAG_SIZE ")", elem_size);
+		USERP_DISPATCH_ERR(enc->env);
+		return false;
+	}
+	return enc_le_elems(enc, values, elem_size, count);
+}
+
+/*APIDOC
+
+#### userp_enc_bytes
+
+    bool success= userp_enc_bytes(enc, data, length);
+
+Encode `length` bytes, copying them into the output.  Like the array functions, this writes
+only the bytes; the length and type are up to the caller.  The alignment and padding of the
+type being encoded are applied around them.
+
+#### userp_enc_bytes_zerocopy
+
+    userp_buffer buf= userp_new_buffer(env, frame, frame_len, 0);
+    buf->destructor= release_frame;
+    buf->destructor_data= frame;
+    bool success= userp_enc_bytes_zerocopy(enc, buf, frame, frame_len);
+    userp_drop_buffer(buf);
+
+Like `userp_enc_bytes`, but instead of copying, the output references `data` directly as a
+part of its own (`data` may be NULL to mean `buf->data`).  The encoder holds a reference to
+`buf` for as long as its output, or anything it was handed to such as a `userp_writer`, needs
+it, and when the last reference is dropped the buffer's destructor lets you know the memory is
+free again.  If `buf` is not reference-counted (`refcnt` of 0) the data must outlive the
+encoder and its output.  Any alignment padding goes into the encoder's own buffer before the
+data, and encoding continues in the unused space of that buffer afterward, so small values
+around a large one don't cost extra buffers.  Data shorter than `USERP_ENC_ZEROCOPY_MIN` is
+copied, since a separate part would cost more than the copy.
+
+*/
+
+// Position of out_pos in the whole output
+static size_t enc_out_ofs(userp_enc enc) {
+	struct userp_bstr_part *last;
+	if (!enc->output.part_count)
+		return 0;
+	last= &enc->output.parts[enc->output.part_count-1];
+	return last->ofs + (enc->out_pos? (size_t)(enc->out_pos - last->data) : last->len);
+}
+
+static bool enc_zeros(userp_enc enc, size_t n) {
+	if (!n)
+		return true;
+	if ((size_t)(enc->out_lim - enc->out_pos) < n && !userp_enc_make_room(enc, n, 0))
+		return false;
+	memset(enc->out_pos, 0, n);
+	enc->out_pos += n;
+	return true;
+}
+
+// Pad with zeros to the next multiple of 2**align bits of the whole output
+static bool enc_align(userp_enc enc, int align) {
+	size_t mask, ofs;
+	if (align <= 3)
+		return true;
+	mask= ((size_t)1 << (align - 3)) - 1;
+	ofs= enc_out_ofs(enc);
+	return !(ofs & mask) || enc_zeros(enc, mask + 1 - (ofs & mask));
+}
+
+bool userp_enc_bytes(userp_enc enc, const void *data, size_t length) {
+	return enc_align(enc, enc->val_align)
+		&& enc_le_elems(enc, data, 1, length)
+		&& enc_zeros(enc, enc->val_pad);
+}
+
+// Add 'length' bytes of 'buf' at 'data' to the output as a part of its own
+static bool enc_splice(userp_enc enc, userp_buffer buf, const void *data, size_t length) {
+	struct userp_bstr_part *part;
+	uint8_t *tail;
+	size_t ofs;
+	if (enc->out_redirect)
+		return enc_le_elems(enc, data, 1, length);
+	// "commit" the current buffer, then add the caller's data as the next part
+	tail= enc->out_pos;
+	if (tail)
+		enc->output.parts[enc->output.part_count-1].len= tail - enc->output.parts[enc->output.part_count-1].data;
+	enc->out_pos= NULL;
+	ofs= enc_out_ofs(enc);
+	if (!enc_grow_parts(enc, 2))
+		return false;
+	if (!userp_grab_buffer(buf)) {
+		USERP_DISPATCH_ERR(enc->env);
+		return false;
 	}
-	memcpy(enc->out_pos, &value, 4);
-	enc->out_pos += 4;
+	part= &enc->output.parts[enc->output.part_count++];
+	part->buf= buf;
+	part->data= (uint8_t*) data;
+	part->len= length;
+	part->ofs= ofs;
+	// Continue in the rest of the previous buffer, as another part referencing it
+	if (tail && tail < enc->out_lim && userp_grab_buffer(part[-1].buf)) {
+		part[1].buf= part[-1].buf;
+		part[1].data= tail;
+		part[1].len= 0;
+		part[1].ofs= ofs + length;
+		enc->output.part_count++;
+		enc->out_pos= tail;
+	}
+	else
+		enc->out_lim= NULL;
 	return true;
 }
 
+bool userp_enc_bytes_zerocopy(userp_enc enc, userp_buffer buf, const void *data, size_t length) {
+	if (!data)
+		data= buf->data;
+	if (length < USERP_ENC_ZEROCOPY_MIN)
+		return userp_enc_bytes(enc, data, length);
+	return enc_align(enc, enc->val_align)
+		&& enc_splice(enc, buf, data, length)
+		&& enc_zeros(enc, enc->val_pad);
+}
+
 struct userp_bstr* userp_enc_finish(userp_enc enc) {
 	struct userp_bstr_part *part;
 	// TODO: finish any current frames
@@ -112,81 +636,1329 @@ struct userp_bstr* userp_enc_finish(userp_enc enc) {
 	if (enc->out_pos) {
 		part= &enc->output.parts[enc->output.part_count-1];
 		part->len= enc->out_pos - part->data;
+		if (enc->writer && !enc_flush_output(enc))
+			return NULL;
 	}
 	return &enc->output;
 }
 
-/* userp_enc_rec_begin
- *
- * Configure the encoder to begin writing fields of a record.
- */
+/*APIDOC
+
+#### userp_enc_rec_begin
+
+    if (!userp_enc_rec_begin(enc, type)) ...
+    if (!userp_enc_rec_seek_field(enc, 0) || !userp_enc_int(enc, 42)) ...
+    if (!userp_enc_rec_seek_field(enc, 1) || !userp_enc_double(enc, 1.5)) ...
+    if (!userp_enc_rec_end(enc)) ...
+
+Begin encoding a record of `type`.  Each field is written by seeking to it (by its index in the
+record type's list of fields) and then encoding its value with the usual functions, which
+follow the field's type (see `userp_enc_int`).  The field is finished by seeking to the next
+one, by `userp_enc_rec_commit_field`, or by `userp_enc_rec_end`.  Fields may be written in any
+order.  A field of a record type is written by beginning a nested record.
+
+For a record with no optional fields, the static area is reserved in the output up front and
+static fields (all fields, for a record where every field has a fixed size) are stored at their
+offset as they are written, so a record of fixed-size integers costs one store per field.
+Other fields written in order are encoded in place after the static area.
+
+#### userp_enc_rec_declare_fields
+
+    size_t fields[]= { 0, 2, 5 };
+    if (!userp_enc_rec_declare_fields(enc, fields, 3)) ...
+
+A record with Often or Seldom fields or ad-hoc fields begins with a header saying which are
+present.  Declaring the fields right after `userp_enc_rec_begin` writes the header, so the rest
+of the record can be encoded in place, in the order of the encoding: the Always fields and
+declared Often fields in the order of the type, then declared Seldom fields in the order given
+here.  Every Always field is implied and need not be listed.  Fields can still be written in
+another order, at the cost of moving them.
+
+Without a declaration, the static area and each field are written into temporary buffers
+(taken from the env's buffer pool), and `userp_enc_rec_end` writes the header and assembles the
+record from them.
+
+#### userp_enc_rec_add_field
+
+    if (!userp_enc_rec_add_field(enc, sym, type) || !userp_enc_int(enc, 7)) ...
+
+Add an ad-hoc field named by `sym`, for a record type with an `other_field_type`, which `type`
+must match.  The symbol must not already be a field of the record.  Ad-hoc fields can't be
+declared, so a record using them is always assembled at the end.
+
+#### userp_enc_rec_commit_field
+
+    if (!userp_enc_rec_commit_field(enc)) ...
+
+Finish the field being written.  This happens automatically when seeking to another field or
+ending the record.
+
+#### userp_enc_rec_end
+
+    if (!userp_enc_rec_end(enc)) ...
+
+Finish the record, moving any fields that were written out of order into place.  It is an
+error if an Always field (or a declared field) was not written, in which case the record is
+still open and you may write the missing field and try again.
+
+*/
+
+/*IMPLDOC
+
+### Record Encoding
+
+Each record being encoded has a `struct enc_rec_frame` on `enc->rec`, and works in one of two
+modes:
+
+  * **Direct**: the header (if any) is written, the record is aligned, and its static area is
+    reserved and zeroed in the output.  `order[]` lists the plan positions of the dynamic
+    fields in the order they are encoded, and a field that is `order[next]` is encoded in
+    place.  Records without a header begin in this mode, and records with a header switch to
+    it when their fields are declared.
+  * **Temp**: a record with a header whose fields were not declared.  The static area is the
+    start of the frame's temporary output.
+
+Static fields are never moved.  An integer static field is stored with a single 8-byte
+read-modify-write at its bit offset (applying the type's shift, mask, and byte swap), which is
+why the buffer end is remembered in `static_lim`.  Other static fields must be whole bytes, and
+are encoded by pointing `out_pos` into the static area for the duration of the value.
+
+A dynamic field which can't be written in place is written to the frame's temporary output
+(`alt`, swapped with the encoder's output for the duration of the value), and recorded as a
+segment with a sort key: its index in `order[]` in direct mode, or in temp mode its plan
+position (extras come after every other field, in the order they were written).  At the end,
+the segments are sorted and appended to the output, copying short ones and referencing the
+buffers of long ones.  The alignment of a field holds for its start after it moves, but any
+alignment inside it finer than that of its own type is relative to where it was written.
+
+While any record is open, an attached writer is not given the output, since the static area of
+the record is still being written.
+
+*/
+
+#define ENC_REC_PENDING 0
+#define ENC_REC_DIRECT  1
+#define ENC_REC_TEMP    2
+#define ENC_REC_NONE    SIZE_MAX
+#define ENC_REC_ADHOC   (SIZE_MAX-1)
+
+// Whether a value of this type begins by aligning.  A record with a header aligns after it.
+static inline bool plan_aligns_first(const struct type_plan *plan) {
+	return !(plan->op == PLAN_RECORD && (plan->often_count || plan->seldom_count || plan->other));
+}
+
+static inline bool plan_has_header(const struct type_plan *plan) {
+	return plan->op == PLAN_RECORD && (plan->often_count || plan->seldom_count || plan->other);
+}
+
+static bool rec_fail(userp_enc enc, int code, const char *msg, size_t index) {
+	userp_diag_setf(&enc->env->err, code, msg, (int) index);
+	USERP_DISPATCH_ERR(enc->env);
+	return false;
+}
+
+static struct enc_rec_frame* rec_top(userp_enc enc) {
+	if (!enc->rec_depth) {
+		userp_diag_set(&enc->env->err, USERP_EDOINGITWRONG, "No record is being encoded");
+		USERP_DISPATCH_ERR(enc->env);
+		return NULL;
+	}
+	return &enc->rec[enc->rec_depth - 1];
+}
+
+// Exchange the encoder's output with the frame's other output
+static void rec_swap_output(userp_enc enc, struct enc_rec_frame *f) {
+	struct userp_bstr str= enc->output;
+	uint8_t *pos= enc->out_pos, *lim= enc->out_lim;
+	// "commit" the progress in the current part, since out_pos goes away with it
+	if (pos)
+		str.parts[str.part_count-1].len= pos - str.parts[str.part_count-1].data;
+	enc->output= f->alt;
+	enc->out_pos= f->alt_pos;
+	enc->out_lim= f->alt_lim;
+	f->alt= str;
+	f->alt_pos= pos;
+	f->alt_lim= lim;
+}
+
+// Grow an array of size_t, for the frame's lists
+static bool rec_list_push(userp_enc enc, size_t **list, size_t *count, size_t *alloc, size_t value) {
+	size_t n;
+	if (*count >= *alloc) {
+		n= *alloc * 2 + 8;
+		if (!USERP_ALLOC_ARRAY(enc->env, list, n))
+			return false;
+		*alloc= n;
+	}
+	(*list)[(*count)++]= value;
+	return true;
+}
+
+// Align and reserve the static area in the current output, zeroed
+static bool rec_reserve_static(userp_enc enc, struct enc_rec_frame *f) {
+	const struct type_plan *plan= f->plan;
+	struct userp_bstr_part *part;
+	size_t n= plan->op == PLAN_RECORD_FIXED? (plan->fixed_bits + 7) / 8 + plan->pad : (plan->static_bits + 7) / 8;
+	// Within a parent's static area, the offset was already aligned, and the parent's buffer
+	// is the limit for the 8-byte stores
+	if (!enc->out_redirect && !enc_align(enc, plan->align))
+		return false;
+	f->static_area= NULL;
+	if (!n)
+		return true;
+	if ((size_t)(enc->out_lim - enc->out_pos) < n && !userp_enc_make_room(enc, n, 0))
+		return false;
+	if (enc->out_redirect)
+		f->static_lim= f[-1].static_lim;
+	else {
+		part= &enc->output.parts[enc->output.part_count-1];
+		f->static_lim= part->buf->data + part->buf->alloc_len;
+	}
+	f->static_area= enc->out_pos;
+	memset(enc->out_pos, 0, n);
+	enc->out_pos += n;
+	return true;
+}
+
+// Write the record header: presence flags and the count of extras, then each extra's reference
+static bool rec_write_header(userp_enc enc, struct enc_rec_frame *f) {
+	size_t i;
+	if (enc->out_lim - enc->out_pos < USERP_VQTY_MAX && !userp_enc_make_room(enc, USERP_VQTY_MAX, 0))
+		return false;
+	enc->out_pos= userp_encode_vqty(enc->out_pos, f->presence | ((uint64_t) f->extra_count << f->plan->often_count));
+	for (i= 0; i < f->extra_count; i++) {
+		if (enc->out_lim - enc->out_pos < USERP_VQTY_MAX && !userp_enc_make_room(enc, USERP_VQTY_MAX, 0))
+			return false;
+		enc->out_pos= userp_encode_vqty(enc->out_pos, f->extra[i]);
+	}
+	return true;
+}
+
+// Switch a record with a header that wasn't declared to temp mode
+static bool rec_begin_temp(userp_enc enc, struct enc_rec_frame *f) {
+	bool ok;
+	rec_swap_output(enc, f);
+	ok= rec_reserve_static(enc, f);
+	rec_swap_output(enc, f);
+	f->mode= ENC_REC_TEMP;
+	return ok;
+}
+
 bool userp_enc_rec_begin(userp_enc enc, userp_type type) {
-	// If the record does not allow 'extra' or 'ad-hoc' fields, then just allocate
-	// at least the static length (aligned) on the end of the curent buffer (or make a new buffer).
-	...
-	// Else there might be dynamic elements.  Create a new buffer to hold the static area and
-	// encoded fields.  Don't finish the previous buffer until the record is finalized.
-	...
-	// Seek to the first field of the record.
-	...
+	const struct type_plan *plan;
+	struct enc_rec_frame *f;
+	size_t i, n;
+	if (enc->rec_depth >= enc->rec_alloc) {
+		n= enc->rec_alloc * 2 + 4;
+		if (!USERP_ALLOC_ARRAY(enc->env, &enc->rec, n))
+			return false;
+		bzero(enc->rec + enc->rec_alloc, (n - enc->rec_alloc) * sizeof(*enc->rec));
+		for (i= enc->rec_alloc; i < n; i++)
+			enc->rec[i].alt.env= enc->env;
+		enc->rec_alloc= n;
+	}
+	f= &enc->rec[enc->rec_depth];
+	// The frame remembers the plan of the last record at this depth, usually the same type
+	if (f->plan && f->plan->type == type)
+		plan= f->plan;
+	else if (!(plan= userp_scope_get_type_plan(enc->scope, type)))
+		return false;
+	else if (plan->op != PLAN_RECORD && plan->op != PLAN_RECORD_FIXED)
+		return rec_fail(enc, USERP_ETYPE, "Type " USERP_DIAG_INDEX " is not a record", type);
+	if (plan->member_count > f->written_alloc) {
+		n= plan->member_count;
+		if (!USERP_ALLOC_ARRAY(enc->env, &f->written, n))
+			return false;
+		f->written_alloc= n;
+	}
+	bzero(f->written, plan->member_count);
+	f->plan= plan;
+	f->order_count= f->next= f->extra_count= f->seg_count= 0;
+	f->presence= 0;
+	f->cur= ENC_REC_NONE;
+	f->cur_in_temp= false;
+	// The value of a parent's field is this record, which handles its own alignment
+	enc->val_plan= NULL;
+	enc->val_static= NULL;
+	enc->val_align= 0;
+	enc->val_pad= 0;
+	if (plan_has_header(plan))
+		f->mode= ENC_REC_PENDING;
+	else {
+		if (plan->op == PLAN_RECORD)
+			for (i= plan->member_count - plan->always_count; i < plan->member_count; i++)
+				if (!rec_list_push(enc, &f->order, &f->order_count, &f->order_alloc, i))
+					return false;
+		if (!rec_reserve_static(enc, f))
+			return false;
+		f->mode= ENC_REC_DIRECT;
+	}
+	enc->rec_depth++;
+	return true;
+}
+
+// Plan position of the field with index field_id in the record type, or ENC_REC_NONE
+static size_t rec_field_pos(const struct type_plan *plan, size_t field_id) {
+	size_t i;
+	if (field_id < plan->member_count && plan->fields[field_id].index == field_id)
+		return field_id;
+	for (i= 0; i < plan->member_count; i++)
+		if (plan->fields[i].index == field_id)
+			return i;
+	return ENC_REC_NONE;
 }
 
 bool userp_enc_rec_declare_fields(userp_enc enc, size_t fields[], size_t field_count) {
-	// Iterate fields building list of 'extra' and 'ad-hoc'.
-	...
-	// If fields are not in order, warn user
-	...
-	// Write out the list of 'extra' and 'ad-hoc' in same order provided
-	// Allocate the static storage region.
-	// Set the fields list, to be iterated as fields are written.  Mark it as final.
+	struct enc_rec_frame *f= rec_top(enc);
+	const struct type_plan *plan;
+	size_t i, pos, first_often, first_seldom;
+	if (!f)
+		return false;
+	plan= f->plan;
+	if (f->mode != ENC_REC_PENDING) {
+		if (!plan_has_header(plan) && !f->seg_count && f->cur == ENC_REC_NONE)
+			return true; // every field is implied
+		userp_diag_set(&enc->env->err, USERP_EDOINGITWRONG, "Record fields must be declared before writing any of them");
+		USERP_DISPATCH_ERR(enc->env);
+		return false;
+	}
+	first_seldom= plan->member_count - plan->seldom_count;
+	first_often= first_seldom - plan->often_count;
+	for (i= first_often - plan->always_count; i < first_often; i++)
+		if (!rec_list_push(enc, &f->order, &f->order_count, &f->order_alloc, i))
+			return false;
+	// Note the declared fields in 'written' for now, to catch duplicates and sort the often-fields
+	for (i= 0; i < field_count; i++) {
+		if ((pos= rec_field_pos(plan, fields[i])) == ENC_REC_NONE)
+			return rec_fail(enc, USERP_ERECORD, "Record has no field " USERP_DIAG_INDEX, fields[i]);
+		if (f->written[pos])
+			return rec_fail(enc, USERP_ERECORD, "Record field " USERP_DIAG_INDEX " was declared twice", fields[i]);
+		f->written[pos]= 1;
+		if (pos >= first_seldom && !rec_list_push(enc, &f->extra, &f->extra_count, &f->extra_alloc, pos - first_seldom))
+			return false;
+	}
+	for (i= first_often; i < first_seldom; i++)
+		if (f->written[i]) {
+			f->presence |= (uint64_t)1 << (i - first_often);
+			if (!rec_list_push(enc, &f->order, &f->order_count, &f->order_alloc, i))
+				return false;
+		}
+	for (i= 0; i < f->extra_count; i++)
+		if (!rec_list_push(enc, &f->order, &f->order_count, &f->order_alloc, first_seldom + f->extra[i]))
+			return false;
+	bzero(f->written, plan->member_count);
+	if (!rec_write_header(enc, f) || !rec_reserve_static(enc, f))
+		return false;
+	f->mode= ENC_REC_DIRECT;
+	return true;
+}
+
+// Prepare to encode the value of a field at plan position 'pos' (or an ad-hoc field)
+static bool rec_start_field(userp_enc enc, struct enc_rec_frame *f, size_t pos, const struct type_plan *fplan) {
+	const struct type_plan *plan= f->plan;
+	const struct plan_field *pf= pos < plan->member_count? &plan->fields[pos] : NULL;
+	size_t first_often= plan->member_count - plan->seldom_count - plan->often_count, i;
+	bool in_place= false;
+	if (f->mode == ENC_REC_PENDING && !rec_begin_temp(enc, f))
+		return false;
+	f->cur= pos;
+	enc->val_plan= fplan;
+	enc->val_align= 0;
+	enc->val_pad= fplan->pad;
+	// Static fields, and every field of a fixed record, go directly into the static area
+	if (pf && (plan->op == PLAN_RECORD_FIXED || pos < first_often - plan->always_count)) {
+		f->written[pos]= 1;
+		enc->val_pad= 0;
+		if (fplan->op == PLAN_INT_TWOS || fplan->op == PLAN_INT_BITS) {
+			enc->val_static= f->static_area;
+			enc->val_static_lim= f->static_lim;
+			enc->val_bitofs= pf->ofs;
+			return true;
+		}
+		if ((pf->ofs & 7) || (fplan->fixed_bits & 7))
+			return rec_fail(enc, USERP_EDOINGITWRONG,
+				"Static field " USERP_DIAG_INDEX " is not an integer and not whole bytes", pf->index);
+		f->save_pos= enc->out_pos;
+		f->save_lim= enc->out_lim;
+		enc->out_pos= f->static_area + (pf->ofs >> 3);
+		enc->out_lim= enc->out_pos + (fplan->fixed_bits >> 3) + (plan->op == PLAN_RECORD_FIXED? fplan->pad : 0);
+		enc->out_redirect= true;
+		return true;
+	}
+	if (pf)
+		f->written[pos]= 1;
+	if (f->mode == ENC_REC_DIRECT) {
+		// In place if it is next in order, else a segment keyed by its place in the order
+		for (i= f->next; i < f->order_count && f->order[i] != pos; i++);
+		if (i >= f->order_count)
+			return rec_fail(enc, USERP_ERECORD, "Record field " USERP_DIAG_INDEX " was not declared", pf? pf->index : 0);
+		in_place= i == f->next;
+		if (in_place)
+			f->next++;
+		f->cur_seg.key= i;
+	}
+	else if (pos >= first_often + plan->often_count) {
+		// Seldom and ad-hoc fields were added to the extras by the caller
+		f->cur_seg.key= plan->member_count + f->extra_count - 1;
+	}
+	else {
+		if (pos >= first_often)
+			f->presence |= (uint64_t)1 << (pos - first_often);
+		f->cur_seg.key= pos;
+	}
+	if (!in_place) {
+		rec_swap_output(enc, f);
+		f->cur_in_temp= true;
+	}
+	f->cur_seg.align= fplan->align;
+	if (plan_aligns_first(fplan) && !enc_align(enc, fplan->align))
+		return false;
+	f->cur_seg.ofs= enc_out_ofs(enc);
+	return true;
+}
+
+static bool rec_commit(userp_enc enc, struct enc_rec_frame *f) {
+	bool ok= true;
+	struct enc_rec_seg *seg;
+	size_t n;
+	if (enc->out_redirect) {
+		enc->out_pos= f->save_pos;
+		enc->out_lim= f->save_lim;
+		enc->out_redirect= false;
+	}
+	if (f->cur_in_temp) {
+		f->cur_seg.len= enc_out_ofs(enc) - f->cur_seg.ofs;
+		rec_swap_output(enc, f);
+		f->cur_in_temp= false;
+		if (f->seg_count >= f->seg_alloc) {
+			n= f->seg_alloc * 2 + 8;
+			if (!USERP_ALLOC_ARRAY(enc->env, &f->seg, n))
+				ok= false;
+			else
+				f->seg_alloc= n;
+		}
+		if (ok) {
+			seg= &f->seg[f->seg_count++];
+			*seg= f->cur_seg;
+		}
+	}
+	enc->val_plan= NULL;
+	enc->val_static= NULL;
+	enc->val_align= 0;
+	enc->val_pad= 0;
+	f->cur= ENC_REC_NONE;
+	return ok;
+}
+
+bool userp_enc_rec_commit_field(userp_enc enc) {
+	struct enc_rec_frame *f= rec_top(enc);
+	if (!f)
+		return false;
+	return f->cur == ENC_REC_NONE || rec_commit(enc, f);
 }
 
 bool userp_enc_rec_seek_field(userp_enc enc, size_t field_id) {
-	// If this field has static placement,
-	//  If this field has a mask or shift or byteswap, start a new temporary buffer
-	...
-	//  Else use the static region as-is (making sure it is allocated)
-	// Else, if the field is dynamically placed and the previous field has not been
-	// written, start a new temporary buffer.
-}
-
-/* userp_enc_rec_add_field
- *
- * Add an 'ad-hoc' field to the record.
- */
+	struct enc_rec_frame *f= rec_top(enc);
+	size_t pos, first_seldom;
+	if (!f || (f->cur != ENC_REC_NONE && !rec_commit(enc, f)))
+		return false;
+	if ((pos= rec_field_pos(f->plan, field_id)) == ENC_REC_NONE)
+		return rec_fail(enc, USERP_ERECORD, "Record has no field " USERP_DIAG_INDEX, field_id);
+	if (f->written[pos])
+		return rec_fail(enc, USERP_ERECORD, "Record field " USERP_DIAG_INDEX " was already written", field_id);
+	first_seldom= f->plan->member_count - f->plan->seldom_count;
+	if (pos >= first_seldom && f->mode != ENC_REC_DIRECT
+		&& !rec_list_push(enc, &f->extra, &f->extra_count, &f->extra_alloc, pos - first_seldom))
+		return false;
+	return rec_start_field(enc, f, pos, f->plan->fields[pos].plan);
+}
+
 bool userp_enc_rec_add_field(userp_enc enc, userp_symbol sym, userp_type type) {
-	// Check if the symbol already exists as a field.
-	...
-	// Does the type match extra_field_type?
-	...
-	// If not all the normal fields have been written, start a new buffer
-	...
-	// Allocate space on the list of extra/adhoc fields, and add this one (but don't mark
-	// as officially added until _commit_field)
-	...
-}
-
-/* userp_enc_rec_commit_field
- *
- * Perform any post-write operations needed to encode this field.
- * This includes things like shift/mask for static placement fields, or recording
- * the field in the 'extra' set.
- */
-bool userp_enc_rec_commit_field(userp_enc enc) {
-	...
+	struct enc_rec_frame *f= rec_top(enc);
+	const struct type_plan *plan;
+	size_t i;
+	if (!f || (f->cur != ENC_REC_NONE && !rec_commit(enc, f)))
+		return false;
+	plan= f->plan;
+	if (!plan->other)
+		return rec_fail(enc, USERP_ERECORD, "Record type " USERP_DIAG_INDEX " has no ad-hoc fields", plan->type);
+	if (type != plan->other->type)
+		return rec_fail(enc, USERP_ERECORD, "Ad-hoc fields of this record must be type " USERP_DIAG_INDEX, plan->other->type);
+	if (f->mode == ENC_REC_DIRECT) {
+		userp_diag_set(&enc->env->err, USERP_EDOINGITWRONG, "Ad-hoc fields can't be added to a record whose fields were declared");
+		USERP_DISPATCH_ERR(enc->env);
+		return false;
+	}
+	// Check if the symbol already exists as a field
+	for (i= 0; i < plan->member_count; i++)
+		if (plan->fields[i].name == sym)
+			goto fail_dup;
+	for (i= 0; i < f->extra_count; i++)
+		if (f->extra[i] == plan->seldom_count + sym)
+			goto fail_dup;
+	if (!rec_list_push(enc, &f->extra, &f->extra_count, &f->extra_alloc, plan->seldom_count + sym))
+		return false;
+	return rec_start_field(enc, f, ENC_REC_ADHOC, plan->other);
+	CATCH(fail_dup) {
+		userp_diag_setf(&enc->env->err, USERP_ERECORD, "Record already has a field named symbol " USERP_DIAG_INDEX, (int) sym);
+		USERP_DISPATCH_ERR(enc->env);
+	}
+	return false;
+}
+
+// Append a range of a bstr to the output, copying short pieces and referencing long ones
+static bool enc_append_range(userp_enc enc, const struct userp_bstr *src, size_t ofs, size_t len) {
+	const struct userp_bstr_part *p= src->parts, *end= p + src->part_count;
+	size_t skip, n;
+	for (; p < end && len; p++) {
+		if (ofs >= p->ofs + p->len)
+			continue;
+		skip= ofs - p->ofs;
+		n= p->len - skip < len? p->len - skip : len;
+		if (n < USERP_ENC_ZEROCOPY_MIN? !enc_le_elems(enc, p->data + skip, 1, n)
+			: !enc_splice(enc, p->buf, p->data + skip, n))
+			return false;
+		ofs += n;
+		len -= n;
+	}
+	return true;
+}
+
+static int rec_seg_cmp(const void *a, const void *b) {
+	size_t ka= ((const struct enc_rec_seg*) a)->key, kb= ((const struct enc_rec_seg*) b)->key;
+	return ka < kb? -1 : ka > kb? 1 : 0;
 }
 
-/* userp_enc_rec_end
- *
- * Finish writing the record into the buffer, and clean up data structures.
- */
 bool userp_enc_rec_end(userp_enc enc) {
-	// If not "run with scissors"
-		// For each conditionally-present field, check that its condition matches the
-		// presence of the field.  If the condition is false and field was written, set it
-		// to true by setting the lowest bit in the mask of the condition.
-	// else
-		// for each present field with a conditional, set the bit for it
-	// append all the buffers into the output
+	struct enc_rec_frame *f= rec_top(enc);
+	const struct type_plan *plan;
+	struct userp_bstr_part *p, *p2;
+	size_t i, first_always;
+	if (!f || (f->cur != ENC_REC_NONE && !rec_commit(enc, f)))
+		return false;
+	plan= f->plan;
+	if (f->mode == ENC_REC_PENDING && !rec_begin_temp(enc, f))
+		return false;
+	// A record written entirely in place only needs its padding
+	if (f->mode == ENC_REC_DIRECT && !f->seg_count && f->next == f->order_count)
+		goto done;
+	// Check that every required field was written before writing anything
+	if (f->seg_count > 1)
+		qsort(f->seg, f->seg_count, sizeof(*f->seg), rec_seg_cmp);
+	if (f->mode == ENC_REC_DIRECT) {
+		for (i= 0; f->next + i < f->order_count; i++)
+			if (i >= f->seg_count || f->seg[i].key != f->next + i)
+				return rec_fail(enc, USERP_ERECORD, "Record field " USERP_DIAG_INDEX " was not written",
+					plan->fields[f->order[f->next + i]].index);
+	}
+	else {
+		first_always= plan->member_count - plan->seldom_count - plan->often_count - plan->always_count;
+		for (i= first_always; i < first_always + plan->always_count; i++)
+			if (!f->written[i])
+				return rec_fail(enc, USERP_ERECORD, "Record field " USERP_DIAG_INDEX " was not written",
+					plan->fields[i].index);
+		// The header, then the static area from the start of the temporary output
+		if (!rec_write_header(enc, f) || !enc_align(enc, plan->align)
+			|| !enc_append_range(enc, &f->alt, 0, plan->static_bits ? (plan->static_bits + 7) / 8 : 0))
+			return false;
+	}
+	for (i= 0; i < f->seg_count; i++)
+		if (!enc_align(enc, f->seg[i].align) || !enc_append_range(enc, &f->alt, f->seg[i].ofs, f->seg[i].len))
+			return false;
+	// Release the temporary output, keeping its part list for the next record
+	for (p= f->alt.parts, p2= p + f->alt.part_count; p < p2; p++)
+		userp_drop_buffer(p->buf);
+	f->alt.part_count= 0;
+	f->alt_pos= f->alt_lim= NULL;
+	done:
+	if (plan->op != PLAN_RECORD_FIXED && !enc_zeros(enc, plan->pad))
+		return false;
+	enc->rec_depth--;
+	return true;
+}
+
+/*APIDOC
+
+#### userp_enc_struct
+
+    struct telemetry rec;
+    bool success= userp_enc_struct(enc, telemetry_type, sizeof(rec), &rec);
+
+Encode a C struct as a record of `type`, which must have only static and always fields with
+fixed sizes (see `PLAN_RECORD_FIXED`) totalling a whole number of bytes, with each field at the
+same byte offset in the struct as in the record.  `sizeof_struct` must equal the size of the
+record (optionally including its `pad` bytes), as for `userp_dec_struct`.
+
+If the bytes of the record are exactly those of the struct on this host (native integers of 1,
+2, 4, or 8 bytes, IEEE floats, and records of these, with no gaps) the struct is copied with
+one memcpy.  This is decided once per type, when its plan is compiled (`PLAN_HOST_LAYOUT`).
+Otherwise each field is read from the struct as a native integer of its size (signed if the type
+can be negative) or float, and encoded as its type says, such as byte-swapped or as an offset
+from its minimum.  A field that isn't whole bytes can't be read from a struct.
+
+#### userp_enc_struct_array
+
+    struct telemetry recs[1000];
+    bool success= userp_enc_struct_array(enc, telemetry_type, sizeof(*recs), recs, 1000);
+
+Encode `count` consecutive structs as with `userp_enc_struct`.  If the record has the host's
+layout and no padding, the whole array is one copy.
+
+*/
+
+// Check that each field of a record can be read from a C struct at its byte offset
+static bool enc_struct_check(userp_enc enc, const struct type_plan *plan) {
+	const struct plan_field *pf;
+	size_t i;
+	for (i= 0; i < plan->member_count; i++) {
+		pf= &plan->fields[i];
+		if ((pf->ofs & 7) || (pf->plan->fixed_bits & 7))
+			goto fail_field;
+		if (pf->plan->flags & (PLAN_HOST_LAYOUT|PLAN_IEEE_FLOAT))
+			continue;
+		if (pf->plan->op == PLAN_RECORD_FIXED) {
+			if (!enc_struct_check(enc, pf->plan))
+				return false;
+		}
+		else if ((pf->plan->op != PLAN_INT_TWOS && pf->plan->op != PLAN_INT_BITS)
+			|| (pf->plan->fixed_bits != 8 && pf->plan->fixed_bits != 16
+				&& pf->plan->fixed_bits != 32 && pf->plan->fixed_bits != 64))
+			goto fail_field;
+	}
+	return true;
+	CATCH(fail_field) {
+		userp_diag_setf(&enc->env->err, USERP_ETYPE,
+			"Field " USERP_DIAG_INDEX " of the record can't be read from a C struct", (int) pf->index);
+		USERP_DISPATCH_ERR(enc->env);
+	}
+	return false;
+}
+
+// Encode a struct one field at a time (after enc_struct_check)
+static bool enc_struct_fields(userp_enc enc, const struct type_plan *plan, const uint8_t *src) {
+	const struct plan_field *pf;
+	const struct type_plan *fp;
+	const uint8_t *p;
+	union { int8_t i8; uint8_t u8; int16_t i16; uint16_t u16; int32_t i32; uint32_t u32; int64_t i64;
+		float f; double d; } v;
+	bool is_signed, ok;
+	size_t i;
+	if (!userp_enc_rec_begin(enc, plan->type))
+		return false;
+	for (i= 0; i < plan->member_count; i++) {
+		pf= &plan->fields[i];
+		fp= pf->plan;
+		p= src + (pf->ofs >> 3);
+		if (!userp_enc_rec_seek_field(enc, pf->index))
+			return false;
+		if (fp->flags & PLAN_IEEE_FLOAT) {
+			memcpy(&v, p, fp->fixed_bits >> 3);
+			ok= fp->fixed_bits == 32? userp_enc_float(enc, v.f) : userp_enc_double(enc, v.d);
+		}
+		else if (fp->flags & PLAN_HOST_LAYOUT)
+			ok= enc_le_elems(enc, p, 1, fp->fixed_bits >> 3);
+		else if (fp->op == PLAN_RECORD_FIXED)
+			ok= enc_struct_fields(enc, fp, p);
+		else {
+			is_signed= fp->op == PLAN_INT_TWOS || fp->base < 0;
+			memcpy(&v, p, fp->fixed_bits >> 3);
+			ok= userp_enc_int64(enc,
+				fp->fixed_bits == 8?  (is_signed? v.i8 : v.u8)
+				: fp->fixed_bits == 16? (is_signed? v.i16 : v.u16)
+				: fp->fixed_bits == 32? (is_signed? v.i32 : (int64_t) v.u32)
+				: v.i64);
+		}
+		if (!ok)
+			return false;
+	}
+	return userp_enc_rec_end(enc);
+}
+
+bool userp_enc_struct_array(userp_enc enc, userp_type type, size_t sizeof_struct, const void *structs, size_t count) {
+	const struct type_plan *plan;
+	const uint8_t *src= (const uint8_t*) structs;
+	size_t size, i;
+	if (!(plan= userp_scope_get_type_plan(enc->scope, type)))
+		return false;
+	size= plan->fixed_bits >> 3;
+	if (plan->op != PLAN_RECORD_FIXED || (plan->fixed_bits & 7)) {
+		userp_diag_setf(&enc->env->err, USERP_ETYPE,
+			"Type " USERP_DIAG_INDEX " is not a fixed-size record of whole bytes", (int) type);
+		goto fail;
+	}
+	if (sizeof_struct != size && sizeof_struct != size + plan->pad) {
+		userp_diag_setf(&enc->env->err, USERP_ETYPE,
+			"Record is " USERP_DIAG_SIZE " bytes but struct is " USERP_DIAG_SIZE2 " bytes",
+			size, sizeof_struct);
+		goto fail;
+	}
+	// The record's type says how to align and pad it, even as the value of a field
+	enc->val_plan= NULL;
+	enc->val_static= NULL;
+	enc->val_align= 0;
+	enc->val_pad= 0;
+	if (!(plan->flags & PLAN_HOST_LAYOUT)) {
+		if (!enc_struct_check(enc, plan))
+			return false;
+		for (i= 0; i < count; i++, src += sizeof_struct)
+			if (!enc_struct_fields(enc, plan, src))
+				return false;
+		return true;
+	}
+	// Within the static area of a record, the offset is already aligned
+	if (!enc->out_redirect && !enc_align(enc, plan->align))
+		return false;
+	// Records stay aligned one after another if the size is a multiple of the alignment
+	if (sizeof_struct == size && !plan->pad
+		&& (plan->align <= 3 || !(size & (((size_t)1 << (plan->align - 3)) - 1))))
+		return enc_le_elems(enc, src, 1, size * count);
+	for (i= 0; i < count; i++, src += sizeof_struct)
+		if ((i && !enc_align(enc, plan->align))
+			|| !enc_le_elems(enc, src, 1, size)
+			|| !enc_zeros(enc, plan->pad))
+			return false;
+	return true;
+	CATCH(fail) {
+		USERP_DISPATCH_ERR(enc->env);
+	}
+	return false;
+}
+
+bool userp_enc_struct(userp_enc enc, userp_type type, size_t sizeof_struct, const void *s) {
+	return userp_enc_struct_array(enc, type, sizeof_struct, s, 1);
+}
+
+#ifdef UNIT_TEST
+
+static const int64_t test_enc_values[]= {
+	0, 1, -1, 63, -64, 64, -65, 8191, -8192, 8192, 0x0FFFFFFF, -0x10000000, 0x10000000,
+	INT32_MAX, INT32_MIN, (int64_t) 1 << 40, INT64_MAX, INT64_MIN
+};
+
+// Decode n variable-length quantities from the encoder's output
+static size_t test_enc_decode(userp_enc enc, uint64_t *out, size_t n) {
+	struct userp_bstr *str= userp_enc_finish(enc);
+	struct userp_bit_io in= { .str= str, .part= str->parts, .pos= str->parts[0].data,
+		.lim= str->parts[0].data + str->parts[0].len };
+	size_t i, v;
+	for (i= 0; i < n && userp_decode_vqty_quick(&v, &in); i++)
+		out[i]= v;
+	return i;
+}
+
+UNIT_TEST(enc_int) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	userp_enc enc= userp_new_enc(env, scope, 1);
+	int values[]= { 0, 1, -1, 63, -64, 64, 8192, INT32_MAX, INT32_MIN };
+	size_t n= sizeof(values)/sizeof(*values), i;
+	uint64_t out[sizeof(values)/sizeof(*values)];
+	struct userp_bstr *str;
+	for (i= 0; i < n; i++)
+		userp_enc_int(enc, values[i]);
+	str= userp_enc_finish(enc);
+	printf("parts=%d len=%d\n", (int) str->part_count, (int) str->parts[0].len);
+	if (test_enc_decode(enc, out, n) != n)
+		printf("decode failed\n");
+	for (i= 0; i < n; i++)
+		printf("%d -> %llx -> %lld\n", values[i], (long long) out[i],
+			(long long) ((out[i] >> 1) ^ (0 - (out[i] & 1))));
+	userp_free_enc(enc);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+parts=1 len=21
+0 -> 0 -> 0
+1 -> 2 -> 1
+-1 -> 1 -> -1
+63 -> 7e -> 63
+-64 -> 7f -> -64
+64 -> 80 -> 64
+8192 -> 4000 -> 8192
+2147483647 -> fffffffe -> 2147483647
+-2147483648 -> ffffffff -> -2147483648
+*/
+
+UNIT_TEST(enc_int_array) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	userp_enc enc;
+	size_t n= 5000, i, k, elem_size, got, fail;
+	int64_t *values= malloc(n * sizeof(int64_t)), expected;
+	uint64_t *out= malloc(n * sizeof(uint64_t));
+	void *native= malloc(n * sizeof(int64_t));
+	struct userp_bstr *str;
+	int flags;
+
+	// Small output buffers (rounded up to one page), so that blocks hit the tail loop
+	env->enc_output_bufsize= 100;
+	for (i= 0; i < n; i++)
+		values[i]= i < 18? test_enc_values[i]
+			: (int64_t)(i * 0x9E3779B97F4A7C15ull) >> (i % 64);
+	for (k= 0; k < 8; k++) {
+		elem_size= 1 << (k >> 1);
+		flags= k & 1? USERP_ENC_UNSIGNED : 0;
+		for (i= 0; i < n; i++) switch (elem_size) {
+			case 1: ((int8_t*) native)[i]= values[i]; break;
+			case 2: ((int16_t*) native)[i]= values[i]; break;
+			case 4: ((int32_t*) native)[i]= values[i]; break;
+			default: ((int64_t*) native)[i]= values[i];
+		}
+		enc= userp_new_enc(env, scope, 1);
+		// Encode in two calls, to check that they join up
+		if (!userp_enc_int_array(enc, native, elem_size, 7, flags)
+			|| !userp_enc_int_array(enc, (char*) native + 7 * elem_size, elem_size, n - 7, flags))
+			printf("encode failed\n");
+		str= userp_enc_finish(enc);
+		got= test_enc_decode(enc, out, n);
+		for (i= 0, fail= 0; i < got; i++) {
+			switch (elem_size) {
+			case 1: expected= flags? (int64_t)(uint8_t) values[i] : (int8_t) values[i]; break;
+			case 2: expected= flags? (int64_t)(uint16_t) values[i] : (int16_t) values[i]; break;
+			case 4: expected= flags? (int64_t)(uint32_t) values[i] : (int32_t) values[i]; break;
+			default: expected= values[i];
+			}
+			if ((flags? out[i] : (out[i] >> 1) ^ (0 - (out[i] & 1))) != (uint64_t) expected)
+				fail++;
+		}
+		printf("%d-byte %s: parts>1=%d decoded=%d failures=%d\n", (int) elem_size,
+			flags? "unsigned" : "signed", str->part_count > 1, (int) got, (int) fail);
+		userp_free_enc(enc);
+	}
+	// Invalid element size
+	enc= userp_new_enc(env, scope, 1);
+	if (!userp_enc_int_array(enc, native, 3, 1, 0))
+		printf("failed as expected\n");
+	userp_free_enc(enc);
+	free(values);
+	free(out);
+	free(native);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+1-byte signed: parts>1=1 decoded=5000 failures=0
+1-byte unsigned: parts>1=1 decoded=5000 failures=0
+2-byte signed: parts>1=1 decoded=5000 failures=0
+2-byte unsigned: parts>1=1 decoded=5000 failures=0
+4-byte signed: parts>1=1 decoded=5000 failures=0
+4-byte unsigned: parts>1=1 decoded=5000 failures=0
+8-byte signed: parts>1=1 decoded=5000 failures=0
+8-byte unsigned: parts>1=1 decoded=5000 failures=0
+error: Integer element size must be 1, 2, 4, or 8 \(not 3\)
+failed as expected
+*/
+
+UNIT_TEST(enc_writer) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	userp_enc enc= userp_new_enc(env, scope, 1);
+	struct userp_writer *w;
+	struct userp_bstr *str, in_str;
+	struct userp_bstr_part part;
+	size_t n= 100000, i, got, fail;
+	int32_t *values= malloc(n * sizeof(int32_t));
+	uint64_t *out= malloc(n * sizeof(uint64_t));
+	uint8_t *bytes= malloc(n * 5);
+	ssize_t len;
+	FILE *f= tmpfile();
+
+	// Small output buffers, so most of them get written before the end
+	env->enc_output_bufsize= 100;
+	env->enc_output_bufsize_max= 8192;
+	w= userp_new_writer(env, fileno(f), 0);
+	userp_enc_set_writer(enc, w);
+	for (i= 0; i < n; i++)
+		values[i]= (int32_t)(i * 0x9E3779B9u);
+	if (!userp_enc_int_array(enc, values, sizeof(int32_t), n, 0))
+		printf("encode failed\n");
+	printf("parts<=2=%d\n", enc->output.part_count <= 2);
+	if ((str= userp_enc_finish(enc)))
+		printf("remaining=%d\n", (int) str->part_count);
+	// Decode what landed in the file
+	len= pread(fileno(f), bytes, n * 5, 0);
+	part= (struct userp_bstr_part){ .data= bytes, .len= len };
+	in_str= (struct userp_bstr){ .parts= &part, .part_count= 1, .part_alloc= 1 };
+	{
+		struct userp_bit_io in= { .str= &in_str, .part= in_str.parts, .pos= bytes, .lim= bytes + len };
+		size_t v;
+		for (got= 0; got < n && userp_decode_vqty_quick(&v, &in); got++)
+			out[got]= v;
+	}
+	for (i= 0, fail= 0; i < got; i++)
+		if ((int64_t)((out[i] >> 1) ^ (0 - (out[i] & 1))) != values[i])
+			fail++;
+	printf("decoded=%d failures=%d\n", (int) got, (int) fail);
+	userp_free_enc(enc);
+	userp_free_writer(w);
+	fclose(f);
+	free(values);
+	free(out);
+	free(bytes);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+parts<=2=1
+remaining=0
+decoded=100000 failures=0
+*/
+
+static void test_enc_release(void *callback_data, userp_buffer *buf) {
+	++*(int*) callback_data;
+}
+
+UNIT_TEST(enc_bytes_zerocopy) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	userp_enc enc= userp_new_enc(env, scope, 1);
+	struct userp_bstr *str;
+	userp_buffer buf;
+	uint8_t *frame= malloc(100000), small[10]= "0123456789", pad[8];
+	int released= 0, i;
+	for (i= 0; i < 100000; i++)
+		frame[i]= (uint8_t) i;
+	memset(pad, 0, sizeof(pad));
+	buf= userp_new_buffer(env, frame, 100000, 0);
+	buf->destructor= test_enc_release;
+	buf->destructor_data= &released;
+
+	// A small value, then the frame aligned to 8 bytes with 3 bytes of padding, then another value
+	userp_enc_int(enc, 1000);
+	enc->val_align= 6;
+	enc->val_pad= 3;
+	if (!userp_enc_bytes_zerocopy(enc, buf, frame + 1, 99999))
+		printf("encode failed\n");
+	userp_enc_bytes_zerocopy(enc, buf, small, sizeof(small));
+	enc->val_align= 0;
+	enc->val_pad= 0;
+	userp_enc_int(enc, 5);
+	userp_drop_buffer(buf);
+	str= userp_enc_finish(enc);
+	printf("parts=%d zerocopy=%d ofs=%d len=%d shared=%d\n", (int) str->part_count,
+		str->parts[1].data == frame + 1, (int) str->parts[1].ofs, (int) str->parts[1].len,
+		str->parts[0].buf == str->parts[2].buf);
+	printf("head=%d tail=%d padded=%d small=%d released=%d\n",
+		(int) str->parts[0].len, (int) str->parts[2].len,
+		!memcmp(str->parts[0].data + 2, pad, 6) && !memcmp(str->parts[2].data, pad, 3),
+		!memcmp(str->parts[2].data + 9, small, 10), released);
+	userp_free_enc(enc);
+	printf("released=%d\n", released);
+	free(frame);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+parts=3 zerocopy=1 ofs=8 len=99999 shared=1
+head=8 tail=23 padded=1 small=1 released=0
+released=1
+*/
+
+static userp_scope test_enc_record_scope(userp_env env) {
+	userp_scope scope= userp_new_scope(env, NULL);
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part;
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	#define T(id) ((size_t)(id) << 1)
+	tt->len= 0;
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<5), S("U8"), 8, TEST_SIGNED(0));
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3), S("I16"), 16);
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3), S("I32"), 32);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), S("Telemetry"), 64, 4,
+		S("ts"), T(3), (0<<2)|FIELD_PLACEMENT_STATIC,
+		S("seq"), T(2), (32<<2)|FIELD_PLACEMENT_STATIC,
+		S("a"), T(1), (48<<2)|FIELD_PLACEMENT_STATIC,
+		S("b"), T(1), (56<<2)|FIELD_PLACEMENT_STATIC);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<3), S("Sample"), 2,
+		S("ts"), T(3), FIELD_PLACEMENT_ALWAYS,
+		S("note"), T(3), FIELD_PLACEMENT_OFTEN);
+	TT(TYPEDEF_RECORD_SELBASE + 1 + (1<<3), 1, TYPEDEF_RECORD_SELDOM_OTHERTYPE, S("Ext"), 2,
+		S("id"), T(3), FIELD_PLACEMENT_ALWAYS,
+		S("opt"), T(1), FIELD_PLACEMENT_SELDOM,
+		T(2));
+	// The same layout as Telemetry, but big-endian and with an offset, and a record of nibbles
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<4), S("I32BE"), 32, 1);
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<5), S("Year"), 16, TEST_SIGNED(1000));
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), S("Packet"), 64, 4,
+		S("ts"), T(7), (0<<2)|FIELD_PLACEMENT_STATIC,
+		S("year"), T(8), (32<<2)|FIELD_PLACEMENT_STATIC,
+		S("a"), T(1), (48<<2)|FIELD_PLACEMENT_STATIC,
+		S("b"), T(1), (56<<2)|FIELD_PLACEMENT_STATIC);
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3), S("Nib"), 4);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), S("Nibs"), 8, 2,
+		S("lo"), T(10), (0<<2)|FIELD_PLACEMENT_STATIC,
+		S("hi"), T(10), (4<<2)|FIELD_PLACEMENT_STATIC);
+	// Integers wider than 64 bits, as a static and as a dynamic field
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3), S("I72"), 72);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), S("WideStatic"), 72, 1,
+		S("w"), T(12), (0<<2)|FIELD_PLACEMENT_STATIC);
+	TT(TYPEDEF_RECORD_SELBASE + (1<<3), S("Wide"), 1,
+		S("w"), T(12), FIELD_PLACEMENT_ALWAYS);
+	(void) S("z");
+	#undef S
+	#undef T
+	part.data= tt->buf;
+	part.len= tt->len;
+	part.ofs= 0;
+	if (!userp_scope_parse_types(scope, &part, 1, 14, 0) || !userp_scope_finalize(scope, 0))
+		printf("type table failed\n");
+	free(tt);
+	return scope;
+}
+
+struct test_enc_telemetry {
+	int32_t ts;
+	int16_t seq;
+	uint8_t a, b;
+};
+
+// Print the output of the encoder as hex, and check that each record of 'type' in it decodes
+static void test_enc_dump(userp_enc enc, userp_type type) {
+	struct userp_bstr *str= userp_enc_finish(enc);
+	struct userp_bit_io in= { .str= str, .part= str->parts, .pos= str->parts[0].data,
+		.lim= str->parts[0].data + str->parts[0].len };
+	const struct type_plan *plan= userp_scope_get_type_plan(enc->scope, type);
+	size_t i, n= 0;
+	for (i= 0; i < str->parts[0].len; i++)
+		printf("%s%02X", i? " " : "", str->parts[0].data[i]);
+	while (!userp_bit_io_at_end(&in) && userp_plan_skip(enc->scope, plan, &in))
+		n++;
+	printf(" (%d)\n", (int) n);
+	for (i= 0; i < str->part_count; i++)
+		userp_drop_buffer(str->parts[i].buf);
+	str->part_count= 0;
+	enc->out_pos= enc->out_lim= NULL;
+}
+
+UNIT_TEST(enc_record_fixed) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_enc_record_scope(env);
+	userp_enc enc= userp_new_enc(env, scope, 4);
+	const struct type_plan *plan= userp_scope_get_type_plan(scope, 4);
+	struct userp_bstr *str;
+	struct userp_bit_io in;
+	struct test_enc_telemetry rec[2];
+	int i;
+
+	// Every field is stored at its offset, in whatever order they are written
+	for (i= 0; i < 2; i++) {
+		if (!userp_enc_rec_begin(enc, 4)
+			|| !userp_enc_rec_seek_field(enc, 3) || !userp_enc_int(enc, 200 + i)
+			|| !userp_enc_rec_seek_field(enc, 0) || !userp_enc_int(enc, -2 - i)
+			|| !userp_enc_rec_seek_field(enc, 2) || !userp_enc_int(enc, 7 + i)
+			|| !userp_enc_rec_seek_field(enc, 1) || !userp_enc_int(enc, 0x1234 + i)
+			|| !userp_enc_rec_end(enc))
+			printf("encode failed\n");
+	}
+	str= userp_enc_finish(enc);
+	for (i= 0; i < (int) str->parts[0].len; i++)
+		printf("%s%02X", i? " " : "", str->parts[0].data[i]);
+	printf("\n");
+	in= (struct userp_bit_io){ .str= str, .part= str->parts, .pos= str->parts[0].data,
+		.lim= str->parts[0].data + str->parts[0].len };
+	for (i= 0; i < 2; i++)
+		if (userp_plan_copy_struct(plan, &in, &rec[i], sizeof(rec[i])))
+			printf("ts=%d seq=%d a=%d b=%d\n", rec[i].ts, rec[i].seq, rec[i].a, rec[i].b);
+	userp_free_enc(enc);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+FE FF FF FF 34 12 07 C8 FD FF FF FF 35 12 08 C9
+ts=-2 seq=4660 a=7 b=200
+ts=-3 seq=4661 a=8 b=201
+*/
+
+UNIT_TEST(enc_record_dynamic) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_enc_record_scope(env);
+	userp_enc enc= userp_new_enc(env, scope, 5);
+	userp_symbol z= userp_scope_get_symbol(scope, "z", 0);
+	size_t note[]= { 1 };
+
+	// Declared, written in order, directly in the output
+	if (!userp_enc_rec_begin(enc, 5) || !userp_enc_rec_declare_fields(enc, note, 1)
+		|| !userp_enc_rec_seek_field(enc, 0) || !userp_enc_int(enc, 5)
+		|| !userp_enc_rec_seek_field(enc, 1) || !userp_enc_int(enc, -1)
+		|| !userp_enc_rec_end(enc))
+		printf("encode failed\n");
+	test_enc_dump(enc, 5);
+	// Declared, but written out of order
+	if (!userp_enc_rec_begin(enc, 5) || !userp_enc_rec_declare_fields(enc, note, 1)
+		|| !userp_enc_rec_seek_field(enc, 1) || !userp_enc_int(enc, 10)
+		|| !userp_enc_rec_seek_field(enc, 0) || !userp_enc_int(enc, 9)
+		|| !userp_enc_rec_end(enc))
+		printf("encode failed\n");
+	test_enc_dump(enc, 5);
+	// Not declared, so assembled at the end
+	if (!userp_enc_rec_begin(enc, 5)
+		|| !userp_enc_rec_seek_field(enc, 1) || !userp_enc_int(enc, 6)
+		|| !userp_enc_rec_seek_field(enc, 0) || !userp_enc_int(enc, 7)
+		|| !userp_enc_rec_end(enc)
+		|| !userp_enc_rec_begin(enc, 5)
+		|| !userp_enc_rec_seek_field(enc, 0) || !userp_enc_int(enc, 8)
+		|| !userp_enc_rec_end(enc))
+		printf("encode failed\n");
+	test_enc_dump(enc, 5);
+	// An ad-hoc field and a seldom field, in the order they were written
+	printf("z=%d\n", (int) z);
+	if (!userp_enc_rec_begin(enc, 6)
+		|| !userp_enc_rec_add_field(enc, z, 2) || !userp_enc_int(enc, 0x102)
+		|| !userp_enc_rec_seek_field(enc, 1) || !userp_enc_int(enc, 9)
+		|| !userp_enc_rec_seek_field(enc, 0) || !userp_enc_int(enc, 100)
+		|| !userp_enc_rec_end(enc))
+		printf("encode failed\n");
+	test_enc_dump(enc, 6);
+	userp_free_enc(enc);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+02 05 00 00 00 FF FF FF FF \(1\)
+02 09 00 00 00 0A 00 00 00 \(1\)
+02 07 00 00 00 06 00 00 00 00 08 00 00 00 \(2\)
+z=([0-9]+)
+04 [0-9A-F]{2} 00 64 00 00 00 02 01 09 \(1\)
+*/
+
+UNIT_TEST(enc_record_errors) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_enc_record_scope(env);
+	userp_enc enc= userp_new_enc(env, scope, 4);
+	userp_symbol id= userp_scope_get_symbol(scope, "id", 0);
+	size_t fields[]= { 1, 1 };
+
+	userp_enc_rec_seek_field(enc, 0);
+	userp_enc_rec_begin(enc, 3);
+	userp_enc_rec_begin(enc, 4);
+	userp_enc_rec_seek_field(enc, 7);
+	userp_enc_rec_seek_field(enc, 2);
+	userp_enc_int(enc, 300);
+	userp_enc_rec_seek_field(enc, 2);
+	userp_enc_rec_end(enc);
+	// A missing field leaves the record open to be finished
+	userp_enc_rec_begin(enc, 5);
+	userp_enc_rec_seek_field(enc, 1);
+	userp_enc_int(enc, 1);
+	userp_enc_rec_declare_fields(enc, fields, 1);
+	if (!userp_enc_rec_end(enc) && userp_enc_rec_seek_field(enc, 0) && userp_enc_int(enc, 2)
+		&& userp_enc_rec_end(enc))
+		printf("finished after error\n");
+	userp_enc_rec_begin(enc, 5);
+	userp_enc_rec_declare_fields(enc, fields, 2);
+	userp_enc_rec_add_field(enc, id, 2);
+	userp_enc_rec_end(enc);
+	// The Sample record is still open, and Ext nests inside it
+	userp_enc_rec_begin(enc, 6);
+	userp_enc_rec_add_field(enc, id, 2);
+	userp_enc_rec_add_field(enc, userp_scope_get_symbol(scope, "z", 0), 3);
+	userp_free_enc(enc);
+	// Integers wider than int64_t are refused rather than truncated
+	enc= userp_new_enc(env, scope, 13);
+	userp_enc_rec_begin(enc, 13);
+	userp_enc_rec_seek_field(enc, 0);
+	userp_enc_int(enc, -1);
+	userp_free_enc(enc);
+	enc= userp_new_enc(env, scope, 14);
+	userp_enc_rec_begin(enc, 14);
+	userp_enc_rec_seek_field(enc, 0);
+	userp_enc_int(enc, -1);
+	userp_free_enc(enc);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+error: No record is being encoded
+error: Type 3 is not a record
+error: Record has no field 7
+error: .*out of range.*
+error: Record field 2 was already written
+error: Record fields must be declared before writing any of them
+error: Record field 0 was not written
+finished after error
+error: Record field 1 was declared twice
+error: Record type 5 has no ad-hoc fields
+error: Record field 0 was not written
+error: Record already has a field named symbol [0-9]+
+error: Ad-hoc fields of this record must be type 2
+error: Type 12 is wider than 64 bits, which is not supported yet
+error: Type 12 is wider than 64 bits, which is not supported yet
+*/
+
+UNIT_TEST(enc_struct) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_enc_record_scope(env);
+	userp_enc enc= userp_new_enc(env, scope, 4);
+	struct test_enc_telemetry recs[3]= { { -2, 0x1234, 7, 200 }, { 5, 2024, 1, 2 }, { 6, 2025, 3, 4 } }, out;
+	struct userp_bstr *str;
+	struct userp_bit_io in;
+	uint8_t nibs= 0x21;
+	int i;
+
+	printf("host layout: Telemetry=%d Packet=%d\n",
+		(userp_scope_get_type_plan(scope, 4)->flags & PLAN_HOST_LAYOUT) != 0,
+		(userp_scope_get_type_plan(scope, 9)->flags & PLAN_HOST_LAYOUT) != 0);
+	// Copied whole, or packed field by field
+	if (!userp_enc_struct(enc, 4, sizeof(*recs), recs)
+		|| !userp_enc_struct_array(enc, 4, sizeof(*recs), recs + 1, 2)
+		|| !userp_enc_struct_array(enc, 9, sizeof(*recs), recs, 2))
+		printf("encode failed\n");
+	str= userp_enc_finish(enc);
+	for (i= 0; i < (int) str->parts[0].len; i++)
+		printf("%s%02X", (i & 7)? " " : i? "\n" : "", str->parts[0].data[i]);
+	printf("\n");
+	in= (struct userp_bit_io){ .str= str, .part= str->parts, .pos= str->parts[0].data,
+		.lim= str->parts[0].data + str->parts[0].len };
+	for (i= 0; i < 3; i++)
+		if (!userp_plan_copy_struct(userp_scope_get_type_plan(scope, 4), &in, &out, sizeof(out))
+			|| memcmp(&out, recs + i, sizeof(out)))
+			printf("record %d differs\n", i);
+	userp_free_enc(enc);
+	// Errors
+	enc= userp_new_enc(env, scope, 4);
+	userp_enc_struct(enc, 4, 6, recs);
+	userp_enc_struct(enc, 5, sizeof(*recs), recs);
+	userp_enc_struct(enc, 11, 1, &nibs);
+	recs[0].seq= 999;
+	userp_enc_struct(enc, 9, sizeof(*recs), recs);
+	userp_free_enc(enc);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+host layout: Telemetry=1 Packet=0
+FE FF FF FF 34 12 07 C8
+05 00 00 00 E8 07 01 02
+06 00 00 00 E9 07 03 04
+FF FF FF FE 4C 0E 07 C8
+00 00 00 05 00 04 01 02
+error: Record is 8 bytes but struct is 6 bytes
+error: Type 5 is not a fixed-size record of whole bytes
+error: Field 0 of the record can't be read from a C struct
+error: Value is out of range for type 8
+*/
+
+UNIT_TEST(bench_enc_int_array) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	userp_enc enc;
+	size_t n= argc > 0? atoi(argv[0]) : 1000000, iters= argc > 1? atoi(argv[1]) : 10;
+	int32_t *values= malloc(n * sizeof(*values));
+	struct userp_bstr *str;
+	double t[2];
+	clock_t start;
+	size_t i, j, k, len[2], fail= 0;
+
+	env->enc_output_bufsize= 65536;
+	for (i= 0; i < n; i++)
+		values[i]= (int32_t)(i * 0x9E3779B97F4A7C15ull >> 32) >> (i % 20 + 12);
+	for (k= 0; k < 2; k++) {
+		start= clock();
+		for (j= 0; j < iters; j++) {
+			enc= userp_new_enc(env, scope, 1);
+			if (k == 0) {
+				for (i= 0; i < n; i++)
+					if (!userp_enc_int(enc, values[i]))
+						fail++;
+			}
+			else if (!userp_enc_int_array(enc, values, sizeof(*values), n, 0))
+				fail++;
+			str= userp_enc_finish(enc);
+			for (i= 0, len[k]= 0; i < str->part_count; i++)
+				len[k] += str->parts[i].len;
+			userp_free_enc(enc);
+		}
+		t[k]= (double)(clock() - start) / CLOCKS_PER_SEC;
+	}
+	if (len[0] != len[1])
+		fail++;
+	printf("one at a time: %.1f M values/sec\n", n * iters / (t[0] > 0? t[0] : 1e-9) / 1e6);
+	printf("bulk: %.1f M values/sec\n", n * iters / (t[1] > 0? t[1] : 1e-9) / 1e6);
+	printf("failures: %d\n", (int) fail);
+	free(values);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+one at a time: [0-9.]+ M values/sec
+bulk: [0-9.]+ M values/sec
+failures: 0
+*/
+
+UNIT_TEST(bench_enc_record) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= test_enc_record_scope(env);
+	userp_enc enc;
+	size_t n= argc > 0? atoi(argv[0]) : 1000000, iters= argc > 1? atoi(argv[1]) : 10;
+	struct test_enc_telemetry *recs= malloc(n * sizeof(*recs));
+	struct userp_bstr *str;
+	static const char *names[]= { "record fields", "struct", "struct array", "struct packed", "memcpy" };
+	double t[5];
+	clock_t start;
+	size_t i, j, k, len[5], fail= 0;
+
+	env->enc_output_bufsize= 65536;
+	for (i= 0; i < n; i++) {
+		recs[i].ts= (int32_t)(i * 0x9E3779B97F4A7C15ull >> 32);
+		recs[i].seq= (int16_t)(1000 + i % 30000);
+		recs[i].a= (uint8_t) i;
+		recs[i].b= (uint8_t)(i >> 8);
+	}
+	for (k= 0; k < 5; k++) {
+		start= clock();
+		for (j= 0; j < iters; j++) {
+			enc= userp_new_enc(env, scope, 4);
+			if (k == 2) {
+				if (!userp_enc_struct_array(enc, 4, sizeof(*recs), recs, n))
+					fail++;
+			}
+			else for (i= 0; i < n; i++) {
+				if (k == 0) {
+					if (!userp_enc_rec_begin(enc, 4)
+						|| !userp_enc_rec_seek_field(enc, 0) || !userp_enc_int(enc, recs[i].ts)
+						|| !userp_enc_rec_seek_field(enc, 1) || !userp_enc_int(enc, recs[i].seq)
+						|| !userp_enc_rec_seek_field(enc, 2) || !userp_enc_int(enc, recs[i].a)
+						|| !userp_enc_rec_seek_field(enc, 3) || !userp_enc_int(enc, recs[i].b)
+						|| !userp_enc_rec_end(enc))
+						fail++;
+				}
+				else if (k == 1) {
+					if (!userp_enc_struct(enc, 4, sizeof(*recs), &recs[i]))
+						fail++;
+				}
+				// Packet has the same layout, but big-endian with an offset, so is packed per field
+				else if (k == 3) {
+					if (!userp_enc_struct(enc, 9, sizeof(*recs), &recs[i]))
+						fail++;
+				}
+				else if (!userp_enc_bytes(enc, &recs[i], sizeof(*recs)))
+					fail++;
+			}
+			str= userp_enc_finish(enc);
+			for (i= 0, len[k]= 0; i < str->part_count; i++)
+				len[k] += str->parts[i].len;
+			userp_free_enc(enc);
+		}
+		t[k]= (double)(clock() - start) / CLOCKS_PER_SEC;
+	}
+	for (k= 0; k < 5; k++) {
+		if (len[k] != len[4])
+			fail++;
+		printf("%s: %.1f M records/sec\n", names[k], n * iters / (t[k] > 0? t[k] : 1e-9) / 1e6);
+	}
+	printf("failures: %d\n", (int) fail);
+	free(recs);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
 }
+/*OUTPUT
+record fields: [0-9.]+ M records/sec
+struct: [0-9.]+ M records/sec
+struct array: [0-9.]+ M records/sec
+struct packed: [0-9.]+ M records/sec
+memcpy: [0-9.]+ M records/sec
+failures: 0
+*/
 
+#endif
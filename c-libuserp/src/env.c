@@ -2,6 +2,7 @@
 #include "userp_private.h"
 
 static bool userp_default_alloc_fn(void *unused, void **pointer, size_t new_size, userp_alloc_flags flags);
+static void arena_destroy(userp_env env);
 
 /*APIDOC
 ## userp_env
@@ -48,6 +49,9 @@ callback.
 The allocation function cannot be changed, but the logger can be set later using
 `userp_env_set_logger`.
 
+The `flags` may include `USERP_ENV_ARENA` to allocate the library's objects from an arena (see
+`userp_env_reset_arena`) right from the start.
+
 A `userp_env` object contains an internal reference count.  It remains until the last reference
 is dropped at which time it gets destroyed and freed through the same allocation function that
 it came from.  The `userp_env` returned has an initial reference count of 1.  You should call
@@ -68,6 +72,28 @@ if `env` is not valid or if the internal reference count is corrupt.
 Release a reference to the `userp_env`, possibly destroying it if the last reference is removed.
 This can emit a fatal error if `env` is not valid or if the internal reference count is corrupt.
 
+#### userp_env_reset_arena
+
+    userp_env env= userp_new_env(NULL, NULL, NULL, USERP_ENV_ARENA);
+    for (...) {
+      userp_dec dec= userp_new_dec(env, ...);
+      ... // decode a block, extract what you need
+      userp_free_dec(dec);
+      userp_env_reset_arena(env);
+    }
+
+When the arena is selected (with `USERP_ENV_ARENA` or the `allocator` attribute) the library's
+objects, arrays, and buffers are carved out of large chunks obtained from the allocator function,
+instead of each being a separate call to it.  Objects that will not grow are packed one after
+another, arrays that grow are rounded up to a power of two and recycled through free lists, and
+anything over 64KiB gets a chunk of its own.  Freeing an object in the arena costs almost nothing,
+but most of its memory is not available again until the arena is reset.
+
+The reset reclaims all of the arena's memory at once, keeping its chunks for the next round of
+allocations, and freeing only the oversized ones.  Every object allocated from the arena must
+already be freed or dropped (or simply never used again); the reset does not visit them.  This
+fits a pattern of decoding a block of data, extracting from it, and discarding it all.
+
 */
 
 userp_env userp_new_env(userp_alloc_fn alloc_fn, userp_diag_fn diag_fn, void *cb_data, userp_env_flags flags) {
@@ -96,6 +122,13 @@ userp_env userp_new_env(userp_alloc_fn alloc_fn, userp_diag_fn diag_fn, void *cb
 	env->record_fields_max=  MIN(USERP_DEFAULT_RECORD_FIELDS_MAX, USERP_IMPL_RECORD_FIELDS_MAX);
 	env->enc_output_parts=   USERP_DEFAULT_ENC_OUTPUT_PARTS;
 	env->enc_output_bufsize= USERP_DEFAULT_ENC_OUTPUT_BUFSIZE;
+	env->symtable_index=     USERP_SYMTABLE_HASHTREE;
+	env->symtable_swiss_min= USERP_DEFAULT_SYMTABLE_SWISS_MIN;
+	env->map_window=         USERP_DEFAULT_MAP_WINDOW;
+	env->enc_output_bufsize_max= USERP_DEFAULT_ENC_OUTPUT_BUFSIZE_MAX;
+	env->buffer_pool_max=    USERP_DEFAULT_BUFFER_POOL_MAX;
+	env->arena.chunk_size=   USERP_DEFAULT_ARENA_CHUNK;
+	env->arena.enabled=      (flags & USERP_ENV_ARENA) != 0;
 	return env;
 }
 
@@ -106,6 +139,8 @@ static void userp_free_env(userp_env env) {
 	void *alloc_cb_data= env->alloc_cb_data;
 	struct userp_diag err;
 
+	userp_env_empty_buffer_pool(env);
+	arena_destroy(env);
 	if (env->measure_twice) {
 		bzero(env, sizeof(*env)); // help identify freed env
 		env->measure_twice= 1;
@@ -320,6 +355,54 @@ There are currently three settings:
   * USERP_RUN_WITH_SCISSORS - "Never run with scissors".  Assume protocol is encoded correctly
     and that all API calls are made correctly.  Never use this on un-trusted data.
 
+#### symtable_index
+
+    userp_env_set_attr(env, USERP_SYMTABLE_INDEX, USERP_SYMTABLE_SWISS);
+    userp_env_set_attr(env, USERP_SYMTABLE_SWISS_MIN, 10000);
+
+Choose the lookup index used for large symbol tables.  The default `USERP_SYMTABLE_HASHTREE`
+uses the compact hashtree for every table.  `USERP_SYMTABLE_SWISS` switches any symbol table
+with more than `USERP_SYMTABLE_SWISS_MIN` symbols to an open-addressing table that probes 16
+slots at a time.  This costs more memory per symbol but gives faster and more predictable
+lookups.  `USERP_SYMTABLE_SWISS_MIN` defaults to 4096.  This only affects symbol tables that
+get indexed after the attribute is set.
+
+#### map_window
+
+    userp_env_set_attr(env, USERP_MAP_WINDOW, 64<<20);
+
+The largest span of a file that `userp_bstr_map_file` maps with a single `mmap` call.  Each
+window becomes its own buffer, so a decoder reading from a file only keeps the windows it has
+not finished with.  The value is rounded up to a multiple of the page size.  The default is
+1GiB on 64-bit hosts and 64MiB on 32-bit hosts.
+
+#### buffer_pool_max
+
+    userp_env_set_attr(env, USERP_BUFFER_POOL_MAX, 8<<20);
+
+The most bytes of released `USERP_BUFFER_POOLED` buffers (encoder output, prefetch blocks) the
+env keeps for reuse, instead of returning them to the allocator.  At most 32 buffers are kept.
+The default is 32MiB.  A limit of 1 byte disables the pool.
+
+#### enc_output_bufsize_max
+
+    userp_env_set_attr(env, USERP_ENC_OUTPUT_BUFSIZE_MAX, 4<<20);
+
+Each time an encoder runs out of room it allocates an output buffer twice the size of its
+previous one, starting from the default output buffer size (4KiB) and capped at this limit.
+The default is 1MiB.
+
+#### allocator
+
+    userp_env_set_attr(env, USERP_ALLOCATOR, USERP_ALLOCATOR_ARENA);
+    userp_env_set_attr(env, USERP_ARENA_CHUNK, 256<<10);
+
+Choose whether new allocations come from the arena (see `userp_env_reset_arena`) or go directly
+to the allocator function, which is the default `USERP_ALLOCATOR_DIRECT`.  Memory keeps going
+back to wherever it came from, so this can be changed at any time.  `USERP_ARENA_CHUNK` is the
+size of the first chunk the arena takes from the allocator function (default 64KiB, at least
+4KiB), and each later one is twice as big, up to 1MiB.
+
 */
 
 void userp_env_set_attr(userp_env env, int attr_id, size_t value) {
@@ -352,6 +435,45 @@ void userp_env_set_attr(userp_env env, int attr_id, size_t value) {
 			attr_name= "safety level"; goto unknown_val;
 		}
 		return;
+	case USERP_SYMTABLE_INDEX:
+		switch (value) {
+		case USERP_DEFAULT:
+		case USERP_SYMTABLE_HASHTREE:
+			env->symtable_index= USERP_SYMTABLE_HASHTREE; break;
+		case USERP_SYMTABLE_SWISS:
+			env->symtable_index= USERP_SYMTABLE_SWISS; break;
+		default:
+			attr_name= "symbol table index"; goto unknown_val;
+		}
+		return;
+	case USERP_SYMTABLE_SWISS_MIN:
+		env->symtable_swiss_min= value == USERP_DEFAULT? USERP_DEFAULT_SYMTABLE_SWISS_MIN : value;
+		return;
+	case USERP_MAP_WINDOW:
+		env->map_window= value == USERP_DEFAULT? USERP_DEFAULT_MAP_WINDOW : value;
+		return;
+	case USERP_BUFFER_POOL_MAX:
+		env->buffer_pool_max= value == USERP_DEFAULT? USERP_DEFAULT_BUFFER_POOL_MAX : value;
+		// Shrinking the limit doesn't evict anything until the env is destroyed
+		return;
+	case USERP_ENC_OUTPUT_BUFSIZE_MAX:
+		env->enc_output_bufsize_max= value == USERP_DEFAULT? USERP_DEFAULT_ENC_OUTPUT_BUFSIZE_MAX : value;
+		return;
+	case USERP_ALLOCATOR:
+		switch (value) {
+		case USERP_DEFAULT:
+		case USERP_ALLOCATOR_DIRECT:
+			env->arena.enabled= false; break;
+		case USERP_ALLOCATOR_ARENA:
+			env->arena.enabled= true; break;
+		default:
+			attr_name= "allocator"; goto unknown_val;
+		}
+		return;
+	case USERP_ARENA_CHUNK:
+		env->arena.chunk_size= value == USERP_DEFAULT? USERP_DEFAULT_ARENA_CHUNK
+			: value < 4096? 4096 : value;
+		return;
 	}
 	CATCH(unknown_val) {
 		if (!env->run_with_scissors) {
@@ -363,8 +485,216 @@ void userp_env_set_attr(userp_env env, int attr_id, size_t value) {
 
 // ----------------------------- Private methods -----------------------------
 
+/*IMPLDOC
+
+### Arena Allocator
+
+The arena sits between `userp_alloc` and `env->alloc`, from which it takes chunks.  Each block in
+a chunk has a header giving its size and how it was allocated:
+
+  * Allocations without `USERP_HINT_DYNAMIC` are bumped off the current chunk at their size
+    (rounded to 16 bytes).  Freeing one does nothing, unless it was the most recent allocation,
+    and the same goes for growing it in place.
+  * `USERP_HINT_DYNAMIC` allocations (and anything that is reallocated larger) are rounded up to
+    a power of 2 size class from 16 bytes to 64KiB.  They grow in place up to the size of their
+    class, and freed blocks go onto a free list per class for the next allocation of that class.
+  * Anything larger gets a chunk of its own, reallocated or freed through `env->alloc`.
+
+The chunks holding blocks are listed most recent first, and a pointer passed to `userp_alloc` is
+looked up in that list to find out whether it is an arena block.  Pointers that aren't (allocated
+while the arena was not selected) go to `env->alloc` as usual.  The list is short, since chunks
+double in size up to USERP_ARENA_CHUNK_MAX.  A reset moves the chunks to a spare list, to be
+used again in place of new chunks, and frees only those holding a single large block.
+
+*/
+
+struct arena_block {
+	size_t size;                 // usable bytes after the header
+	size_t cls;                  // size class, or ARENA_BUMP or ARENA_LARGE
+};
+
+#define ARENA_HDR       USERP_ARENA_ROUND(sizeof(struct arena_block))
+#define ARENA_CHUNK_HDR USERP_ARENA_ROUND(sizeof(struct userp_arena_chunk))
+#define ARENA_BUMP      USERP_ARENA_CLASSES
+#define ARENA_LARGE     (USERP_ARENA_CLASSES+1)
+
+// Find the link to the chunk holding p, or NULL if p didn't come from the arena
+static struct userp_arena_chunk** arena_find_chunk(struct userp_arena *arena, const void *p) {
+	struct userp_arena_chunk **link;
+	for (link= &arena->chunks; *link; link= &(*link)->next)
+		if ((uintptr_t) p > (uintptr_t) *link && (uintptr_t) p < (uintptr_t) (*link)->lim)
+			return link;
+	return NULL;
+}
+
+// Take n bytes from the chunk being divided, moving on to a spare or new chunk if needed
+static uint8_t* arena_bump(userp_env env, size_t n) {
+	struct userp_arena *arena= &env->arena;
+	struct userp_arena_chunk *chunk, **link;
+	size_t size;
+	uint8_t *p;
+	if ((size_t)(arena->lim - arena->pos) < n) {
+		for (link= &arena->spare; *link; link= &(*link)->next)
+			if ((size_t)((*link)->lim - (uint8_t*) *link) >= ARENA_CHUNK_HDR + n)
+				break;
+		if ((chunk= *link))
+			*link= chunk->next;
+		else {
+			size= arena->chunk_size < ARENA_CHUNK_HDR + n? ARENA_CHUNK_HDR + n : arena->chunk_size;
+			if (!env->alloc(env->alloc_cb_data, (void**) &chunk, size, USERP_HINT_STATIC))
+				return NULL;
+			chunk->lim= (uint8_t*) chunk + size;
+			chunk->large= false;
+			if (arena->chunk_size < USERP_ARENA_CHUNK_MAX)
+				arena->chunk_size= arena->chunk_size * 2 < USERP_ARENA_CHUNK_MAX?
+					arena->chunk_size * 2 : USERP_ARENA_CHUNK_MAX;
+		}
+		chunk->next= arena->chunks;
+		arena->chunks= chunk;
+		arena->pos= (uint8_t*) chunk + ARENA_CHUNK_HDR;
+		arena->lim= chunk->lim;
+	}
+	p= arena->pos;
+	arena->pos += n;
+	return p;
+}
+
+static void* arena_new_block(userp_env env, size_t size, userp_alloc_flags flags) {
+	struct userp_arena *arena= &env->arena;
+	struct userp_arena_chunk *chunk= NULL;
+	struct arena_block *b;
+	size_t cls, cap;
+	void *p;
+	if (size > USERP_ARENA_LARGE) {
+		if (!env->alloc(env->alloc_cb_data, (void**) &chunk, ARENA_CHUNK_HDR + ARENA_HDR + size, USERP_HINT_STATIC))
+			return NULL;
+		chunk->lim= (uint8_t*) chunk + ARENA_CHUNK_HDR + ARENA_HDR + size;
+		chunk->large= true;
+		chunk->next= arena->chunks;
+		arena->chunks= chunk;
+		b= (struct arena_block*) ((uint8_t*) chunk + ARENA_CHUNK_HDR);
+		b->size= size;
+		b->cls= ARENA_LARGE;
+		return (uint8_t*) b + ARENA_HDR;
+	}
+	if (flags & USERP_HINT_DYNAMIC) {
+		for (cls= 0, cap= 16; cap < size; cls++, cap <<= 1);
+		if ((p= arena->free_list[cls])) {
+			arena->free_list[cls]= *(void**) p;
+			return p;
+		}
+	}
+	else {
+		cls= ARENA_BUMP;
+		cap= USERP_ARENA_ROUND(size);
+	}
+	if (!(b= (struct arena_block*) arena_bump(env, ARENA_HDR + cap)))
+		return NULL;
+	b->size= cap;
+	b->cls= cls;
+	return (uint8_t*) b + ARENA_HDR;
+}
+
+// Give back a block which is not large
+static void arena_release(struct userp_arena *arena, void *p) {
+	struct arena_block *b= (struct arena_block*) ((uint8_t*) p - ARENA_HDR);
+	if (b->cls < USERP_ARENA_CLASSES) {
+		*(void**) p= arena->free_list[b->cls];
+		arena->free_list[b->cls]= p;
+	}
+	else if ((uint8_t*) p + b->size == arena->pos)
+		arena->pos= (uint8_t*) b;
+}
+
+static bool arena_alloc(userp_env env, void **pointer, size_t new_size, userp_alloc_flags flags) {
+	struct userp_arena *arena= &env->arena;
+	struct userp_arena_chunk **link= NULL, *chunk, *next;
+	struct arena_block *b;
+	void *p;
+	if (!*pointer) {
+		if (new_size && !(*pointer= arena_new_block(env, new_size, flags)))
+			return false;
+		return true;
+	}
+	// Pointers from before the arena was selected belong to env->alloc
+	if (!(link= arena_find_chunk(arena, *pointer)))
+		return env->alloc(env->alloc_cb_data, pointer, new_size, flags);
+	chunk= *link;
+	b= (struct arena_block*) ((uint8_t*) *pointer - ARENA_HDR);
+	if (chunk->large) {
+		next= chunk->next;
+		if (!env->alloc(env->alloc_cb_data, (void**) &chunk, new_size? ARENA_CHUNK_HDR + ARENA_HDR + new_size : 0, USERP_HINT_STATIC))
+			return false;
+		if (!new_size) {
+			*link= next;
+			*pointer= NULL;
+			return true;
+		}
+		*link= chunk;
+		chunk->lim= (uint8_t*) chunk + ARENA_CHUNK_HDR + ARENA_HDR + new_size;
+		b= (struct arena_block*) ((uint8_t*) chunk + ARENA_CHUNK_HDR);
+		b->size= new_size;
+		*pointer= (uint8_t*) b + ARENA_HDR;
+		return true;
+	}
+	if (!new_size) {
+		arena_release(arena, *pointer);
+		*pointer= NULL;
+		return true;
+	}
+	if (new_size <= b->size)
+		return true;
+	// The most recent allocation can grow into the rest of the chunk
+	if (b->cls == ARENA_BUMP && (uint8_t*) *pointer + b->size == arena->pos && new_size <= USERP_ARENA_LARGE
+		&& (size_t)(arena->lim - (uint8_t*) *pointer) >= USERP_ARENA_ROUND(new_size)
+	) {
+		b->size= USERP_ARENA_ROUND(new_size);
+		arena->pos= (uint8_t*) *pointer + b->size;
+		return true;
+	}
+	// Anything that grows once is likely to grow again
+	if (!(p= arena_new_block(env, new_size, flags | USERP_HINT_DYNAMIC)))
+		return false;
+	memcpy(p, *pointer, b->size);
+	arena_release(arena, *pointer);
+	*pointer= p;
+	return true;
+}
+
+void userp_env_reset_arena(userp_env env) {
+	struct userp_arena *arena= &env->arena;
+	struct userp_arena_chunk *chunk, *next;
+	// Pooled buffers are probably in the arena
+	userp_env_empty_buffer_pool(env);
+	for (chunk= arena->chunks; chunk; chunk= next) {
+		next= chunk->next;
+		if (chunk->large)
+			env->alloc(env->alloc_cb_data, (void**) &chunk, 0, 0);
+		else {
+			chunk->next= arena->spare;
+			arena->spare= chunk;
+		}
+	}
+	arena->chunks= NULL;
+	arena->pos= arena->lim= NULL;
+	bzero(arena->free_list, sizeof(arena->free_list));
+}
+
+static void arena_destroy(userp_env env) {
+	struct userp_arena_chunk *chunk;
+	userp_env_reset_arena(env);
+	while ((chunk= env->arena.spare)) {
+		env->arena.spare= chunk->next;
+		env->alloc(env->alloc_cb_data, (void**) &chunk, 0, 0);
+	}
+}
+
 bool userp_alloc(userp_env env, void **pointer, size_t new_size, userp_alloc_flags flags) {
-	if (env->alloc(env->alloc_cb_data, pointer, new_size, flags))
+	if (*pointer? env->arena.chunks != NULL : env->arena.enabled) {
+		if (arena_alloc(env, pointer, new_size, flags))
+			return true;
+	}
+	else if (env->alloc(env->alloc_cb_data, pointer, new_size, flags))
 		return true;
 	userp_diag_set(&env->err, new_size? USERP_ELIMIT : USERP_EFATAL, "alloc(" USERP_DIAG_SIZE ") failed");
 	env->err.size= new_size;
@@ -430,4 +760,102 @@ alloc 0x0+ to \d+ = 0x\w+
 alloc 0x\w+ to 0 = 0x0+
 */
 
+UNIT_TEST(env_arena) {
+	userp_env env= userp_new_env(logging_alloc, userp_file_logger, stdout, USERP_ENV_ARENA);
+	void *a= NULL, *b= NULL, *c= NULL, *d= NULL, *big= NULL, *old= NULL, *p;
+	printf("# static allocations are packed, and the last one can grow in place\n");
+	userp_alloc(env, &a, 40, USERP_HINT_STATIC);
+	userp_alloc(env, &b, 8, USERP_HINT_STATIC);
+	p= b;
+	userp_alloc(env, &b, 100, USERP_HINT_STATIC);
+	printf("adjacent=%d in_place=%d\n", (int)((uint8_t*) b - (uint8_t*) a) == 48 + (int) ARENA_HDR, b == p);
+	printf("# dynamic allocations grow within their size class, then recycle it\n");
+	userp_alloc(env, &c, 100, USERP_HINT_DYNAMIC);
+	p= c;
+	userp_alloc(env, &c, 120, USERP_HINT_DYNAMIC);
+	printf("in_place=%d\n", c == p);
+	userp_alloc(env, &c, 1000, USERP_HINT_DYNAMIC);
+	userp_alloc(env, &d, 128, USERP_HINT_DYNAMIC);
+	printf("moved=%d recycled=%d\n", c != p, d == p);
+	printf("# large\n");
+	userp_alloc(env, &big, 100000, 0);
+	userp_alloc(env, &big, 200000, 0);
+	userp_alloc(env, &big, 0, 0);
+	printf("# allocated directly, then freed while the arena is selected\n");
+	userp_env_set_attr(env, USERP_ALLOCATOR, USERP_ALLOCATOR_DIRECT);
+	userp_alloc(env, &old, 10, 0);
+	userp_env_set_attr(env, USERP_ALLOCATOR, USERP_ALLOCATOR_ARENA);
+	userp_alloc(env, &old, 0, 0);
+	printf("# reset\n");
+	userp_alloc(env, &big, 100000, 0);
+	p= a;
+	userp_env_reset_arena(env);
+	a= NULL;
+	userp_alloc(env, &a, 40, USERP_HINT_STATIC);
+	printf("reused=%d\n", a == p);
+	userp_drop_env(env);
+}
+/*OUTPUT
+alloc 0x0+ to \d+ = 0x\w+
+# static allocations are packed, and the last one can grow in place
+alloc 0x0+ to 65536 = 0x\w+
+adjacent=1 in_place=1
+# dynamic allocations grow within their size class, then recycle it
+in_place=1
+moved=1 recycled=1
+# large
+alloc 0x0+ to 100\d\d\d = 0x\w+
+alloc 0x\w+ to 200\d\d\d = 0x\w+
+alloc 0x\w+ to 0 = 0x0+
+# allocated directly, then freed while the arena is selected
+alloc 0x0+ to 10 = 0x\w+
+alloc 0x\w+ to 0 = 0x0+
+# reset
+alloc 0x0+ to 100\d\d\d = 0x\w+
+alloc 0x\w+ to 0 = 0x0+
+reused=1
+alloc 0x\w+ to 0 = 0x0+
+alloc 0x\w+ to 0 = 0x0+
+*/
+
+// A decoder-like pattern of small objects and growing arrays, all freed at the end
+static void test_env_alloc_round(userp_env env, void **objs, size_t n) {
+	size_t i, k;
+	for (i= 0; i < n; i++) {
+		objs[i]= NULL;
+		if (i & 7)
+			userp_alloc(env, &objs[i], 32 + (i * 37 % 480), USERP_HINT_STATIC);
+		else
+			for (k= 16; k <= 4096; k <<= 1)
+				userp_alloc(env, &objs[i], k, USERP_HINT_DYNAMIC);
+	}
+	for (i= n; i > 0; i--)
+		userp_alloc(env, &objs[i-1], 0, 0);
+}
+
+UNIT_TEST(bench_env_arena) {
+	size_t rounds= argc > 0? atoi(argv[0]) : 100000, n= 64, i, k;
+	void *objs[64];
+	userp_env env;
+	double t[2];
+	clock_t start;
+	for (k= 0; k < 2; k++) {
+		env= userp_new_env(NULL, userp_file_logger, stdout, k? USERP_ENV_ARENA : 0);
+		start= clock();
+		for (i= 0; i < rounds; i++) {
+			test_env_alloc_round(env, objs, n);
+			if (k)
+				userp_env_reset_arena(env);
+		}
+		t[k]= (double)(clock() - start) / CLOCKS_PER_SEC;
+		userp_drop_env(env);
+	}
+	printf("direct: %.1f M allocs/sec\n", rounds * (n + n / 8 * 8) / (t[0] > 0? t[0] : 1e-9) / 1e6);
+	printf("arena: %.1f M allocs/sec\n", rounds * (n + n / 8 * 8) / (t[1] > 0? t[1] : 1e-9) / 1e6);
+}
+/*OUTPUT
+direct: [0-9.]+ M allocs/sec
+arena: [0-9.]+ M allocs/sec
+*/
+
 #endif
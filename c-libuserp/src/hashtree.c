@@ -37,22 +37,30 @@ NODE_TYPE {
 
 #ifndef HASHTREE_KEY_CMP
 
-#define HASHTREE_KEY_CMP(symtable, keyhash, key, node) ( \
+#define HASHTREE_KEY_CMP(symtable, keyhash, key, keylen, node) ( \
 	(keyhash) < (node).hash? -1 \
 	: (keyhash) > (node).hash? 1 \
-	: strcmp( (key), (symtable)->symbols[(node).sym].name ) \
+	: HASHTREE_NAME_CMP(key, keylen, (symtable)->symbols[(node).sym]) \
 )
 
 #define HASHTREE_NODE_CMP(symtable, node1, node2) ( \
 	(node1).hash < (node2).hash? -1 \
 	: (node1).hash > (node2).hash? 1 \
-	: strcmp( (symtable)->symbols[(node1).sym].name, (symtable)->symbols[(node2).sym].name ) \
+	: HASHTREE_NAME_CMP((symtable)->symbols[(node1).sym].name, (symtable)->symbols[(node1).sym].len, \
+		(symtable)->symbols[(node2).sym]) \
 )
 
-#define HASHTREE_PAIRNODE_GET_MATCH(symtable, keyhash, key, node) ( \
-	0 == HASHTREE_KEY_CMP(symtable, keyhash, key, node) \
+// Length is compared first, so most mismatches never touch the string
+#define HASHTREE_NAME_CMP(key, keylen, sym_entry) ( \
+	(keylen) < (sym_entry).len? -1 \
+	: (keylen) > (sym_entry).len? 1 \
+	: memcmp( (key), (sym_entry).name, (keylen) ) \
+)
+
+#define HASHTREE_PAIRNODE_GET_MATCH(symtable, keyhash, key, keylen, node) ( \
+	0 == HASHTREE_KEY_CMP(symtable, keyhash, key, keylen, node) \
 		? (symtable)->id_offset + (node).sym \
-		: ((node).left == (keyhash) && 0 == strcmp((key), (symtable)->symbols[(node).right].name )) \
+		: ((node).left == (keyhash) && 0 == HASHTREE_NAME_CMP(key, keylen, (symtable)->symbols[(node).right])) \
 		? (symtable)->id_offset + (node).right \
 		: 0 )
 
@@ -61,7 +69,8 @@ NODE_TYPE {
 static userp_symbol BIT_SUFFIX_NAME(userp_symtable_hashtree_get, IDBITS) (
 	struct userp_symtable *st,
 	uint32_t hash,
-	const char *name
+	const char *name,
+	size_t len
 ) {
 	// read the bucket for the hash
 	WORD_TYPE *bucket= &((WORD_TYPE*) st->buckets)[ hash % st->bucket_alloc ];
@@ -72,11 +81,11 @@ static userp_symbol BIT_SUFFIX_NAME(userp_symtable_hashtree_get, IDBITS) (
 		// Oh but wait, I added one more optimization where it could be a non-tree
 		// holding a pair of nodes.
 		if (nodes[node_idx].is_pair)
-			return HASHTREE_PAIRNODE_GET_MATCH(st, (WORD_TYPE)hash, name, nodes[node_idx]);
+			return HASHTREE_PAIRNODE_GET_MATCH(st, (WORD_TYPE)hash, name, len, nodes[node_idx]);
 		// now back to your regularly scheduled R/B programming
 		int cmp;
 		while (node_idx) {
-			cmp= HASHTREE_KEY_CMP(st, (WORD_TYPE)hash, name, nodes[node_idx]);
+			cmp= HASHTREE_KEY_CMP(st, (WORD_TYPE)hash, name, len, nodes[node_idx]);
 			if (cmp == 0) return st->id_offset + nodes[node_idx].sym;
 			else if (cmp > 0) node_idx= nodes[node_idx].right;
 			else node_idx= nodes[node_idx].left;
@@ -85,7 +94,7 @@ static userp_symbol BIT_SUFFIX_NAME(userp_symtable_hashtree_get, IDBITS) (
 	// else this bucket refers to exactly one symbol, but still need to verify the string
 	else {
 		WORD_TYPE sym_idx= *bucket >> 1;
-		if (sym_idx && strcmp(name, st->symbols[sym_idx].name) == 0)
+		if (sym_idx && HASHTREE_NAME_CMP(name, len, st->symbols[sym_idx]) == 0)
 			return st->id_offset + sym_idx;
 	}
 	return 0;
@@ -224,7 +233,7 @@ static bool BIT_SUFFIX_NAME(userp_symtable_hashtree_insert, IDBITS) (
 	
 	// calculate the official hash on the symbol entry if it wasn't done yet
 	if (!hash) {
-		hash= userp_symtable_calc_hash(st, st->symbols[sym_ofs].name);
+		hash= userp_symtable_calc_hash(st, st->symbols[sym_ofs].name, st->symbols[sym_ofs].len);
 		st->symbols[sym_ofs].hash= hash;
 	}
 
@@ -306,6 +315,43 @@ static bool BIT_SUFFIX_NAME(userp_symtable_hashtree_insert, IDBITS) (
 	return true;
 }
 
+// Bulk-build, first pass: every symbol that lands in an empty bucket is placed directly,
+// and the rest are counted.  Each of those will need at most 2 tree nodes.
+static size_t BIT_SUFFIX_NAME(userp_symtable_hashtree_place, IDBITS) (
+	struct userp_symtable *st,
+	size_t from,
+	size_t to
+) {
+	WORD_TYPE *buckets= (WORD_TYPE*) st->buckets, *bucket;
+	size_t i, collisions= 0;
+	for (i= from; i < to; i++) {
+		bucket= &buckets[ st->symbols[i].hash % st->bucket_alloc ];
+		if (!*bucket) {
+			*bucket= i << 1;
+			st->bucket_used++;
+		}
+		else ++collisions;
+	}
+	return collisions;
+}
+
+// Bulk-build, second pass: insert every symbol that did not get its own bucket.
+// Symbols are visited in the same order as the first pass, so a directly-placed
+// symbol is always seen before anything that collides with it.
+static bool BIT_SUFFIX_NAME(userp_symtable_hashtree_place_collisions, IDBITS) (
+	struct userp_symtable *st,
+	size_t from,
+	size_t to
+) {
+	WORD_TYPE *buckets= (WORD_TYPE*) st->buckets;
+	size_t i;
+	for (i= from; i < to; i++)
+		if (buckets[ st->symbols[i].hash % st->bucket_alloc ] != (WORD_TYPE)(i << 1))
+			if (!BIT_SUFFIX_NAME(userp_symtable_hashtree_insert, IDBITS)(st, i))
+				return false;
+	return true;
+}
+
 static bool BIT_SUFFIX_NAME(userp_symtable_hashtree_walk, IDBITS) (
 	struct userp_symtable *st,
 	WORD_TYPE root,
@@ -6,6 +6,23 @@
  * for a standard modern Linux system.
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#else
+// Without configure, assume the optional features whose headers this compiler can find
+#if defined(__has_include)
+#if !defined(HAVE_PTHREAD) && __has_include(<pthread.h>)
+#define HAVE_PTHREAD 1
+#endif
+#if !defined(HAVE_LINUX_IO_URING_H) && __has_include(<linux/io_uring.h>)
+#define HAVE_LINUX_IO_URING_H 1
+#endif
+#if !defined(HAVE_LINUX_ERRQUEUE_H) && __has_include(<linux/errqueue.h>)
+#define HAVE_LINUX_ERRQUEUE_H 1
+#endif
+#endif
+#endif
+
 // Adjust these as needed according to config macros
 #include <stdbool.h>
 #include <stdint.h>
@@ -15,6 +32,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <time.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -22,5 +40,33 @@
 #include <fcntl.h>
 
 #define HAVE_POSIX_FILES 1
-#define HAVE_POSIX_MEMMAP 0
+#define HAVE_POSIX_MEMMAP 1
 #include <errno.h>
+#if HAVE_POSIX_MEMMAP
+#include <sys/mman.h>
+#endif
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if HAVE_POSIX_FILES
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
+#if !defined(HAVE_IO_URING) && HAVE_LINUX_IO_URING_H
+#define HAVE_IO_URING 1
+#endif
+#if HAVE_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#if !defined(HAVE_MSG_ZEROCOPY) && HAVE_POSIX_FILES && HAVE_LINUX_ERRQUEUE_H && defined(MSG_ZEROCOPY)
+#define HAVE_MSG_ZEROCOPY 1
+#endif
+#if HAVE_MSG_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
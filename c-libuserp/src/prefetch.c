@@ -0,0 +1,579 @@
+#include "local.h"
+#include "userp_private.h"
+
+/*APIDOC
+## Prefetching Reader
+
+### Synopsis
+
+    struct userp_prefetch *pf= userp_new_prefetch_reader(env, fd, 0, -1, 1<<20, 8, 0);
+    userp_dec_set_reader(dec, userp_prefetch_read, pf);
+    ... // decode
+    userp_drop_dec(env, dec);
+    userp_free_prefetch_reader(pf);
+
+### Description
+
+A stock `userp_reader_fn` for large sequential files, which keeps `depth` block-sized reads in
+flight ahead of the decoder so that the device works while the decoder is busy.  On Linux it
+submits the reads through io_uring; if io_uring is unavailable (old kernel, seccomp, or the
+`USERP_PREFETCH_THREAD` flag) it falls back to one background thread calling `pread`.  Either
+way the decoder's thread never copies the data: completed blocks are appended to the decoder's
+input as parts referencing the block's buffer.
+
+The block buffers come from the env's buffer pool (`USERP_BUFFER_POOLED`), so once the decoder
+drops a block, the buffer gets used for a later read instead of being freed.  Keep
+`USERP_BUFFER_POOL_MAX` at least `depth * block_size` for a steady stream to make no allocations.
+
+#### userp_new_prefetch_reader
+
+    struct userp_prefetch *pf= userp_new_prefetch_reader(
+      env,
+      fd,           // file to read; must support pread (not a pipe or socket)
+      offset,       // first byte to read
+      length,       // number of bytes, or -1 to read until EOF
+      block_size,   // bytes per read; 0 for the default of 1MiB
+      depth,        // reads to keep in flight; 0 for the default of 8
+      flags         // USERP_PREFETCH_THREAD to skip io_uring
+    );
+
+Returns NULL and emits an error if allocation fails or no backend can be started.  Nothing is
+read until the first call to `userp_prefetch_read`.  The reader does not take ownership of `fd`.
+`userp_prefetch_using_uring(pf)` tells you which backend it got.
+
+#### userp_prefetch_read
+
+    bool userp_prefetch_read(void *pf, struct userp_bstr *str, size_t bytes_needed, userp_env env);
+
+The `userp_reader_fn`.  Waits for blocks in file order until at least `bytes_needed` bytes have
+been appended to `str`, then tops the queue back up before returning.  Returns false with
+`USERP_EFEEDME` at the end of the range, or `USERP_ESYS` if a read failed.
+
+#### userp_free_prefetch_reader
+
+    userp_free_prefetch_reader(pf);
+
+Waits for reads still in flight, stops the backend, and frees the reader.  Blocks already handed
+to a decoder remain valid until the decoder drops them.
+
+*/
+
+#if HAVE_POSIX_FILES && HAVE_PTHREAD
+
+#define PREFETCH_IDLE   0
+#define PREFETCH_QUEUED 1
+#define PREFETCH_DONE   2
+
+#ifndef USERP_DEFAULT_PREFETCH_BLOCK
+#define USERP_DEFAULT_PREFETCH_BLOCK (1<<20)
+#endif
+#ifndef USERP_DEFAULT_PREFETCH_DEPTH
+#define USERP_DEFAULT_PREFETCH_DEPTH 8
+#endif
+
+struct prefetch_slot {
+	userp_buffer buf;          // the slot holds one reference while the read is queued
+	int64_t ofs;               // file offset of this block
+	size_t len;                // bytes requested
+	ssize_t result;            // bytes read, or -errno
+	int state;
+#if HAVE_IO_URING
+	struct iovec iov;
+#endif
+};
+
+#if HAVE_IO_URING
+struct prefetch_uring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_map, *cq_map;
+	size_t sq_map_len, cq_map_len, sqes_len;
+	unsigned pending;          // SQEs written but not yet passed to io_uring_enter
+};
+#endif
+
+struct userp_prefetch {
+	userp_env env;
+	int fd;
+	size_t block_size;
+	int64_t next_ofs, lim;     // next block to submit, and the end of the range
+	unsigned depth, head;      // slots are used in ring order; 'head' is the next one to consume
+	unsigned queued;           // slots submitted and not yet consumed
+	struct prefetch_slot *slots;
+#if HAVE_IO_URING
+	struct prefetch_uring ring;
+#endif
+	bool threaded, stop;
+	unsigned work;             // next slot the pread thread will read
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+/*IMPLDOC
+### Prefetch Backends
+
+Slots are a ring of `depth` entries.  A slot is QUEUED when its read is submitted, DONE when the
+read completes, and IDLE again after `userp_prefetch_read` hands its buffer to the decoder.
+Reads are submitted and consumed in ring order, which is also file order, so the consumer only
+ever waits on `slots[head]`.
+
+The io_uring backend talks to the kernel with the raw syscalls and the ring layout from
+`<linux/io_uring.h>` rather than depending on liburing.  It uses `IORING_OP_READV` (kernel 5.1)
+and never has more than `depth` operations outstanding, so the completion ring can't overflow.
+The thread backend has a single worker that walks the ring behind the submitter; one thread is
+enough to overlap I/O with decoding, which is the goal.
+*/
+
+#if HAVE_IO_URING
+
+static bool uring_init(struct userp_prefetch *pf) {
+	struct prefetch_uring *r= &pf->ring;
+	struct io_uring_params p;
+	int fd;
+	bzero(&p, sizeof(p));
+	if ((fd= (int) syscall(__NR_io_uring_setup, pf->depth, &p)) < 0)
+		return false;
+	r->fd= fd;
+	r->sq_map_len= p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_map_len= p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_map_len > r->sq_map_len)
+			r->sq_map_len= r->cq_map_len;
+		r->cq_map_len= 0;
+	}
+	r->sq_map= mmap(NULL, r->sq_map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (r->sq_map == MAP_FAILED)
+		goto fail_sq;
+	r->cq_map= !r->cq_map_len? r->sq_map
+		: mmap(NULL, r->cq_map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (r->cq_map == MAP_FAILED)
+		goto fail_cq;
+	r->sqes_len= p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes= mmap(NULL, r->sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto fail_sqes;
+	r->sq_head=  (unsigned*)((char*) r->sq_map + p.sq_off.head);
+	r->sq_tail=  (unsigned*)((char*) r->sq_map + p.sq_off.tail);
+	r->sq_mask=  (unsigned*)((char*) r->sq_map + p.sq_off.ring_mask);
+	r->sq_array= (unsigned*)((char*) r->sq_map + p.sq_off.array);
+	r->cq_head=  (unsigned*)((char*) r->cq_map + p.cq_off.head);
+	r->cq_tail=  (unsigned*)((char*) r->cq_map + p.cq_off.tail);
+	r->cq_mask=  (unsigned*)((char*) r->cq_map + p.cq_off.ring_mask);
+	r->cqes= (struct io_uring_cqe*)((char*) r->cq_map + p.cq_off.cqes);
+	r->pending= 0;
+	return true;
+
+	CATCH(fail_sqes) {
+		if (r->cq_map_len) munmap(r->cq_map, r->cq_map_len);
+	}
+	CATCH(fail_cq) {
+		munmap(r->sq_map, r->sq_map_len);
+	}
+	CATCH(fail_sq) {
+		close(fd);
+	}
+	return false;
+}
+
+static void uring_destroy(struct userp_prefetch *pf) {
+	struct prefetch_uring *r= &pf->ring;
+	munmap(r->sqes, r->sqes_len);
+	if (r->cq_map_len) munmap(r->cq_map, r->cq_map_len);
+	munmap(r->sq_map, r->sq_map_len);
+	close(r->fd);
+}
+
+static void uring_queue(struct userp_prefetch *pf, unsigned slot_idx) {
+	struct prefetch_uring *r= &pf->ring;
+	struct prefetch_slot *slot= &pf->slots[slot_idx];
+	unsigned tail= *r->sq_tail, idx= tail & *r->sq_mask;
+	struct io_uring_sqe *sqe= &r->sqes[idx];
+	slot->iov.iov_base= slot->buf->data;
+	slot->iov.iov_len= slot->len;
+	bzero(sqe, sizeof(*sqe));
+	sqe->opcode= IORING_OP_READV;
+	sqe->fd= pf->fd;
+	sqe->addr= (uint64_t)(uintptr_t) &slot->iov;
+	sqe->len= 1;
+	sqe->off= (uint64_t) slot->ofs;
+	sqe->user_data= slot_idx;
+	r->sq_array[idx]= idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->pending++;
+}
+
+// Submit pending SQEs, and if 'wait' is given, block until that slot's read completes
+static bool uring_enter(struct userp_prefetch *pf, struct prefetch_slot *wait) {
+	struct prefetch_uring *r= &pf->ring;
+	struct io_uring_cqe *cqe;
+	unsigned head;
+	int ret;
+	for (;;) {
+		// Reap completions
+		head= *r->cq_head;
+		while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe= &r->cqes[head & *r->cq_mask];
+			pf->slots[cqe->user_data].result= cqe->res;
+			pf->slots[cqe->user_data].state= PREFETCH_DONE;
+			head++;
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+		if (!r->pending && (!wait || wait->state == PREFETCH_DONE))
+			return true;
+		ret= (int) syscall(__NR_io_uring_enter, r->fd, r->pending,
+			wait && wait->state != PREFETCH_DONE? 1 : 0,
+			wait && wait->state != PREFETCH_DONE? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+			userp_diag_setf(&pf->env->err, USERP_ESYS, "io_uring_enter() failed: " USERP_DIAG_CSTR1, strerror(errno));
+			return false;
+		}
+		r->pending -= ret < (int) r->pending? ret : r->pending;
+	}
+}
+
+#endif /* HAVE_IO_URING */
+
+static void* prefetch_thread(void *arg) {
+	struct userp_prefetch *pf= (struct userp_prefetch*) arg;
+	struct prefetch_slot *slot;
+	ssize_t got;
+	pthread_mutex_lock(&pf->mutex);
+	for (;;) {
+		while (!pf->stop && pf->slots[pf->work].state != PREFETCH_QUEUED)
+			pthread_cond_wait(&pf->cond, &pf->mutex);
+		if (pf->stop)
+			break;
+		slot= &pf->slots[pf->work];
+		pthread_mutex_unlock(&pf->mutex);
+		do got= pread(pf->fd, slot->buf->data, slot->len, (off_t) slot->ofs);
+		while (got < 0 && errno == EINTR);
+		pthread_mutex_lock(&pf->mutex);
+		slot->result= got < 0? -errno : got;
+		slot->state= PREFETCH_DONE;
+		pf->work= (pf->work + 1) % pf->depth;
+		pthread_cond_broadcast(&pf->cond);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	return NULL;
+}
+
+// Fill every idle slot with the next block of the file, and start the reads
+static bool prefetch_submit(struct userp_prefetch *pf) {
+	struct prefetch_slot *slot;
+	unsigned idx, n= 0;
+	while (pf->queued < pf->depth && pf->next_ofs < pf->lim) {
+		idx= (pf->head + pf->queued) % pf->depth;
+		slot= &pf->slots[idx];
+		if (!(slot->buf= userp_env_take_buffer(pf->env, pf->block_size, 0)))
+			break;
+		slot->ofs= pf->next_ofs;
+		slot->len= pf->lim - pf->next_ofs < (int64_t) pf->block_size? (size_t)(pf->lim - pf->next_ofs) : pf->block_size;
+		pf->next_ofs += slot->len;
+		pf->queued++;
+		n++;
+		if (pf->threaded) {
+			pthread_mutex_lock(&pf->mutex);
+			slot->state= PREFETCH_QUEUED;
+			pthread_cond_broadcast(&pf->cond);
+			pthread_mutex_unlock(&pf->mutex);
+		}
+#if HAVE_IO_URING
+		else {
+			slot->state= PREFETCH_QUEUED;
+			uring_queue(pf, idx);
+		}
+#endif
+	}
+#if HAVE_IO_URING
+	if (n && !pf->threaded && !uring_enter(pf, NULL))
+		return false;
+#endif
+	return pf->queued > 0 || pf->next_ofs >= pf->lim;
+}
+
+static bool prefetch_wait(struct userp_prefetch *pf, struct prefetch_slot *slot) {
+	if (pf->threaded) {
+		pthread_mutex_lock(&pf->mutex);
+		while (slot->state != PREFETCH_DONE)
+			pthread_cond_wait(&pf->cond, &pf->mutex);
+		pthread_mutex_unlock(&pf->mutex);
+		return true;
+	}
+#if HAVE_IO_URING
+	return uring_enter(pf, slot);
+#else
+	return false;
+#endif
+}
+
+struct userp_prefetch* userp_new_prefetch_reader(userp_env env, int fd, int64_t offset, int64_t length,
+	size_t block_size, unsigned depth, int flags
+) {
+	struct userp_prefetch *pf= NULL;
+	if (!USERP_ALLOC_OBJ(env, &pf))
+		return NULL;
+	bzero(pf, sizeof(*pf));
+	pf->env= env;
+	pf->fd= fd;
+	pf->block_size= block_size? block_size : USERP_DEFAULT_PREFETCH_BLOCK;
+	pf->depth= depth? depth : USERP_DEFAULT_PREFETCH_DEPTH;
+	pf->next_ofs= offset;
+	pf->lim= length < 0? INT64_MAX : offset + length;
+	if (!USERP_ALLOC_ARRAY(env, &pf->slots, pf->depth)) {
+		USERP_FREE(env, &pf);
+		return NULL;
+	}
+	bzero(pf->slots, sizeof(*pf->slots) * pf->depth);
+#if HAVE_IO_URING
+	if (!(flags & USERP_PREFETCH_THREAD) && uring_init(pf))
+		pf->threaded= false;
+	else
+#endif
+	{
+		pf->threaded= true;
+		pthread_mutex_init(&pf->mutex, NULL);
+		pthread_cond_init(&pf->cond, NULL);
+		if (pthread_create(&pf->thread, NULL, prefetch_thread, pf) != 0) {
+			userp_diag_setf(&env->err, USERP_ESYS, "pthread_create() failed: " USERP_DIAG_CSTR1, strerror(errno));
+			USERP_DISPATCH_ERR(env);
+			pthread_cond_destroy(&pf->cond);
+			pthread_mutex_destroy(&pf->mutex);
+			USERP_FREE(env, &pf->slots);
+			USERP_FREE(env, &pf);
+			return NULL;
+		}
+	}
+	userp_grab_env(env);
+	return pf;
+}
+
+bool userp_prefetch_using_uring(struct userp_prefetch *pf) {
+	return !pf->threaded;
+}
+
+void userp_free_prefetch_reader(struct userp_prefetch *pf) {
+	userp_env env= pf->env;
+	unsigned i;
+	// Let outstanding reads land before their buffers go away
+	for (i= 0; i < pf->queued; i++)
+		prefetch_wait(pf, &pf->slots[(pf->head + i) % pf->depth]);
+	if (pf->threaded) {
+		pthread_mutex_lock(&pf->mutex);
+		pf->stop= true;
+		pthread_cond_broadcast(&pf->cond);
+		pthread_mutex_unlock(&pf->mutex);
+		pthread_join(pf->thread, NULL);
+		pthread_cond_destroy(&pf->cond);
+		pthread_mutex_destroy(&pf->mutex);
+	}
+#if HAVE_IO_URING
+	else
+		uring_destroy(pf);
+#endif
+	for (i= 0; i < pf->depth; i++)
+		if (pf->slots[i].state != PREFETCH_IDLE)
+			userp_drop_buffer(pf->slots[i].buf);
+	USERP_FREE(env, &pf->slots);
+	USERP_FREE(env, &pf);
+	userp_drop_env(env);
+}
+
+bool userp_prefetch_read(void *callback_data, struct userp_bstr *str, size_t bytes_needed, userp_env env) {
+	struct userp_prefetch *pf= (struct userp_prefetch*) callback_data;
+	struct prefetch_slot *slot;
+	struct userp_bstr_part part;
+	size_t got= 0;
+	ssize_t n;
+	while (got < bytes_needed) {
+		if (!prefetch_submit(pf))
+			return false;
+		if (!pf->queued) {
+			userp_diag_set(&env->err, USERP_EFEEDME, "No bytes ready to read from stream");
+			return false;
+		}
+		slot= &pf->slots[pf->head];
+		if (!prefetch_wait(pf, slot))
+			return false;
+		// Finish a short read synchronously; if it is still short, that's the end of the file.
+		while (slot->result > 0 && (size_t) slot->result < slot->len) {
+			do n= pread(pf->fd, slot->buf->data + slot->result, slot->len - slot->result, (off_t)(slot->ofs + slot->result));
+			while (n < 0 && errno == EINTR);
+			if (n <= 0) {
+				pf->lim= slot->ofs + slot->result;
+				break;
+			}
+			slot->result += n;
+		}
+		if (slot->result == 0 && pf->lim > slot->ofs)
+			pf->lim= slot->ofs;
+		if (slot->result < 0) {
+			userp_diag_setf(&env->err, USERP_ESYS, "read() failed: " USERP_DIAG_CSTR1, strerror((int) -slot->result));
+			return false;
+		}
+		if (slot->result > 0) {
+			part.buf= slot->buf;
+			part.data= slot->buf->data;
+			part.len= slot->result;
+			part.ofs= str->part_count? str->parts[str->part_count-1].ofs + str->parts[str->part_count-1].len : 0;
+			if (!userp_bstr_append_parts(str, &part, 1))
+				return false;
+			got += part.len;
+		}
+		// The bstr holds its own reference now; the slot is free for the next block
+		userp_drop_buffer(slot->buf);
+		slot->buf= NULL;
+		if (pf->threaded) pthread_mutex_lock(&pf->mutex);
+		slot->state= PREFETCH_IDLE;
+		if (pf->threaded) pthread_mutex_unlock(&pf->mutex);
+		pf->head= (pf->head + 1) % pf->depth;
+		pf->queued--;
+	}
+	// Keep the device busy while the decoder works on what it just got
+	return prefetch_submit(pf);
+}
+
+#endif
+
+#ifdef UNIT_TEST
+
+#if HAVE_POSIX_FILES && HAVE_PTHREAD
+
+static FILE* test_prefetch_file(size_t len) {
+	FILE *f= tmpfile();
+	uint8_t block[4096];
+	size_t i, n;
+	for (i= 0; i < len; i += n) {
+		n= len - i < sizeof(block)? len - i : sizeof(block);
+		for (size_t j= 0; j < n; j++)
+			block[j]= (uint8_t)((i + j) * 7 + ((i + j) >> 12));
+		if (fwrite(block, 1, n, f) != n) abort();
+	}
+	fflush(f);
+	return f;
+}
+
+UNIT_TEST(prefetch_reader) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	FILE *f= test_prefetch_file(100000);
+	struct userp_prefetch *pf;
+	struct userp_bstr str;
+	size_t i, j, pos, total, mismatch;
+	int mode;
+	for (mode= 0; mode < 2; mode++) {
+		pf= userp_new_prefetch_reader(env, fileno(f), 10, -1, 16384, 4, mode? USERP_PREFETCH_THREAD : 0);
+		userp_bstr_init(&str, env);
+		total= 0;
+		while (userp_prefetch_read(pf, &str, 1000, env)) {}
+		printf("%s: eof=%d parts=%d", mode? "thread" : "default", env->err.code == USERP_EFEEDME, (int) str.part_count);
+		for (i= 0, pos= 10, mismatch= 0; i < str.part_count; i++) {
+			for (j= 0; j < str.parts[i].len; j++, pos++)
+				if (str.parts[i].data[j] != (uint8_t)(pos * 7 + (pos >> 12)))
+					mismatch++;
+			total += str.parts[i].len;
+		}
+		printf(" total=%d mismatch=%d\n", (int) total, (int) mismatch);
+		userp_bstr_destroy(&str);
+		userp_free_prefetch_reader(pf);
+	}
+	// A bounded range stops at its end, and the blocks went back to the pool
+	pf= userp_new_prefetch_reader(env, fileno(f), 0, 20000, 16384, 4, 0);
+	userp_bstr_init(&str, env);
+	if (userp_prefetch_read(pf, &str, 20000, env))
+		printf("range: parts=%d len=%d+%d pooled=%d\n", (int) str.part_count, (int) str.parts[0].len,
+			(int) str.parts[1].len, env->buffer_pool_count);
+	userp_bstr_destroy(&str);
+	userp_free_prefetch_reader(pf);
+	fclose(f);
+	userp_drop_env(env);
+}
+/*OUTPUT
+default: eof=1 parts=7 total=99990 mismatch=0
+thread: eof=1 parts=7 total=99990 mismatch=0
+range: parts=2 len=16384\+3616 pooled=\d+
+*/
+
+static double test_prefetch_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Read a generated file with a synchronous read() reader, then with the prefetch reader in each
+ * backend.  A checksum over every byte stands in for the decoder's work, so the prefetch modes
+ * can overlap it with I/O.  The page cache is dropped before each pass where possible, so the
+ * numbers reflect the device.  Args: size in MiB (default 64), and optionally a path on the
+ * device to test (default is a tmpfile).
+ */
+UNIT_TEST(bench_prefetch_reader) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	size_t mb= argc > 0? atoi(argv[0]) : 64, len= mb << 20, i, total;
+	FILE *f= argc > 1? fopen(argv[1], "w+") : tmpfile();
+	struct userp_fd_reader *rd;
+	struct userp_prefetch *pf;
+	struct userp_bstr str;
+	uint64_t sum[3];
+	double t[3], start;
+	int mode, uring= 0;
+	uint8_t block[1<<16];
+	if (!f) { perror("fopen"); abort(); }
+	for (i= 0; i < sizeof(block); i++)
+		block[i]= (uint8_t)(i * 7);
+	for (i= 0; i < len; i += sizeof(block))
+		if (fwrite(block, 1, sizeof(block), f) != sizeof(block)) abort();
+	fflush(f);
+	fsync(fileno(f));
+	for (mode= 0; mode < 3; mode++) {
+		posix_fadvise(fileno(f), 0, 0, POSIX_FADV_DONTNEED);
+		lseek(fileno(f), 0, SEEK_SET);
+		start= test_prefetch_now();
+		rd= NULL; pf= NULL;
+		if (mode == 0)
+			rd= userp_new_fd_reader(env, fileno(f), 1<<20);
+		else
+			pf= userp_new_prefetch_reader(env, fileno(f), 0, -1, 1<<20, 8, mode == 2? USERP_PREFETCH_THREAD : 0);
+		if (mode == 1)
+			uring= userp_prefetch_using_uring(pf);
+		userp_bstr_init(&str, env);
+		sum[mode]= 0;
+		total= 0;
+		while (rd? userp_fd_read(rd, &str, 1<<20, env) : userp_prefetch_read(pf, &str, 1<<20, env)) {
+			// "decode" the new parts, then release them like a decoder would
+			for (i= 0; i < str.part_count; i++) {
+				const uint8_t *p= str.parts[i].data, *lim= p + str.parts[i].len;
+				for (; p < lim; p++)
+					sum[mode]= sum[mode] * 31 + *p;
+				total += str.parts[i].len;
+			}
+			userp_bstr_partalloc(&str, 0);
+		}
+		userp_bstr_destroy(&str);
+		if (rd) userp_free_fd_reader(rd);
+		if (pf) userp_free_prefetch_reader(pf);
+		t[mode]= test_prefetch_now() - start;
+		if (total != len)
+			printf("mode %d read %d of %d bytes\n", mode, (int) total, (int) len);
+	}
+	printf("read(): %.0f MB/sec\n", mb / t[0]);
+	printf("prefetch %s: %.0f MB/sec\n", uring? "io_uring" : "default (no io_uring)", mb / t[1]);
+	printf("prefetch thread: %.0f MB/sec\n", mb / t[2]);
+	printf("checksums %s\n", sum[0] == sum[1] && sum[1] == sum[2]? "match" : "differ");
+	fclose(f);
+	if (argc > 1) unlink(argv[1]);
+	userp_drop_env(env);
+}
+/*OUTPUT
+read\(\): \d+ MB/sec
+prefetch (io_uring|default \(no io_uring\)): \d+ MB/sec
+prefetch thread: \d+ MB/sec
+checksums match
+*/
+
+#endif
+
+#endif
@@ -41,6 +41,7 @@ other libuserp objects.
 static struct scope_import* scope_import_new(userp_scope dst, userp_scope src);
 static void scope_import_free(struct scope_import *imp);
 static void userp_free_scope(userp_scope scope);
+static void scope_flat_free(userp_env env, struct scope_flat **flat);
 
 // Scope Table and Type Table implementations are split into separate files
 // for readability, but are part of the same compilation unit.
@@ -130,6 +131,20 @@ static void userp_free_scope(userp_scope scope) {
 			USERP_FREE(env, &scope->symtable.symbols);
 		userp_bstr_destroy(&scope->symtable.chardata);
 	}
+	if (scope->has_types) {
+		if (scope->typetable.types)
+			USERP_FREE(env, &scope->typetable.types);
+		if (scope->typetable.name_index)
+			USERP_FREE(env, &scope->typetable.name_index);
+		userp_bstr_destroy(&scope->typetable.typeobjects);
+		userp_bstr_destroy(&scope->typetable.typedata);
+	}
+	if (scope->phash)
+		USERP_FREE(env, &scope->phash);
+	if (scope->flat_sym && (!parent || scope->flat_sym != parent->flat_sym))
+		scope_flat_free(env, &scope->flat_sym);
+	if (scope->flat_type && (!parent || scope->flat_type != parent->flat_type))
+		scope_flat_free(env, &scope->flat_type);
 	// Free elements of linked list while walking it
 	for (imp= scope->lazyimports; imp; imp= next_imp) {
 		next_imp= imp->next_import;
@@ -188,6 +203,65 @@ bool userp_drop_scope(userp_scope scope) {
 	return false;
 }
 
+/*IMPLDOC
+
+#### scope_flat_build
+
+    if (!scope_flat_build(env, &scope->flat_sym, parent_flat, entries, entry_size, first_id, n)) ...
+
+Build a flattened index mapping absolute IDs to table entries.  It is a two-level radix: a
+directory of pages, each holding `SCOPE_FLAT_PAGE` entry pointers.  The directory is copied from
+the parent's index, which shares every page that the new entries don't touch, and so only the
+page straddling the boundary and the pages of the new entries get allocated.  Since a scope
+holds a reference to its parent, the shared pages live at least as long as the child.
+
+`entries` points to the first of `n` entries of size `entry_size`, which have consecutive IDs
+starting from `first_id`, which must be the first ID after the parent's range.
+
+*/
+
+static bool scope_flat_build(userp_env env, struct scope_flat **flat_out, struct scope_flat *inherit,
+	uint8_t *entries, size_t entry_size, size_t first_id, size_t n
+) {
+	struct scope_flat *flat= NULL;
+	size_t count= first_id + n, page_count= (count + SCOPE_FLAT_PAGE - 1) >> SCOPE_FLAT_BITS,
+		own_from= !inherit? 0 : n? first_id >> SCOPE_FLAT_BITS : page_count, i, id;
+	// (an empty root scope needs no index at all, and a scope adding nothing shares its parent's)
+
+	assert(!inherit || inherit->count == first_id);
+	if (!USERP_ALLOC_OBJPLUS(env, &flat, page_count * sizeof(flat->pages[0])))
+		return false;
+	flat->count= count;
+	flat->page_count= page_count;
+	flat->own_from= own_from;
+	flat->own_pages= NULL;
+	if (own_from < page_count) {
+		if (!USERP_ALLOC_ARRAY(env, &flat->own_pages, ((page_count - own_from) << SCOPE_FLAT_BITS))) {
+			USERP_FREE(env, &flat);
+			return false;
+		}
+		bzero(flat->own_pages, ((page_count - own_from) << SCOPE_FLAT_BITS) * sizeof(void*));
+		for (i= own_from; i < page_count; i++)
+			flat->pages[i]= flat->own_pages + ((i - own_from) << SCOPE_FLAT_BITS);
+	}
+	if (inherit) {
+		memcpy(flat->pages, inherit->pages, own_from * sizeof(flat->pages[0]));
+		// The parent's final page is partially filled, and needs copied if this scope extends it
+		if (own_from < inherit->page_count)
+			memcpy(flat->pages[own_from], inherit->pages[own_from], SCOPE_FLAT_PAGE * sizeof(void*));
+	}
+	for (i= 0, id= first_id; i < n; i++, id++)
+		flat->pages[id >> SCOPE_FLAT_BITS][id & (SCOPE_FLAT_PAGE-1)]= entries + i * entry_size;
+	*flat_out= flat;
+	return true;
+}
+
+static void scope_flat_free(userp_env env, struct scope_flat **flat) {
+	if ((*flat)->own_pages)
+		USERP_FREE(env, &(*flat)->own_pages);
+	USERP_FREE(env, flat);
+}
+
 /*APIDOC
 
 #### userp_scope_finalize
@@ -199,8 +273,23 @@ This marks the scope 'final', preventing further changes to the symbol table and
 Once finalized, a scope can be used as a parent context for new scopes, and can be used as a
 source of type imports for other scopes.
 
-No flags are currently defined, but there may be future options to re-allocate any "loose"
-data structures to be more ticktly packed, etc.
+Flags:
+
+  * `USERP_PERFECT_HASH` - build a minimal perfect hash of every symbol visible from this
+    scope (including inherited ones) so that `userp_scope_get_symbol` resolves any name with
+    one probe and one compare.  This costs roughly 18 bytes per symbol, and is worthwhile for
+    long-lived scopes that see many lookups, or that are nested several levels deep.
+
+Finalizing also compiles the decode plan of every type (see "Decode Plans"), and fails if any
+type can't be compiled, such as a record whose static field has a variable-length type.
+
+Finalizing also builds a flattened index of every symbol and type ID visible from the scope,
+so that resolving an ID (such as `userp_scope_get_symbol_str`) takes constant time no matter
+how deeply the scope is nested.  Pages of the index are shared with the parent scope, so the
+cost is roughly 8 bytes per new ID plus one pointer per 256 inherited IDs.
+
+There may be future options to re-allocate any "loose" data structures to be more tightly
+packed, etc.
 
 Any errors are reported via the scope's `userp_env`.
 
@@ -212,9 +301,46 @@ bool userp_scope_finalize(userp_scope scope, int flags) {
 	//   then walk the tree copying each symbol into the new buffer,
 	//   then replace the vector with a new vector of sorted elements,
 	//   then free the tree and the old vector.
+	struct scope_flat *sym_inherit= scope->parent? scope->parent->flat_sym : NULL,
+		*type_inherit= scope->parent? scope->parent->flat_type : NULL,
+		*flat_sym= sym_inherit, *flat_type= type_inherit;
 	// TODO: make sure there aren't incomplete type definitions
+	if (!scope->is_final) {
+		// Build the flattened ID indexes, so that resolving an ID doesn't depend on nesting depth.
+		// A scope that adds nothing shares the parent's index.  They are only attached to the
+		// scope once finalizing can't fail, since lookups trust them over the live tables.
+		if (scope->has_symbols && !scope_flat_build(scope->env, &flat_sym, sym_inherit,
+			(uint8_t*)(scope->symtable.symbols + 1), sizeof(struct symbol_entry),
+			scope->symtable.id_offset + 1, scope->symtable.used - 1)
+		)
+			goto fail;
+		if (scope->has_types && !scope_flat_build(scope->env, &flat_type, type_inherit,
+			(uint8_t*) scope->typetable.types, sizeof(struct type_entry),
+			scope->typetable.id_offset, scope->typetable.used)
+		)
+			goto fail;
+		// Compile the decode plan of every type, which also verifies that they are complete.
+		if (scope->has_types && !scope_compile_plans(scope, scope->typetable.used))
+			goto fail;
+	}
+	// The hash is built last, because it answers userp_scope_get_symbol and must not be left
+	// behind if finalizing fails and the scope goes on adding symbols.
+	if ((flags & USERP_PERFECT_HASH) && !userp_scope_build_phash(scope))
+		goto fail;
+	if (!scope->is_final) {
+		scope->flat_sym= flat_sym;
+		scope->flat_type= flat_type;
+	}
 	scope->is_final= 1;
 	return true;
+
+	CATCH(fail) {
+		if (flat_sym != sym_inherit)
+			scope_flat_free(scope->env, &flat_sym);
+		if (flat_type != type_inherit)
+			scope_flat_free(scope->env, &flat_type);
+	}
+	return false;
 }
 
 /*APIDOC
@@ -434,6 +560,13 @@ static void dump_scope(userp_scope scope) {
 			: scope->symtable_stack[scope->symtable_count-1]->id_offset
 			+ scope->symtable_stack[scope->symtable_count-1]->used - 1 )
 	);
+	if (scope->phash)
+		printf("  perfect hash: %d symbols, %d buckets (%lld bytes)\n",
+			(int)scope->phash->slot_count,
+			(int)scope->phash->bucket_count,
+			(long long)( scope->phash->slot_count * sizeof(struct scope_phash_slot)
+				+ scope->phash->bucket_count * sizeof(*scope->phash->disp) )
+		);
 	if (scope->has_symbols) {
 		printf("   local table: %d-%d %s (%lld vector bytes)\n",
 			(int)scope->symtable.id_offset,
@@ -443,7 +576,14 @@ static void dump_scope(userp_scope scope) {
 				: "partially indexed",
 			(long long)(scope->symtable.alloc * sizeof(scope->symtable.symbols[0]))
 		);
-		if (scope->symtable.buckets) {
+		if (scope->symtable.buckets && scope->symtable.is_swiss) {
+			printf("    swisstable: %d/%d (%lld table bytes)\n",
+				(int)scope->symtable.bucket_used,
+				(int)scope->symtable.bucket_alloc,
+				(long long) SWISS_ALLOC_SIZE(scope->symtable.bucket_alloc)
+			);
+		}
+		else if (scope->symtable.buckets) {
 			printf("      hashtree: %d/%d+%d (%lld table bytes, %lld node bytes)\n",
 				(int)scope->symtable.bucket_used,
 				(int)scope->symtable.bucket_alloc,
@@ -617,4 +757,556 @@ ref 0110111111 = NULL
 ref 1101111111 = NULL
 */
 
+UNIT_TEST(scope_flat_index) {
+	// Symbol counts chosen to land on, before, and after the page boundaries, plus an empty scope
+	static const int counts[]= { 255, 1, 0, 300, 512, 7 };
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scopes[6], child;
+	char buf[32];
+	int i, j, id= 0, failures= 0;
+	const char *str;
+	for (i= 0; i < 6; i++) {
+		scopes[i]= userp_new_scope(env, i? scopes[i-1] : NULL);
+		for (j= 0; j < counts[i]; j++) {
+			snprintf(buf, sizeof(buf), "s%d.%d", i, j);
+			userp_scope_get_symbol(scopes[i], buf, USERP_CREATE);
+		}
+		// A few types, filled in directly since there is no API to define them yet
+		if (i & 1) {
+			scope_typetable_alloc(scopes[i], 3);
+			bzero(scopes[i]->typetable.types, 3 * sizeof(struct type_entry));
+			scopes[i]->typetable.used= 3;
+			scopes[i]->type_count += 3;
+		}
+		userp_scope_finalize(scopes[i], 0);
+	}
+	// The non-final child resolves inherited IDs through the parent's index
+	child= userp_new_scope(env, scopes[5]);
+	userp_scope_get_symbol(child, "c.0", USERP_CREATE);
+	for (i= 0; i < 6; i++) {
+		for (j= 0; j < counts[i]; j++) {
+			snprintf(buf, sizeof(buf), "s%d.%d", i, j);
+			++id;
+			str= userp_scope_get_symbol_str(scopes[5], id);
+			if (!str || strcmp(str, buf) != 0
+				|| userp_scope_get_symbol_str(child, id) != str
+				|| userp_scope_get_symbol_str(scopes[i], id) != str
+				|| (i < 5 && userp_scope_get_symbol_str(scopes[i], id + counts[i] + 1) != NULL)
+			) {
+				printf("wrong symbol %d (%s)\n", id, buf);
+				++failures;
+			}
+		}
+	}
+	printf("symbols: %d, last: %s, past end: %s, zero: %s\n", id,
+		userp_scope_get_symbol_str(child, id+1),
+		userp_scope_get_symbol_str(scopes[5], id+1)? "found" : "NULL",
+		userp_scope_get_symbol_str(scopes[5], 0)? "found" : "NULL");
+	for (i= 1; i <= 10; i++) {
+		struct type_entry *t= userp_scope_get_type_entry(child, i);
+		j= (i - 1) / 3 * 2 + 1; // scope 1, 3, 5 define types 1-3, 4-6, 7-9
+		if (i <= 9? (t != scopes[j]->typetable.types + (i - 1) % 3 || t != userp_scope_get_type_entry(scopes[j], i)) : t != NULL) {
+			printf("wrong type %d\n", i);
+			++failures;
+		}
+	}
+	printf("shared: %d %d\n", scopes[2]->flat_sym == scopes[1]->flat_sym, scopes[2]->flat_type == scopes[1]->flat_type);
+	printf("failures: %d\n", failures);
+	userp_drop_scope(child);
+	for (i= 5; i >= 0; i--)
+		userp_drop_scope(scopes[i]);
+	userp_drop_env(env);
+}
+/*OUTPUT
+symbols: 1075, last: c.0, past end: NULL, zero: NULL
+shared: 1 1
+failures: 0
+*/
+
+/* Resolve every symbol ID from the innermost of a chain of nested scopes, for several nesting
+ * depths.  Pass a depth as the first argument to test only that one, and a number of rounds
+ * as the second.
+ */
+UNIT_TEST(bench_scope_flat_depth) {
+	static const int default_depths[]= { 1, 10, 40 };
+	int depths[3], n_depths, d, depth, i, r, rounds= argc > 1? atoi(argv[1]) : 100, failures= 0;
+	size_t total;
+	char buf[32];
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope *scopes;
+	clock_t t0;
+	double sec;
+	if (argc > 0) {
+		depths[0]= atoi(argv[0]);
+		n_depths= 1;
+	} else {
+		memcpy(depths, default_depths, sizeof(depths));
+		n_depths= 3;
+	}
+	for (d= 0; d < n_depths; d++) {
+		depth= depths[d];
+		scopes= malloc(sizeof(userp_scope) * depth);
+		// Keep the total number of symbols the same, regardless of depth
+		for (i= 0; i < depth; i++) {
+			scopes[i]= userp_new_scope(env, i? scopes[i-1] : NULL);
+			for (r= 0; r < 4000 / depth; r++) {
+				snprintf(buf, sizeof(buf), "d%d.%d", i, r);
+				userp_scope_get_symbol(scopes[i], buf, USERP_CREATE);
+			}
+			userp_scope_finalize(scopes[i], 0);
+		}
+		total= scopes[depth-1]->symbol_count;
+		t0= clock();
+		for (r= 0; r < rounds; r++)
+			for (i= 1; i <= total; i++)
+				if (!userp_scope_get_symbol_str(scopes[depth-1], i))
+					++failures;
+		sec= (double)(clock() - t0) / CLOCKS_PER_SEC;
+		printf("depth %3d: %5.1f ns/lookup\n", depth, sec * 1e9 / ((double) rounds * total));
+		for (i= depth-1; i >= 0; i--)
+			userp_drop_scope(scopes[i]);
+		free(scopes);
+	}
+	printf("failures: %d\n", failures);
+	userp_drop_env(env);
+}
+/*OUTPUT
+depth +\d+: +[0-9.]+ ns/lookup
+depth +\d+: +[0-9.]+ ns/lookup
+depth +\d+: +[0-9.]+ ns/lookup
+failures: 0
+*/
+
+// Insert a named entry directly, without encoding a type table
+static userp_type test_add_named_type(userp_scope scope, const char *name) {
+	struct type_entry *t;
+	if (!scope_typetable_alloc(scope, scope->typetable.used + 1))
+		return 0;
+	t= scope->typetable.types + scope->typetable.used;
+	bzero(t, sizeof(*t));
+	t->name= userp_scope_get_symbol(scope, name, USERP_CREATE);
+	scope->type_count++;
+	return scope->typetable.id_offset + scope->typetable.used++;
+}
+
+UNIT_TEST(scope_type_by_name) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope outer= userp_new_scope(env, NULL), inner, empty;
+	userp_type foo, bar, foo2, baz;
+	char buf[16];
+	int i, failures= 0;
+	foo= test_add_named_type(outer, "Foo");
+	bar= test_add_named_type(outer, "Bar");
+	for (i= 0; i < 100; i++) {
+		snprintf(buf, sizeof(buf), "T%d", i);
+		test_add_named_type(outer, buf);
+	}
+	userp_scope_finalize(outer, 0);
+	inner= userp_new_scope(env, outer);
+	printf("Foo=%d Bar=%d Baz=%d\n",
+		(int) userp_scope_type_by_name(inner, "Foo", 0),
+		(int) userp_scope_type_by_name(inner, "Bar", 0),
+		(int) userp_scope_type_by_name(inner, "Baz", 0));
+	printf("local Foo=%d\n", (int) userp_scope_type_by_name(inner, "Foo", USERP_GET_LOCAL));
+	// Define types in the inner scope after "Foo" was cached from the outer
+	foo2= test_add_named_type(inner, "Foo");
+	baz= test_add_named_type(inner, "Baz");
+	printf("Foo=%d Bar=%d Baz=%d\n",
+		(int) userp_scope_type_by_name(inner, "Foo", 0),
+		(int) userp_scope_type_by_name(inner, "Bar", 0),
+		(int) userp_scope_type_by_name(inner, "Baz", 0));
+	printf("local Foo=%d Bar=%d\n",
+		(int) userp_scope_type_by_name(inner, "Foo", USERP_GET_LOCAL),
+		(int) userp_scope_type_by_name(inner, "Bar", USERP_GET_LOCAL));
+	printf("outer Foo=%d\n", (int) userp_scope_type_by_name(outer, "Foo", 0));
+	if (userp_scope_type_by_name(outer, "Foo", 0) != foo || userp_scope_type_by_name(inner, "Bar", 0) != bar
+		|| userp_scope_type_by_name(inner, "Foo", 0) != foo2 || userp_scope_type_by_name(inner, "Baz", 0) != baz)
+		++failures;
+	for (i= 0; i < 100; i++) {
+		snprintf(buf, sizeof(buf), "T%d", i);
+		if (userp_scope_type_by_name(inner, buf, 0) != i + 3)
+			++failures;
+		if (userp_scope_get_type(inner, userp_scope_get_symbol(inner, buf, 0), 0) != i + 3)
+			++failures;
+	}
+	printf("failures: %d\n", failures);
+	// A scope whose type table is present but empty has no name index
+	empty= userp_new_scope(env, NULL);
+	userp_scope_get_symbol(empty, "Foo", USERP_CREATE);
+	if (userp_scope_parse_types(empty, &(struct userp_bstr_part){ .len= 0 }, 1, 0, 0))
+		printf("empty Foo=%d local Foo=%d\n",
+			(int) userp_scope_type_by_name(empty, "Foo", 0),
+			(int) userp_scope_type_by_name(empty, "Foo", USERP_GET_LOCAL));
+	userp_drop_scope(empty);
+	userp_drop_scope(inner);
+	userp_drop_scope(outer);
+	userp_drop_env(env);
+}
+/*OUTPUT
+Foo=1 Bar=2 Baz=0
+local Foo=0
+Foo=103 Bar=2 Baz=104
+local Foo=103 Bar=0
+outer Foo=1
+failures: 0
+empty Foo=0 local Foo=0
+*/
+
+/* Look up types by name in a scope with a large number of types.  Pass the number of types
+ * as the first argument, and a number of rounds as the second.
+ */
+UNIT_TEST(bench_scope_type_by_name) {
+	int n= argc > 0? atoi(argv[0]) : 20000, rounds= argc > 1? atoi(argv[1]) : 20, i, r, failures= 0;
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope outer= userp_new_scope(env, NULL), middle, inner;
+	userp_symbol *syms= malloc(sizeof(userp_symbol) * n);
+	char buf[32];
+	clock_t t0;
+	double sec;
+	// Most types are in the outer scope, with a few in each nested scope
+	for (i= 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "Type%d", i);
+		test_add_named_type(outer, buf);
+	}
+	userp_scope_finalize(outer, USERP_PERFECT_HASH);
+	middle= userp_new_scope(env, outer);
+	test_add_named_type(middle, "Middle");
+	userp_scope_finalize(middle, USERP_PERFECT_HASH);
+	inner= userp_new_scope(env, middle);
+	test_add_named_type(inner, "Inner");
+	userp_scope_finalize(inner, USERP_PERFECT_HASH);
+	for (i= 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "Type%d", i);
+		syms[i]= userp_scope_get_symbol(inner, buf, 0);
+	}
+	// Spread across all names, so the cache rarely hits
+	t0= clock();
+	for (r= 0; r < rounds; r++)
+		for (i= 0; i < n; i++)
+			if (userp_scope_get_type(inner, syms[(i * 7919) % n], 0) != (i * 7919) % n + 1)
+				++failures;
+	sec= (double)(clock() - t0) / CLOCKS_PER_SEC;
+	printf("%d types, by symbol:   %6.1f ns/lookup\n", n, sec * 1e9 / ((double) rounds * n));
+	// Repeatedly the same few names
+	t0= clock();
+	for (r= 0; r < rounds; r++)
+		for (i= 0; i < n; i++)
+			if (userp_scope_get_type(inner, syms[i & 7], 0) != (i & 7) + 1)
+				++failures;
+	sec= (double)(clock() - t0) / CLOCKS_PER_SEC;
+	printf("%d types, cached:      %6.1f ns/lookup\n", n, sec * 1e9 / ((double) rounds * n));
+	t0= clock();
+	for (r= 0; r < rounds; r++)
+		for (i= 0; i < n; i++) {
+			snprintf(buf, sizeof(buf), "Type%d", (i * 7919) % n);
+			if (userp_scope_type_by_name(inner, buf, 0) != (i * 7919) % n + 1)
+				++failures;
+		}
+	sec= (double)(clock() - t0) / CLOCKS_PER_SEC;
+	printf("%d types, by name:     %6.1f ns/lookup (including snprintf)\n", n, sec * 1e9 / ((double) rounds * n));
+	printf("failures: %d\n", failures);
+	free(syms);
+	userp_drop_scope(inner);
+	userp_drop_scope(middle);
+	userp_drop_scope(outer);
+	userp_drop_env(env);
+}
+/*OUTPUT
+\d+ types, by symbol: +[0-9.]+ ns/lookup
+\d+ types, cached: +[0-9.]+ ns/lookup
+\d+ types, by name: +[0-9.]+ ns/lookup .*
+failures: 0
+*/
+
+static void test_tt_vqty(struct test_typetable *tt, size_t v) {
+	tt->len= userp_encode_vqty(tt->buf + tt->len, v) - tt->buf;
+}
+static void test_tt_put(struct test_typetable *tt, int n, ...) {
+	va_list ap;
+	va_start(ap, n);
+	while (n-- > 0)
+		test_tt_vqty(tt, va_arg(ap, size_t));
+	va_end(ap);
+}
+
+static void test_build_typetable(struct test_typetable *tt, userp_scope scope) {
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	#define T(id) ((size_t)(id) << 1)
+	tt->len= 0;
+	// 1: Int8, bits + min
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3) + (1<<5), S("Int8"), 8, TEST_SIGNED(-128));
+	// 2: Color, seldom names
+	TT(TYPEDEF_INTEGER_SELBASE + 1, 1, TYPEDEF_INT_SELDOM_NAMES, S("Color"),
+		3, S("red"), TEST_SIGNED(0), S("green"), TEST_SIGNED(1), S("blue"), TEST_SIGNED(1));
+	// 3: SmallColor, parent Color + bits
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<1) + (1<<3), S("SmallColor"), T(2), 2);
+	// 4: MaybeInt, option of type Int8 merged, and the value 5 of Int8
+	TT(TYPEDEF_CHOICE_SELBASE + (1<<2), S("MaybeInt"), 2,
+		TYPEDEF_CHOICE_OPT_MERGE, T(1), 0, 10,
+		TYPEDEF_CHOICE_OPT_VALUE, T(1), 1);
+	tt->buf[tt->len++]= 0x05;
+	// 5: Bytes, array of Int8 with 1 dimension given in the data
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2) + (1<<4), S("Bytes"), T(1), 1, 0);
+	// 6: Matrix, parent Bytes with 2 fixed dimensions
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<1) + (1<<4), S("Matrix"), T(5), 2, 3, 3);
+	// 7: Point, two static fields in 16 bits
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), S("Point"), 16, 2,
+		S("x"), T(1), (0<<2)|FIELD_PLACEMENT_STATIC,
+		S("y"), T(1), (8<<2)|FIELD_PLACEMENT_STATIC);
+	// 8: AlignedPoint, parent Point with seldom align
+	TT(TYPEDEF_RECORD_SELBASE + 1 + (1<<1), 1, TYPEDEF_RECORD_SELDOM_ALIGN, S("AlignedPoint"), T(7), 4);
+	// 9: Node, refers to itself
+	TT(TYPEDEF_RECORD_SELBASE + (1<<3), S("Node"), 2,
+		S("value"), T(1), FIELD_PLACEMENT_ALWAYS,
+		S("next"), T(9), FIELD_PLACEMENT_OFTEN);
+	// 10-12: Any, Symref, Typeref
+	TT(TYPEDEF_ANY_SELBASE, S("Anything"));
+	TT(TYPEDEF_SYMREF_SELBASE + 1, 1, TYPEDEF_BASIC_SELDOM_PAD, S("Sym"), 2);
+	TT(TYPEDEF_TYPEREF_SELBASE, S("Type"));
+	#undef S
+	#undef T
+}
+
+static void test_dump_types(userp_scope scope) {
+	struct type_entry *t;
+	userp_type i;
+	size_t j;
+	for (i= 1; i <= scope->type_count; i++) {
+		t= userp_scope_get_type_entry(scope, i);
+		printf("%d %s class=%d parent=%d", (int) i, userp_scope_get_symbol_str(scope, t->name),
+			(int) t->typeclass, (int) t->parent);
+		switch (t->typeclass) {
+		case TYPE_CLASS_INT: {
+			struct userp_type_int *ti= (struct userp_type_int*) t->typeobj;
+			if (ti->has_bits) printf(" bits=%d", ti->bits);
+			if (ti->has_min) printf(" min=%d", (int) ti->min);
+			for (j= 0; j < ti->name_count; j++)
+				printf(" %s=%d", userp_scope_get_symbol_str(scope, ti->names[j].name), (int) ti->names[j].value);
+			break;
+		}
+		case TYPE_CLASS_CHOICE: {
+			struct userp_type_choice *tc= (struct userp_type_choice*) t->typeobj;
+			for (j= 0; j < tc->option_count; j++)
+				if (tc->options[j].is_value)
+					printf(" (%d value %d bytes %02X)", (int) tc->options[j].type,
+						(int) tc->options[j].value_len, tc->options[j].value[0]);
+				else
+					printf(" (%d merge %d+%d)", (int) tc->options[j].type,
+						(int) tc->options[j].merge_ofs, (int) tc->options[j].merge_count);
+			break;
+		}
+		case TYPE_CLASS_ARRAY: {
+			struct userp_type_array *ta= (struct userp_type_array*) t->typeobj;
+			printf(" elem=%d dims=", (int) ta->elem_type);
+			for (j= 0; j < ta->dimension_count; j++)
+				printf("%s%d", j? "x" : "", (int) ta->dimensions[j]);
+			break;
+		}
+		case TYPE_CLASS_RECORD: {
+			struct userp_type_record *tr= (struct userp_type_record*) t->typeobj;
+			printf(" static_bits=%d align=%d counts=%d/%d/%d/%d", (int) tr->static_bits, tr->align,
+				(int) tr->static_field_count, (int) tr->always_field_count,
+				(int) tr->often_field_count, (int) tr->seldom_field_count);
+			for (j= 0; j < tr->field_count; j++)
+				printf(" %s:%d", userp_scope_get_symbol_str(scope, tr->fields[j].name), (int) tr->fields[j].type);
+			break;
+		}
+		default:
+			printf(" pad=%d", ((struct userp_type_basic*) t->typeobj)->pad);
+		}
+		printf("\n");
+	}
+}
+
+UNIT_TEST(scope_parse_types) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope syms= userp_new_scope(env, NULL), scope;
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part parts[2];
+	size_t i;
+	int failures= 0;
+	// Symbols come from a parent scope, so that each child can parse the same table
+	test_build_typetable(tt, syms);
+	userp_scope_finalize(syms, 0);
+	scope= userp_new_scope(env, syms);
+	parts[0]= (struct userp_bstr_part){ .data= tt->buf, .len= tt->len };
+	printf("parse: %d\n", (int) userp_scope_parse_types(scope, parts, 1, 0, 0));
+	test_dump_types(scope);
+	printf("Matrix=%d\n", (int) userp_scope_type_by_name(scope, "Matrix", 0));
+	userp_drop_scope(scope);
+	// Split the input at every position
+	for (i= 0; i <= tt->len; i++) {
+		scope= userp_new_scope(env, syms);
+		parts[0]= (struct userp_bstr_part){ .data= tt->buf, .len= i };
+		parts[1]= (struct userp_bstr_part){ .data= tt->buf + i, .len= tt->len - i };
+		if (!userp_scope_parse_types(scope, parts, 2, 12, 0) || scope->type_count != 12)
+			++failures;
+		userp_drop_scope(scope);
+	}
+	printf("split failures: %d\n", failures);
+	free(tt);
+	userp_drop_scope(syms);
+	userp_drop_env(env);
+}
+/*OUTPUT
+parse: 1
+1 Int8 class=2 parent=0 bits=8 min=-128
+2 Color class=2 parent=0 red=0 green=1 blue=2
+3 SmallColor class=2 parent=2 bits=2 red=0 green=1 blue=2
+4 MaybeInt class=5 parent=0 \(1 merge 0\+10\) \(1 value 1 bytes 05\)
+5 Bytes class=6 parent=0 elem=1 dims=0
+6 Matrix class=6 parent=5 elem=1 dims=3x3
+7 Point class=7 parent=0 static_bits=16 align=0 counts=2/0/0/0 x:1 y:1
+8 AlignedPoint class=7 parent=7 static_bits=16 align=4 counts=2/0/0/0 x:1 y:1
+9 Node class=7 parent=0 static_bits=0 align=0 counts=0/1/1/0 value:1 next:9
+10 Anything class=1 parent=0 pad=0
+11 Sym class=3 parent=0 pad=2
+12 Type class=4 parent=0 pad=0
+Matrix=6
+split failures: 0
+*/
+
+UNIT_TEST(scope_parse_types_errors) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part= { .data= tt->buf };
+	size_t foo= (size_t) userp_scope_get_symbol(scope, "Foo", USERP_CREATE) << 1,
+		bar= (size_t) userp_scope_get_symbol(scope, "Bar", USERP_CREATE) << 1;
+	bool ok;
+	#define TEST_PARSE(n) (part.len= tt->len, ok= userp_scope_parse_types(scope, &part, 1, n, 0), \
+		printf("parse: %d types: %d\n", (int) ok, (int) scope->type_count))
+	printf("# duplicate name\n");
+	tt->len= 0;
+	TT(TYPEDEF_ANY_SELBASE, foo, TYPEDEF_ANY_SELBASE, foo);
+	TEST_PARSE(0);
+	printf("# forward reference without a count\n");
+	tt->len= 0;
+	TT(TYPEDEF_ARRAY_SELBASE + (1<<2), foo, 2<<1, TYPEDEF_ANY_SELBASE, bar);
+	TEST_PARSE(0);
+	printf("# forward reference with a count\n");
+	TEST_PARSE(2);
+	printf("# parent of a different class\n");
+	tt->len= 0;
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<1), 0, 1<<1);
+	TEST_PARSE(0);
+	printf("# truncated\n");
+	tt->len= 0;
+	TT(TYPEDEF_RECORD_SELBASE + (1<<3), 0, 2, foo, 1<<1, 1);
+	TEST_PARSE(0);
+	printf("# unknown selector\n");
+	tt->len= 0;
+	TT(TYPEDEF_SELECTOR_LIMIT, 0);
+	TEST_PARSE(0);
+	printf("# finalized\n");
+	userp_scope_finalize(scope, 0);
+	tt->len= 0;
+	TT(TYPEDEF_ANY_SELBASE, 0);
+	TEST_PARSE(0);
+	#undef TEST_PARSE
+	free(tt);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+# duplicate name
+error: Type 2 has the same name as a previous type in this scope
+parse: 0 types: 0
+# forward reference without a count
+error: Invalid type reference
+parse: 0 types: 0
+# forward reference with a count
+parse: 1 types: 2
+# parent of a different class
+error: Parent type 1 must be a previously defined type of the same typeclass
+parse: 0 types: 2
+# truncated
+error: Type definition list of 2 elements exceeds end of input
+parse: 0 types: 2
+# unknown selector
+error: Unknown type definition selector 158
+parse: 0 types: 2
+# finalized
+error: Can't add types to a finalized scope
+parse: 0 types: 2
+*/
+
+UNIT_TEST(scope_finalize_fails) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	struct test_typetable *tt= malloc(sizeof(*tt) + 4096);
+	struct userp_bstr_part part= { .data= tt->buf };
+	userp_symbol late;
+	#define S(name) ((size_t) userp_scope_get_symbol(scope, name, USERP_CREATE) << 1)
+	tt->len= 0;
+	// A static field can't hold a variable-length integer, so compiling the plan fails
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<5), S("V"), TEST_SIGNED(0));
+	TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), S("Bad"), 8, 1, S("v"), 1<<1, (0<<2)|FIELD_PLACEMENT_STATIC);
+	#undef S
+	part.len= tt->len;
+	if (!userp_scope_parse_types(scope, &part, 1, 2, 0))
+		printf("parse failed\n");
+	printf("finalize: %d\n", (int) userp_scope_finalize(scope, USERP_PERFECT_HASH));
+	printf("final: %d phash: %s flat: %s %s\n", (int) scope->is_final, scope->phash? "built" : "NULL",
+		scope->flat_sym? "built" : "NULL", scope->flat_type? "built" : "NULL");
+	// The scope is still open, and finds symbols added after the failure
+	late= userp_scope_get_symbol(scope, "Late", USERP_CREATE);
+	printf("Late: %s %s\n", late && userp_scope_get_symbol(scope, "Late", 0) == late? "found" : "missing",
+		userp_scope_get_symbol_str(scope, late));
+	free(tt);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+error: Static field 0 of record must have a fixed-size type
+finalize: 0
+final: 0 phash: NULL flat: NULL NULL
+Late: found Late
+*/
+
+/* Parse a large type table of records.  Pass the number of types as the first argument, and
+ * a number of rounds as the second.
+ */
+UNIT_TEST(bench_scope_parse_types) {
+	int n= argc > 0? atoi(argv[0]) : 20000, rounds= argc > 1? atoi(argv[1]) : 10, i, r, failures= 0;
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope syms= userp_new_scope(env, NULL), scope;
+	struct test_typetable *tt= malloc(sizeof(*tt) + (size_t) n * 32);
+	struct userp_bstr_part part;
+	size_t x= (size_t) userp_scope_get_symbol(syms, "x", USERP_CREATE) << 1,
+		y= (size_t) userp_scope_get_symbol(syms, "y", USERP_CREATE) << 1;
+	char buf[32];
+	clock_t t0;
+	double sec;
+	tt->len= 0;
+	// One integer type, then records with two fields referring to it or a previous record
+	TT(TYPEDEF_INTEGER_SELBASE + (1<<3), (size_t) userp_scope_get_symbol(syms, "Int32", USERP_CREATE) << 1, 32);
+	for (i= 1; i < n; i++) {
+		snprintf(buf, sizeof(buf), "Rec%d", i);
+		TT(TYPEDEF_RECORD_SELBASE + (1<<2) + (1<<3), (size_t) userp_scope_get_symbol(syms, buf, USERP_CREATE) << 1, 64, 2,
+			x, (size_t) 1 << 1, FIELD_PLACEMENT_STATIC,
+			y, (size_t)(i > 1? i - 1 : 1) << 1, (32<<2)|FIELD_PLACEMENT_STATIC);
+	}
+	userp_scope_finalize(syms, 0);
+	part= (struct userp_bstr_part){ .data= tt->buf, .len= tt->len };
+	t0= clock();
+	for (r= 0; r < rounds; r++) {
+		scope= userp_new_scope(env, syms);
+		if (!userp_scope_parse_types(scope, &part, 1, n, 0) || scope->type_count != n)
+			++failures;
+		userp_drop_scope(scope);
+	}
+	sec= (double)(clock() - t0) / CLOCKS_PER_SEC;
+	printf("%d types, %d bytes: %6.1f MB/s, %6.1f ns/type\n", n, (int) tt->len,
+		(double) tt->len * rounds / (sec * 1e6), sec * 1e9 / ((double) rounds * n));
+	printf("failures: %d\n", failures);
+	free(tt);
+	userp_drop_scope(syms);
+	userp_drop_env(env);
+}
+/*OUTPUT
+\d+ types, \d+ bytes: +[0-9.]+ MB/s, +[0-9.]+ ns/type
+failures: 0
+*/
+
 #endif
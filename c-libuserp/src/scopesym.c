@@ -96,7 +96,12 @@ if the hash collisions exceed its size.
 ### Methods
 */
 
-static inline uint32_t userp_symtable_calc_hash(struct userp_symtable *st, const char *name);
+static inline uint32_t userp_symtable_calc_hash(struct userp_symtable *st, const char *name, size_t len);
+static userp_symbol userp_symtable_swiss_get(struct userp_symtable *st, uint32_t hash, const char *name, size_t len);
+
+#if !defined(USERP_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // This handles both the case of limiting symbols to the 2**31 limit imposed by the hash table,
 // and also guards against overflow of size_t for allocations on 32-bit systems.
@@ -199,7 +204,7 @@ static bool scope_symtable_alloc(userp_scope scope, size_t n) {
 
 	// If the bit size of the hashtree is changing, reset it.
 	old_n= st->alloc;
-	if (HASHTREE_BUCKET_SIZE(n) != HASHTREE_BUCKET_SIZE(old_n)) {
+	if (!st->is_swiss && HASHTREE_BUCKET_SIZE(n) != HASHTREE_BUCKET_SIZE(old_n)) {
 		st->processed= 0;
 		st->bucket_alloc= st->bucket_alloc
 			* HASHTREE_BUCKET_SIZE(old_n) / HASHTREE_BUCKET_SIZE(n);
@@ -216,41 +221,66 @@ static bool scope_symtable_alloc(userp_scope scope, size_t n) {
 
     struct userp_symtable *st= &scope->symtable;
     const char *name= ...
-    uint32_t hash= userp_symtable_calc_hash(st, name);
+    uint32_t hash= userp_symtable_calc_hash(st, name, strlen(name));
+
+This calculates the hash for a string of known length.  The algorithm is subject to change, but
+is currently modeled after [wyhash](https://github.com/wangyi-fudan/wyhash), consuming 8 bytes
+per multiply and folding the 128-bit product.  The final partial word is assembled from
+overlapping 4-byte reads (or single bytes) within the string, so nothing beyond it is read.
+On compilers without a 128-bit integer type, the multiply folds a 64-bit product instead.
 
-This calculates the hash for a NUL-terminated string.  The algorithm
-is subject to change, but is currently a munged-up interpretation of
-[MurmurHash32 by Austin Appleby](https://github.com/aappleby/smhasher)
+Only 32 bits of the result are kept because it seems unnecessary to do 64 for symbol tables that
+likely never even cross 16 bit number of entries.  The return value is never zero, since zero
+marks a symbol whose hash has not been calculated yet.
 
-Only 32 bits are used because it seems unnecessary to do 64 for symbol
-tables that likely never even cross 16 bit number of entries.
+The 64-bit core is available as `userp_symtable_calc_hash64(name, len, seed)` for the perfect
+hash (below) which needs more independent bits and the ability to re-seed.  A seed of 0 gives
+the same result that the 32-bit hash folds.
 
 */
-static inline uint32_t userp_symtable_calc_hash(struct userp_symtable *st, const char *name) {
-	// This is mostly MurmurHash32 by Austin Appleby, but I fudged the
-	// implementation a bit since I don't have the key length in advance.
-	uint32_t hash= 0, accum= 0;
-	const char *pos= name;
-	if (*pos) while (1) {
-		accum= (accum << 7) ^ *pos++;
-		if (*pos) accum= (accum << 7) ^ *pos++;
-		if (*pos) accum= (accum << 7) ^ *pos++;
-		if (*pos) accum= (accum << 7) ^ *pos++;
-		accum *= 0xcc9e2d51;
-		accum = (accum << 15) | (accum >> 17);
-		accum *= 0x1b873593;
-		hash ^= accum;
-		if (!*pos) break;
-		hash= (hash << 13) | (hash >> 19);
-		hash= hash * 5 + 0xe6546b64;
+#define SYMBOL_HASH_P0 UINT64_C(0xa0761d6478bd642f)
+#define SYMBOL_HASH_P1 UINT64_C(0xe7037ed1a0b428db)
+#define SYMBOL_HASH_P2 UINT64_C(0x8ebc6af09c88c6e3)
+
+static inline uint64_t userp_symtable_hash_mum(uint64_t a, uint64_t b) {
+	#ifdef __SIZEOF_INT128__
+	__uint128_t r= (__uint128_t) a * b;
+	return (uint64_t) r ^ (uint64_t)(r >> 64);
+	#else
+	uint64_t r= a * b;
+	return r ^ (r >> 29);
+	#endif
+}
+
+static inline uint64_t userp_symtable_calc_hash64(const char *name, size_t len, uint64_t seed) {
+	uint64_t hash= SYMBOL_HASH_P0 ^ seed ^ ((uint64_t) len * SYMBOL_HASH_P1), word;
+	uint32_t hi, lo;
+	const uint8_t *pos= (const uint8_t*) name, *lim= pos + len;
+	size_t rem;
+	while (lim - pos >= 8) {
+		memcpy(&word, pos, 8);
+		hash= userp_symtable_hash_mum(hash ^ word, SYMBOL_HASH_P1);
+		pos += 8;
 	}
-	hash ^= pos - name;
-	hash ^= hash >> 16;
-	hash *= 0x85ebca6b;
-	hash ^= hash >> 13;
-	hash *= 0xc2b2ae35;
-	hash ^= hash >> 16;
-	return hash? hash : 1;
+	// Final 1-7 bytes are read as two overlapping 4-byte words, or 3 single bytes.
+	// (the length was mixed in above, so overlap doesn't cause ambiguity)
+	if ((rem= lim - pos)) {
+		if (rem >= 4) {
+			memcpy(&hi, pos, 4);
+			memcpy(&lo, lim - 4, 4);
+			word= ((uint64_t) hi << 32) | lo;
+		}
+		else
+			word= ((uint64_t) pos[0] << 16) | ((uint64_t) pos[rem >> 1] << 8) | lim[-1];
+		hash= userp_symtable_hash_mum(hash ^ word, SYMBOL_HASH_P2);
+	}
+	return userp_symtable_hash_mum(hash ^ SYMBOL_HASH_P0, SYMBOL_HASH_P2);
+}
+
+static inline uint32_t userp_symtable_calc_hash(struct userp_symtable *st, const char *name, size_t len) {
+	uint64_t hash= userp_symtable_calc_hash64(name, len, 0);
+	hash ^= hash >> 32;
+	return (uint32_t) hash? (uint32_t) hash : 1;
 }
 
 /*IMPLDOC
@@ -259,9 +289,10 @@ static inline uint32_t userp_symtable_calc_hash(struct userp_symtable *st, const
 
     struct userp_symtable *st= &scope->symtable;
 	userp_scope_symtable_hashtree_populate(...);
-    userp_symbol sym= userp_symtable_hashtree_get(st, hash, name);
+    userp_symbol sym= userp_symtable_hashtree_get(st, hash, name, len);
 
-This function looks up the name in the hashtree.  The name and hash are both required. The symbol
+This function looks up the name in the hashtree.  The name, length, and hash are all required.
+Entries are compared by hash, then length, and only then by the bytes of the name. The symbol
 table must be fully 'processed' in advanced.  The userp_symbol returned includes the st->id_offset
 and is ready to be handed to the user.
 
@@ -279,12 +310,14 @@ more before trying again.
 
 */
 
-static userp_symbol userp_symtable_hashtree_get(struct userp_symtable *st, uint32_t hash, const char *name) {
+static userp_symbol userp_symtable_hashtree_get(struct userp_symtable *st, uint32_t hash, const char *name, size_t len) {
 	assert(hash != 0);
 	assert(name != NULL && *name != '\0');
-	return ((st->alloc-1) >> 15)? userp_symtable_hashtree_get31(st, hash, name)
-	     : ((st->alloc-1) >>  7)? userp_symtable_hashtree_get15(st, hash, name)
-	     :                        userp_symtable_hashtree_get7 (st, hash, name);
+	if (st->is_swiss)
+		return userp_symtable_swiss_get(st, hash, name, len);
+	return ((st->alloc-1) >> 15)? userp_symtable_hashtree_get31(st, hash, name, len)
+	     : ((st->alloc-1) >>  7)? userp_symtable_hashtree_get15(st, hash, name, len)
+	     :                        userp_symtable_hashtree_get7 (st, hash, name, len);
 }
 
 static bool userp_symtable_hashtree_insert(struct userp_symtable *st, size_t sym_ofs) {
@@ -307,10 +340,220 @@ static bool userp_symtable_hashtree_walk(
 	     :                        userp_symtable_hashtree_walk7 (st, root_node, from_key, walk_cb, context);
 }
 
+static size_t userp_symtable_hashtree_place(struct userp_symtable *st, size_t from, size_t to) {
+	return ((st->alloc-1) >> 15)? userp_symtable_hashtree_place31(st, from, to)
+	     : ((st->alloc-1) >>  7)? userp_symtable_hashtree_place15(st, from, to)
+	     :                        userp_symtable_hashtree_place7 (st, from, to);
+}
+
+static bool userp_symtable_hashtree_place_collisions(struct userp_symtable *st, size_t from, size_t to) {
+	return ((st->alloc-1) >> 15)? userp_symtable_hashtree_place_collisions31(st, from, to)
+	     : ((st->alloc-1) >>  7)? userp_symtable_hashtree_place_collisions15(st, from, to)
+	     :                        userp_symtable_hashtree_place_collisions7 (st, from, to);
+}
+
 // This handles both the case of limiting tables to 2x the max number of symbols,
 // and also guards against overflow of size_t for allocations on 32-bit systems.
 #define MAX_HASH_BUCKETS (MIN((SIZE_MAX/MAX_HASHTREE_BUCKET_SIZE), MAX_SYMTABLE_ENTRIES*2))
 
+// Batches of at least this many new symbols get added with the bulk algorithm
+#ifndef HASHTREE_BULK_MIN
+#define HASHTREE_BULK_MIN 64
+#endif
+
+/*IMPLDOC
+
+#### userp_scope_symtable_hashtree_bulk_insert
+
+    if (!userp_scope_symtable_hashtree_bulk_insert(st, env)) { ... }
+
+Add all unprocessed symbols to the hashtree at once.  This first calculates any missing hashes in
+one tight loop, then places every symbol that lands in an empty bucket, which counts the
+collisions.  Each collision needs at most two tree nodes, so the node pool can be allocated once
+before inserting the colliding symbols into their trees.  If the symbol vector was allocated with
+its final size (like when `userp_scope_parse_symbols` is given a `sym_count`) then the buckets
+were also sized from the final count, and nothing gets reallocated or rebuilt along the way.
+
+*/
+
+static bool userp_scope_symtable_hashtree_bulk_insert(struct userp_symtable *st, userp_env env) {
+	size_t i, need;
+	for (i= st->processed; i < st->used; i++)
+		if (!st->symbols[i].hash)
+			st->symbols[i].hash= userp_symtable_calc_hash(st, st->symbols[i].name, st->symbols[i].len);
+	// +1 for the sentinel node, if not allocated yet
+	need= (st->node_used? st->node_used : 1)
+		+ 2 * userp_symtable_hashtree_place(st, st->processed, st->used);
+	if (need > st->node_alloc) {
+		if (!userp_alloc(env, &st->nodes, need * HASHTREE_NODE_SIZE(st->alloc), USERP_HINT_DYNAMIC))
+			goto failure;
+		if (!st->node_alloc) {
+			// first node is a sentinel set to zeroes
+			bzero(st->nodes, HASHTREE_NODE_SIZE(st->alloc));
+			st->node_used= 1;
+		}
+		st->node_alloc= need;
+	}
+	if (!userp_symtable_hashtree_place_collisions(st, st->processed, st->used)) {
+		userp_diag_set(&env->err, USERP_EBADSTATE, "userp_scope: symbol table hashtree is corrupt");
+		USERP_DISPATCH_ERR(env);
+		goto failure;
+	}
+	st->processed= st->used;
+	return true;
+
+	CATCH(failure) {
+		// Some symbols were placed but not counted as processed, so force a rebuild next time
+		st->processed= 0;
+	}
+	return false;
+}
+
+/*IMPLDOC
+
+### Swiss Table Index
+
+As an alternative to the hashtree, a symbol table can be indexed with an open-addressing table
+in the style of Abseil's "Swiss Table".  It is selected per-environment with
+
+    userp_env_set_attr(env, USERP_SYMTABLE_INDEX, USERP_SYMTABLE_SWISS);
+    userp_env_set_attr(env, USERP_SYMTABLE_SWISS_MIN, 10000);
+
+and is used for any symbol table holding more than `USERP_SYMTABLE_SWISS_MIN` symbols; smaller
+tables still use the hashtree.  The table re-uses `st->buckets` for one allocation holding a power-of-2 number
+of 32-bit symbol slots followed by the same number of control bytes (plus `SWISS_GROUP` more
+which mirror the first group, so that a group can be loaded at any offset without wrapping).
+A control byte of 0x80 is an empty slot, else it holds the top 7 bits of the symbol's hash.
+Symbols are never removed, so there are no tombstones.
+
+A lookup starts at `hash & mask`, compares the 7-bit tag against a whole group of 16 control
+bytes at once (with SSE2, if available), checks the full hash, length, and name of each
+candidate, and stops at the first group containing an empty slot.  Groups are probed
+triangularly, which visits every group of a power-of-2 table.  The load factor is kept at or
+below 7/8.
+
+*/
+
+#define SWISS_GROUP 16
+#define SWISS_EMPTY 0x80
+#define SWISS_TAG(hash) ((uint8_t)((hash) >> 25))
+#define SWISS_SLOTS(st) ((uint32_t*) (st)->buckets)
+#define SWISS_CTRL(st) ((uint8_t*) (SWISS_SLOTS(st) + (st)->bucket_alloc))
+#define SWISS_ALLOC_SIZE(cap) ((cap) * (sizeof(uint32_t) + 1) + SWISS_GROUP)
+
+static inline unsigned userp_symtable_swiss_match(const uint8_t *group, uint8_t tag) {
+	#if !defined(USERP_NO_SIMD) && defined(__SSE2__)
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), _mm_loadu_si128((const __m128i*) group)));
+	#else
+	unsigned i, mask= 0;
+	for (i= 0; i < SWISS_GROUP; i++)
+		mask |= (unsigned)(group[i] == tag) << i;
+	return mask;
+	#endif
+}
+
+static inline unsigned userp_symtable_swiss_match_empty(const uint8_t *group) {
+	#if !defined(USERP_NO_SIMD) && defined(__SSE2__)
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+	#else
+	unsigned i, mask= 0;
+	for (i= 0; i < SWISS_GROUP; i++)
+		mask |= (unsigned)(group[i] >> 7) << i;
+	return mask;
+	#endif
+}
+
+static userp_symbol userp_symtable_swiss_get(struct userp_symtable *st, uint32_t hash, const char *name, size_t len) {
+	const uint32_t *slots= SWISS_SLOTS(st);
+	const uint8_t *ctrl= SWISS_CTRL(st), tag= SWISS_TAG(hash);
+	size_t mask= st->bucket_alloc - 1, pos= hash & mask, step= 0, i;
+	struct symbol_entry *sym;
+	unsigned match;
+	while (1) {
+		for (match= userp_symtable_swiss_match(ctrl + pos, tag); match; match &= match - 1) {
+			i= (pos + __builtin_ctz(match)) & mask;
+			sym= &st->symbols[slots[i]];
+			if (sym->hash == hash && HASHTREE_NAME_CMP(name, len, *sym) == 0)
+				return st->id_offset + slots[i];
+		}
+		if (userp_symtable_swiss_match_empty(ctrl + pos))
+			return 0;
+		step += SWISS_GROUP;
+		pos= (pos + step) & mask;
+	}
+}
+
+static void userp_symtable_swiss_insert(struct userp_symtable *st, size_t sym_ofs) {
+	uint32_t hash= st->symbols[sym_ofs].hash, *slots= SWISS_SLOTS(st);
+	uint8_t *ctrl= SWISS_CTRL(st);
+	size_t mask= st->bucket_alloc - 1, pos= hash & mask, step= 0, i;
+	unsigned empty;
+	while (!(empty= userp_symtable_swiss_match_empty(ctrl + pos))) {
+		step += SWISS_GROUP;
+		pos= (pos + step) & mask;
+	}
+	i= (pos + __builtin_ctz(empty)) & mask;
+	ctrl[i]= SWISS_TAG(hash);
+	if (i < SWISS_GROUP)
+		ctrl[st->bucket_alloc + i]= ctrl[i];
+	slots[i]= sym_ofs;
+	st->bucket_used++;
+}
+
+/*IMPLDOC
+
+#### userp_scope_symtable_swiss_populate
+
+    if (!userp_scope_symtable_swiss_populate(st, env)) { ... }
+
+Add all new symbols to the swiss table, converting the symbol table from a hashtree or growing
+the swiss table first if needed.  As with the hashtree, the symbol vector's allocated size is
+used as the hint for how large to make the table.
+
+*/
+
+static bool userp_scope_symtable_swiss_populate(struct userp_symtable *st, userp_env env) {
+	size_t cap, i;
+	// Rebuild if converting from hashtree, or if this would exceed 7/8 load
+	if (!st->is_swiss || st->used > st->bucket_alloc - (st->bucket_alloc >> 3)) {
+		cap= roundup_pow2(MAX(st->alloc, st->used) + (MAX(st->alloc, st->used) >> 2));
+		if (cap < SWISS_GROUP * 2)
+			cap= SWISS_GROUP * 2;
+		if (env->log_trace) {
+			userp_diag_setf(&env->msg, USERP_MSG_SYMTABLE_SWISS_ALLOC,
+				"userp_scope: alloc symtable swisstable size=" USERP_DIAG_SIZE
+					" slots=" USERP_DIAG_COUNT
+					" for " USERP_DIAG_POS " symbols",
+				(size_t) SWISS_ALLOC_SIZE(cap), cap, st->used
+			);
+			USERP_DISPATCH_MSG(env);
+		}
+		// The hashtree nodes are not needed anymore
+		if (st->nodes)
+			USERP_FREE(env, &st->nodes);
+		st->node_alloc= st->node_used= 0;
+		userp_alloc(env, &st->buckets, 0, 0);
+		if (!userp_alloc(env, &st->buckets, SWISS_ALLOC_SIZE(cap), 0)) {
+			st->bucket_alloc= 0;
+			st->processed= 0;
+			st->is_swiss= 0;
+			return false;
+		}
+		st->bucket_alloc= cap;
+		st->bucket_used= 0;
+		st->is_swiss= 1;
+		memset(SWISS_CTRL(st), SWISS_EMPTY, cap + SWISS_GROUP);
+		st->processed= 1;
+	}
+	for (i= st->processed; i < st->used; i++)
+		if (!st->symbols[i].hash)
+			st->symbols[i].hash= userp_symtable_calc_hash(st, st->symbols[i].name, st->symbols[i].len);
+	for (i= st->processed; i < st->used; i++)
+		userp_symtable_swiss_insert(st, i);
+	st->processed= st->used;
+	return true;
+}
+
 /*IMPLDOC
 
 #### userp_scope_symtable_hashtree_populate
@@ -318,9 +561,10 @@ static bool userp_symtable_hashtree_walk(
     struct userp_symtable *st= &scope->symtable;
     if (!userp_scope_symtable_hashtree_populate(st, scope->env)) { ... }
 
-This function adds all new symbols to the hashtree.  The symbol table may grow without updating
+This function adds all new symbols to the hashtree (or swiss table, see above).  The symbol table may grow without updating
 the hashtree (because the hashtree is only needed for lookup-by-name, not lookup-by-id) so this
 allows the hashtree to be lazily built on demand.  This function needs called before hashtree_get.
+Batches of `HASHTREE_BULK_MIN` or more symbols are added with `..._hashtree_bulk_insert`.
 
 This method only fails if it can't allocate memory, or if the trees are corrupt.
 
@@ -328,6 +572,11 @@ This method only fails if it can't allocate memory, or if the trees are corrupt.
 
 static bool userp_scope_symtable_hashtree_populate(struct userp_symtable *st, userp_env env) {
 	size_t orig_bucket_alloc= st->bucket_alloc;
+	// Large tables can be configured to use the swiss table instead
+	if (st->is_swiss || (
+		env->symtable_index == USERP_SYMTABLE_SWISS && st->used > env->symtable_swiss_min
+	))
+		return userp_scope_symtable_swiss_populate(st, env);
 	// Need at least 1.5x as many buckets as symbols
 	if (st->bucket_alloc < st->alloc + (st->alloc>>1)) {
 		// The allocated size of the symbol vector is a good hint about the ideal size for
@@ -392,7 +641,11 @@ static bool userp_scope_symtable_hashtree_populate(struct userp_symtable *st, us
 		st->processed= 1;
 	}
 	size_t batch= st->used - st->processed;
-	while (st->processed < st->used) {
+	if (batch >= HASHTREE_BULK_MIN) {
+		if (!userp_scope_symtable_hashtree_bulk_insert(st, env))
+			return false;
+	}
+	else while (st->processed < st->used) {
 		// Now try adding the symbol entry
 		if (userp_symtable_hashtree_insert(st, st->processed))
 			++st->processed;
@@ -438,6 +691,209 @@ static bool userp_scope_symtable_hashtree_populate(struct userp_symtable *st, us
 	return true;
 }
 
+/*IMPLDOC
+
+#### userp_scope_build_phash
+
+    if (!userp_scope_build_phash(scope)) { ... }
+
+This builds a minimal perfect hash over every symbol visible from the scope, including the
+ones inherited from parent scopes, so that `userp_scope_get_symbol` can resolve any name in a
+single probe and a single string compare instead of searching each level of the symtable stack.
+It is called by `userp_scope_finalize` when given the flag `USERP_PERFECT_HASH`.  Names masked
+by a deeper scope are left out, so the table returns the same symbol the stack search would.
+
+The construction is "hash, displace, and compress" (CHD).  Each name's 64-bit hash picks one of
+`n / SCOPE_PHASH_LAMBDA` buckets and two values `f1` and `f2` in `[0, n)`.  Buckets are placed
+largest-first, each searching for a displacement pair `(d0, d1)` such that every name in the
+bucket lands on a free slot at `(f1 + d0 * f2 + d1) % n`.  Since `d1` ranges over every slot,
+the small buckets placed last can always find room.  If a bucket can't be placed (two names in
+it with identical `f1` and `f2`) the whole table is retried with a new seed.
+
+Each slot holds the name pointer, length, and symbol ID, so a lookup costs one hash, one
+displacement load, one slot load, and one compare.  A name that isn't in the table lands on
+some other symbol's slot and fails the compare.
+
+*/
+
+#define SCOPE_PHASH_LAMBDA     4
+#define SCOPE_PHASH_D0_MAX     16
+#define SCOPE_PHASH_BUCKET_MAX 32
+#define SCOPE_PHASH_SEED_TRIES 8
+#define SCOPE_PHASH_BUCKET(ph, h) ((size_t)(((h) & 0xFFFFFFFF) * (uint64_t)(ph)->bucket_count >> 32))
+#define SCOPE_PHASH_F1(ph, h) ((size_t)(((h) >> 32) * (uint64_t)(ph)->slot_count >> 32))
+#define SCOPE_PHASH_F2(ph, h) ((size_t)(((h) * SYMBOL_HASH_P1 >> 32) * (ph)->slot_count >> 32))
+
+static inline userp_symbol userp_scope_phash_get(const struct scope_phash *ph, const char *name, size_t len) {
+	uint64_t h= userp_symtable_calc_hash64(name, len, ph->seed);
+	const uint32_t *d= ph->disp[SCOPE_PHASH_BUCKET(ph, h)];
+	const struct scope_phash_slot *slot= &ph->slots[
+		(SCOPE_PHASH_F1(ph, h) + d[0] * (uint64_t) SCOPE_PHASH_F2(ph, h) + d[1]) % ph->slot_count
+	];
+	return slot->len == len && memcmp(slot->name, name, len) == 0? slot->id : 0;
+}
+
+static bool userp_scope_phash_place(struct scope_phash *ph, const uint64_t *hashes, const uint32_t *keys, size_t count, uint32_t *disp) {
+	size_t m= ph->slot_count, base[SCOPE_PHASH_BUCKET_MAX], pos[SCOPE_PHASH_BUCKET_MAX], d0, d1, i, j;
+	for (d0= 0; d0 < SCOPE_PHASH_D0_MAX; d0++) {
+		for (i= 0; i < count; i++)
+			base[i]= (SCOPE_PHASH_F1(ph, hashes[keys[i]]) + d0 * (uint64_t) SCOPE_PHASH_F2(ph, hashes[keys[i]])) % m;
+		for (d1= 0; d1 < m; d1++) {
+			for (i= 0; i < count; i++) {
+				pos[i]= base[i] + d1 < m? base[i] + d1 : base[i] + d1 - m;
+				if (ph->slots[pos[i]].name)
+					break;
+				for (j= 0; j < i && pos[j] != pos[i]; j++);
+				if (j < i)
+					break;
+			}
+			if (i == count) {
+				disp[0]= d0;
+				disp[1]= d1;
+				for (i= 0; i < count; i++)
+					ph->slots[pos[i]].id= keys[i]; // caller fills in the rest
+				for (i= 0; i < count; i++)
+					ph->slots[pos[i]].name= "";
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static bool userp_scope_build_phash(userp_scope scope) {
+	userp_env env= scope->env;
+	struct scope_phash *ph= NULL;
+	struct scope_phash_slot *keys= NULL;
+	struct userp_symtable *st;
+	uint64_t *hashes= NULL;
+	uint32_t *order= NULL, *bstart= NULL, *border= NULL, sizecount[SCOPE_PHASH_BUCKET_MAX+2];
+	size_t total= 0, n= 0, r, i, b, sz, maxsz, ofs, seed_try;
+	int lv, up;
+	bool ok= false;
+	userp_symbol found;
+
+	// Make sure every level has a current index, then collect the symbols that aren't masked
+	for (lv= scope->symtable_count - 1; lv >= 0; lv--) {
+		st= scope->symtable_stack[lv];
+		if (st->processed < st->used && !userp_scope_symtable_hashtree_populate(st, env))
+			return false;
+		total += st->used - 1;
+	}
+	if (!total)
+		return true; // nothing to index; lookups fall through to the (empty) stack search
+	if (!USERP_ALLOC_ARRAY(env, &keys, total))
+		return false;
+	for (lv= scope->symtable_count - 1; lv >= 0; lv--) {
+		st= scope->symtable_stack[lv];
+		for (ofs= 1; ofs < st->used; ofs++) {
+			struct symbol_entry *sym= &st->symbols[ofs];
+			// the first level (from the top) that knows the name decides which ID is visible
+			for (up= scope->symtable_count - 1, found= 0; up >= lv && !found; up--)
+				found= userp_symtable_hashtree_get(scope->symtable_stack[up], sym->hash, sym->name, sym->len);
+			if (found == st->id_offset + ofs) {
+				keys[n].name= sym->name;
+				keys[n].len= sym->len;
+				keys[n].id= found;
+				n++;
+			}
+		}
+	}
+	r= (n + SCOPE_PHASH_LAMBDA - 1) / SCOPE_PHASH_LAMBDA;
+	if (!USERP_ALLOC_OBJPLUS(env, &ph, n * sizeof(struct scope_phash_slot) + r * sizeof(*ph->disp))
+		|| !USERP_ALLOC_ARRAY(env, &hashes, n)
+		|| !USERP_ALLOC_ARRAY(env, &order, n)
+		|| !USERP_ALLOC_ARRAY(env, &bstart, (r+1))
+		|| !USERP_ALLOC_ARRAY(env, &border, r)
+	)
+		goto failure;
+	ph->slot_count= n;
+	ph->bucket_count= r;
+	ph->disp= (uint32_t (*)[2]) (ph->slots + n);
+
+	for (seed_try= 0; seed_try < SCOPE_PHASH_SEED_TRIES; seed_try++) {
+		ph->seed= seed_try * SYMBOL_HASH_P2;
+		memset(ph->slots, 0, n * sizeof(struct scope_phash_slot));
+		memset(ph->disp, 0, r * sizeof(*ph->disp));
+		memset(bstart, 0, (r+1) * sizeof(*bstart));
+		// Group the keys by bucket
+		for (i= 0; i < n; i++) {
+			hashes[i]= userp_symtable_calc_hash64(keys[i].name, keys[i].len, ph->seed);
+			bstart[SCOPE_PHASH_BUCKET(ph, hashes[i]) + 1]++;
+		}
+		memset(sizecount, 0, sizeof(sizecount));
+		for (b= 0, maxsz= 0; b < r; b++) {
+			sz= bstart[b+1];
+			if (sz > SCOPE_PHASH_BUCKET_MAX)
+				break;
+			sizecount[sz]++;
+			if (sz > maxsz) maxsz= sz;
+			bstart[b+1] += bstart[b];
+		}
+		if (b < r)
+			continue;
+		for (i= 0; i < n; i++)
+			order[bstart[SCOPE_PHASH_BUCKET(ph, hashes[i])]++]= i;
+		// bstart[b] now holds the end of bucket b, so the start is bstart[b-1]
+		// Sort the non-empty buckets by size, largest first
+		for (sz= maxsz, ofs= 0; sz > 0; sz--) {
+			size_t c= sizecount[sz];
+			sizecount[sz]= ofs;
+			ofs += c;
+		}
+		for (b= 0; b < r; b++) {
+			sz= bstart[b] - (b? bstart[b-1] : 0);
+			if (sz)
+				border[sizecount[sz]++]= b;
+		}
+		for (i= 0; i < ofs; i++) {
+			b= border[i];
+			sz= b? bstart[b-1] : 0;
+			if (!userp_scope_phash_place(ph, hashes, order + sz, bstart[b] - sz, ph->disp[b]))
+				break;
+		}
+		if (i == ofs)
+			break;
+	}
+	if (seed_try == SCOPE_PHASH_SEED_TRIES) {
+		userp_diag_setf(&env->err, USERP_ERROR,
+			"Unable to build perfect hash for " USERP_DIAG_COUNT " symbols",
+			n);
+		USERP_DISPATCH_ERR(env);
+		goto failure;
+	}
+	// Slots hold the key index; replace with the key
+	for (i= 0; i < n; i++)
+		ph->slots[i]= keys[ph->slots[i].id];
+	if (env->log_trace) {
+		userp_diag_setf(&env->msg, USERP_MSG_SCOPE_PERFECT_HASH,
+			"userp_scope: built perfect hash size=" USERP_DIAG_SIZE
+				" for " USERP_DIAG_COUNT " symbols",
+			(size_t)(sizeof(*ph) + n * sizeof(struct scope_phash_slot) + r * sizeof(*ph->disp)), n
+		);
+		USERP_DISPATCH_MSG(env);
+	}
+	if (scope->phash)
+		USERP_FREE(env, &scope->phash);
+	scope->phash= ph;
+	ok= true;
+
+	CATCH(failure) {
+		if (ph)
+			USERP_FREE(env, &ph);
+	}
+	if (hashes)
+		USERP_FREE(env, &hashes);
+	if (order)
+		USERP_FREE(env, &order);
+	if (bstart)
+		USERP_FREE(env, &bstart);
+	if (border)
+		USERP_FREE(env, &border);
+	USERP_FREE(env, &keys);
+	return ok;
+}
+
 /*APIDOC
 
 #### userp_scope_get_symbol
@@ -449,16 +905,30 @@ symbol table has not been finalized.  Symbols can be returned from parent scopes
 add the flag `USERP_GET_LOCAL`.  By combining `USERP_GET_LOCAL|USERP_CREATE`, you can create
 symbols in the local scope that mask the same name in a parent scope.
 
+If the scope was finalized with `USERP_PERFECT_HASH`, names are resolved with a single probe of
+the perfect hash instead of searching the scope and each of its parents.
+
 */
 
 userp_symbol userp_scope_get_symbol(userp_scope scope, const char *name, int flags) {
-	int i, pos, len;
+	int i, pos;
 	struct userp_symtable *st;
 	userp_symbol ret;
 	struct symbol_entry *sym;
 	userp_env env= scope->env;
-	uint32_t hash= userp_symtable_calc_hash(&scope->symtable, name);
-
+	size_t len= strlen(name);
+	uint32_t hash;
+
+	// A finalized scope may have a perfect hash covering all visible symbols
+	if (scope->phash) {
+		ret= userp_scope_phash_get(scope->phash, name, len);
+		// For local-only, the visible symbol must come from this scope's own table
+		if (ret && (flags & USERP_GET_LOCAL) && !(scope->has_symbols && ret > scope->symtable.id_offset))
+			ret= 0;
+		if (ret || !(flags & USERP_CREATE))
+			return ret;
+	}
+	hash= userp_symtable_calc_hash(&scope->symtable, name, len);
 	// search self and parent scopes for symbol (but flags can request local-only)
 	if (!(flags & USERP_GET_LOCAL) || scope->has_symbols) {
 		for (i= scope->symtable_count - 1; i >= 0; --i) {
@@ -468,7 +938,7 @@ userp_symbol userp_scope_get_symbol(userp_scope scope, const char *name, int fla
 				if (!userp_scope_symtable_hashtree_populate(st, scope->env))
 					return false;
 			// Now use the hashtable
-			ret= userp_symtable_hashtree_get(st, hash, name);
+			ret= userp_symtable_hashtree_get(st, hash, name, len);
 			if (ret)
 				return ret;
 			// User can request only searching immediate scope
@@ -492,12 +962,12 @@ userp_symbol userp_scope_get_symbol(userp_scope scope, const char *name, int fla
 	pos= scope->symtable.used++;
 	scope->symbol_count++;
 	// Copy the name into scope storage
-	len= strlen(name);
 	if (!(name= (char*) userp_bstr_append_bytes(&scope->symtable.chardata, (const uint8_t*) name, len+1, USERP_CONTIGUOUS)))
 		return 0;
 	// add symbol to the vector
 	sym= scope->symtable.symbols + pos;
 	sym->name= name; // name was replaced with the local pointer, above
+	sym->len= len;
 	sym->hash= hash;
 	sym->type_ref= 0;
 	sym->canonical= 0;
@@ -514,36 +984,31 @@ userp_symbol userp_scope_get_symbol(userp_scope scope, const char *name, int fla
 This returns a pointer to a NUL-terminated string of the given userp_symbol.
 If the userp_symbol is out of bounds, or is the special value 0, this returns NULL.
 
+This runs in constant time regardless of how deeply the scope is nested, using the flattened
+index built by `userp_scope_finalize` (of this scope, or of its parent).
+
 */
 const char * userp_scope_get_symbol_str(userp_scope scope, userp_symbol sym) {
-	size_t ofs, first, last;
+	struct symbol_entry *entry;
 	struct userp_symtable *st;
 
+	// A finalized scope resolves every ID through its flattened index
+	if (scope->flat_sym) {
+		entry= (struct symbol_entry*) scope_flat_get(scope->flat_sym, sym);
+		return entry? entry->name : NULL;
+	}
 	// for the unlikely case of no symbols at all
-	if (!sym || (last= scope->symtable_count) == 0)
+	if (!sym || scope->symtable_count == 0)
 		return NULL;
-	--last;
 	// Most common symtable is probably the most recent user-declared one
-	st= scope->symtable_stack[last];
-	if (sym > st->id_offset) {
-		ofs= sym - st->id_offset;
-		return ofs < st->used? st->symbols[ofs].name : NULL;
-	}
-	if (last == 0)
+	st= scope->symtable_stack[scope->symtable_count - 1];
+	if (sym > st->id_offset)
+		return sym - st->id_offset < st->used? st->symbols[sym - st->id_offset].name : NULL;
+	// else it belongs to the parent, which is final and has a flattened index
+	if (!scope->parent || !scope->parent->flat_sym)
 		return NULL;
-	--last;
-	// else binary search for it
-	for (first= 0; first < last;) {
-		size_t mid= (first+last+1) >> 1;
-		if (sym > scope->symtable_stack[mid]->id_offset)
-			first= mid;
-		else
-			last= mid-1;
-	}
-	st= scope->symtable_stack[first];
-	assert(sym > st->id_offset);
-	assert(sym - st->id_offset < st->used); // already checked final range, and anything before should be covered
-	return st->symbols[sym - st->id_offset].name;
+	entry= (struct symbol_entry*) scope_flat_get(scope->parent->flat_sym, sym);
+	return entry? entry->name : NULL;
 }
 
 /*IMPLDOC
@@ -581,6 +1046,96 @@ struct symbol_parse_state {
 	//bool sorted;          // whether elements found so far are in correct order
 	struct userp_diag diag;
 };
+
+/*IMPLDOC
+
+#### symbol_scan_plain
+
+    pos= symbol_scan(pos, limit);
+
+Skip over a run of "plain" characters (printable ASCII, 0x20-0x7E) and return a pointer to the
+first byte that is not plain, meaning NUL, a control character, DEL, or the start of a multi-byte
+UTF-8 sequence.  The returned pointer is always less than `limit`, so the final byte of the buffer
+is left for the validator in `parse_symbols`, which reports the same diagnostics it would have if
+it had walked every byte itself.
+
+There is a scalar version that checks 8 bytes per step, an SSE2 version that checks 16, and an
+AVX2 version that checks 32.  The AVX2 version is only used if the CPU reports support for it,
+which is checked once when the library is loaded.  Define `USERP_NO_SIMD` to build only the scalar version.
+
+*/
+
+typedef const uint8_t* (*symbol_scan_fn)(const uint8_t *pos, const uint8_t *limit);
+
+#define SYMBOL_SCAN_ONES (~(uint64_t)0/255)
+static const uint8_t* symbol_scan_plain_scalar(const uint8_t *pos, const uint8_t *limit) {
+	uint64_t w;
+	while (pos + 8 < limit) {
+		memcpy(&w, pos, 8);
+		// bytes < 0x20, bytes with the high bit set, or bytes equal to 0x7F
+		if (((w - SYMBOL_SCAN_ONES*0x20) | w | (w + SYMBOL_SCAN_ONES)) & (SYMBOL_SCAN_ONES*0x80))
+			break;
+		pos += 8;
+	}
+	while (pos + 1 < limit && *pos >= 0x20 && *pos < 0x7F)
+		++pos;
+	return pos;
+}
+#undef SYMBOL_SCAN_ONES
+
+#if !defined(USERP_NO_SIMD) && defined(__SSE2__)
+static const uint8_t* symbol_scan_plain_sse2(const uint8_t *pos, const uint8_t *limit) {
+	const __m128i ctl= _mm_set1_epi8(0x20), del= _mm_set1_epi8(0x7F);
+	__m128i v;
+	int mask;
+	while (pos + 16 < limit) {
+		v= _mm_loadu_si128((const __m128i*) pos);
+		// signed compare catches both 0x00-0x1F and 0x80-0xFF
+		mask= _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v, ctl), _mm_cmpeq_epi8(v, del)));
+		if (mask)
+			return pos + __builtin_ctz(mask);
+		pos += 16;
+	}
+	return symbol_scan_plain_scalar(pos, limit);
+}
+#define SYMBOL_SCAN_DEFAULT symbol_scan_plain_sse2
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+__attribute__((target("avx2")))
+static const uint8_t* symbol_scan_plain_avx2(const uint8_t *pos, const uint8_t *limit) {
+	const __m256i ctl= _mm256_set1_epi8(0x1F), del= _mm256_set1_epi8(0x7F);
+	__m256i v;
+	unsigned mask;
+	while (pos + 32 < limit) {
+		v= _mm256_loadu_si256((const __m256i*) pos);
+		// plain bytes are (signed) greater than 0x1F and not equal to 0x7F
+		mask= ~(unsigned) _mm256_movemask_epi8(_mm256_andnot_si256(
+			_mm256_cmpeq_epi8(v, del), _mm256_cmpgt_epi8(v, ctl)));
+		if (mask)
+			return pos + __builtin_ctz(mask);
+		pos += 32;
+	}
+	return symbol_scan_plain_sse2(pos, limit);
+}
+#define SYMBOL_SCAN_HAVE_AVX2
+#endif
+#else
+#define SYMBOL_SCAN_DEFAULT symbol_scan_plain_scalar
+#endif
+
+// The kernel is chosen when the library loads, so it never changes while threads parse
+static symbol_scan_fn symbol_scan= SYMBOL_SCAN_DEFAULT;
+
+#ifdef SYMBOL_SCAN_HAVE_AVX2
+__attribute__((constructor))
+static void symbol_scan_init(void) {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		symbol_scan= symbol_scan_plain_avx2;
+}
+#endif
+
 static bool parse_symbols(struct symbol_parse_state *parse) {
 	const uint8_t
 		*limit= parse->limit,
@@ -591,6 +1146,8 @@ static bool parse_symbols(struct symbol_parse_state *parse) {
 		parse->start= (uint8_t*) pos;
 		// Begin one symbol
 		while (1) {
+			// Skip ahead over printable ASCII; stops on NUL, multi-byte, or anything to be rejected
+			pos= symbol_scan(pos, limit);
 			// 1-byte code: 0x00-0x7F
 			// 2-byte code: 0xE0-0xEF + 6 bits
 			// 3-byte code: 0xF0-0xF7 + 12 bits
@@ -677,6 +1234,11 @@ static bool parse_symbols(struct symbol_parse_state *parse) {
 		//	parse->prev= parse->start;
 		//}
 		parse->dest_pos->name= (char*)parse->start;
+		parse->dest_pos->len= pos - parse->start;
+		// the vector is not zeroed when allocated, and hash=0 means "not calculated yet"
+		parse->dest_pos->hash= 0;
+		parse->dest_pos->type_ref= 0;
+		parse->dest_pos->canonical= 0;
 		++parse->dest_pos;
 		++pos; // resume parsing at char beyond '\0'
 	}
@@ -1119,6 +1681,42 @@ Scope level=0  refcnt=1 has_symbols
 debug: userp_scope: destroy 2 .*
 */
 
+/* Every prefix of a dotted name is a distinct symbol.  This covers each length of
+ * partial word at the end of the hash, and names which differ only in length.
+ */
+UNIT_TEST(scope_symbol_prefixes) {
+	const char *full= "com.example.schema.Foo.Bar";
+	char buf[32];
+	int i, n= strlen(full), failures= 0;
+	userp_symbol syms[32];
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope= userp_new_scope(env, NULL);
+	for (i= 1; i <= n; i++) {
+		memcpy(buf, full, i);
+		buf[i]= '\0';
+		syms[i]= userp_scope_get_symbol(scope, buf, USERP_CREATE);
+	}
+	for (i= 1; i <= n; i++) {
+		memcpy(buf, full, i);
+		buf[i]= '\0';
+		if (userp_scope_get_symbol(scope, buf, 0) != syms[i]
+			|| strcmp(userp_scope_get_symbol_str(scope, syms[i]), buf) != 0
+		) {
+			printf("lookup of '%s' failed\n", buf);
+			++failures;
+		}
+	}
+	printf("%d symbols, %d failures\n", (int) scope->symbol_count, failures);
+	printf("'%s' = %d\n", "com.example.schema.Foo.Baz",
+		(int) userp_scope_get_symbol(scope, "com.example.schema.Foo.Baz", 0));
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+26 symbols, 0 failures
+'com.example.schema.Foo.Baz' = 0
+*/
+
 static const char symbol_data_sorted[]=
 	"ace\0bat\0car\0dog\0egg";
 static struct userp_buffer symbol_data_sorted_buf= {
@@ -1255,4 +1853,337 @@ Scope level=0  refcnt=1 has_symbols
 # drop env
 */
 
+/* Symbols longer than the vector width of symbol_scan, and errors at various
+ * offsets within a vector, must give the same result as the byte-wise validator.
+ */
+static const char *symbol_scan_cases[]= {
+	"this_symbol_name_is_longer_than_one_avx2_vector\0short\0x\0another_rather_long_symbol_to_cross_chunk_edges",
+	"abcdefghijklmnopqrstuvwxyz0123456789_\x01tail",
+	"abcdefghijklmnopqrst\x7Fuvwxyz0123456789_tail",
+	"abcdefghijklmnopqrstuvwxyz0123456789_ABCDEFGHIJKLMN\x80tail",
+	"abcdefghijklmnopqrstuvwxyz0123456789_ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+	NULL
+};
+// lengths include the final NUL, except for the last case
+static const size_t symbol_scan_case_len[]= { 104, 43, 43, 57, 63 };
+static const int symbol_scan_case_count[]= { 4, 1, 1, 1, 1 };
+
+UNIT_TEST(scope_parse_symbols_vector) {
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope;
+	struct userp_buffer buf;
+	struct userp_bstr_part str;
+	int i, j;
+	for (i= 0; symbol_scan_cases[i]; i++) {
+		bzero(&buf, sizeof(buf));
+		buf.data= (uint8_t*) symbol_scan_cases[i];
+		buf.alloc_len= symbol_scan_case_len[i];
+		str.buf= &buf;
+		str.data= buf.data;
+		str.len= buf.alloc_len;
+		scope= userp_new_scope(env, NULL);
+		printf("# case %d\n", i);
+		if (userp_scope_parse_symbols(scope, &str, 1, symbol_scan_case_count[i], 0))
+			for (j= 1; j < scope->symtable.used; j++)
+				printf("%s\n", scope->symtable.symbols[j].name);
+		userp_drop_scope(scope);
+	}
+	userp_drop_env(env);
+}
+/*OUTPUT
+# case 0
+this_symbol_name_is_longer_than_one_avx2_vector
+short
+x
+another_rather_long_symbol_to_cross_chunk_edges
+# case 1
+error: Symbol table: encountered forbidden codepoint 1 at "abcdefghijklmnopqrstuvwxyz0123456789_" >"\\x01"
+# case 2
+error: Symbol table: encountered forbidden codepoint 127 at "abcdefghijklmnopqrst" >"\\x7F"
+# case 3
+error: Symbol table: encountered invalid UTF-8 sequence at "abcdefghijklmnopqrstuvwxyz0123456789_ABCDEFGHIJKLMN" >"\\x80"
+# case 4
+error: Symbol table ended mid-symbol
+*/
+
+/* Compare the time to index a parsed symbol table one symbol at a time (the way
+ * it happens when each lookup is followed by an insert) against the bulk build.
+ * Pass a symbol count as the first argument for larger runs.
+ */
+UNIT_TEST(bench_symtable_hashtree_build) {
+	int n= argc > 0? atoi(argv[0]) : 20000, i, mode, missing;
+	size_t len= 0, used;
+	char *names= malloc((size_t)n * 16);
+	struct userp_buffer buf;
+	struct userp_bstr_part str;
+	struct userp_symtable *st;
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope;
+	clock_t t0;
+	for (i= 0; i < n; i++)
+		len += sprintf(names + len, "field_%d", i*7) + 1;
+	for (mode= 0; mode < 2; mode++) {
+		bzero(&buf, sizeof(buf));
+		buf.data= (uint8_t*) names;
+		buf.alloc_len= len;
+		str.buf= &buf;
+		str.data= buf.data;
+		str.len= len;
+		scope= userp_new_scope(env, NULL);
+		if (!userp_scope_parse_symbols(scope, &str, 1, n, 0))
+			abort();
+		st= &scope->symtable;
+		t0= clock();
+		if (mode == 0) {
+			used= st->used;
+			for (st->used= 2; st->used <= used; st->used++)
+				if (!userp_scope_symtable_hashtree_populate(st, env))
+					abort();
+			st->used= used;
+		}
+		else if (!userp_scope_symtable_hashtree_populate(st, env))
+			abort();
+		printf("%s: %d symbols, %.6f sec\n", mode? "bulk" : "incremental", n,
+			(double)(clock() - t0) / CLOCKS_PER_SEC);
+		for (i= 1, missing= 0; i < st->used; i++)
+			if (userp_scope_get_symbol(scope, st->symbols[i].name, 0) != i)
+				++missing;
+		printf("lookup failures: %d\n", missing);
+		userp_drop_scope(scope);
+	}
+	userp_drop_env(env);
+	free(names);
+}
+/*OUTPUT
+incremental: \d+ symbols, [0-9.]+ sec
+lookup failures: 0
+bulk: \d+ symbols, [0-9.]+ sec
+lookup failures: 0
+*/
+
+UNIT_TEST(scope_symbol_swiss) {
+	char buf[32];
+	int i, failures= 0;
+	userp_symbol sym;
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_env_set_attr(env, USERP_SYMTABLE_INDEX, USERP_SYMTABLE_SWISS);
+	userp_env_set_attr(env, USERP_SYMTABLE_SWISS_MIN, 100);
+	userp_scope scope= userp_new_scope(env, NULL);
+	// Starts as a hashtree, converts at 100, then grows several times
+	for (i= 0; i < 5000; i++) {
+		snprintf(buf, sizeof(buf), "sym.%d", i);
+		sym= userp_scope_get_symbol(scope, buf, USERP_CREATE);
+		if (sym != i+1 || userp_scope_get_symbol(scope, buf, 0) != sym) {
+			printf("Failed to add %s\n", buf);
+			++failures;
+		}
+	}
+	for (i= 0; i < 5000; i++) {
+		snprintf(buf, sizeof(buf), "sym.%d", i);
+		if (userp_scope_get_symbol(scope, buf, 0) != i+1)
+			++failures;
+		snprintf(buf, sizeof(buf), "sym.%d", i+5000);
+		if (userp_scope_get_symbol(scope, buf, 0) != 0)
+			++failures;
+	}
+	printf("failures: %d\n", failures);
+	dump_scope(scope);
+	userp_drop_scope(scope);
+	userp_drop_env(env);
+}
+/*OUTPUT
+failures: 0
+Scope level=0  refcnt=1 has_symbols
+ *Symbol Table: stack of 1 tables, 5000 symbols
+ *local table: 0-5000 indexed .*
+ *swisstable: 5000/8192 \(\d+ table bytes\)
+ *buffers:.*
+ *Type Table: stack of 0 tables, 0 types
+*/
+
+/* Compare lookup throughput and memory per symbol of the 7, 15, and 31-bit hashtree
+ * against the swiss table.  Pass a number of lookup rounds as the first argument.
+ */
+UNIT_TEST(bench_symtable_index) {
+	static const int sizes[]= { 100, 20000, 500000 };
+	int rounds= argc > 0? atoi(argv[0]) : 1, size_i, mode, n, i, r, failures;
+	size_t len, mem, *order;
+	char *names, **name_ptr;
+	struct userp_buffer buf;
+	struct userp_bstr_part str;
+	struct userp_symtable *st;
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope;
+	clock_t t0;
+	double sec;
+	for (size_i= 0; size_i < 3; size_i++) {
+		n= sizes[size_i];
+		names= malloc((size_t)n * 24);
+		name_ptr= malloc(sizeof(char*) * n * 2);
+		for (i= 0, len= 0; i < n; i++) {
+			name_ptr[i]= names + len;
+			len += sprintf(names + len, "com.example.f%d", i*3) + 1;
+		}
+		// lookups visit the names in a scrambled order
+		order= malloc(sizeof(size_t) * n);
+		for (i= 0; i < n; i++)
+			order[i]= ((size_t) i * 7919) % n;
+		for (mode= 0; mode < 2; mode++) {
+			userp_env_set_attr(env, USERP_SYMTABLE_INDEX, mode? USERP_SYMTABLE_SWISS : USERP_SYMTABLE_HASHTREE);
+			userp_env_set_attr(env, USERP_SYMTABLE_SWISS_MIN, 1);
+			bzero(&buf, sizeof(buf));
+			buf.data= (uint8_t*) names;
+			buf.alloc_len= len;
+			str.buf= &buf;
+			str.data= buf.data;
+			str.len= len;
+			scope= userp_new_scope(env, NULL);
+			if (!userp_scope_parse_symbols(scope, &str, 1, n, 0))
+				abort();
+			st= &scope->symtable;
+			if (!userp_scope_symtable_hashtree_populate(st, env))
+				abort();
+			failures= 0;
+			t0= clock();
+			for (r= 0; r < rounds; r++)
+				for (i= 0; i < n; i++)
+					if (userp_scope_get_symbol(scope, name_ptr[order[i]], 0) != order[i]+1)
+						++failures;
+			sec= (double)(clock() - t0) / CLOCKS_PER_SEC;
+			mem= st->is_swiss? SWISS_ALLOC_SIZE(st->bucket_alloc)
+				: st->bucket_alloc * HASHTREE_BUCKET_SIZE(st->alloc)
+				+ st->node_alloc * HASHTREE_NODE_SIZE(st->alloc);
+			printf("%-10s %6d symbols: %8.2f M lookups/sec, %5.2f bytes/symbol, %d failures\n",
+				st->is_swiss? "swiss" : ((st->alloc-1) >> 15)? "hashtree31" : ((st->alloc-1) >> 7)? "hashtree15" : "hashtree7",
+				n, sec > 0? (double) n * rounds / sec / 1e6 : 0.0, (double) mem / n, failures);
+			userp_drop_scope(scope);
+		}
+		free(order);
+		free(name_ptr);
+		free(names);
+	}
+	userp_drop_env(env);
+}
+/*OUTPUT
+hashtree7 +100 symbols: +[0-9.]+ M lookups/sec, +[0-9.]+ bytes/symbol, 0 failures
+swiss +100 symbols: .*, 0 failures
+hashtree15 +20000 symbols: .*, 0 failures
+swiss +20000 symbols: .*, 0 failures
+hashtree31 +500000 symbols: .*, 0 failures
+swiss +500000 symbols: .*, 0 failures
+*/
+
+UNIT_TEST(scope_symbol_perfect_hash) {
+	char buf[32];
+	int i, failures= 0;
+	userp_symbol expect[2300], expect_local[2300];
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope root= userp_new_scope(env, NULL), mid, top;
+	for (i= 0; i < 1000; i++) {
+		snprintf(buf, sizeof(buf), "sym.%d", i);
+		userp_scope_get_symbol(root, buf, USERP_CREATE);
+	}
+	userp_scope_finalize(root, USERP_PERFECT_HASH);
+	// mid masks sym.500-999 and adds sym.1000-1499
+	mid= userp_new_scope(env, root);
+	for (i= 500; i < 1500; i++) {
+		snprintf(buf, sizeof(buf), "sym.%d", i);
+		userp_scope_get_symbol(mid, buf, USERP_CREATE|USERP_GET_LOCAL);
+	}
+	userp_scope_finalize(mid, USERP_PERFECT_HASH);
+	// top masks sym.0-99 and adds some short names
+	top= userp_new_scope(env, mid);
+	for (i= 0; i < 100; i++) {
+		snprintf(buf, sizeof(buf), "sym.%d", i);
+		userp_scope_get_symbol(top, buf, USERP_CREATE|USERP_GET_LOCAL);
+		snprintf(buf, sizeof(buf), "%c%d", 'a' + i % 26, i / 26);
+		userp_scope_get_symbol(top, buf, USERP_CREATE);
+	}
+	// Record what the stack search returns, then compare against the perfect hash
+	for (i= 0; i < 2300; i++) {
+		if (i < 2000) snprintf(buf, sizeof(buf), "sym.%d", i);
+		else snprintf(buf, sizeof(buf), "%c%d", 'a' + i % 26, (i - 2000) / 26);
+		expect[i]= userp_scope_get_symbol(top, buf, 0);
+		expect_local[i]= userp_scope_get_symbol(top, buf, USERP_GET_LOCAL);
+	}
+	if (!userp_scope_finalize(top, USERP_PERFECT_HASH))
+		++failures;
+	for (i= 0; i < 2300; i++) {
+		if (i < 2000) snprintf(buf, sizeof(buf), "sym.%d", i);
+		else snprintf(buf, sizeof(buf), "%c%d", 'a' + i % 26, (i - 2000) / 26);
+		if (userp_scope_get_symbol(top, buf, 0) != expect[i]
+			|| userp_scope_get_symbol(top, buf, USERP_GET_LOCAL) != expect_local[i]
+		) {
+			printf("mismatch for %s\n", buf);
+			++failures;
+		}
+	}
+	printf("sym.0=%d sym.500=%d sym.1499=%d sym.1500=%d\n",
+		(int) userp_scope_get_symbol(top, "sym.0", 0),
+		(int) userp_scope_get_symbol(top, "sym.500", 0),
+		(int) userp_scope_get_symbol(top, "sym.1499", 0),
+		(int) userp_scope_get_symbol(top, "sym.1500", 0));
+	printf("failures: %d\n", failures);
+	dump_scope(top);
+	userp_drop_scope(top);
+	userp_drop_scope(mid);
+	userp_drop_scope(root);
+	userp_drop_env(env);
+}
+/*OUTPUT
+sym.0=2001 sym.500=1001 sym.1499=2000 sym.1500=0
+failures: 0
+Scope level=2  refcnt=1 is_final has_symbols
+ *Symbol Table: stack of 3 tables, 2200 symbols
+ *perfect hash: 1600 symbols, 400 buckets \(\d+ bytes\)
+ *local table: 2000-2200 indexed .*
+ *hashtree: .*
+ *buffers:.*
+ *Type Table: stack of 0 tables, 0 types
+*/
+
+/* Compare name lookups in a scope nested 8 levels deep, with and without the perfect hash.
+ * Pass a number of lookup rounds as the first argument.
+ */
+UNIT_TEST(bench_scope_perfect_hash) {
+	char buf[32], *names;
+	int rounds= argc > 0? atoi(argv[0]) : 1, depth, i, r, failures= 0;
+	userp_env env= userp_new_env(NULL, userp_file_logger, stdout, 0);
+	userp_scope scope[8];
+	clock_t t0;
+	double sec;
+	names= malloc(8 * 2000 * 16);
+	for (depth= 0; depth < 8; depth++) {
+		scope[depth]= userp_new_scope(env, depth? scope[depth-1] : NULL);
+		for (i= 0; i < 2000; i++) {
+			snprintf(buf, sizeof(buf), "L%d.sym%d", depth, i);
+			strcpy(names + (depth * 2000 + i) * 16, buf);
+			userp_scope_get_symbol(scope[depth], buf, USERP_CREATE);
+		}
+		userp_scope_finalize(scope[depth], 0);
+	}
+	for (i= 0; i < 2; i++) {
+		if (i)
+			userp_scope_finalize(scope[7], USERP_PERFECT_HASH);
+		t0= clock();
+		for (r= 0; r < rounds; r++)
+			for (depth= 0; depth < 8 * 2000; depth++)
+				if (userp_scope_get_symbol(scope[7], names + depth * 16, 0) != depth + 1)
+					++failures;
+		sec= (double)(clock() - t0) / CLOCKS_PER_SEC;
+		printf("%-12s %6.1f ns/lookup\n", i? "perfecthash" : "stack",
+			sec * 1e9 / ((double) rounds * 8 * 2000));
+	}
+	printf("failures: %d\n", failures);
+	for (depth= 7; depth >= 0; depth--)
+		userp_drop_scope(scope[depth]);
+	free(names);
+	userp_drop_env(env);
+}
+/*OUTPUT
+stack +[0-9.]+ ns/lookup
+perfecthash +[0-9.]+ ns/lookup
+failures: 0
+*/
+
 #endif
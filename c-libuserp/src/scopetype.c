@@ -67,219 +67,1366 @@ static bool scope_typetable_alloc(userp_scope scope, size_t n) {
 	return true;
 }
 
-userp_type userp_scope_get_type(userp_scope scope, userp_symbol name, int flags) {
-	// look up the symbol (binary search on symbol table), return the type if it exists,
-	// If not found, go to parent scope and look up symbol of same name
-	return 0;
+/*APIDOC
+
+#### userp_scope_contains_type
+
+    if (!userp_scope_contains_type(scope, type)) ...
+
+Returns true if the userp_type ID is defined in this scope or one of its parents.
+
+*/
+bool userp_scope_contains_type(userp_scope scope, userp_type type) {
+	return type > 0 && type <= scope->type_count;
 }
-userp_type userp_scope_type_by_name(userp_scope scope, const char *name, int flags) {
-	// look up the symbol (binary search on symbol table), return the type if it exists,
-	// If not found, go to parent scope and look up symbol of same name
-	return 0;
+
+/*IMPLDOC
+
+#### userp_scope_get_type_entry
+
+    struct type_entry *entry= userp_scope_get_type_entry(scope, type);
+
+Return the type table entry for an absolute userp_type ID, or NULL if the ID is not valid in the
+scope.  This is constant-time regardless of nesting depth: a finalized scope uses its flattened
+index, and otherwise the ID is either in the local table or in the (finalized) parent's index.
+
+*/
+struct type_entry* userp_scope_get_type_entry(userp_scope scope, userp_type type) {
+	if (scope->flat_type)
+		return (struct type_entry*) scope_flat_get(scope->flat_type, type);
+	if (scope->has_types && type >= scope->typetable.id_offset)
+		return type - scope->typetable.id_offset < scope->typetable.used
+			? scope->typetable.types + (type - scope->typetable.id_offset) : NULL;
+	if (!scope->parent || !scope->parent->flat_type)
+		return NULL;
+	return (struct type_entry*) scope_flat_get(scope->parent->flat_type, type);
 }
 
-int userp_scope_parse_types(userp_scope scope, struct userp_bstr_part *parts, size_t part_count, int type_count, int flags) {
-	// If scope is finalized, emit an error
-	// while there is more input and type_count hasn't been reached,
-	//   allocate an entry in the type vector
-	//   if the type has aux data, allocate space in the next aux buffer
-	//   when the type is fully decoded,
-	//     if the type name was already used in this scope, emit an error and return false
-	// push a new element onto the type vector
-	// have the new type point to the old type's aux data, with a flag to indicate it is shared
-	// return the id of the new type
+/*IMPLDOC
+
+#### userp_typetable_index_names
+
+    if (!userp_typetable_index_names(tt, env)) ...
+
+Add any new types to the typetable's name index, which is an open-addressed (linear probing)
+hash table of `uint32_t` holding the index+1 into `types[]`, keyed by the type's name symbol.
+Like the symbol hashtree, this is built lazily on the first lookup after types are added, and
+rebuilt larger if the load would exceed 1/2.  Anonymous types (name 0) are not indexed.
+
+#### userp_typetable_get_by_name
+
+    userp_type t= userp_typetable_get_by_name(tt, name);
+
+Look up a name in one typetable's index, which must be current.  Returns 0 if not found.
+
+*/
+
+#define TYPE_NAME_HASH(name) ((uint32_t)(name) * UINT32_C(0x9E3779B1))
+
+static bool userp_typetable_index_names(struct userp_typetable *tt, userp_env env) {
+	size_t cap, i, slot;
+	if (!tt->name_index || tt->used * 2 > tt->name_index_mask + 1) {
+		cap= roundup_pow2(MAX(tt->used, tt->alloc) * 2);
+		if (cap < 16)
+			cap= 16;
+		if (!userp_alloc(env, (void**) &tt->name_index, cap * sizeof(uint32_t), 0))
+			return false;
+		bzero(tt->name_index, cap * sizeof(uint32_t));
+		tt->name_index_mask= cap - 1;
+		tt->name_indexed= 0;
+	}
+	for (i= tt->name_indexed; i < tt->used; i++) {
+		if (!tt->types[i].name)
+			continue;
+		for (slot= TYPE_NAME_HASH(tt->types[i].name) & tt->name_index_mask;
+			tt->name_index[slot];
+			slot= (slot + 1) & tt->name_index_mask
+		);
+		tt->name_index[slot]= i + 1;
+	}
+	tt->name_indexed= tt->used;
+	return true;
+}
+
+static inline userp_type userp_typetable_get_by_name(struct userp_typetable *tt, userp_symbol name) {
+	size_t slot;
+	uint32_t i;
+	// A table with no types (such as an empty type block) has no index
+	if (!tt->used || !tt->name_index)
+		return 0;
+	slot= TYPE_NAME_HASH(name) & tt->name_index_mask;
+	while ((i= tt->name_index[slot])) {
+		if (tt->types[i-1].name == name)
+			return tt->id_offset + i - 1;
+		slot= (slot + 1) & tt->name_index_mask;
+	}
 	return 0;
 }
 
+/*APIDOC
+
+#### userp_scope_get_type
+
+    userp_type t= userp_scope_get_type(scope, name_sym, flags);
+
+Find the type whose name is the given symbol, searching this scope and then each parent scope,
+unless `flags` includes `USERP_GET_LOCAL`.  Returns 0 if there is no such type.  A type defined
+in this scope masks a type of the same name in a parent scope.
+
+Each level of the scope has a hash index of its types by name, and the scope keeps a small
+cache of recent results, so repeated lookups of the same name cost one comparison.
+
+#### userp_scope_type_by_name
+
+    userp_type t= userp_scope_type_by_name(scope, "Name", flags);
+
+Same as above, but first resolves the name to the symbol visible in this scope.  Returns 0 if
+the symbol or the type doesn't exist.
+
+*/
+
+userp_type userp_scope_get_type(userp_scope scope, userp_symbol name, int flags) {
+	struct userp_typetable *tt;
+	struct scope_type_cache *cache;
+	userp_type ret= 0;
+	int i;
+
+	if (!name)
+		return 0;
+	// If types were added to the local table, index them, and forget any cached results
+	// which they might now mask.
+	if (scope->has_types && scope->typetable.name_indexed < scope->typetable.used) {
+		if (!userp_typetable_index_names(&scope->typetable, scope->env))
+			return 0;
+		bzero(scope->type_cache, sizeof(scope->type_cache));
+	}
+	if (flags & USERP_GET_LOCAL)
+		return scope->has_types? userp_typetable_get_by_name(&scope->typetable, name) : 0;
+	cache= &scope->type_cache[(TYPE_NAME_HASH(name) >> 16) & (SCOPE_TYPE_CACHE-1)];
+	if (cache->name == name)
+		return cache->type;
+	for (i= scope->typetable_count - 1; i >= 0 && !ret; i--) {
+		tt= scope->typetable_stack[i];
+		// Parent tables are final, but might not be indexed yet
+		if (tt->name_indexed < tt->used && !userp_typetable_index_names(tt, scope->env))
+			return 0;
+		ret= userp_typetable_get_by_name(tt, name);
+	}
+	if (ret) {
+		cache->name= name;
+		cache->type= ret;
+	}
+	return ret;
+}
+
+userp_type userp_scope_type_by_name(userp_scope scope, const char *name, int flags) {
+	// Types may be named by a parent's symbol, so don't restrict the symbol to the local scope
+	userp_symbol sym= userp_scope_get_symbol(scope, name, 0);
+	return sym? userp_scope_get_type(scope, sym, flags & USERP_GET_LOCAL) : 0;
+}
+
+/*IMPLDOC
+
+### Type Table Encoding
+
+A type table is a sequence of type definitions packed end to end.  Each begins with a variable-
+length quantity "selector" which identifies the typeclass, and whose remaining bits say which of
+the "often" attributes of that typeclass are present:
+
+    selector  | typeclass | bits of (selector - base)
+    ----------|-----------|-------------------------------------------------------------
+      0 -   1 | Any       | 0: seldom list
+      2 -   3 | Symref    | 0: seldom list
+      4 -   5 | Typeref   | 0: seldom list
+      6 -  69 | Integer   | 0: seldom list, 1: parent, 2: align, 3: bits, 4: bswap, 5: min
+     70 -  77 | Choice    | 0: seldom list, 1: parent, 2: options
+     78 - 141 | Array     | 0: seldom list, 1: parent, 2: elem_type, 3: dim_type, 4: dims
+    142 - 157 | Record    | 0: seldom list, 1: parent, 2: static_bits, 3: fields
+
+If the "seldom list" bit is set, the selector is followed by a count and then that many indices
+of "seldom" attributes, each listed at most once.  Next is the name of the type (a symbol
+reference, or 0 for an anonymous type), then each "often" attribute whose bit is set, in order
+of the bits, and then the seldom attributes in the order they were listed.
+
+    typeclass             | seldom attributes
+    ----------------------|------------------------------------
+    Any, Symref, Typeref  | 0: align, 1: pad
+    Integer               | 0: max, 1: names, 2: pad, 3: delta, 4: scale, 5: bias
+    Choice                | 0: align, 1: pad
+    Array                 | 0: align, 1: pad
+    Record                | 0: align, 1: pad, 2: other_field_type
+
+Each attribute is one or more variable-length quantities:
+
+  * Type and symbol references are absolute (even) or relative (odd), as in the data.  A type
+    may refer to itself, or (if the caller gave a count of types) to any type in the same table.
+  * `min`, `max`, and the steps of `names` are signed: the low bit is the sign, and a negative
+    value N is stored as `-N-1`.
+  * `names` is a count followed by pairs of (symbol, step), where each value is the previous
+    value (starting from 0) plus the step.
+  * `options` is a count followed by a header quantity, a type reference, and then either nothing,
+    a pair of (merge_ofs, merge_count) if header bit 1 is set, or a byte length and that many
+    bytes of the encoded value if header bit 0 is set.
+  * `delta` is 0 for a plain integer, 1 if each element of an array is stored as the difference
+    from the previous element (the first from 0), or 2 if that difference is additionally
+    zigzag-encoded (sign in the low bit) within the integer's own encoding.
+  * `scale` and `bias` are each a pair of signed quantities (coefficient, exponent) giving the
+    decimal number `coefficient * 10**exponent`.  An integer with either one is a fixed-point
+    number whose value is `integer * scale + bias`.
+  * `dims` is a count followed by each dimension, where 0 means it is given in the data.
+  * `fields` is a count followed by (name, type, placement) for each field.  The low 2 bits of
+    placement are 0 for a static field at bit offset (placement >> 2), or 1, 2, 3 for a field
+    which is Always, Often, or Seldom present.
+
+The parent of a type must be a type of the same typeclass that was already defined.  The new
+type starts as a copy of the parent, and any list attribute that is given replaces the whole
+list of the parent.
+
+The parser reads each definition once, front to back.  Each list is preceded by its count, so
+the final object (the typeclass struct plus its variable-length list) is allocated from
+`typetable.typeobjects` as soon as the count is known, and the list is decoded directly into
+it.  The objects are packed end to end in large buffers, so a table of thousands of types needs
+only a handful of allocations.  The scalar attributes collect in a temporary copy of the
+struct header which is written over the final object at the end.
+
+*/
+
+#define TYPEDEF_ANY_SELBASE     0
+#define TYPEDEF_ANY_SELBITS     1
+#define TYPEDEF_SYMREF_SELBASE  (TYPEDEF_ANY_SELBASE+(1<<TYPEDEF_ANY_SELBITS))
+#define TYPEDEF_SYMREF_SELBITS  1
+#define TYPEDEF_TYPEREF_SELBASE (TYPEDEF_SYMREF_SELBASE+(1<<TYPEDEF_SYMREF_SELBITS))
+#define TYPEDEF_TYPEREF_SELBITS 1
+#define TYPEDEF_INTEGER_SELBASE (TYPEDEF_TYPEREF_SELBASE+(1<<TYPEDEF_TYPEREF_SELBITS))
+#define TYPEDEF_INTEGER_SELBITS 6
+#define TYPEDEF_CHOICE_SELBASE  (TYPEDEF_INTEGER_SELBASE+(1<<TYPEDEF_INTEGER_SELBITS))
+#define TYPEDEF_CHOICE_SELBITS  3
+#define TYPEDEF_ARRAY_SELBASE   (TYPEDEF_CHOICE_SELBASE+(1<<TYPEDEF_CHOICE_SELBITS))
+#define TYPEDEF_ARRAY_SELBITS   6
+#define TYPEDEF_RECORD_SELBASE  (TYPEDEF_ARRAY_SELBASE+(1<<TYPEDEF_ARRAY_SELBITS))
+#define TYPEDEF_RECORD_SELBITS  4
+#define TYPEDEF_SELECTOR_LIMIT  (TYPEDEF_RECORD_SELBASE+(1<<TYPEDEF_RECORD_SELBITS))
+
+#define TYPEDEF_SELDOM_BIT             0
+#define TYPEDEF_SELDOM_MAX             6
+
+#define TYPEDEF_BASIC_SELDOM_ALIGN     0
+#define TYPEDEF_BASIC_SELDOM_PAD       1
+#define TYPEDEF_BASIC_SELDOM_FIELDS    2
+
+#define TYPEDEF_INT_PARENT_BIT         1
+#define TYPEDEF_INT_ALIGN_BIT          2
+#define TYPEDEF_INT_BITS_BIT           3
+#define TYPEDEF_INT_BSWAP_BIT          4
+#define TYPEDEF_INT_MIN_BIT            5
+#define TYPEDEF_INT_SELDOM_MAX         0
+#define TYPEDEF_INT_SELDOM_NAMES       1
+#define TYPEDEF_INT_SELDOM_PAD         2
+#define TYPEDEF_INT_SELDOM_DELTA       3
+#define TYPEDEF_INT_SELDOM_SCALE       4
+#define TYPEDEF_INT_SELDOM_BIAS        5
+#define TYPEDEF_INT_SELDOM_FIELDS      6
+
+#define TYPEDEF_CHOICE_PARENT_BIT      1
+#define TYPEDEF_CHOICE_OPTIONS_BIT     2
+#define TYPEDEF_CHOICE_SELDOM_ALIGN    0
+#define TYPEDEF_CHOICE_SELDOM_PAD      1
+#define TYPEDEF_CHOICE_SELDOM_FIELDS   2
+#define TYPEDEF_CHOICE_OPT_VALUE       1
+#define TYPEDEF_CHOICE_OPT_MERGE       2
+
+#define TYPEDEF_ARRAY_PARENT_BIT       1
+#define TYPEDEF_ARRAY_ELEM_BIT         2
+#define TYPEDEF_ARRAY_DIMTYPE_BIT      3
+#define TYPEDEF_ARRAY_DIMS_BIT         4
+#define TYPEDEF_ARRAY_RESERVED_BIT     5
+#define TYPEDEF_ARRAY_SELDOM_ALIGN     0
+#define TYPEDEF_ARRAY_SELDOM_PAD       1
+#define TYPEDEF_ARRAY_SELDOM_FIELDS    2
+
+#define TYPEDEF_RECORD_PARENT_BIT      1
+#define TYPEDEF_RECORD_STATICBITS_BIT  2
+#define TYPEDEF_RECORD_FIELDS_BIT      3
+#define TYPEDEF_RECORD_SELDOM_ALIGN    0
+#define TYPEDEF_RECORD_SELDOM_PAD      1
+#define TYPEDEF_RECORD_SELDOM_OTHERTYPE 2
+#define TYPEDEF_RECORD_SELDOM_FIELDS   3
+
+struct typedef_parse {
+	userp_scope scope;
+	struct userp_bit_io in;
+	userp_type type_limit;        // highest type ID that the current definition may refer to
+	unsigned code;                // selector minus the base of its typeclass
+	size_t seldom_count;          // number of seldom[] attributes to decode after the others
+	uint8_t seldom[TYPEDEF_SELDOM_MAX];
+};
+
+// These macros use 'goto fail' with the error set in scope->env->err but not dispatched.
+// 'p' is the struct typedef_parse, and 'scope' is p->scope.
+
 #define READ_VQTY(dest) \
   do { \
-	size_t tmp; \
-    if (!userp_decode_vqty_quick(&tmp, in)) \
-        goto fail_vqty; \
-	(dest)= tmp; \
+	size_t qty; \
+	if (!userp_decode_vqty_quick(&qty, &p->in)) \
+		goto fail; \
+	(dest)= qty; \
+  } while(0)
+
+#define READ_VQTY_INT(dest) \
+  do { \
+	size_t qty; \
+	if (!userp_decode_vqty_quick(&qty, &p->in)) \
+		goto fail; \
+	if (qty > INT_MAX) { \
+		userp_diag_setf(&scope->env->err, USERP_ELIMIT, \
+			"Type attribute " USERP_DIAG_SIZE " exceeds limit", qty); \
+		goto fail; \
+	} \
+	(dest)= (int) qty; \
+  } while(0)
+
+#define READ_SIGNED(dest) \
+  do { \
+	size_t qty; \
+	if (!userp_decode_vqty_quick(&qty, &p->in)) \
+		goto fail; \
+	(dest)= (qty & 1)? -(intmax_t)(qty >> 1) - 1 : (intmax_t)(qty >> 1); \
   } while(0)
 
 #define READ_SYMREF(dest) \
   do { \
-	size_t tmp; \
-    if (!userp_decode_vqty_quick(&tmp, in)) \
-        goto fail_vqty; \
-    if (!(tmp & 1) && (tmp >> 1) <= scope->symbol_count) \
-        (dest)= tmp >> 1; \
-	else if (!((dest)= userp_scope_resolve_relative_symref(scope, tmp))) \
-		goto fail_symref; \
+	size_t qty; \
+	if (!userp_decode_vqty_quick(&qty, &p->in)) \
+		goto fail; \
+	if (!(qty & 1) && (qty >> 1) <= scope->symbol_count) \
+		(dest)= qty >> 1; \
+	else if (!((dest)= userp_scope_resolve_relative_symref(scope, qty))) { \
+		userp_diag_set(&scope->env->err, USERP_ESYMBOL, "Invalid symbol reference"); \
+		goto fail; \
+	} \
   } while (0)
 
 #define READ_TYPEREF(dest) \
   do { \
-	size_t tmp; \
-    if (!userp_decode_vqty_quick(&tmp, in)) \
-        goto fail_vqty; \
-    if (!(tmp & 1) && (tmp >> 1) <= scope->type_count) \
-        (dest)= tmp >> 1; \
-	else if (!((dest)= userp_scope_resolve_relative_typeref(scope, tmp))) \
-		goto fail_typeref; \
+	size_t qty; \
+	if (!userp_decode_vqty_quick(&qty, &p->in)) \
+		goto fail; \
+	if (!(qty & 1) && (qty >> 1) <= p->type_limit) \
+		(dest)= qty >> 1; \
+	else if (!((dest)= userp_scope_resolve_relative_typeref(scope, qty))) { \
+		userp_diag_set(&scope->env->err, USERP_ETYPE, "Invalid type reference"); \
+		goto fail; \
+	} \
   } while (0)
 
-#define TYPEDEF_RECORD_ALWAYS_FIELDS       1
-#define TYPEDEF_RECORD_OFTEN_FIELDS        3
-#define TYPEDEF_RECORD_FIELD_PARENT_BIT      1
-#define TYPEDEF_RECORD_FIELD_STATICBITS_BIT  2
-#define TYPEDEF_RECORD_FIELD_FIELDS_BIT      3
-#define TYPEDEF_RECORD_SELDOM_FIELDS       3
-#define TYPEDEF_RECORD_FIELD_ALIGN_BIT       5
-#define TYPEDEF_RECORD_FIELD_PAD_BIT         6
-#define TYPEDEF_RECORD_FIELD_OTHERTYPE_BIT   7
-static bool parse_record_typedef(userp_scope scope, size_t table_idx, struct userp_bit_io *in)
-{
-	unsigned seldom_fields[TYPEDEF_RECORD_SELDOM_FIELDS];
-	struct userp_type_record tmp_rec, *dest_rec= NULL;
-	size_t n, i, size, field, n_seldom,
-		name, parent,
-		max_fields= scope->env->record_fields_max;
-	bzero(&tmp_rec, sizeof(tmp_rec));
-
-	assert(in->accum_bits == 1 + TYPEDEF_RECORD_SELDOM_FIELDS);
-	unsigned code= in->accum;
-	// Bit 0 indicates presence of 'seldom' fields
-	if (code & 1) {
-		// How many seldom fields?
-		READ_VQTY(n_seldom);
-		if (n_seldom > TYPEDEF_RECORD_SELDOM_FIELDS) goto fail_seldom_count;
-		// add them to a queue to be decoded
-		for (i= 0; i < n_seldom; i++) {
-			READ_VQTY(field);
-			// check for out of bounds
-			if (field > TYPEDEF_RECORD_SELDOM_FIELDS) goto fail_seldom_ref;
-			field += TYPEDEF_RECORD_ALWAYS_FIELDS + TYPEDEF_RECORD_OFTEN_FIELDS;
-			// check for duplicate
-			if (code & (1<<field)) goto fail_seldom_ref_dup;
-			code |= (1<<field);
-			// queue it
-			seldom_fields[i]= field;
+// Read the count of a list, where each element occupies at least min_bytes of input.
+// This prevents a corrupt count from causing a huge allocation.
+#define READ_LIST_COUNT(dest, min_bytes) \
+  do { \
+	size_t qty; \
+	if (!userp_decode_vqty_quick(&qty, &p->in)) \
+		goto fail; \
+	if (qty > userp_bit_io_remaining(&p->in) / (min_bytes)) { \
+		userp_diag_setf(&scope->env->err, USERP_EOVERRUN, \
+			"Type definition list of " USERP_DIAG_COUNT " elements exceeds end of input", qty); \
+		goto fail; \
+	} \
+	(dest)= qty; \
+  } while(0)
+
+static bool bit_io_copy_bytes(struct userp_bit_io *in, uint8_t *dest, size_t len) {
+	size_t n;
+	while (len) {
+		if (userp_bit_io_at_end(in)) {
+			userp_diag_set(&in->str->env->err, USERP_EOVERRUN, "Type definition exceeds end of input");
+			return false;
 		}
+		n= MIN(len, (size_t)(in->lim - in->pos));
+		memcpy(dest, in->pos, n);
+		in->pos += n;
+		dest += n;
+		len -= n;
 	}
-	// "Always" fields:
-	READ_SYMREF(name);
+	return true;
+}
 
-	// "Often" fields
-	if (code & (1<<TYPEDEF_RECORD_FIELD_PARENT_BIT)) {
-		READ_TYPEREF(parent);
-		// locate parent, copy fields
-		unimplemented("copy fields from parent");
-	}
+// Allocate a type object at the end of the typeobjects arena.  Any error is already dispatched.
+static void* scope_typeobj_alloc(userp_scope scope, size_t size) {
+	return userp_bstr_append_bytes(&scope->typetable.typeobjects, NULL, TYPEOBJ_SIZE(size), USERP_CONTIGUOUS);
+}
 
-	if (code & (1<<TYPEDEF_RECORD_FIELD_STATICBITS_BIT)) {
-		READ_VQTY(tmp_rec.static_bits);
-	}
+// Read the list of seldom attributes and the name of the type
+static bool parse_typedef_header(struct typedef_parse *p, struct type_entry *entry, unsigned n_seldom_attrs) {
+	userp_scope scope= p->scope;
+	unsigned seen= 0;
+	size_t n, i, attr;
 
-	if (code & (1<<TYPEDEF_RECORD_FIELD_FIELDS_BIT)) {
+	p->seldom_count= 0;
+	if (p->code & (1<<TYPEDEF_SELDOM_BIT)) {
 		READ_VQTY(n);
-		// sanity check number of fields
-		if (n > max_fields) goto fail_field_count;
-		// Have enough info now to allocate the struct
-		size= sizeof(struct userp_type_record) + (n * sizeof(struct record_field));
-		dest_rec= (struct userp_type_record*) userp_bstr_append_bytes(
-			&scope->typetable.typeobjects, NULL, size,
-			USERP_CONTIGUOUS|USERP_ALLOC_ALIGN_SIZET
-		);
-		if (!dest_rec) goto fail_alloc;
-		// Now parse each field
+		if (n > n_seldom_attrs)
+			goto fail_seldom;
 		for (i= 0; i < n; i++) {
-			READ_SYMREF(dest_rec->fields[i].name);
-			READ_TYPEREF(dest_rec->fields[i].type);
-			READ_VQTY(dest_rec->fields[i].placement);
+			READ_VQTY(attr);
+			if (attr >= n_seldom_attrs || (seen & (1 << attr)))
+				goto fail_seldom;
+			seen |= 1 << attr;
+			p->seldom[i]= (uint8_t) attr;
 		}
+		p->seldom_count= n;
+	}
+	READ_SYMREF(entry->name);
+	return true;
+
+	CATCH(fail_seldom) {
+		userp_diag_set(&scope->env->err, USERP_ETYPE, "Invalid list of seldom attributes in type definition");
+	}
+	CATCH(fail) {}
+	return false;
+}
+
+// Read the parent type reference, and return the parent's typeobj
+static const void* parse_typedef_parent(struct typedef_parse *p, struct type_entry *entry) {
+	userp_scope scope= p->scope;
+	struct type_entry *parent;
+
+	READ_TYPEREF(entry->parent);
+	// The entry being parsed is not counted yet, so it can't be its own parent
+	parent= userp_scope_get_type_entry(scope, entry->parent);
+	if (!parent || parent->typeclass != entry->typeclass) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE,
+			"Parent type " USERP_DIAG_INDEX " must be a previously defined type of the same typeclass",
+			(int) entry->parent);
+		goto fail;
+	}
+	return parent->typeobj;
+
+	CATCH(fail) {}
+	return NULL;
+}
+
+static bool parse_basic_typedef(struct typedef_parse *p, struct type_entry *entry) {
+	userp_scope scope= p->scope;
+	struct userp_type_basic tmp, *dest;
+	size_t i;
+
+	bzero(&tmp, sizeof(tmp));
+	if (!parse_typedef_header(p, entry, TYPEDEF_BASIC_SELDOM_FIELDS))
+		goto fail;
+	for (i= 0; i < p->seldom_count; i++) {
+		switch (p->seldom[i]) {
+		case TYPEDEF_BASIC_SELDOM_ALIGN: READ_VQTY_INT(tmp.align); break;
+		case TYPEDEF_BASIC_SELDOM_PAD:   READ_VQTY_INT(tmp.pad); break;
+		}
+	}
+	if (!(dest= (struct userp_type_basic*) scope_typeobj_alloc(scope, sizeof(*dest))))
+		goto fail_alloc;
+	memcpy(dest, &tmp, sizeof(tmp));
+	entry->typeobj= dest;
+	return true;
+
+	CATCH(fail) {
+		(void)0; // error message is already set, but not dispatched
+	}
+	USERP_DISPATCH_ERR(scope->env);
+	CATCH(fail_alloc) {
+		(void)0; // error message already dispatched
+	}
+	return false;
+}
+
+#define DECIMAL_EXP_MAX 308
+
+// Return coef * 10**exp, dividing for negative exponents so that (for example) 1e-2 is the
+// nearest double to 0.01
+static double typedef_decimal(intmax_t coef, int exp) {
+	double pow= 1;
+	int i;
+	for (i= exp < 0? -exp : exp; i > 0; i--)
+		pow *= 10;
+	return exp < 0? (double) coef / pow : (double) coef * pow;
+}
+
+static bool parse_int_typedef(struct typedef_parse *p, struct type_entry *entry) {
+	userp_scope scope= p->scope;
+	const struct userp_type_int *parent= NULL;
+	struct userp_type_int tmp, *dest= NULL;
+	intmax_t value= 0, step, coef, exp;
+	size_t n, i, j;
+
+	bzero(&tmp, sizeof(tmp));
+	if (!parse_typedef_header(p, entry, TYPEDEF_INT_SELDOM_FIELDS))
+		goto fail;
+	if (p->code & (1<<TYPEDEF_INT_PARENT_BIT)) {
+		if (!(parent= parse_typedef_parent(p, entry)))
+			goto fail;
+		memcpy(&tmp, parent, sizeof(tmp));
+	}
+	if (p->code & (1<<TYPEDEF_INT_ALIGN_BIT))
+		READ_VQTY_INT(tmp.align);
+	if (p->code & (1<<TYPEDEF_INT_BITS_BIT)) {
+		READ_VQTY_INT(tmp.bits);
+		tmp.has_bits= true;
 	}
-	for (i= 0; i < n_seldom; i++) {
-		switch (seldom_fields[i]) {
-		case TYPEDEF_RECORD_FIELD_ALIGN_BIT:
-			READ_VQTY(tmp_rec.align);
+	if (p->code & (1<<TYPEDEF_INT_BSWAP_BIT)) {
+		READ_VQTY_INT(tmp.bswap);
+		tmp.has_bswap= true;
+	}
+	if (p->code & (1<<TYPEDEF_INT_MIN_BIT)) {
+		READ_SIGNED(tmp.min);
+		tmp.has_min= true;
+	}
+	for (i= 0; i < p->seldom_count; i++) {
+		switch (p->seldom[i]) {
+		case TYPEDEF_INT_SELDOM_MAX:
+			READ_SIGNED(tmp.max);
+			tmp.has_max= true;
 			break;
-		case TYPEDEF_RECORD_FIELD_PAD_BIT:
-			READ_VQTY(tmp_rec.pad);
+		case TYPEDEF_INT_SELDOM_NAMES:
+			READ_LIST_COUNT(n, 2);
+			if (n > INT_MAX)
+				goto fail_count;
+			if (!(dest= (struct userp_type_int*) scope_typeobj_alloc(scope, sizeof(*dest) + n * sizeof(dest->names[0]))))
+				goto fail_alloc;
+			for (j= 0; j < n; j++) {
+				READ_SYMREF(dest->names[j].name);
+				READ_SIGNED(step);
+				value= (intmax_t)((uintmax_t) value + (uintmax_t) step);
+				dest->names[j].value= value;
+			}
+			tmp.name_count= (int) n;
 			break;
-		case TYPEDEF_RECORD_FIELD_OTHERTYPE_BIT:
-			READ_TYPEREF(tmp_rec.other_field_type);
+		case TYPEDEF_INT_SELDOM_PAD:
+			READ_VQTY_INT(tmp.pad);
+			break;
+		case TYPEDEF_INT_SELDOM_DELTA:
+			READ_VQTY_INT(tmp.delta);
+			if (tmp.delta > INT_DELTA_ZIGZAG)
+				goto fail_delta;
+			break;
+		case TYPEDEF_INT_SELDOM_SCALE:
+			READ_SIGNED(coef);
+			READ_SIGNED(exp);
+			if (exp < -DECIMAL_EXP_MAX || exp > DECIMAL_EXP_MAX)
+				goto fail_exponent;
+			tmp.scale= typedef_decimal(coef, (int) exp);
+			tmp.has_scale= true;
+			break;
+		case TYPEDEF_INT_SELDOM_BIAS:
+			READ_SIGNED(coef);
+			READ_SIGNED(exp);
+			if (exp < -DECIMAL_EXP_MAX || exp > DECIMAL_EXP_MAX)
+				goto fail_exponent;
+			tmp.bias= typedef_decimal(coef, (int) exp);
+			tmp.has_bias= true;
 			break;
-		default:
-			unimplemented("BUG: unhandled seldom field in record typedef");
 		}
 	}
-	if (!dest_rec) {
-		unimplemented("copy temp fields into final field struct");
+	// If no names were given, the names (if any) come from the parent
+	if (!dest) {
+		n= parent? parent->name_count : 0;
+		if (!(dest= (struct userp_type_int*) scope_typeobj_alloc(scope, sizeof(*dest) + n * sizeof(dest->names[0]))))
+			goto fail_alloc;
+		if (n)
+			memcpy(dest->names, parent->names, n * sizeof(dest->names[0]));
 	}
-	memcpy(dest_rec, &tmp_rec, sizeof(tmp_rec));
-	// dest_rec is completely loaded, but not completely validated at this point.
-	scope->typetable.types[table_idx].name= name;
-	scope->typetable.types[table_idx].parent= parent;
-	scope->typetable.types[table_idx].typeclass= USERP_TYPECLASS_RECORD;
-	scope->typetable.types[table_idx].typeobj= dest_rec;
+	memcpy(dest, &tmp, sizeof(tmp));
+	entry->typeobj= dest;
 	return true;
 
-	CATCH(fail_vqty) {
+	CATCH(fail_count) {
+		userp_diag_setf(&scope->env->err, USERP_ELIMIT,
+			"Integer definition of " USERP_DIAG_COUNT " names exceeds limit", n);
+	}
+	CATCH(fail_delta) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE,
+			"Integer delta mode " USERP_DIAG_SIZE " is not valid", (size_t) tmp.delta);
+	}
+	CATCH(fail_exponent) {
+		userp_diag_set(&scope->env->err, USERP_ETYPE, "Integer scale or bias exponent exceeds limit");
+	}
+	CATCH(fail) {
 		(void)0; // error message is already set, but not dispatched
 	}
-	CATCH(fail_symref) {
-		userp_diag_set(&scope->env->err, USERP_ESYMBOL, "Invalid symbol reference");
+	USERP_DISPATCH_ERR(scope->env);
+	CATCH(fail_alloc) {
+		(void)0; // error message already dispatched
 	}
-	CATCH(fail_typeref) {
-		userp_diag_set(&scope->env->err, USERP_ETYPE, "Invalid type reference");
+	return false;
+}
+
+static bool parse_choice_typedef(struct typedef_parse *p, struct type_entry *entry) {
+	userp_scope scope= p->scope;
+	const struct userp_type_choice *parent= NULL;
+	struct userp_type_choice tmp, *dest= NULL;
+	struct choice_option *opt;
+	uint8_t *value;
+	size_t n, i, opt_flags, len;
+
+	bzero(&tmp, sizeof(tmp));
+	if (!parse_typedef_header(p, entry, TYPEDEF_CHOICE_SELDOM_FIELDS))
+		goto fail;
+	if (p->code & (1<<TYPEDEF_CHOICE_PARENT_BIT)) {
+		if (!(parent= parse_typedef_parent(p, entry)))
+			goto fail;
+		memcpy(&tmp, parent, sizeof(tmp));
+	}
+	if (p->code & (1<<TYPEDEF_CHOICE_OPTIONS_BIT)) {
+		READ_LIST_COUNT(n, 2);
+		if (!(dest= (struct userp_type_choice*) scope_typeobj_alloc(scope, sizeof(*dest) + n * sizeof(dest->options[0]))))
+			goto fail_alloc;
+		for (i= 0; i < n; i++) {
+			opt= &dest->options[i];
+			bzero(opt, sizeof(*opt));
+			READ_VQTY(opt_flags);
+			if (opt_flags == (TYPEDEF_CHOICE_OPT_VALUE|TYPEDEF_CHOICE_OPT_MERGE) || opt_flags > 3)
+				goto fail_option;
+			READ_TYPEREF(opt->type);
+			if (opt_flags & TYPEDEF_CHOICE_OPT_MERGE) {
+				READ_VQTY(opt->merge_ofs);
+				READ_VQTY(opt->merge_count);
+			}
+			else if (opt_flags & TYPEDEF_CHOICE_OPT_VALUE) {
+				READ_LIST_COUNT(len, 1);
+				opt->is_value= true;
+				if (len) {
+					if (!(value= scope_typeobj_alloc(scope, len)))
+						goto fail_alloc;
+					if (!bit_io_copy_bytes(&p->in, value, len))
+						goto fail;
+					opt->value= value;
+					opt->value_len= len;
+				}
+			}
+		}
+		tmp.option_count= n;
+	}
+	for (i= 0; i < p->seldom_count; i++) {
+		switch (p->seldom[i]) {
+		case TYPEDEF_CHOICE_SELDOM_ALIGN: READ_VQTY_INT(tmp.align); break;
+		case TYPEDEF_CHOICE_SELDOM_PAD:   READ_VQTY_INT(tmp.pad); break;
+		}
+	}
+	if (!dest) {
+		n= parent? parent->option_count : 0;
+		if (!(dest= (struct userp_type_choice*) scope_typeobj_alloc(scope, sizeof(*dest) + n * sizeof(dest->options[0]))))
+			goto fail_alloc;
+		// values of the parent's options live in the same arena, so can be shared
+		if (n)
+			memcpy(dest->options, parent->options, n * sizeof(dest->options[0]));
+	}
+	memcpy(dest, &tmp, sizeof(tmp));
+	entry->typeobj= dest;
+	return true;
+
+	CATCH(fail_option) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE,
+			"Invalid header " USERP_DIAG_SIZE " for choice option", opt_flags);
 	}
-	CATCH(fail_seldom_count) {
-		userp_diag_set(&scope->env->err, USERP_ERECORD, "Invalid number of additional fields for record");
+	CATCH(fail) {
+		(void)0; // error message is already set, but not dispatched
+	}
+	USERP_DISPATCH_ERR(scope->env);
+	CATCH(fail_alloc) {
+		(void)0; // error message already dispatched
+	}
+	return false;
+}
+
+static bool parse_array_typedef(struct typedef_parse *p, struct type_entry *entry) {
+	userp_scope scope= p->scope;
+	const struct userp_type_array *parent= NULL;
+	struct userp_type_array tmp, *dest= NULL;
+	size_t n, i;
+
+	bzero(&tmp, sizeof(tmp));
+	if (p->code & (1<<TYPEDEF_ARRAY_RESERVED_BIT)) {
+		userp_diag_set(&scope->env->err, USERP_ETYPE, "Array definition uses a reserved attribute");
+		goto fail;
 	}
-	CATCH(fail_seldom_ref) {
-		userp_diag_set(&scope->env->err, USERP_ERECORD, "Invalid field reference in record");
+	if (!parse_typedef_header(p, entry, TYPEDEF_ARRAY_SELDOM_FIELDS))
+		goto fail;
+	if (p->code & (1<<TYPEDEF_ARRAY_PARENT_BIT)) {
+		if (!(parent= parse_typedef_parent(p, entry)))
+			goto fail;
+		memcpy(&tmp, parent, sizeof(tmp));
 	}
-	CATCH(fail_seldom_ref_dup) {
-		userp_diag_set(&scope->env->err, USERP_ERECORD, "Invalid duplicate field reference in record");
+	if (p->code & (1<<TYPEDEF_ARRAY_ELEM_BIT))
+		READ_TYPEREF(tmp.elem_type);
+	if (p->code & (1<<TYPEDEF_ARRAY_DIMTYPE_BIT))
+		READ_TYPEREF(tmp.dim_type);
+	if (p->code & (1<<TYPEDEF_ARRAY_DIMS_BIT)) {
+		READ_LIST_COUNT(n, 1);
+		if (!(dest= (struct userp_type_array*) scope_typeobj_alloc(scope, sizeof(*dest) + n * sizeof(dest->dimensions[0]))))
+			goto fail_alloc;
+		for (i= 0; i < n; i++)
+			READ_VQTY(dest->dimensions[i]);
+		tmp.dimension_count= n;
 	}
+	for (i= 0; i < p->seldom_count; i++) {
+		switch (p->seldom[i]) {
+		case TYPEDEF_ARRAY_SELDOM_ALIGN: READ_VQTY_INT(tmp.align); break;
+		case TYPEDEF_ARRAY_SELDOM_PAD:   READ_VQTY_INT(tmp.pad); break;
+		}
+	}
+	if (!dest) {
+		n= parent? parent->dimension_count : 0;
+		if (!(dest= (struct userp_type_array*) scope_typeobj_alloc(scope, sizeof(*dest) + n * sizeof(dest->dimensions[0]))))
+			goto fail_alloc;
+		if (n)
+			memcpy(dest->dimensions, parent->dimensions, n * sizeof(dest->dimensions[0]));
+	}
+	memcpy(dest, &tmp, sizeof(tmp));
+	entry->typeobj= dest;
+	return true;
+
+	CATCH(fail) {
+		(void)0; // error message is already set, but not dispatched
+	}
+	USERP_DISPATCH_ERR(scope->env);
+	CATCH(fail_alloc) {
+		(void)0; // error message already dispatched
+	}
+	return false;
+}
+
+static bool parse_record_typedef(struct typedef_parse *p, struct type_entry *entry) {
+	userp_scope scope= p->scope;
+	const struct userp_type_record *parent= NULL;
+	struct userp_type_record tmp, *dest= NULL;
+	size_t n, i, max_fields= scope->env->record_fields_max;
+
+	bzero(&tmp, sizeof(tmp));
+	if (!parse_typedef_header(p, entry, TYPEDEF_RECORD_SELDOM_FIELDS))
+		goto fail;
+	if (p->code & (1<<TYPEDEF_RECORD_PARENT_BIT)) {
+		if (!(parent= parse_typedef_parent(p, entry)))
+			goto fail;
+		memcpy(&tmp, parent, sizeof(tmp));
+	}
+	if (p->code & (1<<TYPEDEF_RECORD_STATICBITS_BIT))
+		READ_VQTY(tmp.static_bits);
+	if (p->code & (1<<TYPEDEF_RECORD_FIELDS_BIT)) {
+		READ_LIST_COUNT(n, 3);
+		if (n > max_fields)
+			goto fail_field_count;
+		// Have enough info now to allocate the struct
+		if (!(dest= (struct userp_type_record*) scope_typeobj_alloc(scope, sizeof(*dest) + n * sizeof(dest->fields[0]))))
+			goto fail_alloc;
+		// Now parse each field
+		for (i= 0; i < n; i++) {
+			READ_SYMREF(dest->fields[i].name);
+			READ_TYPEREF(dest->fields[i].type);
+			READ_VQTY(dest->fields[i].placement);
+		}
+		tmp.field_count= n;
+	}
+	for (i= 0; i < p->seldom_count; i++) {
+		switch (p->seldom[i]) {
+		case TYPEDEF_RECORD_SELDOM_ALIGN:     READ_VQTY_INT(tmp.align); break;
+		case TYPEDEF_RECORD_SELDOM_PAD:       READ_VQTY_INT(tmp.pad); break;
+		case TYPEDEF_RECORD_SELDOM_OTHERTYPE: READ_TYPEREF(tmp.other_field_type); break;
+		}
+	}
+	if (!dest) {
+		n= parent? parent->field_count : 0;
+		if (!(dest= (struct userp_type_record*) scope_typeobj_alloc(scope, sizeof(*dest) + n * sizeof(dest->fields[0]))))
+			goto fail_alloc;
+		if (n)
+			memcpy(dest->fields, parent->fields, n * sizeof(dest->fields[0]));
+	}
+	// Count the fields of each placement, for the decoder
+	tmp.static_field_count= tmp.always_field_count= tmp.often_field_count= tmp.seldom_field_count= 0;
+	for (i= 0; i < tmp.field_count; i++) {
+		switch (FIELD_PLACEMENT(dest->fields[i].placement)) {
+		case FIELD_PLACEMENT_STATIC: tmp.static_field_count++; break;
+		case FIELD_PLACEMENT_ALWAYS: tmp.always_field_count++; break;
+		case FIELD_PLACEMENT_OFTEN:  tmp.often_field_count++; break;
+		case FIELD_PLACEMENT_SELDOM: tmp.seldom_field_count++; break;
+		}
+	}
+	memcpy(dest, &tmp, sizeof(tmp));
+	// dest is completely loaded, but the field types are not validated until they are used.
+	entry->typeobj= dest;
+	return true;
+
 	CATCH(fail_field_count) {
 		userp_diag_setf(&scope->env->err, USERP_ELIMIT,
 			"Record definition of " USERP_DIAG_COUNT " fields exceeds maximum of " USERP_DIAG_COUNT2,
 			(size_t) n, (size_t) max_fields);
 	}
+	CATCH(fail) {
+		(void)0; // error message is already set, but not dispatched
+	}
 	USERP_DISPATCH_ERR(scope->env);
 	CATCH(fail_alloc) {
 		(void)0; // error message already dispatched
 	}
-	return NULL;
-}	
-
-//#define TYPEDEF_ANY_SELBASE     0
-//#define TYPEDEF_ANY_SELBITS     1
-//#define TYPEDEF_SYMREF_SELBASE  (TYPEDEF_ANY_SELBASE+(1<<TYPEDEF_ANY_SELBITS))
-//#define TYPEDEF_SYMREF_SELBITS  1
-//#define TYPEDEF_TYPEREF_SELBASE (TYPEDEF_SYMREF_SELBASE+(1<<TYPEDEF_SYMREF_SELBITS))
-//#define TYPEDEF_TYPEREF_SELBITS 1
-//#define TYPEDEF_INTEGER_SELBASE (TYPEDEF_TYPEREF_SELBASE+(1<<TYPEDEF_TYPEREF_SELBITS))
-//#define TYPEDEF_INTEGER_SELBITS 6
-//#define TYPEDEF_CHOICE_SELBASE  (TYPEDEF_INTEGER_SELBASE+(1<<TYPEDEF_INTEGER_SELBITS))
-//#define TYPEDEF_CHOICE_SELBITS  3
-//#define TYPEDEF_ARRAY_SELBASE   (TYPEDEF_CHOICE_SELBASE+(1<<TYPEDEF_CHOICE_SELBITS))
-//#define TYPEDEF_ARRAY_SELBITS   6
-//#define TYPEDEF_RECORD_SELBASE  (TYPEDEF_ARRAY_OFS+(1<<TYPEDEF_ARRAY_SELBITS))
-//#define TYPEDEF_RECORD_SELBITS  (1+TYPEDEF_RECORD_OFTEN_FIELDS)
-//bool parse_typedef(userp_scope scope, struct userp_bit_io *in) {
-//	if (in->pos >
-//	unsigned code= *pos++;
-//	if (code >= TYPEDEF_RECORD_OFS) {
-//		code -= TYPEDEF_RECORD_OFS;
-//		return parse_record_typedef(scope, in);
-//	} else if (code >= TYPEDEF_ARRAY_OFS) {
-//		unimplemented("parse array");
-//	} else if (code >= TYPEDEF_CHOICE_OFS) {
-//		unimplemented("parse choice");
-//	} else if (code >= TYPEDEF_INTEGER_OFS) {
-//		code -= TYPEDEF_INTEGER_OFS;
-//		// Fields: name, bit0? n_seldom, bit1? parent, bit2? align, bit3? bits, bit4? bswap, bit5? min
-//		unimplemented("parse integer");
-//	} else if (code >= TYPEDEF_TYPEREF_OFS) {
-//		unimplemented("parse typeref");
-//	} else if (code >= TYPEDEF_SYMREF_OFS) {
-//		unimplemented("parse symref");
-//	} else /* if (*pos >= TYPEDEF_ANY_OFS) */ {
-//		unimplemented("parse typeany");
-//	}
-//}
+	return false;
+}
+
+// Parse one type definition into entry.  Any error is dispatched.
+static bool parse_typedef(struct typedef_parse *p, struct type_entry *entry) {
+	userp_scope scope= p->scope;
+	size_t code;
+
+	if (!userp_decode_vqty_quick(&code, &p->in)) {
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	if (code >= TYPEDEF_SELECTOR_LIMIT) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE, "Unknown type definition selector " USERP_DIAG_SIZE, code);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	if (code >= TYPEDEF_RECORD_SELBASE) {
+		p->code= code - TYPEDEF_RECORD_SELBASE;
+		entry->typeclass= TYPE_CLASS_RECORD;
+		return parse_record_typedef(p, entry);
+	}
+	if (code >= TYPEDEF_ARRAY_SELBASE) {
+		p->code= code - TYPEDEF_ARRAY_SELBASE;
+		entry->typeclass= TYPE_CLASS_ARRAY;
+		return parse_array_typedef(p, entry);
+	}
+	if (code >= TYPEDEF_CHOICE_SELBASE) {
+		p->code= code - TYPEDEF_CHOICE_SELBASE;
+		entry->typeclass= TYPE_CLASS_CHOICE;
+		return parse_choice_typedef(p, entry);
+	}
+	if (code >= TYPEDEF_INTEGER_SELBASE) {
+		p->code= code - TYPEDEF_INTEGER_SELBASE;
+		entry->typeclass= TYPE_CLASS_INT;
+		return parse_int_typedef(p, entry);
+	}
+	if (code >= TYPEDEF_TYPEREF_SELBASE) {
+		p->code= code - TYPEDEF_TYPEREF_SELBASE;
+		entry->typeclass= TYPE_CLASS_TYPE;
+	}
+	else if (code >= TYPEDEF_SYMREF_SELBASE) {
+		p->code= code - TYPEDEF_SYMREF_SELBASE;
+		entry->typeclass= TYPE_CLASS_SYM;
+	}
+	else {
+		p->code= code - TYPEDEF_ANY_SELBASE;
+		entry->typeclass= TYPE_CLASS_ANY;
+	}
+	return parse_basic_typedef(p, entry);
+}
+
+/*APIDOC
+
+#### userp_scope_parse_types
+
+    struct userp_bstr_part parts[]= { ... }
+    // parse an exact number of types
+    if (!userp_scope_parse_types(scope, parts, part_count, type_count, flags)) { ... }
+    // parse however many types are found in the buffers
+    if (!userp_scope_parse_types(scope, parts, part_count, 0, flags)) { ... }
+
+This method parses a type table (see "Type Table Encoding") from one or more buffers, and adds
+the types to the scope.  The buffers may be part of a `userp_bstr` or you can allocate them on
+the stack, and a definition may be split across buffers.  The types do not refer to the buffers
+afterward.  If `type_count` is not zero, this function parses exactly that number of types, and
+the definitions may refer forward to any type in the table.  If `type_count` is zero, this parses
+types until the end of the input.
+
+Each type name may only be defined once per scope.  On any error, the types added by this call
+are removed from the scope and it returns false.
+
+*/
+
+bool userp_scope_parse_types(userp_scope scope, struct userp_bstr_part *parts, size_t part_count, int type_count, int flags) {
+	userp_env env= scope->env;
+	struct userp_bstr str= { .parts= parts, .part_count= part_count, .part_alloc= 0, .env= env };
+	struct typedef_parse parse;
+	struct type_entry *entry;
+	userp_type id, last_id;
+	size_t n, orig_used, orig_count;
+
+	// If scope is finalized, emit an error
+	if (scope->is_final) {
+		userp_diag_set(&env->err, USERP_ESCOPEFINAL, "Can't add types to a finalized scope");
+		USERP_DISPATCH_ERR(env);
+		return false;
+	}
+	if (type_count < 0) {
+		userp_diag_set(&env->err, USERP_EDOINGITWRONG, "Negative type_count");
+		USERP_DISPATCH_ERR(env);
+		return false;
+	}
+	// ensure type vector has type_count slots available (if type_count provided)
+	// scope_typetable_alloc needs to be called regardless, if typetable not initialized yet.
+	n= scope->typetable.used + (type_count? type_count : 1);
+	if (n > scope->typetable.alloc)
+		if (!scope_typetable_alloc(scope, n))
+			return false;
+	bzero(&parse, sizeof(parse));
+	parse.scope= scope;
+	parse.in.str= &str;
+	if (part_count) {
+		parse.in.part= parts;
+		parse.in.pos= parts[0].data;
+		parse.in.lim= parts[0].data + parts[0].len;
+	}
+	// Record the original status of the type table, to be able to revert changes
+	orig_used= scope->typetable.used;
+	orig_count= scope->type_count;
+	last_id= scope->typetable.id_offset + orig_used + type_count - 1;
+	while (type_count? scope->typetable.used - orig_used < (size_t) type_count : !userp_bit_io_at_end(&parse.in)) {
+		if (scope->typetable.used >= scope->typetable.alloc)
+			if (!scope_typetable_alloc(scope, scope->typetable.used + 1 /* gets rounded up */))
+				goto failure;
+		entry= scope->typetable.types + scope->typetable.used;
+		bzero(entry, sizeof(*entry));
+		id= scope->typetable.id_offset + scope->typetable.used;
+		// A type can refer to itself, and to later types if the size of the table is known
+		parse.type_limit= id > last_id? id : last_id;
+		if (!parse_typedef(&parse, entry))
+			goto failure;
+		// Check for a duplicate name, among the types added so far
+		if (entry->name) {
+			if (!userp_typetable_index_names(&scope->typetable, env))
+				goto failure;
+			if (userp_typetable_get_by_name(&scope->typetable, entry->name)) {
+				userp_diag_setf(&env->err, USERP_ETYPE,
+					"Type " USERP_DIAG_INDEX " has the same name as a previous type in this scope",
+					(int) id);
+				USERP_DISPATCH_ERR(env);
+				goto failure;
+			}
+		}
+		scope->typetable.used++;
+		scope->type_count++;
+	}
+	// The new types might mask cached results from parent scopes
+	bzero(scope->type_cache, sizeof(scope->type_cache));
+	return true;
+
+	CATCH(failure) {
+		// Anything allocated in typeobjects stays there until the scope is freed
+		scope->typetable.used= orig_used;
+		scope->type_count= orig_count;
+		if (scope->typetable.name_indexed > orig_used) {
+			bzero(scope->typetable.name_index, (scope->typetable.name_index_mask + 1) * sizeof(uint32_t));
+			scope->typetable.name_indexed= 0;
+		}
+		bzero(scope->type_cache, sizeof(scope->type_cache));
+	}
+	return false;
+}
+
+/*APIDOC
+
+#### userp_scope_add_float_types
+
+    if (!userp_scope_add_float_types(scope)) { ... }
+    userp_type f32= userp_scope_type_by_name(scope, "Float32", 0);
+
+Add the types Float32 and Float64 to a scope which is not yet final.  Each is a record of
+unsigned fields `sig`, `exp`, and `sign` in static positions that match the IEEE-754 binary32
+and binary64 formats bit for bit, so the encoded record is the same 4 or 8 bytes as the
+little-endian native `float` or `double`.  The decoder recognizes that layout (in any type, not
+just these) and reads such values and arrays of them without assembling fields; see "IEEE-754
+Floats".  These are the definitions that the stream protocol's builtin scope provides.
+
+*/
+
+bool userp_scope_add_float_types(userp_scope scope) {
+	// bits of the sign, exponent, and mantissa of binary32 and binary64
+	static const uint8_t field_bits[5]= { 1, 8, 23, 11, 52 };
+	static const char *field_names[3]= { "sign", "exp", "sig" };
+	userp_symbol sym[3], name[2];
+	userp_type first= scope->type_count + 1, ref[3];
+	uint8_t buf[256], *p= buf;
+	struct userp_bstr_part part;
+	int i, j;
+
+	if (!(name[0]= userp_scope_get_symbol(scope, "Float32", USERP_CREATE))
+		|| !(name[1]= userp_scope_get_symbol(scope, "Float64", USERP_CREATE)))
+		return false;
+	for (i= 0; i < 3; i++)
+		if (!(sym[i]= userp_scope_get_symbol(scope, field_names[i], USERP_CREATE)))
+			return false;
+	// Types first+0 .. first+4 are the anonymous unsigned fields
+	for (i= 0; i < 5; i++) {
+		p= userp_encode_vqty(p, TYPEDEF_INTEGER_SELBASE + (1<<TYPEDEF_INT_BITS_BIT) + (1<<TYPEDEF_INT_MIN_BIT));
+		p= userp_encode_vqty(p, 0);
+		p= userp_encode_vqty(p, field_bits[i]);
+		p= userp_encode_vqty(p, 0);
+	}
+	// Then the records, with the sign in the top bit and the mantissa at bit 0
+	for (i= 0; i < 2; i++) {
+		ref[0]= first;
+		ref[1]= first + (i? 3 : 1);
+		ref[2]= first + (i? 4 : 2);
+		p= userp_encode_vqty(p, TYPEDEF_RECORD_SELBASE + (1<<TYPEDEF_RECORD_STATICBITS_BIT) + (1<<TYPEDEF_RECORD_FIELDS_BIT));
+		p= userp_encode_vqty(p, (uint64_t) name[i] << 1);
+		p= userp_encode_vqty(p, i? 64 : 32);
+		p= userp_encode_vqty(p, 3);
+		for (j= 0; j < 3; j++) {
+			p= userp_encode_vqty(p, (uint64_t) sym[j] << 1);
+			p= userp_encode_vqty(p, (uint64_t) ref[j] << 1);
+			p= userp_encode_vqty(p, ((uint64_t)(j == 0? (i? 63 : 31) : j == 1? (i? 52 : 23) : 0) << 2)
+				| FIELD_PLACEMENT_STATIC);
+		}
+	}
+	part.data= buf;
+	part.len= p - buf;
+	part.ofs= 0;
+	part.buf= NULL;
+	return userp_scope_parse_types(scope, &part, 1, 7, 0);
+}
+
+/*IMPLDOC
+
+### Decode Plans
+
+    const struct type_plan *plan= userp_scope_get_type_plan(scope, type);
+
+Rather than have the decoder rediscover from the type object how to read each value, each type
+is compiled once into a `struct type_plan`.  The plan has one operation code for the decoder to
+dispatch on, with everything else about the encoding resolved in advance:
+
+  * Integers become fixed-width two's complement, fixed-width offset, or variable-length
+    quantity (signed, or offset up from min or down from max).  `min` and `max` without
+    `bits` become a fixed width of just enough bits for the range.
+  * A record's fields are sorted into groups of static, always, often, and seldom, each with
+    the plan of its type.  If there are no optional fields and every field has a fixed size,
+    the record is PLAN_RECORD_FIXED and every field has a bit offset from the record start.
+  * A choice's options each get the range of selector values that choose them.
+  * An array with a fixed element size and fixed dimensions has a fixed size.
+
+Any plan with a fixed size has the flag PLAN_FIXED and `fixed_bits`, so the decoder can skip
+it in one step.  A fixed record whose bytes are exactly those of a C struct on this host (native
+integers and floats at byte offsets, with no gaps) also gets PLAN_HOST_LAYOUT, so the encoder
+can copy such structs whole.
+
+`userp_scope_finalize` compiles the plans of all types in the scope, so the plans of a parent
+scope are always available.  In a scope that isn't final, plans are compiled on first use, in
+order of type ID, so that back-references (the common case) never recurse more than one level.
+A type that refers to itself (or to a type referring back to it) sees the incomplete plan with
+flag PLAN_COMPILING, and is treated as having a variable size.  Plans are allocated from the
+typeobjects arena of the scope that defines the type, and so last as long as the type does.
+
+*/
+
+#define PLAN_DEPTH_MAX 256
+#define PLAN_OFTEN_FIELDS_MAX 32
+
+static struct type_plan* scope_compile_plan(userp_scope scope, struct type_entry *entry, userp_type type, int depth);
+
+// Get the plan of a referenced type, compiling it if needed.  Any error is dispatched.
+static const struct type_plan* scope_plan_ref(userp_scope scope, userp_type type, int depth) {
+	struct type_entry *entry= userp_scope_get_type_entry(scope, type);
+	if (!entry) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE, "Invalid type reference " USERP_DIAG_INDEX, (int) type);
+		USERP_DISPATCH_ERR(scope->env);
+		return NULL;
+	}
+	return entry->plan? entry->plan : scope_compile_plan(scope, entry, type, depth + 1);
+}
+
+static bool scope_plan_int(struct type_plan *plan, const struct userp_type_int *ti) {
+	uintmax_t range;
+	plan->align= ti->align;
+	plan->pad= ti->pad;
+	if (ti->has_bits || (ti->has_min && ti->has_max)) {
+		if (ti->has_bits)
+			plan->bits= ti->bits;
+		else // just enough bits for the range
+			for (range= (uintmax_t) ti->max - (uintmax_t) ti->min; range; range >>= 1)
+				plan->bits++;
+		plan->op= (ti->has_min || ti->has_max)? PLAN_INT_BITS : PLAN_INT_TWOS;
+		plan->flags |= PLAN_FIXED;
+		plan->fixed_bits= plan->bits;
+		if (ti->has_bswap && ti->bswap)
+			plan->flags |= PLAN_BSWAP;
+	}
+	else
+		plan->op= (ti->has_min || ti->has_max)? PLAN_INT_VQTY : PLAN_INT_VQTY_SIGNED;
+	if (ti->has_min)
+		plan->base= ti->min;
+	else if (ti->has_max) {
+		plan->base= ti->max;
+		plan->flags |= PLAN_DESCENDING;
+	}
+	if (ti->delta)
+		plan->flags |= ti->delta == INT_DELTA_ZIGZAG? PLAN_DELTA | PLAN_DELTA_ZIGZAG : PLAN_DELTA;
+	if (ti->has_scale || ti->has_bias) {
+		plan->flags |= PLAN_SCALED;
+		plan->scale= ti->has_scale? ti->scale : 1;
+		plan->bias= ti->has_bias? ti->bias : 0;
+	}
+	return true;
+}
+
+static bool scope_plan_choice(userp_scope scope, struct type_plan *plan, const struct userp_type_choice *tc, int depth) {
+	const struct choice_option *opt;
+	struct plan_option *popt;
+	size_t i, sel= 0;
+	plan->op= PLAN_CHOICE;
+	plan->align= tc->align;
+	plan->pad= tc->pad;
+	plan->options= (struct plan_option*) (plan + 1);
+	plan->member_count= tc->option_count;
+	for (i= 0; i < tc->option_count; i++) {
+		opt= &tc->options[i];
+		popt= &plan->options[i];
+		popt->index= i;
+		popt->sel_start= sel;
+		popt->merged= !opt->is_value && opt->merge_count > 0;
+		popt->merge_ofs= popt->merged? opt->merge_ofs : 0;
+		popt->sel_count= popt->merged? opt->merge_count : 1;
+		if (!opt->is_value && !(popt->plan= scope_plan_ref(scope, opt->type, depth)))
+			return false;
+		sel += popt->sel_count;
+	}
+	return true;
+}
+
+static bool scope_plan_array(userp_scope scope, struct type_plan *plan, const struct userp_type_array *ta, int depth) {
+	size_t i, count= 1, size, stride;
+	plan->op= PLAN_ARRAY;
+	plan->align= ta->align;
+	plan->pad= ta->pad;
+	if (ta->elem_type && !(plan->elem= scope_plan_ref(scope, ta->elem_type, depth)))
+		return false;
+	if (ta->dim_type && !(plan->dim= scope_plan_ref(scope, ta->dim_type, depth)))
+		return false;
+	// The element count is known if there are dimensions and none are given in the data
+	for (i= 0; i < ta->dimension_count && count; i++)
+		count= SIZET_MUL_CAN_OVERFLOW(count, ta->dimensions[i])? 0 : count * ta->dimensions[i];
+	plan->elem_count= ta->dimension_count? count : 0;
+	if (plan->elem && (plan->elem->flags & PLAN_FIXED)) {
+		// Each element (with its padding) begins aligned, so the stride is its size rounded up
+		size= plan->elem->fixed_bits + plan->elem->pad * 8;
+		stride= !plan->elem->align? size
+			: (size + ((size_t)1 << plan->elem->align) - 1) & ~(((size_t)1 << plan->elem->align) - 1);
+		plan->elem_stride= stride;
+		if (plan->elem_count && !SIZET_MUL_CAN_OVERFLOW(stride, plan->elem_count)) {
+			plan->flags |= PLAN_FIXED;
+			plan->fixed_bits= stride * (plan->elem_count - 1) + size;
+			if (plan->elem->align > plan->align)
+				plan->align= plan->elem->align;
+		}
+	}
+	return true;
+}
+
+// A fixed record of exactly three unsigned fields, the mantissa at bit 0, the exponent above
+// it, and the sign in the top bit, has the bits of a little-endian IEEE-754 float.
+static bool scope_plan_is_ieee_float(const struct type_plan *plan) {
+	static const uint8_t layout[2][3]= { { 23, 8, 1 }, { 52, 11, 1 } };
+	const struct type_plan *fp;
+	const uint8_t *bits;
+	size_t i, j, ofs;
+	if (plan->member_count != 3 || plan->pad || (plan->fixed_bits != 32 && plan->fixed_bits != 64))
+		return false;
+	bits= layout[plan->fixed_bits == 64];
+	for (i= 0, ofs= 0; i < 3; ofs += bits[i++]) {
+		for (j= 0; j < 3 && plan->fields[j].ofs != ofs; j++);
+		if (j == 3)
+			return false;
+		fp= plan->fields[j].plan;
+		if (fp->op != PLAN_INT_BITS || fp->bits != bits[i] || fp->base != 0
+			|| fp->flags != PLAN_FIXED || fp->align || fp->pad)
+			return false;
+	}
+	return true;
+}
+
+// Whether a fixed record has the layout of a C struct on this host: every field is a native
+// integer, float, or such a record, at a byte offset, and together they cover every byte.
+static bool scope_plan_is_host_layout(const struct type_plan *plan) {
+	const struct plan_field *pf;
+	const struct type_plan *fp;
+	size_t i, j, covered= 0;
+	if (plan->flags & PLAN_IEEE_FLOAT)
+		return ENDIAN == LSB_FIRST;
+	if (plan->fixed_bits & 7)
+		return false;
+	for (i= 0; i < plan->member_count; i++) {
+		pf= &plan->fields[i];
+		fp= pf->plan;
+		if ((pf->ofs & 7) || fp->pad)
+			return false;
+		switch (fp->op) {
+		case PLAN_INT_BITS:
+			if (fp->base || (fp->flags & PLAN_DESCENDING))
+				return false;
+			// an unsigned native int, otherwise the same as two's complement
+		case PLAN_INT_TWOS:
+			if ((fp->bits != 8 && fp->bits != 16 && fp->bits != 32 && fp->bits != 64)
+				|| (fp->flags & PLAN_DELTA_ZIGZAG)
+				|| (fp->bits > 8 && ((fp->flags & PLAN_BSWAP) != 0) == (ENDIAN == LSB_FIRST)))
+				return false;
+			break;
+		case PLAN_RECORD_FIXED:
+			if (!(fp->flags & PLAN_HOST_LAYOUT))
+				return false;
+			break;
+		default:
+			return false;
+		}
+		// Static fields may overlap
+		for (j= 0; j < i; j++)
+			if (pf->ofs < plan->fields[j].ofs + plan->fields[j].plan->fixed_bits
+				&& plan->fields[j].ofs < pf->ofs + fp->fixed_bits)
+				return false;
+		covered += fp->fixed_bits;
+	}
+	return covered == plan->fixed_bits;
+}
+
+static bool scope_plan_record(userp_scope scope, struct type_plan *plan, const struct userp_type_record *tr, int depth) {
+	struct plan_field *pf;
+	size_t i, next[4], end, pos;
+	bool fixed;
+	plan->op= PLAN_RECORD;
+	plan->align= tr->align;
+	plan->pad= tr->pad;
+	plan->fields= (struct plan_field*) (plan + 1);
+	plan->member_count= tr->field_count;
+	plan->always_count= tr->always_field_count;
+	plan->often_count= tr->often_field_count;
+	plan->seldom_count= tr->seldom_field_count;
+	// The presence flags of often-fields are decoded as a single quantity
+	if (tr->often_field_count > PLAN_OFTEN_FIELDS_MAX) {
+		userp_diag_setf(&scope->env->err, USERP_ELIMIT,
+			"Record has " USERP_DIAG_COUNT " often-fields, but the limit is " USERP_DIAG_COUNT2,
+			tr->often_field_count, (size_t) PLAN_OFTEN_FIELDS_MAX);
+		USERP_DISPATCH_ERR(scope->env);
+		return false;
+	}
+	if (tr->other_field_type && !(plan->other= scope_plan_ref(scope, tr->other_field_type, depth)))
+		return false;
+	// Sort the fields into groups of static, always, often, seldom, preserving their order
+	next[FIELD_PLACEMENT_STATIC]= 0;
+	next[FIELD_PLACEMENT_ALWAYS]= tr->static_field_count;
+	next[FIELD_PLACEMENT_OFTEN]= next[FIELD_PLACEMENT_ALWAYS] + tr->always_field_count;
+	next[FIELD_PLACEMENT_SELDOM]= next[FIELD_PLACEMENT_OFTEN] + tr->often_field_count;
+	plan->static_bits= tr->static_bits;
+	for (i= 0; i < tr->field_count; i++) {
+		pf= &plan->fields[ next[FIELD_PLACEMENT(tr->fields[i].placement)]++ ];
+		pf->name= tr->fields[i].name;
+		pf->index= i;
+		if (!(pf->plan= scope_plan_ref(scope, tr->fields[i].type, depth)))
+			return false;
+		if (FIELD_PLACEMENT(tr->fields[i].placement) == FIELD_PLACEMENT_STATIC) {
+			if (!(pf->plan->flags & PLAN_FIXED)) {
+				userp_diag_setf(&scope->env->err, USERP_ERECORD,
+					"Static field " USERP_DIAG_INDEX " of record must have a fixed-size type", (int) i);
+				USERP_DISPATCH_ERR(scope->env);
+				return false;
+			}
+			pf->ofs= FIELD_STATIC_OFS(tr->fields[i].placement);
+			end= pf->ofs + pf->plan->fixed_bits;
+			if (end > plan->static_bits)
+				plan->static_bits= end;
+		}
+	}
+	// If every field is present and has a fixed size, each has a fixed offset
+	fixed= !tr->often_field_count && !tr->seldom_field_count && !tr->other_field_type;
+	for (i= tr->static_field_count, pos= plan->static_bits; fixed && i < tr->static_field_count + tr->always_field_count; i++) {
+		pf= &plan->fields[i];
+		if (!(pf->plan->flags & PLAN_FIXED))
+			fixed= false;
+		else {
+			if (pf->plan->align) {
+				pos= (pos + ((size_t)1 << pf->plan->align) - 1) & ~(((size_t)1 << pf->plan->align) - 1);
+				if (pf->plan->align > plan->align)
+					plan->align= pf->plan->align;
+			}
+			pf->ofs= pos;
+			pos += pf->plan->fixed_bits + pf->plan->pad * 8;
+		}
+	}
+	if (fixed) {
+		plan->op= PLAN_RECORD_FIXED;
+		plan->flags |= PLAN_FIXED;
+		plan->fixed_bits= pos;
+		if (scope_plan_is_ieee_float(plan))
+			plan->flags |= PLAN_IEEE_FLOAT;
+		if (scope_plan_is_host_layout(plan))
+			plan->flags |= PLAN_HOST_LAYOUT;
+	}
+	return true;
+}
+
+static struct type_plan* scope_compile_plan(userp_scope scope, struct type_entry *entry, userp_type type, int depth) {
+	struct type_plan *plan;
+	size_t n= 0;
+	bool ok= true;
+	userp_scope owner= scope;
+
+	if (depth > PLAN_DEPTH_MAX) {
+		userp_diag_setf(&scope->env->err, USERP_ELIMIT,
+			"Type " USERP_DIAG_INDEX " is nested more than " USERP_DIAG_COUNT " levels deep",
+			(int) type, (size_t) PLAN_DEPTH_MAX);
+		USERP_DISPATCH_ERR(scope->env);
+		return NULL;
+	}
+	// The plan lives as long as the scope which defined the type
+	while (!owner->has_types || type < owner->typetable.id_offset)
+		owner= owner->parent;
+	if (entry->typeclass == TYPE_CLASS_RECORD)
+		n= ((struct userp_type_record*) entry->typeobj)->field_count * sizeof(struct plan_field);
+	else if (entry->typeclass == TYPE_CLASS_CHOICE)
+		n= ((struct userp_type_choice*) entry->typeobj)->option_count * sizeof(struct plan_option);
+	if (!(plan= (struct type_plan*) scope_typeobj_alloc(owner, sizeof(*plan) + n)))
+		return NULL;
+	bzero(plan, sizeof(*plan) + n);
+	plan->type= type;
+	plan->typeobj= entry->typeobj;
+	plan->flags= PLAN_COMPILING;
+	entry->plan= plan;
+	if (entry->typeobj) {
+		switch (entry->typeclass) {
+		case TYPE_CLASS_ANY:    plan->op= PLAN_ANY; break;
+		case TYPE_CLASS_TYPE:   plan->op= PLAN_TYPEREF; break;
+		case TYPE_CLASS_SYM:    plan->op= PLAN_SYMREF; break;
+		case TYPE_CLASS_INT:    ok= scope_plan_int(plan, (struct userp_type_int*) entry->typeobj); break;
+		case TYPE_CLASS_CHOICE: ok= scope_plan_choice(scope, plan, (struct userp_type_choice*) entry->typeobj, depth); break;
+		case TYPE_CLASS_ARRAY:  ok= scope_plan_array(scope, plan, (struct userp_type_array*) entry->typeobj, depth); break;
+		case TYPE_CLASS_RECORD: ok= scope_plan_record(scope, plan, (struct userp_type_record*) entry->typeobj, depth); break;
+		}
+		if (plan->op <= PLAN_SYMREF) {
+			plan->align= ((struct userp_type_basic*) entry->typeobj)->align;
+			plan->pad= ((struct userp_type_basic*) entry->typeobj)->pad;
+		}
+	}
+	if (!ok) {
+		// Leave it uncompiled, so the error happens again on the next attempt
+		entry->plan= NULL;
+		return NULL;
+	}
+	plan->flags &= ~PLAN_COMPILING;
+	return plan;
+}
+
+// Compile the plans of all local types up to and including types[limit-1]
+static bool scope_compile_plans(userp_scope scope, size_t limit) {
+	struct userp_typetable *tt= &scope->typetable;
+	for (; tt->planned < limit; tt->planned++)
+		if (!tt->types[tt->planned].plan
+			&& !scope_compile_plan(scope, &tt->types[tt->planned], tt->id_offset + tt->planned, 0))
+			return false;
+	return true;
+}
+
+const struct type_plan* userp_scope_get_type_plan(userp_scope scope, userp_type type) {
+	struct type_entry *entry= userp_scope_get_type_entry(scope, type);
+	if (!entry) {
+		userp_diag_setf(&scope->env->err, USERP_ETYPE, "Invalid type reference " USERP_DIAG_INDEX, (int) type);
+		USERP_DISPATCH_ERR(scope->env);
+		return NULL;
+	}
+	if (entry->plan)
+		return entry->plan;
+	// Compile in order of ID, so that references to earlier types are already compiled
+	if (scope->has_types && type >= scope->typetable.id_offset
+		&& !scope_compile_plans(scope, type - scope->typetable.id_offset))
+		return NULL;
+	return scope_compile_plan(scope, entry, type, 0);
+}
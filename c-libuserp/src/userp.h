@@ -53,6 +53,8 @@ struct userp_bstr;
 #define USERP_MSG_SYMTABLE_HASHTREE_REBUILD 0x0003
 #define USERP_MSG_CREATE                    0x0004
 #define USERP_MSG_DESTROY                   0x0005
+#define USERP_MSG_SYMTABLE_SWISS_ALLOC      0x0006
+#define USERP_MSG_SCOPE_PERFECT_HASH        0x0007
 
 extern int    userp_diag_get_code(userp_diag diag);
 extern bool   userp_diag_get_buffer(userp_diag diag, userp_buffer *buf_p, size_t *pos_p, size_t *len_p);
@@ -80,9 +82,12 @@ typedef void userp_diag_fn(void *callback_data, userp_diag diag, int diag_code);
 
 extern bool userp_alloc(userp_env env, void **pointer, size_t new_size, userp_alloc_flags flags);
 
+#define USERP_ENV_ARENA               0x0001
+
 extern userp_env userp_new_env(userp_alloc_fn alloc_callback, userp_diag_fn diag_callback, void *callback_data, userp_env_flags flags);
 extern bool userp_grab_env(userp_env env);
 extern bool userp_drop_env(userp_env env);
+extern void userp_env_reset_arena(userp_env env);
 
 
 #define USERP_LOG_LEVEL               0x0001
@@ -100,6 +105,23 @@ extern bool userp_drop_env(userp_env env);
 #define USERP_TRUNCATE_INTO_INT            3
 #define USERP_TRUNCATE_INTO_FLOAT          4
 
+#define USERP_SYMTABLE_INDEX          0x0003
+
+#define USERP_SYMTABLE_HASHTREE            1
+#define USERP_SYMTABLE_SWISS               2
+
+#define USERP_SYMTABLE_SWISS_MIN      0x0004
+
+#define USERP_MAP_WINDOW              0x0005
+#define USERP_BUFFER_POOL_MAX         0x0006
+#define USERP_ENC_OUTPUT_BUFSIZE_MAX  0x0007
+#define USERP_ALLOCATOR               0x0008
+
+#define USERP_ALLOCATOR_DIRECT             1
+#define USERP_ALLOCATOR_ARENA              2
+
+#define USERP_ARENA_CHUNK             0x0009
+
 void userp_env_set_attr(userp_env env, int attr_id, size_t value);
 
 extern void userp_file_logger(void *callback_data, userp_diag diag, int code);
@@ -120,6 +142,13 @@ extern userp_diag userp_env_get_last_error(userp_env env);
 // Need to copy data into a single span of memory / bstr part
 #define USERP_CONTIGUOUS           0x008000
 
+// when the last reference is dropped, park buf and its data in the env's pool for reuse
+#define USERP_BUFFER_POOLED        0x040000
+
+// madvise() hints for userp_bstr_map_file
+#define USERP_MAP_SEQUENTIAL       0x010000
+#define USERP_MAP_WILLNEED         0x020000
+
 typedef bool userp_reader_fn(void *callback_data, struct userp_bstr* buffers, size_t bytes_needed, userp_env env);
 typedef void userp_buffer_destructor(void *callback_data, userp_buffer *buf);
 
@@ -173,6 +202,8 @@ struct userp_buffer {
 	size_t                   refcnt;    // if nonzero, this buffer is reference-counted
 	size_t                   alloc_len; // if nonzero, how much memory is valid starting at 'data'
 	userp_buffer_flags       flags;
+	userp_buffer_destructor *destructor; // if set, called when the last reference is dropped
+	void *                   destructor_data;
 };
 #define USERP_FIELD_OFFSET(type,field) ((int)( ((int)&(((type*)64)->field)) - 64 ))
 #define USERP_GET_BUFFER_FROM_DATA_PTR(data_ptr) ((userp_buffer)( ((char*)data_ptr) - USERP_FIELD_OFFSET(struct userp_buffer, data) ))
@@ -202,16 +233,46 @@ static inline void userp_bstr_destroy(struct userp_bstr *str) { userp_bstr_parta
 
 //extern userp_bstr userp_new_bstr(userp_env env, int part_alloc_count);
 //extern void userp_free_bstr(userp_bstr *str);
-//extern bool userp_bstr_append_stream(userp_bstr *str, FILE *f, int64_t length);
-//extern bool userp_bstr_map_file(userp_bstr *str, FILE *f, int64_t offset, int64_t length);
+extern bool userp_bstr_append_file(struct userp_bstr *str, int fd, size_t length);
+extern bool userp_bstr_map_file(struct userp_bstr *str, int fd, int64_t offset, int64_t length, int flags);
+
+struct userp_fd_reader;
+extern struct userp_fd_reader* userp_new_fd_reader(userp_env env, int fd, size_t bufsize_max);
+extern struct userp_fd_reader* userp_new_file_reader(userp_env env, FILE *f, size_t bufsize_max);
+extern void userp_free_fd_reader(struct userp_fd_reader *rd);
+extern userp_reader_fn userp_fd_read;
+
+extern bool userp_bstr_writev(int fd, const struct userp_bstr *str, size_t *written);
+extern bool userp_bstr_sendmsg(int sock, const struct userp_bstr *str, size_t *written, int msg_flags);
+
+#define USERP_WRITER_SOCKET   0x0001
+#define USERP_WRITER_ZEROCOPY 0x0002
+struct userp_writer;
+extern struct userp_writer* userp_new_writer(userp_env env, int fd, int flags);
+extern bool userp_writer_write(struct userp_writer *w, const struct userp_bstr *str);
+extern bool userp_writer_flush(struct userp_writer *w);
+extern void userp_free_writer(struct userp_writer *w);
+
 //extern bool userp_bstr_splice(userp_bstr *dst, size_t dst_ofs, size_t dst_len, userp_bstr *src, size_t src_ofs, size_t src_len);
 //extern void userp_bstr_crop(userp_bstr *str, size_t trim_head, size_t trim_tail);
 
+// ----------------------------- prefetch.c ----------------------------------
+
+#define USERP_PREFETCH_THREAD 0x0001
+
+struct userp_prefetch;
+extern struct userp_prefetch* userp_new_prefetch_reader(userp_env env, int fd, int64_t offset, int64_t length,
+	size_t block_size, unsigned depth, int flags);
+extern bool userp_prefetch_using_uring(struct userp_prefetch *pf);
+extern void userp_free_prefetch_reader(struct userp_prefetch *pf);
+extern userp_reader_fn userp_prefetch_read;
+
 // ------------------------------ scope.c ------------------------------------
 
 #define USERP_GET_LOCAL      1
 #define USERP_CREATE         2
 #define USERP_LAZY           4
+#define USERP_PERFECT_HASH   8
 
 extern userp_scope userp_new_scope(userp_env env, userp_scope parent);
 extern bool userp_grab_scope(userp_scope scope);
@@ -231,6 +292,9 @@ extern const char * userp_scope_get_symbol_str(userp_scope scope, userp_symbol s
 #define USERP_TYPECLASS_RECORD  7
 
 extern userp_type userp_scope_get_type(userp_scope scope, userp_symbol name, int flags);
+extern userp_type userp_scope_type_by_name(userp_scope scope, const char *name, int flags);
+extern bool userp_scope_parse_types(userp_scope scope, struct userp_bstr_part *parts, size_t part_count, int type_count, int flags);
+extern bool userp_scope_add_float_types(userp_scope scope);
 extern userp_type userp_scope_new_type(userp_scope scope, userp_symbol name, userp_type base_type);
 extern bool userp_scope_contains_type(userp_scope scope, userp_type type);
 extern userp_enc userp_type_encode(userp_type type);
@@ -270,8 +334,16 @@ extern const userp_type userp_stream1_Int64U;       /* 64-bit little-endian unsi
 //bool          userp_stream_set_header(userp_context stream, const char *name, const char *value);
 //const char *  userp_stream_get_header(userp_context stream, const char *name);
 
+userp_enc userp_new_enc(userp_env env, userp_scope scope, userp_type root_type);
+void userp_free_enc(userp_enc enc);
+struct userp_bstr* userp_enc_finish(userp_enc enc);
+void userp_enc_set_writer(userp_enc enc, struct userp_writer *w);
 void userp_enc_clear_error(userp_enc enc);
 bool userp_enc_int(userp_enc enc, int value);
+bool userp_enc_int64(userp_enc enc, int64_t value);
+#define USERP_ENC_UNSIGNED 0x0001
+#define USERP_ENC_DELTA    0x0002
+bool userp_enc_int_array(userp_enc enc, const void *values, size_t elem_size, size_t count, int flags);
 bool userp_enc_symbol(userp_enc enc, userp_symbol sym);
 bool userp_enc_typeref(userp_enc enc, userp_type type);
 bool userp_enc_select(userp_enc enc, userp_type type);
@@ -280,10 +352,19 @@ bool userp_enc_end_array(userp_enc enc);
 bool userp_enc_begin_record(userp_enc enc, size_t n_field, userp_symbol *fields);
 bool userp_enc_field(userp_enc enc, userp_symbol field);
 bool userp_enc_end_record(userp_enc enc);
+bool userp_enc_rec_begin(userp_enc enc, userp_type type);
+bool userp_enc_rec_declare_fields(userp_enc enc, size_t fields[], size_t field_count);
+bool userp_enc_rec_seek_field(userp_enc enc, size_t field_id);
+bool userp_enc_rec_add_field(userp_enc enc, userp_symbol sym, userp_type type);
+bool userp_enc_rec_commit_field(userp_enc enc);
+bool userp_enc_rec_end(userp_enc enc);
+bool userp_enc_struct(userp_enc enc, userp_type type, size_t sizeof_struct, const void *s);
+bool userp_enc_struct_array(userp_enc enc, userp_type type, size_t sizeof_struct, const void *structs, size_t count);
 bool userp_enc_float(userp_enc enc, float value);
 bool userp_enc_double(userp_enc enc, double value);
+bool userp_enc_float_array(userp_enc enc, const void *values, size_t elem_size, size_t count);
 bool userp_enc_bytes(userp_enc enc, const void* buf, size_t length);
-bool userp_enc_bytes_zerocopy(userp_enc enc, const void* buf, size_t length);
+bool userp_enc_bytes_zerocopy(userp_enc enc, userp_buffer buf, const void* data, size_t length);
 bool userp_enc_string(userp_enc enc, const char* str);
 
 // -------------------------------- dec.c ------------------------------------
@@ -310,21 +391,22 @@ struct userp_node_info {
 		node_type;      // the data type declared for the node (such as "Any")
 	size_t node_depth;  // the number of parent nodes (records or arrays)
 	int64_t intval;     // for integer types, holds the value if (flags & USERP_NODEFLAG_INT)
-	userp_bstr data;    // for various types, references span of buffer(s) containing data
+	struct userp_bstr data; // for various types, references span of buffer(s) containing data
 	size_t array_dim_count;      // for array types, this lists the
 	const size_t *array_dims;    //   dimensions of the array (usually just one)
 	size_t elem_count;  // For arrays or records, this is the number of elements or fields present
 };
 
-typedef const struct userp_node_info userp_node_info;
-
-struct userp_dec;
-typedef struct userp_dec userp_dec;
+typedef const struct userp_node_info *userp_node_info;
 
 userp_dec userp_new_dec(
 	userp_env env, userp_scope scope, userp_type root_type,
 	userp_buffer buffer_ref, uint8_t *bytes, size_t n_bytes
 );
+userp_dec userp_new_dec_from_file(
+	userp_env env, userp_scope scope, userp_type root_type,
+	int fd, int64_t offset, int64_t length
+);
 bool userp_grab_dec(userp_env env, userp_dec dec);
 void userp_drop_dec(userp_env env, userp_dec dec);
 
@@ -348,8 +430,12 @@ bool userp_dec_seek_field(userp_dec dec, userp_symbol fieldname);
 bool userp_dec_skip(userp_dec dec);
 // Decode the current node as an integer, and move to the next node if successful
 bool userp_dec_int(userp_dec dec, int *out);
+bool userp_dec_int64(userp_dec dec, int64_t *out);
 bool userp_dec_int_n(userp_dec dec, void *intbuf, size_t word_size, bool is_signed);
 bool userp_dec_bigint(userp_dec dec, void *intbuf, size_t *len, int *sign);
+// Decode the current node as an array of integers into a native array, and move to the next node
+#define USERP_DEC_UNSIGNED 0x0001
+bool userp_dec_int_array(userp_dec dec, void *out, size_t elem_size, size_t *count, int flags);
 // Decode the current node as a Symbol, and move to the next node if successful
 bool userp_dec_symbol(userp_dec dec, userp_symbol *out);
 // Decode the current node as a Type reference, and move to the next node if successful
@@ -357,9 +443,15 @@ bool userp_dec_typeref(userp_dec dec, userp_type *out);
 // Decode the current node as a `float` and move to the next node
 bool userp_dec_float(userp_dec dec, float *out);
 bool userp_dec_double(userp_dec dec, double *out);
+bool userp_dec_double_array(userp_dec dec, double *out, size_t *count);
+bool userp_dec_float_array(userp_dec dec, float *out, size_t *count);
 // Copy out the bytes of the current node, as-is
-//bool userp_dec_bytes(userp_dec dec, void *out, size_t *length_inout, size_t elem_size, userp_flags flags);
-//userp_bstr userp_dec_bytes_zerocopy(userp_dec dec, size_t elem_size, userp_flags flags);
+bool userp_dec_bytes(userp_dec dec, void *out, size_t *length_inout, size_t elem_size, int flags);
+struct userp_bstr* userp_dec_bytes_zerocopy(userp_dec dec, size_t elem_size, int flags);
+// Copy a record of fixed-size static fields directly into a compatible C struct
+bool userp_dec_struct(userp_dec dec, void *out, size_t sizeof_struct);
+bool userp_dec_struct_array(userp_dec dec, void *out, size_t sizeof_struct, size_t *count);
+const void* userp_dec_struct_zerocopy(userp_dec dec, size_t sizeof_struct);
 
 #ifdef __cplusplus
 }
@@ -20,9 +20,11 @@
 #endif
 
 #if ENDIAN == LSB_FIRST
-  #define userp_load_le16(p) ( *((uint16_t*) p) )
-  #define userp_load_le32(p) ( *((uint32_t*) p) )
-  #define userp_load_le64(p) ( *((uint64_t*) p) )
+  #define userp_load_le16(p) ( *((uint16_t*) (p)) )
+  #define userp_load_le32(p) ( *((uint32_t*) (p)) )
+  #define userp_load_le64(p) ( *((uint64_t*) (p)) )
+  #define userp_store_le32(p, v) ( *((uint32_t*) (p))= (v) )
+  #define userp_store_le64(p, v) ( *((uint64_t*) (p))= (v) )
   // TODO: handle platforms that require aligned reads
 #elif ENDIAN == MSB_FIRST
 static inline uint16_t userp_load_le16(char *p) {
@@ -44,6 +46,16 @@ static inline uint64_t userp_load_le64(char *p) {
 	    |  (((uint64_t) ((uint8_t*) p)[1]) << 8)
 	    |  (((uint64_t) ((uint8_t*) p)[0]);
 }
+static inline void userp_store_le32(uint8_t *p, uint32_t v) {
+	int i;
+	for (i= 0; i < 4; i++, v >>= 8)
+		p[i]= (uint8_t) v;
+}
+static inline void userp_store_le64(uint8_t *p, uint64_t v) {
+	int i;
+	for (i= 0; i < 8; i++, v >>= 8)
+		p[i]= (uint8_t) v;
+}
 #else
 #error Library implementation requires ENDIAN of LSB_FIRST or MSB_FIRST
 #endif
@@ -106,10 +118,58 @@ void userp_diag_setf(userp_diag diag, int code, const char *tpl, ...);
 #ifndef USERP_DEFAULT_ENC_OUTPUT_BUFSIZE
 #define USERP_DEFAULT_ENC_OUTPUT_BUFSIZE 4096
 #endif
+#ifndef USERP_DEFAULT_SYMTABLE_SWISS_MIN
+#define USERP_DEFAULT_SYMTABLE_SWISS_MIN 4096
+#endif
+#ifndef USERP_DEFAULT_MAP_WINDOW
+#if SIZE_MAX > 0xFFFFFFFF
+#define USERP_DEFAULT_MAP_WINDOW ((size_t)1<<30)
+#else
+#define USERP_DEFAULT_MAP_WINDOW ((size_t)1<<26)
+#endif
+#endif
+#ifndef USERP_DEFAULT_ENC_OUTPUT_BUFSIZE_MAX
+#define USERP_DEFAULT_ENC_OUTPUT_BUFSIZE_MAX (1<<20)
+#endif
+#ifndef USERP_DEFAULT_BUFFER_POOL_MAX
+#define USERP_DEFAULT_BUFFER_POOL_MAX (32<<20)
+#endif
+#ifndef USERP_ENV_BUFFER_POOL_SLOTS
+#define USERP_ENV_BUFFER_POOL_SLOTS 32
+#endif
 #ifndef USERP_DEFAULT_RECORD_FIELDS_MAX
 #define USERP_DEFAULT_RECORD_FIELDS_MAX ((1<<16)-1)
 // constrained by USERP_IMPL_RECORD_FIELDS_MAX declared below
 #endif
+#ifndef USERP_DEFAULT_ARENA_CHUNK
+#define USERP_DEFAULT_ARENA_CHUNK (64<<10)
+#endif
+#ifndef USERP_ARENA_CHUNK_MAX
+#define USERP_ARENA_CHUNK_MAX (1<<20)
+#endif
+// DYNAMIC allocations are rounded up to 16 << n bytes, for n < USERP_ARENA_CLASSES
+#define USERP_ARENA_CLASSES 13
+// Allocations larger than the largest size class get a chunk of their own
+#define USERP_ARENA_LARGE ((size_t)16 << (USERP_ARENA_CLASSES-1))
+#define USERP_ARENA_ALIGN 16
+#define USERP_ARENA_ROUND(n) (((n) + USERP_ARENA_ALIGN - 1) & ~(size_t)(USERP_ARENA_ALIGN - 1))
+
+// A chunk of memory obtained from env->alloc, which the arena divides into blocks
+struct userp_arena_chunk {
+	struct userp_arena_chunk *next;
+	uint8_t *lim;                // end of the chunk
+	bool large;                  // chunk holds a single large block
+};
+
+// See "Arena Allocator" in env.c
+struct userp_arena {
+	struct userp_arena_chunk *chunks, // chunks that may hold live blocks, most recent first
+		*spare;                  // chunks emptied by a reset, for reuse
+	uint8_t *pos, *lim;          // unallocated span of the chunk being divided
+	void *free_list[USERP_ARENA_CLASSES];
+	size_t chunk_size;           // size of the next chunk
+	bool enabled;                // new allocations come from the arena
+};
 
 struct userp_env {
 	userp_alloc_fn *alloc;
@@ -141,6 +201,17 @@ struct userp_env {
 	int enc_output_parts;
 	int enc_output_bufsize;
 	int salt;
+	int symtable_index;
+	size_t symtable_swiss_min;
+	size_t map_window;
+	size_t enc_output_bufsize_max;
+
+	// Buffers flagged USERP_BUFFER_POOLED, parked for reuse after their last reference dropped
+	userp_buffer buffer_pool[USERP_ENV_BUFFER_POOL_SLOTS];
+	int buffer_pool_count;
+	size_t buffer_pool_bytes, buffer_pool_max;
+
+	struct userp_arena arena;
 };
 
 #define USERP_DISPATCH_ERR(env) ((env)->diag((env)->diag_cb_data, &((env)->err),  (env)->err.code))
@@ -169,6 +240,9 @@ struct userp_env {
 #define USERP_BUFFER_DATA_ALLOC_ROUND(x) (((x) + 4095) & ~4095)
 #endif
 
+userp_buffer userp_env_take_buffer(userp_env env, size_t min_len, userp_buffer_flags flags);
+void userp_env_empty_buffer_pool(userp_env env);
+
 // -------------------------------- bstr.c -----------------------------------
 
 #define USERP_SIZEOF_BSTR(n_parts) (sizeof(struct userp_bstr) + sizeof(struct userp_bstr_part)*n_parts)
@@ -184,6 +258,7 @@ struct symbol_entry {
 	userp_type type_ref;
 	userp_symbol canonical;
 	uint32_t hash;
+	uint32_t len;              // strlen(name), compared before the name itself during lookups
 };
 
 struct userp_symtable {
@@ -201,12 +276,14 @@ struct userp_symtable {
 		hash_salt,                // salt value to randomize hash layout
 		node_alloc,               // number of allocated tree nodes (size depends on 'used')
 		node_used;                // number of tree nodes holding collisions
+	bool is_swiss;                // buckets holds a swiss table instead of a hashtree
 };
 
 struct type_entry {
 	userp_symbol name;
 	userp_type parent;
 	void *typeobj;
+	struct type_plan *plan;       // decode plan, compiled by finalize or on first use
 	unsigned typeclass: 3;
 };
 
@@ -216,6 +293,10 @@ struct userp_typetable {
 	struct userp_bstr typedata;   // encoded type definitions packed in buffers
 	size_t used, alloc;           // number of types in .types[], and number of slots allocated.
 	userp_type id_offset;         // ID of types[0]
+	uint32_t *name_index;         // open-addressed hash of name symbol to (types[] index + 1)
+	size_t name_index_mask,       // number of name_index slots, minus one
+		name_indexed,             // number of types[] which have been added to name_index
+		planned;                  // number of types[] which have a compiled plan
 };
 
 #define TYPE_CLASS_ANY      1
@@ -226,16 +307,31 @@ struct userp_typetable {
 #define TYPE_CLASS_ARRAY    6
 #define TYPE_CLASS_RECORD   7
 
+// Type objects are packed back-to-back in typetable.typeobjects, each rounded up to this size
+#define TYPEOBJ_ALIGN 16
+#define TYPEOBJ_SIZE(x) (((x) + TYPEOBJ_ALIGN - 1) & ~(size_t)(TYPEOBJ_ALIGN - 1))
+
+// Typeobj of Any, Symref, and Typeref
+struct userp_type_basic {
+	int align;
+	int pad;
+};
+
 struct named_int {
 	userp_symbol name;
 	intmax_t value;
 };
+#define INT_DELTA_NONE   0
+#define INT_DELTA        1          // array elements are stored as the difference from the previous
+#define INT_DELTA_ZIGZAG 2          // ...and the difference has the sign in the low bit
 struct userp_type_int {
 	int align;
 	int pad;
-	bool has_min:1, has_max:1, has_bits:1, has_bswap:1;
+	bool has_min:1, has_max:1, has_bits:1, has_bswap:1, has_scale:1, has_bias:1;
 	intmax_t min, max;
 	int bits, bswap;
+	int delta;                    // INT_DELTA_*, for elements of arrays
+	double scale, bias;           // fixed-point value is integer * scale + bias
 	int name_count;
 	struct named_int names[];
 };
@@ -244,7 +340,8 @@ struct choice_option {
 	userp_type type;
 	bool is_value: 1;
 	intmax_t merge_ofs, merge_count;
-	struct userp_bstr value;
+	const uint8_t *value;         // encoded value, copied into typeobjects
+	size_t value_len;
 };
 struct userp_type_choice {
 	int align;
@@ -262,17 +359,30 @@ struct userp_type_array {
 	size_t dimensions[];
 };
 
+// The low 2 bits of a field's placement say how its presence is determined.
+// Static fields are always present, at bit offset (placement >> 2) of the static area.
+#define FIELD_PLACEMENT_STATIC 0
+#define FIELD_PLACEMENT_ALWAYS 1
+#define FIELD_PLACEMENT_OFTEN  2
+#define FIELD_PLACEMENT_SELDOM 3
+#define FIELD_PLACEMENT(p)     ((p) & 3)
+#define FIELD_STATIC_OFS(p)    ((p) >> 2)
+
 struct record_field {
 	userp_symbol name;
 	userp_type type;
-	int placement;
+	size_t placement;
 };
 struct userp_type_record {
 	int align;
 	int pad;
 	size_t static_bits;
 	userp_type other_field_type;
-	size_t field_count;
+	size_t field_count,
+		static_field_count,       // number of fields[] of each placement
+		always_field_count,
+		often_field_count,
+		seldom_field_count;
 	struct record_field fields[];
 };
 #define USERP_IMPL_RECORD_FIELDS_MAX ((SIZE_MAX - sizeof(struct userp_type_record)) / sizeof(struct record_field))
@@ -286,6 +396,39 @@ struct scope_import {
 	size_t type_map_count;
 };
 
+struct scope_phash_slot {
+	const char *name;
+	uint32_t len;
+	userp_symbol id;
+};
+
+struct scope_phash {
+	uint64_t seed;                // seed passed to userp_symtable_calc_hash64
+	size_t slot_count,            // number of slots, equal to the number of visible symbols
+		bucket_count;             // number of displacement pairs
+	uint32_t (*disp)[2];          // (d0, d1) displacement for each bucket, stored after slots[]
+	struct scope_phash_slot slots[];
+};
+
+// Flattened ID index: a page directory covering every ID visible from a finalized scope.
+// Pages that lie entirely within the parent's range are shared with the parent.
+#define SCOPE_FLAT_BITS 8
+#define SCOPE_FLAT_PAGE (1 << SCOPE_FLAT_BITS)
+
+struct scope_flat {
+	size_t count,                 // number of IDs covered, including the 0 ID
+		page_count,               // number of entries in pages[]
+		own_from;                 // pages[own_from..] live in own_pages, the rest belong to the parent
+	void **own_pages;             // block of (page_count - own_from) pages allocated by this scope
+	void **pages[];               // each page holds SCOPE_FLAT_PAGE pointers to entries, or NULL
+};
+
+static inline void* scope_flat_get(struct scope_flat *flat, size_t id) {
+	return id < flat->count? flat->pages[id >> SCOPE_FLAT_BITS][id & (SCOPE_FLAT_PAGE-1)] : NULL;
+}
+
+#define SCOPE_TYPE_CACHE 16
+
 struct userp_scope {
 	userp_env env;
 	userp_scope parent;
@@ -300,6 +443,13 @@ struct userp_scope {
 
 	size_t symtable_count, symbol_count;
 	size_t typetable_count, type_count;
+	struct scope_phash *phash;    // built by finalize with USERP_PERFECT_HASH
+	struct scope_flat *flat_sym,  // ID -> struct symbol_entry*, built by finalize
+		*flat_type;               // ID -> struct type_entry*, built by finalize
+	struct scope_type_cache {     // recent results of userp_scope_get_type
+		userp_symbol name;
+		userp_type type;
+	} type_cache[SCOPE_TYPE_CACHE];
 	struct userp_symtable symtable, 
 		**symtable_stack;
 	struct userp_typetable typetable,
@@ -307,6 +457,82 @@ struct userp_scope {
 };
 
 userp_symbol userp_scope_add_symbol(userp_scope scope, const char *name);
+struct type_entry* userp_scope_get_type_entry(userp_scope scope, userp_type type);
+
+/* Decode plans
+
+A type_plan is a type "compiled" into what the decoder needs to know to read it: one operation
+code, the alignment, whether the encoding has a fixed size, and for records and choices a
+pre-sorted list of members with their plans and static offsets resolved.  Plans are allocated
+in the typeobjects arena of the scope that owns the type.
+
+*/
+#define PLAN_NONE            0  // type is incomplete and can't be decoded
+#define PLAN_ANY             1  // type reference, then a value of that type
+#define PLAN_TYPEREF         2  // type reference
+#define PLAN_SYMREF          3  // symbol reference
+#define PLAN_INT_TWOS        4  // 'bits' of two's complement
+#define PLAN_INT_BITS        5  // 'bits' of unsigned offset from 'base'
+#define PLAN_INT_VQTY        6  // variable-length unsigned offset from 'base'
+#define PLAN_INT_VQTY_SIGNED 7  // variable-length quantity with the sign in the low bit
+#define PLAN_CHOICE          8  // selector, then the value of the selected option
+#define PLAN_ARRAY           9  // element type and dimensions (if not fixed) then elements
+#define PLAN_RECORD_FIXED   10  // record where every field is at a fixed offset
+#define PLAN_RECORD         11  // record with optional fields
+
+#define PLAN_FIXED        0x01  // encoding is always fixed_bits long, after alignment
+#define PLAN_DESCENDING   0x02  // integer counts downward from base
+#define PLAN_BSWAP        0x04  // fixed-width integer bytes are swapped
+#define PLAN_DELTA        0x08  // array elements are differences from the previous element
+#define PLAN_DELTA_ZIGZAG 0x10  // and the difference is zigzag encoded
+#define PLAN_SCALED       0x20  // integer is fixed-point, with 'scale' and 'bias'
+#define PLAN_IEEE_FLOAT   0x40  // record is laid out as an IEEE-754 binary32 or binary64
+#define PLAN_COMPILING    0x80  // plan is under construction (type refers to itself)
+#define PLAN_HOST_LAYOUT 0x100  // fixed record is laid out like a C struct of native ints and floats
+
+struct plan_field {
+	const struct type_plan *plan;
+	userp_symbol name;
+	uint32_t index;               // index within userp_type_record.fields[]
+	size_t ofs;                   // bit offset of a static field, or any field of a fixed record
+};
+
+struct plan_option {
+	const struct type_plan *plan; // plan of the option's type, or NULL for a value option
+	size_t sel_start, sel_count;  // selector values which choose this option
+	size_t merge_ofs;             // for merged options, the first value of the type's integer
+	uint32_t index;               // index within userp_type_choice.options[]
+	bool merged;
+};
+
+struct type_plan {
+	uint8_t op;                   // PLAN_* operation
+	uint16_t flags;               // PLAN_FIXED, ...
+	uint8_t align;                // power-of-2 bits to align to before the value
+	uint16_t bits;                // bits of a fixed-width integer
+	size_t pad;                   // NUL bytes following the value
+	size_t fixed_bits;            // size of the encoding, if PLAN_FIXED
+	intmax_t base;                // integer min (or max if PLAN_DESCENDING)
+	double scale, bias;           // fixed-point conversion, if PLAN_SCALED
+	userp_type type;
+	const void *typeobj;
+	// Arrays
+	const struct type_plan *elem; // element plan, or NULL if the element type is in the data
+	const struct type_plan *dim;  // plan of dim_type, or NULL for plain quantities
+	size_t elem_count;            // product of the dimensions, if none are given in the data
+	size_t elem_stride;           // bits from one fixed-size element to the next
+	// Records and Choices
+	size_t static_bits,           // size of the static area of a record
+		always_count,             // fields[] are ordered static, always, often, seldom
+		often_count,
+		seldom_count,
+		member_count;             // number of fields[] or options[]
+	const struct type_plan *other;// plan of other_field_type
+	struct plan_field *fields;
+	struct plan_option *options;
+};
+
+const struct type_plan* userp_scope_get_type_plan(userp_scope scope, userp_type type);
 
 struct userp_bit_io {
 	uint8_t *pos, *lim;
@@ -314,45 +540,143 @@ struct userp_bit_io {
 	struct userp_bstr *str;
 	uint64_t accum;
 	uint64_t selector;
-	int accum_bits: 8,
+	int accum_bits: 8,            // when reading bit-packed values, bits of *pos already consumed
 		has_selector: 1;
 };
 
+// Skip over empty parts, and return true if no input remains
+static inline bool userp_bit_io_at_end(struct userp_bit_io *in) {
+	while (in->pos >= in->lim) {
+		if (!in->part || in->part + 1 >= in->str->parts + in->str->part_count)
+			return true;
+		++in->part;
+		in->pos= in->part->data;
+		in->lim= in->part->data + in->part->len;
+	}
+	return false;
+}
+
+// Return the number of bytes remaining in all parts
+static inline size_t userp_bit_io_remaining(struct userp_bit_io *in) {
+	size_t n= in->lim - in->pos;
+	struct userp_bstr_part *part;
+	for (part= in->part + 1; part < in->str->parts + in->str->part_count; part++)
+		n += part->len;
+	return n;
+}
+
+bool userp_decode_vqty_quick(size_t *out, struct userp_bit_io *in);
+size_t userp_decode_vqty_array(uint64_t *out, size_t n, struct userp_bit_io *in);
+
+// Variable-length quantity encoder, see "userp_encode_vqty" in enc.c
+#define USERP_VQTY_MAX 9
+
+// Encoded length, by number of significant bits
+static const uint8_t vqty_enc_len[65]= {
+	1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 4,
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5,
+	5, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+	9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+	9
+};
+// Shift and selector bits for each encoded length of 5 or less
+static const uint8_t vqty_enc_shift[6]=  { 0, 1, 2, 0, 3, 8 };
+static const uint8_t vqty_enc_prefix[6]= { 0, 0, 1, 0, 3, 7 };
+
+static inline size_t vqty_encoded_len(uint64_t v) {
+	return vqty_enc_len[64 - __builtin_clzll(v | 1)];
+}
+
+static inline uint8_t * userp_encode_vqty(uint8_t *p, uint64_t v) {
+	size_t n= vqty_encoded_len(v);
+	if (n == 9) {
+		p[0]= 0x0F;
+		userp_store_le64(p + 1, v);
+	}
+	else
+		userp_store_le64(p, (v << vqty_enc_shift[n]) | vqty_enc_prefix[n]);
+	return p + n;
+}
+
+bool userp_plan_skip(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in);
+bool userp_plan_read_int(const struct type_plan *plan, struct userp_bit_io *in, int64_t *out);
+bool userp_plan_read_int_next(const struct type_plan *plan, struct userp_bit_io *in, int64_t *prev_inout);
+bool userp_plan_copy_struct(const struct type_plan *plan, struct userp_bit_io *in, void *out, size_t sizeof_struct);
+const uint8_t* userp_plan_struct_zerocopy(const struct type_plan *plan, struct userp_bit_io *in, size_t sizeof_struct);
+bool userp_plan_array_slice(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	size_t elem_size, struct userp_bstr *slice);
+bool userp_plan_read_int_array(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	void *out, size_t elem_size, size_t *count, int flags);
+bool userp_plan_read_struct_array(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	void *out, size_t sizeof_struct, size_t *count);
+bool userp_plan_read_double(const struct type_plan *plan, struct userp_bit_io *in, double *out);
+bool userp_plan_read_double_array(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	double *out, size_t *count);
+bool userp_plan_read_float_array(userp_scope scope, const struct type_plan *plan, struct userp_bit_io *in,
+	void *out, size_t elem_size, size_t *count);
+
 // ----------------------------- enc.c -------------------------------
 
+// userp_enc_bytes_zerocopy copies anything shorter than this instead of adding a part
+#ifndef USERP_ENC_ZEROCOPY_MIN
+#define USERP_ENC_ZEROCOPY_MIN 1024
+#endif
+
+// A record field written somewhere other than its final position, moved into place by
+// userp_enc_rec_end
+struct enc_rec_seg {
+	size_t key;                  // sorts the fields into the order of the encoding
+	size_t ofs, len;             // range of the frame's temporary output
+	int align;                   // alignment of the field's type
+};
+
+// A record being encoded (see "Record Encoding" in enc.c)
+struct enc_rec_frame {
+	const struct type_plan *plan;
+	int mode;                    // ENC_REC_PENDING, ENC_REC_DIRECT, or ENC_REC_TEMP
+	uint8_t *static_area,        // static area (all of a fixed record), zeroed when reserved
+		*static_lim;             // end of the buffer holding it, for 8-byte read-modify-write
+	size_t *order,               // in direct mode, plan positions of the fields in encoded order
+		order_count, order_alloc, next;
+	size_t *extra,               // header references of the extra fields, in order
+		extra_count, extra_alloc;
+	uint64_t presence;           // presence flags of the often-fields
+	uint8_t *written;            // per plan position, whether the field was written
+	size_t written_alloc;
+	struct enc_rec_seg *seg;     // fields in the temporary output
+	size_t seg_count, seg_alloc;
+	struct userp_bstr alt;       // the temporary output, or the main output while swapped
+	uint8_t *alt_pos, *alt_lim;
+	// the field being written
+	size_t cur;                  // plan position, ENC_REC_ADHOC, or ENC_REC_NONE
+	bool cur_in_temp;
+	struct enc_rec_seg cur_seg;
+	uint8_t *save_pos, *save_lim; // output position while the value is redirected into the static area
+};
+
 struct userp_enc {
 	userp_env env;
 	userp_scope scope;
 	struct userp_bstr output;
 	uint8_t *out_pos, *out_lim;
 	int out_align;
+	size_t out_bufsize;          // size of the next output buffer; doubles up to a limit
+	struct userp_writer *writer; // if set, completed output parts are written and released
+	int val_align;               // alignment (power of 2 bits) of the next value, from its type
+	size_t val_pad;              // bytes of padding after the next value, from its type
+	const struct type_plan *val_plan; // type of the next value, if it is a field of a record
+	uint8_t *val_static,         // if set, store the next integer at this static area
+		*val_static_lim;
+	size_t val_bitofs;           // at this bit offset
+	bool out_redirect;           // out_pos points into a static area, and can't grow
+	struct enc_rec_frame *rec;   // stack of records being encoded
+	size_t rec_depth, rec_alloc;
 	
 	struct userp_bstr_part output_initial_parts[];
 };
 
 // ----------------------------- dec.c -------------------------------
 
-/*
-## Userp Decoder Input
-
-This struct tracks the current position in the sequence of buffers.
-buf_lim points to the byte beyond the end of the buffer, and bits_left is the
-number of bits remaining before that pointer.  buf_lim always ends on a byte
-boundary, and it is not possible to have a non-multiple-of-8 bits in a buffer
-segment.
-
-str is the bstr holding the buffer parts, and str_part is the index of the
-current part within that bstr.
-
-*/
-
-struct userp_dec_input {
-	uint8_t *buf_lim;
-	struct userp_bstr *str;
-	size_t bits_left;
-	size_t str_part;
-};
-
 /*
 struct userp_node_info {
 	uint32_t flags;     // indicates which fields are valid.
@@ -375,6 +699,8 @@ struct userp_node_info_private {
 			bool is_negative;
 			size_t limb_count;
 		} bigint;
+		userp_type as_typeref;       // if flags & USERP_NODEFLAG_TYPE
+		userp_symbol as_symref;      // if flags & USERP_NODEFLAG_SYM
 	};
 };
 
@@ -384,21 +710,32 @@ struct userp_dec {
 	struct userp_dec_frame *stack;
 	unsigned refcnt;
 	size_t stack_i, stack_lim;
-	struct userp_bstr input;
+	struct userp_bstr input;     // the buffers given to the decoder, starting with the current part
+	struct userp_bit_io in;      // read position within input
+	struct userp_bstr slice;     // result of userp_dec_bytes_zerocopy, holding buffer references
 	userp_reader_fn *reader;
 	void * reader_cb_data;
-	// The struct ends with a userp_bstr instance, allocated to a default
-	// length specified in the environment.  As long as the input buffers
-	// can fit in this bstr, ->input doesn't need a second allocation.
-	struct userp_bstr input_inst;
+	int map_fd;                  // userp_new_dec_from_file maps windows of this file
+	int64_t map_pos, map_lim;    //   on demand, from map_pos up to map_lim
+	struct userp_node_info_private node; // result of userp_dec_node_info
 };
 
+// Bit positions in a frame are absolute offsets into the stream (userp_bstr_part.ofs), so that
+// they survive the decoder releasing or the reader reallocating the parts.
 struct userp_dec_frame {
-	int frame_type;
-	userp_type node_type, parent_type;
-	size_t elem_i, elem_lim;
-	
-	userp_type array_type, rec_type;
+	int frame_type;               // FRAME_TYPE_ARRAY or FRAME_TYPE_RECORD, or 0 for the root
+	userp_type node_type;         // type of the current node, or 0 after the last one
+	const struct type_plan *node_plan, // plan of node_type, once looked up
+		*plan;                    // plan of the array or record being iterated
+	size_t elem_i, elem_lim;      // index of the current node, and the number of nodes present
+	size_t field_i,               // for records, index into plan->fields[] of the current node,
+		extra_i, extra_count;     //   and of the seldom or ad-hoc fields listed in the header
+	size_t presence;              // bits of the often fields that are present
+	userp_symbol field_name;      // name of the current field
+	uint64_t start,               // first element, or the static area of a record
+		resume,                   // end of the static area, or of a fixed record
+		refs, refs_start;         // next and first field reference in the record header
+	int64_t delta_prev;           // running value of the delta integer elements read so far
 };
 
 static inline size_t roundup_pow2(size_t s) {
@@ -447,6 +784,17 @@ static inline void unimplemented(const char* msg) {
 #ifdef UNIT_TEST
 static bool logging_alloc(void *callback_data, void **pointer, size_t new_size, userp_alloc_flags flags);
 static void dump_scope(userp_scope scope);
+
+// Build the bytes of a type table (or of data) for tests.  Each argument of TT is a
+// variable-length quantity, appended to the 'tt' in scope.
+struct test_typetable {
+	size_t len;
+	uint8_t buf[];
+};
+#define TEST_SIGNED(x) ((x) < 0? ((size_t)(-(x)-1) << 1) | 1 : (size_t)(x) << 1)
+#define TT(...) test_tt_put(tt, sizeof((size_t[]){__VA_ARGS__})/sizeof(size_t), __VA_ARGS__)
+static void test_tt_vqty(struct test_typetable *tt, size_t v);
+static void test_tt_put(struct test_typetable *tt, int n, ...);
 #endif
 
 #endif /* USERP_PRIVATE_H */
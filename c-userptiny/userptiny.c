@@ -157,8 +157,9 @@ userptiny_decode_node(struct userptiny_dec *dec) {
 		and must be sign-extended if smaller than 32 bits.
 	
 	Any of these may be combined with a
-	1) scale (multiplier)
-	2) bias (offset)
+	1) base (offset added to the encoded value)
+	2) scale (integer multiplier applied after the base)
+	and the result must still fit in int32_t.
 	*/
 	case USERPTINY_TYPECLASS_VINT_UNSIGNED:
 	case USERPTINY_TYPECLASS_VINT_SIGNED:
@@ -243,9 +244,19 @@ userptiny_decode_node(struct userptiny_dec *dec) {
 			dec->node.as_int32= u32;
 			dec->node.flags= USERPTINY_NODEFLAG_INT32;
 		}
-		// TODO: scale and offset
 		if (type->flags & (USERPTINY_TYPEFLAG_INT_BASE|USERPTINY_TYPEFLAG_INT_SCALE)) {
-			return USERPTINY_EUNSUPPORTED;
+			int64_t val;
+			// Adjusting a BigInt would need bigint math, which this library avoids
+			if (dec->node.flags & USERPTINY_NODEFLAG_BIGINT)
+				return USERPTINY_EUNSUPPORTED;
+			val= dec->node.as_int32;
+			if (type->flags & USERPTINY_TYPEFLAG_INT_BASE)
+				val += type->integer.base;
+			if (type->flags & USERPTINY_TYPEFLAG_INT_SCALE)
+				val *= type->integer.scale;
+			if (val < INT32_MIN || val > INT32_MAX)
+				return USERPTINY_EOVERFLOW;
+			dec->node.as_int32= (int32_t) val;
 		}
 		break;
 	}
@@ -58,8 +58,8 @@ struct userptiny_type {
 			uint8_t subtype;
 		} builtin;
 		struct userptiny_type_int {
-			uint16_t base;
-			uint8_t scale;
+			uint16_t base;    // added to the encoded value, if INT_BASE
+			uint8_t scale;    // multiplies the value after the base, if INT_SCALE
 			uint8_t bits;
 		} integer;
 		struct userptiny_type_array {